@@ -69,3 +69,12 @@ hist.setName("points_vs_times")
 sim.addHistogram(hist)
 
 sim.run()
+
+# results can also be accessed as NumPy arrays without reading the output file.
+# These views share memory with the simulation and keep the object they were
+# taken from alive. The next run() invalidates them: the views then raise
+# BufferError, and the arrays taken from them must not be used any more
+import numpy as np
+counters = np.asarray(sim.photonCountersView())
+counts = np.asarray(hist.countsView())  # points_vs_times, overflow bins last
+print(counters, counts.shape)
@@ -21,10 +21,10 @@
 using namespace MCPP;
 
 BaseRandom::BaseRandom(BaseObject *parent) :
-    BaseObject(NULL), mt(NULL)
+    BaseObject(NULL)
 {
     _inheritsRandom = true;
-    mt = NULL;
+    _engineType = ENGINE_MT19937_64;
 
     // we need to call the BaseObject constructor with NULL parent, and then
     // call setParent() here because we want setParent_impl() to be called (but
@@ -34,9 +34,7 @@ BaseRandom::BaseRandom(BaseObject *parent) :
 }
 
 BaseRandom::~BaseRandom() {
-    if(!hasAParent() || !parent()->inheritsRandom())
-        if(mt!=NULL)
-            delete mt;
+
 }
 
 /**
@@ -53,7 +51,31 @@ void BaseRandom::setSeed(unsigned int seed) {
     if(hasAParent() && parent()->inheritsRandom())
         return;
     _currentSeed = seed;
-    setRNG(new MCEngine(seed));
+    setRNG(boost::shared_ptr<MCEngine>(new MCEngine(seed, _engineType)));
+}
+
+/**
+ * @brief Sets the algorithm of the RNG
+ * @param type
+ *
+ *
+ * The new algorithm is used from the next call to setSeed(). Loading a RNG
+ * state also sets the algorithm the state was saved with.
+ */
+
+void BaseRandom::setEngineType(MCEngineType type)
+{
+    _engineType = type;
+}
+
+/**
+ * @brief The algorithm of the RNG
+ * @return
+ */
+
+MCEngineType BaseRandom::engineType() const
+{
+    return mt ? mt->type() : _engineType;
 }
 
 /**
@@ -79,10 +101,15 @@ void BaseRandom::loadGeneratorState(const char *fileName)
     logMessage("Loading RNG state from: %s",fileName);
     ifstream file;
     file.open(fileName);
-    MCEngine *mt = new MCEngine(0);
+    boost::shared_ptr<MCEngine> mt(new MCEngine(0));
     file >> *mt;
-    setRNG(mt);
     file.close();
+    if(file.fail()) {
+        logMessage("Invalid RNG state in %s", fileName);
+        return;
+    }
+    _engineType = mt->type();
+    setRNG(mt);
 }
 
 /**
@@ -107,10 +134,70 @@ string BaseRandom::generatorState() const
 
 void BaseRandom::setGeneratorState(string state)
 {
-    MCEngine *mt = new MCEngine(0);
+    boost::shared_ptr<MCEngine> mt(new MCEngine(0));
     stringstream ss;
     ss << state;
     ss >> *mt;
+    if(ss.fail()) {
+        logMessage("Invalid RNG state");
+        return;
+    }
+    _engineType = mt->type();
+    setRNG(mt);
+}
+
+/**
+ * @brief The RNG internal state as an array of words
+ * @return
+ *
+ *
+ * This is the same state returned by generatorState(), in a form that can be
+ * stored without any text conversion (e.g. in a checkpoint). Use
+ * setBinaryGeneratorState() to restore it.
+ *
+ * \see MCEngine::state()
+ */
+
+vector<u_int64_t> BaseRandom::binaryGeneratorState() const
+{
+    return mt->state();
+}
+
+/**
+ * @brief Set the internal RNG state from an array of words
+ * @param state
+ *
+ *
+ * \see binaryGeneratorState()
+ */
+
+void BaseRandom::setBinaryGeneratorState(const vector<u_int64_t> &state)
+{
+    boost::shared_ptr<MCEngine> mt(new MCEngine(0));
+    if(!mt->setState(state)) {
+        logMessage("Invalid RNG state");
+        return;
+    }
+    _engineType = mt->type();
+    setRNG(mt);
+}
+
+/**
+ * @brief Advances the RNG by n jumps
+ * @param n
+ *
+ *
+ * Objects whose RNGs start from the same state and are jumped 0, 1, 2, ...
+ * times draw non-overlapping streams of random numbers, see MCEngine::jump().
+ * As for setSeed(), this function has no effect if the object has a parent of
+ * type BaseRandom.
+ */
+
+void BaseRandom::jumpGenerator(u_int64_t n)
+{
+    if(hasAParent() && parent()->inheritsRandom())
+        return;
+    mt->jump(n);
     setRNG(mt);
 }
 
@@ -119,7 +206,7 @@ bool BaseRandom::sanityCheck_impl() const
     if(hasAParent())
         return true;
 
-    if(mt != NULL)
+    if(mt)
         return true;
     else
         return false;
@@ -143,11 +230,9 @@ unsigned int BaseRandom::currentSeed() const
  * The specified RNG is propagated to all child BaseRandoms.
  */
 
-void BaseRandom::setRNG(MCEngine *mt) {
-    if(mt == NULL)
+void BaseRandom::setRNG(boost::shared_ptr<MCEngine> mt) {
+    if(!mt)
         return;
-    if(!hasAParent() && this->mt != NULL)
-        delete this->mt;
     this->mt = mt;
     setRNG_impl();
     std::list<BaseRandom *>::const_iterator iterator;
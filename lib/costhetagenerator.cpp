@@ -17,6 +17,8 @@
 
 #include <MCPlusPlus/costhetagenerator.h>
 
+#include <algorithm>
+
 using namespace MCPP;
 
 CosThetaGenerator::CosThetaGenerator(double g, BaseObject *parent) :
@@ -48,6 +50,42 @@ MCfloat CosThetaGenerator::spin() const {
     }
 }
 
+/**
+ * @brief Generates n variates without branches in the loop
+ * @param out
+ * @param n
+ */
+
+void CosThetaGenerator::fill(MCfloat *out, size_t n) const {
+    fillOpenUnit(out, n);
+    if(g == 0.) {
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = out[i] * 2 - 1;
+        }
+        return;
+    }
+    const MCfloat g2 = g * g;
+    for (size_t i = 0; i < n; ++i) {
+        MCfloat temp = (1 - g2) / (1 - g + 2 * g * out[i]);
+        temp = (1 + g2 - temp * temp) / (2 * g);
+        out[i] = std::min<MCfloat>(std::max<MCfloat>(temp, -1), 1);
+    }
+}
+
+/**
+ * @brief The Henyey-Greenstein quantile function, as used by spin()
+ * @param u
+ * @return
+ */
+
+MCfloat CosThetaGenerator::quantile(MCfloat u) const {
+    if(g == 0.)
+        return u * 2 - 1;
+    MCfloat temp = (1 - g * g) / (1 - g + 2 * g * u);
+    temp = (1 + g * g - temp * temp) / (2 * g);
+    return std::min<MCfloat>(std::max<MCfloat>(temp, -1), 1);
+}
+
 BaseObject *CosThetaGenerator::clone_impl() const
 {
     return new CosThetaGenerator(g);
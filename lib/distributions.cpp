@@ -16,8 +16,16 @@
 */
 
 #include <MCPlusPlus/distributions.h>
+#include <MCPlusPlus/h5filehelper.h>
 
 #include <boost/math/constants/constants.hpp>
+#include <boost/math/special_functions/erf.hpp>
+#include <algorithm>
+#include <limits>
+
+/* number of variates converted at once by the fill() implementations, which
+ * keep their intermediate results on the stack */
+#define FILL_CHUNK 256
 
 using namespace boost::math::constants;
 using namespace MCPP;
@@ -67,6 +75,69 @@ void AbstractDistribution::setRNG_impl() {
     reset();
 }
 
+/**
+ * @brief Generates n random variates
+ * @param out Array of at least n elements
+ * @param n
+ *
+ *
+ * The default implementation calls spin() n times.
+ *
+ * \pre The RNG has to be valid (see BaseRandom)
+ */
+
+void AbstractDistribution::fill(MCfloat *out, size_t n) const {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = spin();
+    }
+}
+
+/**
+ * @brief The variate corresponding to the given uniform number
+ * @param u A number in the open interval \f$ (0, 1) \f$
+ * @return
+ *
+ *
+ * Derived classes return the inverse of their cumulative distribution, or any
+ * other transformation mapping uniform numbers onto the distribution, so that
+ * quantile() of a uniform variate is distributed as spin(). The default
+ * implementation ignores u and calls spin(): distributions without a
+ * closed-form quantile are still correctly sampled, though not stratified.
+ */
+
+MCfloat AbstractDistribution::quantile(MCfloat u) const {
+    return spin();
+}
+
+/**
+ * @brief Generates n numbers uniformly distributed in the open interval
+ * \f$ (0, 1) \f$
+ * @param out
+ * @param n
+ *
+ *
+ * The engine output is first copied to a buffer in bulk, then converted
+ * without branches: the values are the centers of \f$ 2^{p-1} \f$ equal bins, \f$ p
+ * \f$ being the precision of MCfloat, so that neither 0 nor 1 can occur and no
+ * rejection loop is needed.
+ */
+
+void AbstractDistribution::fillOpenUnit(MCfloat *out, size_t n) const {
+    const int bits = std::min(numeric_limits<MCfloat>::digits, 64) - 1;
+    const int shift = 64 - bits;
+    const MCfloat scale = ldexp((MCfloat)1, -bits);
+    u_int64_t raw[FILL_CHUNK];
+
+    for (size_t i = 0; i < n; i += FILL_CHUNK) {
+        size_t m = std::min<size_t>(FILL_CHUNK, n - i);
+        mt->generate(raw, m);
+        MCfloat *dest = out + i;
+        for (size_t j = 0; j < m; ++j) {
+            dest[j] = ((int64_t)(raw[j] >> shift) + (MCfloat)0.5) * scale;
+        }
+    }
+}
+
 
 
 
@@ -86,6 +157,16 @@ MCfloat DeltaDistribution::spin() const {
     return x0;
 }
 
+void DeltaDistribution::fill(MCfloat *out, size_t n) const {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = x0;
+    }
+}
+
+MCfloat DeltaDistribution::quantile(MCfloat u) const {
+    return x0;
+}
+
 BaseObject * DeltaDistribution::clone_impl() const
 {
     return new DeltaDistribution(x0);
@@ -112,6 +193,7 @@ NormalDistribution::NormalDistribution(double mean, double sigma,
 {
     this->mean = mean;
     this->sigma = sigma;
+    distribution = NULL;
     reconstructDistribution();
 }
 
@@ -120,6 +202,7 @@ NormalDistribution::~NormalDistribution() {
 }
 
 void NormalDistribution::reconstructDistribution() {
+    delete distribution;
     distribution = new normal_distribution<MCfloat>(mean,sigma);
 }
 
@@ -151,6 +234,31 @@ MCfloat NormalDistribution::spin() const {
     return (*distribution)(*mt);
 }
 
+/**
+ * @brief Generates n normal variates
+ * @param out
+ * @param n
+ *
+ *
+ * The boost distribution is a ziggurat, which needs a single engine call and
+ * no transcendental functions for most variates; it beats the Box-Muller
+ * transform unless the latter can use vectorized math functions. The virtual
+ * call is paid once per batch, and the values are the same as with repeated
+ * calls to spin().
+ */
+
+void NormalDistribution::fill(MCfloat *out, size_t n) const {
+    normal_distribution<MCfloat> &d = *distribution;
+    MCEngine &engine = *mt;
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = d(engine);
+    }
+}
+
+MCfloat NormalDistribution::quantile(MCfloat u) const {
+    return mean + sigma * root_two<MCfloat>() * boost::math::erf_inv(2 * u - 1);
+}
+
 
 
 
@@ -193,6 +301,28 @@ MCfloat UniformDistribution::spinOpen() const {
     return p;
 }
 
+/**
+ * @brief Generates n numbers uniformly distributed in the open interval
+ *        \f$ (\textup{min,max}) \f$
+ * @param out
+ * @param n
+ *
+ *
+ * Like spinOpen(), min never occurs, but no rejection loop is needed.
+ */
+
+void UniformDistribution::fill(MCfloat *out, size_t n) const {
+    fillOpenUnit(out, n);
+    const MCfloat width = max - min;
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = min + width * out[i];
+    }
+}
+
+MCfloat UniformDistribution::quantile(MCfloat u) const {
+    return min + (max - min) * u;
+}
+
 
 
 
@@ -254,6 +384,29 @@ MCfloat ExponentialDistribution::spin() const {
     return distribution(*mt);
 }
 
+/**
+ * @brief Generates n exponential variates
+ * @param out
+ * @param n
+ *
+ *
+ * As for NormalDistribution::fill(), the ziggurat of the boost distribution is
+ * faster than inversion with a scalar log(); values are the same as with
+ * repeated calls to spin().
+ */
+
+void ExponentialDistribution::fill(MCfloat *out, size_t n) const {
+    exponential_distribution<MCfloat> d = distribution;
+    MCEngine &engine = *mt;
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = d(engine);
+    }
+}
+
+MCfloat ExponentialDistribution::quantile(MCfloat u) const {
+    return -log1p(-u) / lambda;
+}
+
 
 
 
@@ -276,6 +429,24 @@ MCfloat Sech2Distribution::spin() const {
     return  mean + scale*log(p/(1.-p));
 }
 
+/**
+ * @brief Generates n variates by inversion
+ * @param out
+ * @param n
+ */
+
+void Sech2Distribution::fill(MCfloat *out, size_t n) const {
+    fillOpenUnit(out, n);
+    for (size_t i = 0; i < n; ++i) {
+        MCfloat p = out[i];
+        out[i] = mean + scale * log(p / (1 - p));
+    }
+}
+
+MCfloat Sech2Distribution::quantile(MCfloat u) const {
+    return mean + scale * log(u / (1 - u));
+}
+
 BaseObject *Sech2Distribution::clone_impl() const
 {
     return new Sech2Distribution(mean,scale);
@@ -301,3 +472,345 @@ void Sech2Distribution::setMean(double value) {
 void Sech2Distribution::setFWHM(double value) {
     setScale(value/(4*log(1 + root_two<MCfloat>())));
 }
+
+
+
+
+// Tabulated distribution
+
+TabulatedDistribution::TabulatedDistribution(BaseObject *parent) :
+    AbstractDistribution(parent)
+{
+}
+
+/**
+ * @brief Sets the tabulated probability density
+ * @param x Strictly increasing abscissae
+ * @param pdf Non-negative density values at the given abscissae
+ * @param n Number of points, at least 2
+ * @return false if the table is invalid, in which case the previous one is
+ * kept
+ *
+ *
+ * The density does not need to be normalized, and it is zero outside of
+ * \f$ [x_0, x_{n-1}] \f$.
+ */
+
+bool TabulatedDistribution::setTable(const MCfloat *x, const MCfloat *pdf,
+                                     size_t n)
+{
+    if(n < 2) {
+        logMessage("At least two points are needed");
+        return false;
+    }
+    MCfloat tot = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if(!(pdf[i] >= 0) || !std::isfinite(pdf[i]) || !std::isfinite(x[i])) {
+            logMessage("Invalid density at point %zu", i);
+            return false;
+        }
+        if(i > 0) {
+            if(!(x[i] > x[i-1])) {
+                logMessage("Abscissae must be strictly increasing");
+                return false;
+            }
+            tot += (pdf[i] + pdf[i-1]) * (x[i] - x[i-1]) / 2;
+        }
+    }
+    if(!(tot > 0)) {
+        logMessage("The density has zero integral");
+        return false;
+    }
+
+    Table *t = new Table();
+    t->x.assign(x, x + n);
+    t->pdf.assign(pdf, pdf + n);
+    t->slope.resize(n - 1);
+    t->cdf.resize(n);
+    t->area = tot;
+
+    MCfloat partial = 0;
+    t->cdf[0] = 0;
+    for (size_t i = 0; i < n - 1; ++i) {
+        MCfloat dx = x[i+1] - x[i];
+        t->slope[i] = (pdf[i+1] - pdf[i]) / dx;
+        partial += (pdf[i+1] + pdf[i]) * dx / 2;
+        t->cdf[i+1] = partial / tot;
+    }
+    t->cdf[n-1] = 1;
+
+    // guide[k] is the last interval starting at or before k / guide.size()
+    t->guide.resize(n - 1);
+    size_t i = 0;
+    for (size_t k = 0; k < t->guide.size(); ++k) {
+        MCfloat u = (MCfloat)k / t->guide.size();
+        while(i + 2 < n && t->cdf[i+1] <= u)
+            ++i;
+        t->guide[k] = i;
+    }
+    table.reset(t);
+    return true;
+}
+
+/**
+ * @brief Loads the tabulated density from an HDF5 dataset
+ * @param fileName
+ * @param dataSetName A rank 2 dataset whose first two columns are abscissae and
+ * density values
+ * @return false on error
+ *
+ *
+ * \sa setTable()
+ */
+
+bool TabulatedDistribution::loadTable(const char *fileName,
+                                      const char *dataSetName)
+{
+    vector<MCfloat> xs, ps;
+    boost::lock_guard<boost::recursive_mutex> h5Lock(h5Mutex);
+    H5FileHelper file;
+    if(!file.openFile(fileName, dataSetName) || !file.loadColumns(&xs, &ps)) {
+        logMessage("Cannot load table %s from %s", dataSetName, fileName);
+        return false;
+    }
+    return setTable(xs.data(), ps.data(), xs.size());
+}
+
+size_t TabulatedDistribution::tableSize() const
+{
+    return table ? table->x.size() : 0;
+}
+
+/**
+ * @brief Inverse of the cumulative distribution function
+ * @param u A number in \f$ [0, 1) \f$
+ * @return
+ *
+ *
+ * Within each interval the density is linear, and the cumulative distribution
+ * is inverted solving a quadratic equation in its numerically stable form.
+ *
+ * \pre A table has been set.
+ */
+
+MCfloat TabulatedDistribution::quantile(MCfloat u) const
+{
+    const Table &tab = *table;
+    const size_t nGuide = tab.guide.size();
+    size_t i = tab.guide[std::min<size_t>(u * nGuide, nGuide - 1)];
+    while(i + 2 < tab.x.size() && tab.cdf[i+1] <= u)
+        ++i;
+
+    MCfloat r = (u - tab.cdf[i]) * tab.area;
+    MCfloat p = tab.pdf[i];
+    MCfloat den = p + sqrt(std::max<MCfloat>(p * p + 2 * tab.slope[i] * r, 0));
+    MCfloat t = den > 0 ? 2 * r / den : 0;
+    return std::min(tab.x[i] + t, tab.x[i+1]);
+}
+
+MCfloat TabulatedDistribution::spin() const
+{
+    return quantile(uniform_01<MCfloat>()(*mt));
+}
+
+void TabulatedDistribution::fill(MCfloat *out, size_t n) const
+{
+    fillOpenUnit(out, n);
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = quantile(out[i]);
+    }
+}
+
+BaseObject *TabulatedDistribution::clone_impl() const
+{
+    TabulatedDistribution *d = new TabulatedDistribution();
+    d->table = table;
+    return d;
+}
+
+void TabulatedDistribution::describe_impl() const
+{
+    if(!table)
+        return;
+    logMessage("%zu points in [%f, %f]", table->x.size(), table->x.front(),
+               table->x.back());
+}
+
+bool TabulatedDistribution::sanityCheck_impl() const
+{
+    if(!table) {
+        logMessage("No table set");
+        return false;
+    }
+    return true;
+}
+
+
+
+
+// Alias distribution
+
+AliasDistribution::AliasDistribution(BaseObject *parent) :
+    AbstractDistribution(parent)
+{
+}
+
+/**
+ * @brief Sets the possible outcomes and their weights
+ * @param values
+ * @param weights Non-negative weights, not necessarily normalized
+ * @param n Number of outcomes
+ * @return false if the table is invalid, in which case the previous one is
+ * kept
+ */
+
+bool AliasDistribution::setTable(const MCfloat *values, const MCfloat *weights,
+                                 size_t n)
+{
+    if(n == 0) {
+        logMessage("At least one value is needed");
+        return false;
+    }
+    MCfloat tot = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if(!(weights[i] >= 0) || !std::isfinite(weights[i])) {
+            logMessage("Invalid weight at index %zu", i);
+            return false;
+        }
+        tot += weights[i];
+    }
+    if(!(tot > 0)) {
+        logMessage("Weights sum to zero");
+        return false;
+    }
+
+    this->values.assign(values, values + n);
+    prob.resize(n);
+    alias.resize(n);
+
+    vector<MCfloat> scaled(n);
+    vector<u_int32_t> small, large;
+    for (size_t i = 0; i < n; ++i) {
+        scaled[i] = weights[i] * n / tot;
+        alias[i] = i;
+        if(scaled[i] < 1)
+            small.push_back(i);
+        else
+            large.push_back(i);
+    }
+    while(!small.empty() && !large.empty()) {
+        u_int32_t l = small.back();
+        u_int32_t g = large.back();
+        small.pop_back();
+        prob[l] = scaled[l];
+        alias[l] = g;
+        scaled[g] = (scaled[g] + scaled[l]) - 1;
+        if(scaled[g] < 1) {
+            large.pop_back();
+            small.push_back(g);
+        }
+    }
+    // leftovers are 1 up to rounding errors
+    for (size_t i = 0; i < small.size(); ++i) {
+        prob[small[i]] = 1;
+    }
+    for (size_t i = 0; i < large.size(); ++i) {
+        prob[large[i]] = 1;
+    }
+    return true;
+}
+
+/**
+ * @brief Loads values and weights from an HDF5 dataset
+ * @param fileName
+ * @param dataSetName A rank 2 dataset whose first two columns are values and
+ * weights
+ * @return false on error
+ *
+ *
+ * \sa setTable()
+ */
+
+bool AliasDistribution::loadTable(const char *fileName, const char *dataSetName)
+{
+    vector<MCfloat> vs, ws;
+    boost::lock_guard<boost::recursive_mutex> h5Lock(h5Mutex);
+    H5FileHelper file;
+    if(!file.openFile(fileName, dataSetName) || !file.loadColumns(&vs, &ws)) {
+        logMessage("Cannot load table %s from %s", dataSetName, fileName);
+        return false;
+    }
+    return setTable(vs.data(), ws.data(), vs.size());
+}
+
+size_t AliasDistribution::tableSize() const
+{
+    return values.size();
+}
+
+MCfloat AliasDistribution::spin() const
+{
+    MCfloat u = uniform_01<MCfloat>()(*mt) * values.size();
+    size_t j = std::min<size_t>(u, values.size() - 1);
+    return u - j < prob[j] ? values[j] : values[alias[j]];
+}
+
+/**
+ * @brief Generates n variates
+ * @param out
+ * @param n
+ *
+ *
+ * The integer part of each scaled uniform variate selects a column, the
+ * fractional part chooses between its value and its alias.
+ */
+
+void AliasDistribution::fill(MCfloat *out, size_t n) const
+{
+    fillOpenUnit(out, n);
+    const size_t k = values.size();
+    for (size_t i = 0; i < n; ++i) {
+        MCfloat u = out[i] * k;
+        size_t j = std::min<size_t>(u, k - 1);
+        out[i] = u - j < prob[j] ? values[j] : values[alias[j]];
+    }
+}
+
+/**
+ * @brief Maps a uniform number onto the distribution as spin() does
+ * @param u
+ * @return
+ *
+ *
+ * The mapping is not monotonic, since columns are visited in table order.
+ */
+
+MCfloat AliasDistribution::quantile(MCfloat u) const
+{
+    u *= values.size();
+    size_t j = std::min<size_t>(u, values.size() - 1);
+    return u - j < prob[j] ? values[j] : values[alias[j]];
+}
+
+BaseObject *AliasDistribution::clone_impl() const
+{
+    AliasDistribution *d = new AliasDistribution();
+    d->values = values;
+    d->prob = prob;
+    d->alias = alias;
+    return d;
+}
+
+void AliasDistribution::describe_impl() const
+{
+    logMessage("%zu values", values.size());
+}
+
+bool AliasDistribution::sanityCheck_impl() const
+{
+    if(values.empty()) {
+        logMessage("No table set");
+        return false;
+    }
+    return true;
+}
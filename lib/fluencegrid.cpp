@@ -0,0 +1,685 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/fluencegrid.h>
+#include <MCPlusPlus/h5filehelper.h>
+
+#include <boost/math/constants/constants.hpp>
+#include <algorithm>
+#include <cmath>
+#include <unistd.h>
+
+using namespace MCPP;
+using namespace boost::math::constants;
+
+FluenceGrid::FluenceGrid(BaseObject *parent) :
+    BaseObject(parent)
+{
+    geometry = GRID_CARTESIAN;
+    for (uint i = 0; i < 4; ++i) {
+        min[i] = 0;
+        max[i] = 0;
+        binSize[i] = 0;
+        nBins[i] = 1;
+    }
+    totVoxels = 0;
+    pathLengths = NULL;
+    generation = 0;
+    _nWalkers = 0;
+    gridName = "";
+}
+
+FluenceGrid::~FluenceGrid()
+{
+    if(pathLengths != NULL)
+        free(pathLengths);
+}
+
+/**
+ * @brief Sets the voxel geometry
+ * @param geometry
+ *
+ *
+ * Defaults to GRID_CARTESIAN. Cylindrical grids use setRhoRange() and
+ * setZRange(), cartesian ones setXRange(), setYRange() and setZRange().
+ */
+
+void FluenceGrid::setGeometry(gridGeometry geometry)
+{
+    this->geometry = geometry;
+}
+
+void FluenceGrid::setXRange(const MCfloat min, const MCfloat max,
+                            const MCfloat binSize)
+{
+    setRange(AXIS_X, min, max, binSize);
+}
+
+void FluenceGrid::setYRange(const MCfloat min, const MCfloat max,
+                            const MCfloat binSize)
+{
+    setRange(AXIS_Y, min, max, binSize);
+}
+
+/**
+ * @brief Sets the extent of a cylindrical grid along rho
+ * @param max
+ * @param binSize
+ *
+ *
+ * The first ring always starts on the z axis.
+ */
+
+void FluenceGrid::setRhoRange(const MCfloat max, const MCfloat binSize)
+{
+    setRange(AXIS_X, 0, max, binSize);
+}
+
+void FluenceGrid::setZRange(const MCfloat min, const MCfloat max,
+                            const MCfloat binSize)
+{
+    setRange(AXIS_Z, min, max, binSize);
+}
+
+/**
+ * @brief Resolves the path length in time
+ * @param min
+ * @param max
+ * @param binSize
+ *
+ *
+ * Times are measured as the walk times (see Simulation::setTimeOriginZ()).
+ * By default grids are not time-resolved.
+ */
+
+void FluenceGrid::setTimeRange(const MCfloat min, const MCfloat max,
+                               const MCfloat binSize)
+{
+    setRange(AXIS_T, min, max, binSize);
+}
+
+/**
+ * @brief Sets the name of the group where the grid is saved
+ * @param name
+ */
+
+void FluenceGrid::setName(const char *name)
+{
+    gridName = name;
+}
+
+string FluenceGrid::name() const
+{
+    return gridName;
+}
+
+bool FluenceGrid::isTimeResolved() const
+{
+    return binSize[AXIS_T] > 0;
+}
+
+/**
+ * @brief Allocates the grid and clears its content
+ * @return false if the memory cannot be allocated
+ */
+
+bool FluenceGrid::initialize()
+{
+    if(geometry == GRID_CYLINDRICAL)
+        nBins[AXIS_Y] = 1;
+    totVoxels = 1;
+    for (uint i = 0; i < 4; ++i) {
+        totVoxels *= nBins[i];
+    }
+
+    if(pathLengths != NULL)
+        free(pathLengths);
+    pathLengths = (MCfloat*)calloc(totVoxels, sizeof(MCfloat));
+    generation++;
+    _nWalkers = 0;
+    if(pathLengths == NULL) {
+        logMessage("Cannot allocate %lu voxels", totVoxels);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Scores a straight step of a walker
+ * @param r Starting point
+ * @param k Direction unit vector
+ * @param length Length of the step
+ * @param t0 Walk time at the starting point
+ * @param v Speed of the walker
+ *
+ *
+ * The step is split at the boundaries of the voxels it crosses, so that the
+ * cost is proportional to the number of voxels actually visited.
+ */
+
+void FluenceGrid::addSegment(const MCfloat *r, const MCfloat *k,
+                             const MCfloat length, const MCfloat t0,
+                             const MCfloat v)
+{
+    if(!(length > 0))
+        return;
+
+    // most steps lie entirely above or below the grid
+    MCfloat z1 = r[2] + k[2] * length;
+    if(std::max(r[2], z1) < min[AXIS_Z] || std::min(r[2], z1) > max[AXIS_Z])
+        return;
+    bool timeResolved = isTimeResolved();
+    if(timeResolved && (t0 + length / v < min[AXIS_T] || t0 > max[AXIS_T]))
+        return;
+
+    crossings.clear();
+    if(geometry == GRID_CARTESIAN) {
+        addPlaneCrossings(AXIS_X, r[0], k[0], length);
+        addPlaneCrossings(AXIS_Y, r[1], k[1], length);
+    }
+    else
+        addCylinderCrossings(r, k, length);
+    addPlaneCrossings(AXIS_Z, r[2], k[2], length);
+    if(timeResolved)
+        addPlaneCrossings(AXIS_T, t0, 1 / v, length);
+    crossings.push_back(length);
+    sort(crossings.begin(), crossings.end());
+
+    MCfloat s0 = 0;
+    for (size_t i = 0; i < crossings.size(); ++i) {
+        MCfloat s1 = crossings[i];
+        if(s1 <= s0)
+            continue;
+
+        // the midpoint of each piece unambiguously identifies its voxel
+        MCfloat s = (s0 + s1) / 2;
+        MCfloat x = r[0] + k[0] * s;
+        MCfloat y = r[1] + k[1] * s;
+        long ix, iy = 0, it = 0;
+        if(geometry == GRID_CARTESIAN) {
+            ix = binIndex(AXIS_X, x);
+            iy = binIndex(AXIS_Y, y);
+        }
+        else
+            ix = binIndex(AXIS_X, sqrt(x * x + y * y));
+        long iz = binIndex(AXIS_Z, r[2] + k[2] * s);
+        if(timeResolved)
+            it = binIndex(AXIS_T, t0 + s / v);
+
+        if(ix >= 0 && iy >= 0 && iz >= 0 && it >= 0) {
+            size_t index = ((ix * nBins[AXIS_Y] + iy) * nBins[AXIS_Z] + iz)
+                    * nBins[AXIS_T] + it;
+            pathLengths[index] += s1 - s0;
+        }
+        s0 = s1;
+    }
+}
+
+/**
+ * @brief Adds to the number of walkers used to normalize the grid
+ * @param nWalkers
+ */
+
+void FluenceGrid::addWalkers(u_int64_t nWalkers)
+{
+    _nWalkers += nWalkers;
+}
+
+u_int64_t FluenceGrid::nWalkers() const
+{
+    return _nWalkers;
+}
+
+/**
+ * @brief Adds the path lengths and the number of walkers of another grid
+ * @param rhs A grid with the same layout
+ */
+
+void FluenceGrid::appendCounts(const FluenceGrid *rhs)
+{
+    MCfloat *dest = pathLengths;
+    const MCfloat *src = rhs->pathLengths;
+    for (size_t i = 0; i < totVoxels; ++i) {
+        dest[i] += src[i];
+    }
+    _nWalkers += rhs->_nWalkers;
+}
+
+/**
+ * @brief Whether the given grid has the same geometry and bin edges
+ * @param rhs
+ * @return
+ *
+ *
+ * Edges are compared up to a small fraction of the bin size, since the ones of
+ * a grid restored with loadLayout() are recomputed from the saved ones.
+ */
+
+bool FluenceGrid::hasSameLayout(const FluenceGrid *rhs) const
+{
+    if(geometry != rhs->geometry)
+        return false;
+    for (uint a = 0; a < 4; ++a) {
+        if(usesAxis((axis)a) != rhs->usesAxis((axis)a))
+            return false;
+        if(!usesAxis((axis)a))
+            continue;
+        if(nBins[a] != rhs->nBins[a]
+                || fabs(min[a] - rhs->min[a]) > 1e-9 * binSize[a]
+                || fabs(max[a] - rhs->max[a]) > 1e-9 * binSize[a])
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief The unnormalized path lengths
+ * @return A row-major array of nBinsAlong(0) x ... x nBinsAlong(3) elements,
+ * or NULL if the grid is not initialized
+ */
+
+const MCfloat *FluenceGrid::rawPathLengths() const
+{
+    return pathLengths;
+}
+
+/**
+ * @brief Counts the reallocations of the path lengths
+ * @return A number that changes whenever the array returned by
+ * rawPathLengths() is reallocated, i.e. at each initialize()
+ */
+
+u_int64_t FluenceGrid::rawDataGeneration() const
+{
+    return generation;
+}
+
+/**
+ * @brief The number of bins along the given axis
+ * @param axis 0 for x (or rho), 1 for y, 2 for z and 3 for time
+ * @return 1 for the axes not used by the grid
+ */
+
+size_t FluenceGrid::nBinsAlong(uint axis) const
+{
+    if(axis > AXIS_T)
+        return 0;
+    if(axis == AXIS_Y && geometry == GRID_CYLINDRICAL)
+        return 1;
+    return nBins[axis];
+}
+
+size_t FluenceGrid::nVoxels() const
+{
+    return totVoxels;
+}
+
+/**
+ * @brief Saves the grid in the given H5 file
+ * @param fileName
+ *
+ *
+ * If the file does not exist, it is created.
+ *
+ * \see saveToFile(H5FileHelper *file, const char *groupName)
+ */
+
+void FluenceGrid::saveToFile(const char *fileName) const
+{
+    boost::lock_guard<boost::recursive_mutex> h5Lock(h5Mutex);
+    H5FileHelper *file = new H5FileHelper(0);
+    if(access(fileName, F_OK)<0)
+        file->newFile(fileName);
+    else
+        file->openFile(fileName);
+
+    saveToFile(file);
+
+    file->close();
+    delete file;
+}
+
+/**
+ * @brief Saves the grid in an already open H5 file
+ * @param file
+ * @param groupName The full path of the group to be written. If NULL,
+ * <tt>fluence/\<name\></tt> is used.
+ *
+ *
+ * The group contains the following datasets, the unused axes being omitted
+ * from the shapes:
+ * - <tt>fluence</tt>, with shape (x, y, z, t) or (rho, z, t): the path length
+ * per walker divided by the voxel volume and, for time-resolved grids, by the
+ * time bin width
+ * - <tt>path-lengths</tt>: the unnormalized path lengths, with the same shape
+ * - <tt>n-walkers</tt>: the number of walkers used for normalization
+ * - <tt>x</tt>, <tt>y</tt>, <tt>rho</tt>, <tt>z</tt>, <tt>t</tt>: the bin
+ * edges along each axis
+ *
+ * Existing datasets are overwritten.
+ */
+
+void FluenceGrid::saveToFile(H5FileHelper *file, const char *groupName) const
+{
+    string group = "fluence/" + (gridName == "" ? "grid" : gridName);
+    if(groupName != NULL)
+        group = groupName;
+    file->newGroup(group.c_str());
+
+    hsize_t dims[4];
+    int rank = 0;
+    hsize_t start[4] = {0, 0, 0, 0};
+
+    for (uint a = 0; a < 4; ++a) {
+        if(!usesAxis((axis)a))
+            continue;
+        dims[rank++] = nBins[a];
+
+        vector<MCfloat> edges = binEdges((axis)a);
+        hsize_t nEdges = edges.size();
+        string dsName = group + "/" + axisName((axis)a);
+        file->unlink(dsName.c_str());
+        file->newDataset(dsName.c_str(), 1, &nEdges);
+        file->writeHyperSlab(start, &nEdges, edges.data());
+    }
+
+    MCfloat scale = _nWalkers > 0 ? 1. / _nWalkers : 0;
+    if(isTimeResolved())
+        scale /= binSize[AXIS_T];
+    vector<MCfloat> fluence(totVoxels);
+    size_t perRho = totVoxels / nBins[AXIS_X];
+    for (size_t i = 0; i < totVoxels; ++i) {
+        fluence[i] = pathLengths[i] * scale / voxelVolume(i / perRho);
+    }
+
+    string dsName = group + "/fluence";
+    file->unlink(dsName.c_str());
+    file->newDataset(dsName.c_str(), rank, dims);
+    file->writeHyperSlab(start, dims, fluence.data());
+
+    dsName = group + "/path-lengths";
+    file->unlink(dsName.c_str());
+    file->newDataset(dsName.c_str(), rank, dims);
+    file->writeHyperSlab(start, dims, pathLengths);
+
+    hsize_t one = 1;
+    dsName = group + "/n-walkers";
+    file->unlink(dsName.c_str());
+    file->newDataset(dsName.c_str(), 1, &one, PredType::NATIVE_UINT64);
+    file->writeHyperSlab(start, &one, &_nWalkers);
+    file->closeDataSet();
+}
+
+/**
+ * @brief Restores the geometry and the ranges of a grid saved with saveToFile()
+ * @param file
+ * @param groupName The full path of the group of the grid
+ * @return false if the group has no valid bin edges
+ *
+ *
+ * The grid is not initialized and its name is not changed. Call initialize()
+ * and loadCounts() afterwards to restore the content.
+ */
+
+bool FluenceGrid::loadLayout(H5FileHelper *file, const char *groupName)
+{
+    string group = groupName;
+    geometry = file->dataSetExists((group + "/rho").c_str())
+            ? GRID_CYLINDRICAL : GRID_CARTESIAN;
+    for (uint a = 0; a < 4; ++a) {
+        min[a] = 0;
+        max[a] = 0;
+        binSize[a] = 0;
+        nBins[a] = 1;
+        string dsName = group + "/" + axisName((axis)a);
+        if(!file->dataSetExists(dsName.c_str())) {
+            if(a == AXIS_T || (a == AXIS_Y && geometry == GRID_CYLINDRICAL))
+                continue;
+            logMessage("Cannot find %s", dsName.c_str());
+            return false;
+        }
+        file->openDataSet(dsName.c_str());
+        size_t n = file->extentDims()[0];
+        if(file->getRank() != 1 || n < 2) {
+            logMessage("Invalid bin edges %s", dsName.c_str());
+            return false;
+        }
+        vector<MCfloat> edges(n);
+        file->loadAll(edges.data());
+        min[a] = edges[0];
+        max[a] = edges[n - 1];
+        nBins[a] = n - 1;
+        binSize[a] = (max[a] - min[a]) / nBins[a];
+    }
+    file->closeDataSet();
+    return sanityCheck();
+}
+
+/**
+ * @brief Loads the path lengths and the number of walkers saved with
+ * saveToFile()
+ * @param file
+ * @param groupName The full path of the group of the grid
+ * @return false if they cannot be found or do not match the size of the grid
+ *
+ *
+ * The loaded data replace the current content of the grid.
+ *
+ * \pre The grid must be initialized
+ */
+
+bool FluenceGrid::loadCounts(H5FileHelper *file, const char *groupName)
+{
+    string group = groupName;
+    string dsName = group + "/path-lengths";
+    if(!file->dataSetExists(dsName.c_str())
+            || !file->dataSetExists((group + "/n-walkers").c_str())) {
+        logMessage("Cannot find the path lengths of %s", groupName);
+        return false;
+    }
+    file->openDataSet(dsName.c_str());
+    size_t n = 1;
+    for (int i = 0; i < file->getRank(); ++i) {
+        n *= file->extentDims()[i];
+    }
+    if(n != totVoxels) {
+        logMessage("%s does not match the grid size", dsName.c_str());
+        return false;
+    }
+    file->loadAll(pathLengths);
+    file->openDataSet((group + "/n-walkers").c_str());
+    file->loadAll(&_nWalkers);
+    file->closeDataSet();
+    return true;
+}
+
+bool FluenceGrid::sanityCheck_impl() const
+{
+    uint nAxes = geometry == GRID_CARTESIAN ? 3 : 2;
+    const axis axes[3] = {AXIS_X, AXIS_Z, AXIS_Y};
+    for (uint i = 0; i < nAxes; ++i) {
+        if(binSize[axes[i]] <= 0)
+            return false;
+    }
+    return true;
+}
+
+BaseObject *FluenceGrid::clone_impl() const
+{
+    FluenceGrid *g = new FluenceGrid(NULL);
+    g->gridName = gridName;
+    g->geometry = geometry;
+    for (uint i = 0; i < 4; ++i) {
+        g->min[i] = min[i];
+        g->max[i] = max[i];
+        g->binSize[i] = binSize[i];
+        g->nBins[i] = nBins[i];
+    }
+    return g;
+}
+
+/**
+ * @brief Sets the extent of the grid along an axis
+ * @param a
+ * @param min
+ * @param max Rounded up to a whole number of bins
+ * @param binSize
+ */
+
+void FluenceGrid::setRange(axis a, const MCfloat min, const MCfloat max,
+                           const MCfloat binSize)
+{
+    if(binSize <= 0 || max <= min) {
+        logMessage("Invalid range [%g, %g] with bin size %g",
+                   (double)min, (double)max, (double)binSize);
+        return;
+    }
+    this->min[a] = min;
+    this->binSize[a] = binSize;
+    nBins[a] = ceil((max - min) / binSize);
+    this->max[a] = min + nBins[a] * binSize;
+}
+
+bool FluenceGrid::usesAxis(axis a) const
+{
+    if(a == AXIS_Y)
+        return geometry == GRID_CARTESIAN;
+    if(a == AXIS_T)
+        return isTimeResolved();
+    return true;
+}
+
+/**
+ * @brief The name of the dataset of the bin edges along the given axis
+ * @param a
+ * @return
+ */
+
+const char *FluenceGrid::axisName(axis a) const
+{
+    const char *names[4] = {"x", "y", "z", "t"};
+    if(a == AXIS_X && geometry == GRID_CYLINDRICAL)
+        return "rho";
+    return names[a];
+}
+
+vector<MCfloat> FluenceGrid::binEdges(axis a) const
+{
+    vector<MCfloat> edges(nBins[a] + 1);
+    for (size_t i = 0; i <= nBins[a]; ++i) {
+        edges[i] = min[a] + i * binSize[a];
+    }
+    return edges;
+}
+
+/**
+ * @brief Appends the parameters at which a step crosses the bin edges
+ * along an axis
+ * @param a
+ * @param c0 Coordinate at the starting point
+ * @param dc Derivative of the coordinate along the step
+ * @param length
+ */
+
+void FluenceGrid::addPlaneCrossings(axis a, const MCfloat c0, const MCfloat dc,
+                                    const MCfloat length)
+{
+    if(dc == 0)
+        return;
+    MCfloat c1 = c0 + dc * length;
+    MCfloat lo = (std::min(c0, c1) - min[a]) / binSize[a];
+    MCfloat hi = (std::max(c0, c1) - min[a]) / binSize[a];
+    // clamp before converting, the step can be very long
+    MCfloat first = std::max<MCfloat>(floor(lo) + 1, 0);
+    MCfloat last = std::min<MCfloat>(ceil(hi) - 1, nBins[a]);
+    for (long j = first; j <= last; ++j) {
+        MCfloat s = (min[a] + j * binSize[a] - c0) / dc;
+        if(s > 0 && s < length)
+            crossings.push_back(s);
+    }
+}
+
+/**
+ * @brief Appends the parameters at which a step crosses the cylinders
+ * bounding the rho bins
+ * @param r
+ * @param k
+ * @param length
+ */
+
+void FluenceGrid::addCylinderCrossings(const MCfloat *r, const MCfloat *k,
+                                       const MCfloat length)
+{
+    // rho^2 = A s^2 + B s + C along the step
+    MCfloat A = k[0] * k[0] + k[1] * k[1];
+    if(A == 0)
+        return;
+    MCfloat B = 2 * (r[0] * k[0] + r[1] * k[1]);
+    MCfloat C = r[0] * r[0] + r[1] * r[1];
+
+    MCfloat sMin = std::min<MCfloat>(std::max<MCfloat>(-B / (2 * A), 0),
+                                     length);
+    MCfloat rhoMin = sqrt(std::max<MCfloat>((A * sMin + B) * sMin + C, 0));
+    MCfloat rhoMax = sqrt(std::max(C, (A * length + B) * length + C));
+    MCfloat first = std::max<MCfloat>(ceil(rhoMin / binSize[AXIS_X]), 1);
+    MCfloat last = std::min<MCfloat>(floor(rhoMax / binSize[AXIS_X]),
+                                     nBins[AXIS_X]);
+
+    for (long j = first; j <= last; ++j) {
+        MCfloat R = j * binSize[AXIS_X];
+        MCfloat disc = B * B - 4 * A * (C - R * R);
+        if(disc < 0)
+            continue;
+        MCfloat sq = sqrt(disc);
+        MCfloat s = (-B - sq) / (2 * A);
+        if(s > 0 && s < length)
+            crossings.push_back(s);
+        s = (-B + sq) / (2 * A);
+        if(s > 0 && s < length)
+            crossings.push_back(s);
+    }
+}
+
+/**
+ * @brief The bin containing the given coordinate
+ * @param a
+ * @param c
+ * @return -1 if c is outside the grid
+ */
+
+long FluenceGrid::binIndex(axis a, const MCfloat c) const
+{
+    MCfloat i = floor((c - min[a]) / binSize[a]);
+    if(!(i >= 0 && i < nBins[a]))
+        return -1;
+    return i;
+}
+
+/**
+ * @brief The volume of the voxels in the given x (or rho) bin
+ * @param iRho
+ * @return
+ */
+
+MCfloat FluenceGrid::voxelVolume(size_t iRho) const
+{
+    if(geometry == GRID_CARTESIAN)
+        return binSize[AXIS_X] * binSize[AXIS_Y] * binSize[AXIS_Z];
+    MCfloat r0 = iRho * binSize[AXIS_X];
+    MCfloat r1 = r0 + binSize[AXIS_X];
+    return pi<MCfloat>() * (r1 * r1 - r0 * r0) * binSize[AXIS_Z];
+}
@@ -17,10 +17,6 @@
 
 #include <MCPlusPlus/gaussianraybundlesource.h>
 
-#include <boost/math/special_functions/erf.hpp>
-
-using namespace boost::math::constants;
-using namespace boost::math;
 using namespace MCPP;
 
 /**
@@ -95,6 +91,20 @@ void GaussianRayBundleSource::init()
 {
     setZWaist(0);
     uRand = new UniformDistribution(0,1,this);
+
+    /* Standard normal density, for a quantile lookup which is several times
+     * faster than erf_inv() and accurate to a few parts per million of the
+     * spot size. Tails beyond xMax have a probability below 1e-16. */
+    const size_t n = 8193;
+    const MCfloat xMax = 8.5;
+    vector<MCfloat> x(n), pdf(n);
+    for (size_t i = 0; i < n; ++i) {
+        x[i] = -xMax + 2 * xMax * i / (n - 1);
+        pdf[i] = exp(-x[i] * x[i] / 2);
+    }
+    normal = new TabulatedDistribution(this);
+    normal->setTable(x.data(), pdf.data(), n);
+
     clearObjectsToCheck();
     objectsToCheck.push_back((const BaseObject**)&walkTimeDistribution);
 }
@@ -159,7 +169,7 @@ void GaussianRayBundleSource::setWavelength(double um)
 
 void GaussianRayBundleSource::spinTime(Walker *walker) const
 {
-    walker->walkTime = walkTimeDistribution->spin();
+    walker->walkTime = draw(walkTimeDistribution, 4);
     MCfloat timeOffsetNoSample = d / environment->v;
     MCfloat s = d / walker->k0[2];
     walker->walkTime += (timeOffsetNoSample-s/environment->v);
@@ -189,7 +199,10 @@ BaseObject *GaussianRayBundleSource::clone_impl() const
 {
     GaussianRayBundleSource *src = new GaussianRayBundleSource(
                 xLensWaist, yLensWaist, xWaist, yWaist, d);
-    src->walkTimeDistribution = walkTimeDistribution;
+    if(walkTimeDistribution != NULL)
+        src->setWalkTimeDistribution(
+                    (AbstractDistribution*)walkTimeDistribution->clone());
+    cloneSamplingInto(src);
     return src;
 }
 
@@ -254,23 +267,74 @@ bool GaussianRayBundleSource::focus(double zWaist, Sample *sample)
  */
 
 void GaussianRayBundleSource::spinPosition(Walker *walker) const {
-    walker->r0[0] = xLensWaist * one_div_root_two<MCfloat>()
-            * erf_inv<MCfloat>(2*uRand->spinOpen() -1);
-    walker->r0[1] = yLensWaist * one_div_root_two<MCfloat>()
-            * erf_inv<MCfloat>(2*uRand->spinOpen() -1);
+    walker->r0[0] = xLensWaist / 2 * spinNormal(0);
+    walker->r0[1] = yLensWaist / 2 * spinNormal(1);
     walker->r0[2] = zLens();
 }
 
+/**
+ * @brief Constructs a batch of walkers on the lens
+ * @param walkers
+ * @param n
+ *
+ *
+ * The uniform variates of the whole batch are drawn at once with
+ * AbstractDistribution::fill(), see Source::spinBatch().
+ */
+
+void GaussianRayBundleSource::spinBatch_impl(Walker *walkers, size_t n) const
+{
+    // the four uniform variates of each walker are temporarily stored in r0
+    // and k0
+    vector<MCfloat> u(4 * n), t(n);
+    uRand->fill(u.data(), 4 * n);
+    walkTimeDistribution->fill(t.data(), n);
+    for (size_t i = 0; i < n; ++i) {
+        Walker *w = &walkers[i];
+        w->r0[0] = u[4 * i];
+        w->r0[1] = u[4 * i + 1];
+        w->k0[0] = u[4 * i + 2];
+        w->k0[1] = u[4 * i + 3];
+        w->walkTime = t[i];
+        w->type = -1;
+    }
+
+    MCfloat z = zLens();
+    MCfloat timeOffsetNoSample = d / environment->v;
+    for (size_t i = 0; i < n; ++i) {
+        Walker *w = &walkers[i];
+        MCfloat x = xLensWaist / 2 * normal->quantile(w->r0[0]);
+        MCfloat y = yLensWaist / 2 * normal->quantile(w->r0[1]);
+        MCfloat xW = xWaist / 2 * normal->quantile(w->k0[0]);
+        MCfloat yW = yWaist / 2 * normal->quantile(w->k0[1]);
+        w->r0[0] = x;
+        w->r0[1] = y;
+        w->r0[2] = z;
+
+        MCfloat connectingVector[3];
+        connectingVector[0] = xW - x;
+        connectingVector[1] = yW - y;
+        connectingVector[2] = d;
+        MCfloat connectingVectorNorm = sqrt(pow(connectingVector[0],2)
+                + pow(connectingVector[1],2) + pow(connectingVector[2],2));
+        for (int j = 0; j < 3; ++j) {
+            w->k0[j] = connectingVector[j]/connectingVectorNorm;
+        }
+
+        MCfloat s = d / w->k0[2];
+        w->walkTime += (timeOffsetNoSample-s/environment->v);
+    }
+    spinWavelengths(walkers, n);
+}
+
 /**
  * \copydoc Source::spinDirection()
  * \pre
  */
 
 void GaussianRayBundleSource::spinDirection(Walker *walker) const {
-    MCfloat xW = xWaist * one_div_root_two<MCfloat>()
-            * erf_inv<MCfloat>(2*uRand->spinOpen() -1);
-    MCfloat yW = yWaist * one_div_root_two<MCfloat>()
-            * erf_inv<MCfloat>(2*uRand->spinOpen() -1);
+    MCfloat xW = xWaist / 2 * spinNormal(2);
+    MCfloat yW = yWaist / 2 * spinNormal(3);
     MCfloat connectingVector[3];
     connectingVector[0] = xW - walker->r0[0];
     connectingVector[1] = yW - walker->r0[1];
@@ -281,3 +345,18 @@ void GaussianRayBundleSource::spinDirection(Walker *walker) const {
         walker->k0[i] = connectingVector[i]/connectingVectorNorm;
     }
 }
+
+/**
+ * @brief Draws a standard normal variate
+ * @param coordinate The coordinate of the quasi-random point to be used, see
+ * Source
+ * @return
+ */
+
+MCfloat GaussianRayBundleSource::spinNormal(unsigned int coordinate) const
+{
+    MCfloat u;
+    if(!quasiRandomCoordinate(coordinate, &u))
+        u = uRand->spinOpen();
+    return normal->quantile(u);
+}
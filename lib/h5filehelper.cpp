@@ -20,6 +20,8 @@
 
 using namespace MCPP;
 
+boost::recursive_mutex MCPP::h5Mutex;
+
 H5FileHelper::H5FileHelper(BaseObject *parent) :
     BaseObject(parent)
 {
@@ -28,6 +30,7 @@ H5FileHelper::H5FileHelper(BaseObject *parent) :
     dName = NULL;
     opened = false;
     dsOpened = false;
+    swmrWrite = false;
     file = NULL;
     dataSpace = NULL;
     dataSet = NULL;
@@ -67,6 +70,37 @@ void H5FileHelper::close() {
     opened = false;
 }
 
+/**
+ * @brief Flushes all the buffers of the HDF5 file to disk
+ *
+ *
+ * In SWMR mode (see setSWMRWriteEnabled()), this makes the data written so far
+ * visible to readers.
+ */
+
+void H5FileHelper::flush()
+{
+    if(opened)
+        file->flush(H5F_SCOPE_GLOBAL);
+}
+
+/**
+ * @brief Enables the HDF5 single-writer / multiple-reader mode
+ * @param enable
+ *
+ *
+ * If enabled, newFile() creates files in the latest HDF5 format, which is
+ * needed for SWMR, and openFile() opens them in SWMR write mode, so that other
+ * processes can open the file for reading with the H5F_ACC_SWMR_READ flag
+ * while it is being written. Files created this way can only be read by
+ * HDF5 1.10 or later.
+ */
+
+void H5FileHelper::setSWMRWriteEnabled(bool enable)
+{
+    swmrWrite = enable;
+}
+
 const hsize_t *H5FileHelper::extentDims() const
 {
     return dims;
@@ -138,7 +172,13 @@ bool H5FileHelper::_openFile(const char *fileName) {
             return false;
         }
 
-        file->openFile(fileName, H5F_ACC_RDWR);
+        if(swmrWrite) {
+            FileAccPropList fapl;
+            fapl.setLibverBounds(H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+            file->openFile(fileName, H5F_ACC_RDWR | H5F_ACC_SWMR_WRITE, fapl);
+        }
+        else
+            file->openFile(fileName, H5F_ACC_RDWR);
         opened = true;
     }
     catch ( Exception error )
@@ -170,7 +210,11 @@ bool H5FileHelper::newFile(const char *fileName) {
     logMessage("Creating new file %s... ", fileName);
 #endif
     try{
-        file = new H5File(fileName, H5F_ACC_TRUNC);
+        FileAccPropList fapl;
+        if(swmrWrite)
+            fapl.setLibverBounds(H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+        file = new H5File(fileName, H5F_ACC_TRUNC, FileCreatPropList::DEFAULT,
+                          fapl);
         opened = true;
     }
     catch (Exception error) {
@@ -283,7 +327,34 @@ bool H5FileHelper::newDataset(const char *datasetName, int ndims,
 
 bool H5FileHelper::dataSetExists(const char *dataSetName) const
 {
-    return H5Lexists(file->getId(), dataSetName, H5P_DEFAULT);
+    // H5Lexists fails if an intermediate group is missing
+    string path = dataSetName;
+    size_t pos = 0;
+    while(pos != string::npos) {
+        pos = path.find('/', pos + 1);
+        string parent = path.substr(0, pos);
+        if(H5Lexists(file->getId(), parent.c_str(), H5P_DEFAULT) <= 0)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Removes a dataset or a group from the current file
+ * @param name
+ *
+ *
+ * Does nothing if no such object exists. The space used by the object is not
+ * reclaimed until the file is repacked.
+ */
+
+void H5FileHelper::unlink(const char *name)
+{
+    if(!dataSetExists(name))
+        return;
+    if(dsOpened && dName != NULL && strcmp(dName, name) == 0)
+        closeDataSet();
+    file->unlink(name);
 }
 
 /**
@@ -311,9 +382,76 @@ bool H5FileHelper::openDataSet(const char *dataSetName) {
     return true;
 }
 
+/**
+ * @brief Creates a new group, along with any missing parent group
+ * @param name Full path of the group
+ *
+ *
+ * Does nothing if the group already exists.
+ */
+
 void H5FileHelper::newGroup(const char *name)
 {
-    file->createGroup(name);
+    string path = name;
+    size_t pos = 0;
+    while(pos != string::npos) {
+        pos = path.find('/', pos + 1);
+        string parent = path.substr(0, pos);
+        if(!dataSetExists(parent.c_str()))
+            file->createGroup(parent);
+    }
+}
+
+/**
+ * @brief The number of objects (datasets or groups) in the given group
+ * @param groupName
+ * @return
+ */
+
+hsize_t H5FileHelper::nChildren(const char *groupName) const
+{
+    if(!dataSetExists(groupName))
+        return 0;
+    Group group = file->openGroup(groupName);
+    hsize_t n = group.getNumObjs();
+    group.close();
+    return n;
+}
+
+/**
+ * @brief The name of the given child of a group
+ * @param groupName
+ * @param index From 0 to nChildren() - 1
+ * @return An empty string if there is no such child
+ */
+
+string H5FileHelper::childName(const char *groupName, hsize_t index) const
+{
+    if(index >= nChildren(groupName))
+        return "";
+    Group group = file->openGroup(groupName);
+    string name = group.getObjnameByIdx(index);
+    group.close();
+    return name;
+}
+
+/**
+ * @brief Copies a dataset or a group from another file
+ * @param src
+ * @param name Path of the object, which is the same in both files
+ * @return false if the object does not exist in src or cannot be copied
+ *
+ *
+ * An existing object with the same name is replaced.
+ */
+
+bool H5FileHelper::copyFrom(const H5FileHelper *src, const char *name)
+{
+    if(!src->dataSetExists(name))
+        return false;
+    unlink(name);
+    return H5Ocopy(src->file->getId(), name, file->getId(), name,
+                   H5P_DEFAULT, H5P_DEFAULT) >= 0;
 }
 
 /**
@@ -385,6 +523,47 @@ void H5FileHelper::loadAll(MCfloat *destBuffer) {
 #endif
 }
 
+/**
+ * @brief Loads the whole data in the current integer dataset into memory
+ * @param destBuffer the destination buffer
+ *
+ * \pre destBuffer must be valid and big enough to hold all the data.
+ */
+
+void H5FileHelper::loadAll(u_int64_t *destBuffer) {
+    dataSet->read(destBuffer, PredType::NATIVE_UINT64, H5S_ALL, H5S_ALL);
+}
+
+/**
+ * @brief Loads the first two columns of the current rank 2 dataset
+ * @param first
+ * @param second
+ * @return false if the dataset has a different rank or less than two columns
+ *
+ *
+ * Datasets written by Histogram::saveToFile() can be loaded this way, the
+ * first two columns being bin centers and counts.
+ */
+
+bool H5FileHelper::loadColumns(vector<MCfloat> *first, vector<MCfloat> *second)
+{
+    if(getRank() != 2 || extentDims()[1] < 2) {
+        logMessage("Dataset %s is not a table", dName);
+        return false;
+    }
+    size_t n = extentDims()[0];
+    size_t cols = extentDims()[1];
+    vector<MCfloat> data(n * cols);
+    loadAll(data.data());
+    first->resize(n);
+    second->resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        (*first)[i] = data[i * cols];
+        (*second)[i] = data[i * cols + 1];
+    }
+    return true;
+}
+
 /**
  * @brief Writes a hyperslab in the current dataset
  * @param start Offset of the start of hyperslab
@@ -475,7 +654,12 @@ void H5FileHelper::writeHyperSlab(const hsize_t *start, const hsize_t *count,
         extDims[i] = start[i] + count[i];
     }
 
-    dataSet->extend(extDims);
+    for (int i = 0; i < ndims; ++i) {
+        if(extDims[i] > dims[i]) {
+            dataSet->extend(extDims);
+            break;
+        }
+    }
 
     *dataSpace = dataSet->getSpace();
     dataSpace->getSimpleExtentDims(dims);
@@ -16,14 +16,71 @@
 */
 
 #include <MCPlusPlus/h5outputfile.h>
+#include <MCPlusPlus/mcengine.h>
+#include <MCPlusPlus/recordfile.h>
 
 #include <fstream>
 #include <string.h>
 
-#define MAX_RNGSTATE_STR_LEN 6900
 
 using namespace MCPP;
 
+RawOutputProfile::RawOutputProfile()
+{
+    chunkWalkers = 32768;
+    shuffle = false;
+    deflateLevel = 0;
+    fletcher32 = false;
+    storage = STORAGE_DOUBLE;
+    decimalDigits = 0;
+}
+
+/**
+ * @brief Lossless profile: doubles with shuffle and deflate filters
+ * @param deflateLevel
+ * @return
+ */
+
+RawOutputProfile RawOutputProfile::compressed(int deflateLevel)
+{
+    RawOutputProfile p;
+    p.shuffle = true;
+    p.deflateLevel = deflateLevel;
+    return p;
+}
+
+/**
+ * @brief Profile storing single precision floats, with shuffle and deflate
+ * filters
+ * @param deflateLevel
+ * @return
+ */
+
+RawOutputProfile RawOutputProfile::float32(int deflateLevel)
+{
+    RawOutputProfile p = compressed(deflateLevel);
+    p.storage = STORAGE_FLOAT32;
+    return p;
+}
+
+/**
+ * @brief Profile storing values rounded to the given number of decimal
+ * digits, packed by the scale-offset filter and then deflated
+ * @param decimalDigits
+ * @param deflateLevel
+ * @return
+ */
+
+RawOutputProfile RawOutputProfile::fixedPoint(int decimalDigits,
+                                              int deflateLevel)
+{
+    RawOutputProfile p;
+    p.deflateLevel = deflateLevel;
+    p.storage = STORAGE_FIXED_POINT;
+    p.decimalDigits = decimalDigits;
+    return p;
+}
+
 H5OutputFile::H5OutputFile()
     : H5FileHelper()
 {
@@ -230,6 +287,191 @@ bool H5OutputFile::loadData(MCData group, walkerType type, MCfloat *destBuffer,
     return loadFrom1Ddataset(ss.str().c_str(), destBuffer, start, count);
 }
 
+/**
+ * @brief The HDF5 compound type of the "records" datasets
+ * @return
+ *
+ *
+ * Fields: x, y, t, kx, ky, kz (#MCfloat) and nScatter (unsigned 64 bit
+ * integer), see WalkerRecord.
+ */
+
+CompType H5OutputFile::walkerRecordType()
+{
+    CompType type(sizeof(WalkerRecord));
+    type.insertMember("x", HOFFSET(WalkerRecord, x), MCH5FLOAT);
+    type.insertMember("y", HOFFSET(WalkerRecord, y), MCH5FLOAT);
+    type.insertMember("t", HOFFSET(WalkerRecord, t), MCH5FLOAT);
+    type.insertMember("kx", HOFFSET(WalkerRecord, kx), MCH5FLOAT);
+    type.insertMember("ky", HOFFSET(WalkerRecord, ky), MCH5FLOAT);
+    type.insertMember("kz", HOFFSET(WalkerRecord, kz), MCH5FLOAT);
+    type.insertMember("nScatter", HOFFSET(WalkerRecord, nScatter),
+                      PredType::NATIVE_UINT64);
+    return type;
+}
+
+/**
+ * @brief Creates the empty "records" datasets of the given walker types
+ * @param walkerRecordsSaveFlags See walkerFlags
+ * @return false on error
+ *
+ *
+ * Chunk size and filters are taken from the current RawOutputProfile, while
+ * its storage type is ignored: records are always stored losslessly.
+ * Existing datasets are left untouched.
+ */
+
+bool H5OutputFile::createWalkerRecordDatasets(uint walkerRecordsSaveFlags)
+{
+    if(!walkerRecordsSaveFlags)
+        return true;
+    closeDataSet();
+    newGroup("records");
+
+    for (uint type = 0; type < 4; ++type) {
+        if(!(walkerRecordsSaveFlags & walkerTypeToFlag(type)))
+            continue;
+        string name = string("records/") + walkerTypeToString(type);
+        if(dataSetExists(name.c_str()))
+            continue;
+        if(!newCompoundDataset(name.c_str(), walkerRecordType()))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Appends records to the "records" dataset of the given walker type
+ * @param type
+ * @param buffer
+ * @param size Number of records
+ *
+ *
+ * The dataset is created if it does not exist.
+ */
+
+void H5OutputFile::appendWalkerRecords(walkerType type,
+                                       const WalkerRecord *buffer,
+                                       const hsize_t size)
+{
+    if(!size)
+        return;
+    string name = string("records/") + walkerTypeToString(type);
+    if(!dataSetExists("records") || !dataSetExists(name.c_str())) {
+        if(!createWalkerRecordDatasets(walkerTypeToFlag(type)))
+            return;
+    }
+    appendToCompoundDataset(name.c_str(), buffer, size, walkerRecordType());
+}
+
+/**
+ * @brief Loads records from the "records" dataset of the given walker type
+ * @param type
+ * @param destBuffer
+ * @param start Index of the first record to be loaded
+ * @param count Number of records to be loaded. If NULL, all records are
+ * loaded.
+ * @return false if the dataset does not exist
+ */
+
+bool H5OutputFile::loadWalkerRecords(walkerType type, WalkerRecord *destBuffer,
+                                     const hsize_t *start,
+                                     const hsize_t *count)
+{
+    string name = string("records/") + walkerTypeToString(type);
+    if(!dataSetExists("records") || !dataSetExists(name.c_str()))
+        return false;
+    closeDataSet();
+
+    try {
+        DataSet dset = file->openDataSet(name);
+        DataSpace fspace = dset.getSpace();
+        hsize_t n[1];
+        fspace.getSimpleExtentDims(n);
+        if(count != NULL) {
+            fspace.selectHyperslab(H5S_SELECT_SET, count, start);
+            n[0] = *count;
+        }
+        DataSpace mspace(1, n);
+        dset.read(destBuffer, walkerRecordType(), mspace, fspace);
+        mspace.close();
+        fspace.close();
+        dset.close();
+    }
+    catch (const Exception &error) {
+        logMessage("Cannot read %s", name.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief The number of records saved for the given walker type
+ * @param type
+ * @return 0 if the dataset does not exist
+ */
+
+hsize_t H5OutputFile::nWalkerRecords(walkerType type) const
+{
+    string name = string("records/") + walkerTypeToString(type);
+    if(!dataSetExists("records") || !dataSetExists(name.c_str()))
+        return 0;
+    DataSet dset = file->openDataSet(name);
+    hsize_t n;
+    dset.getSpace().getSimpleExtentDims(&n);
+    dset.close();
+    return n;
+}
+
+/**
+ * @brief Appends the content of a RecordFile to the raw output datasets
+ * @param fileName
+ * @param saveRecords If true, the records are also appended to the "records"
+ * datasets
+ * @return false if the record file cannot be read
+ *
+ *
+ * Exit points, walk times and all three components of the exit k vectors are
+ * appended to the respective datasets, which are created if needed.
+ */
+
+bool H5OutputFile::importRecordFile(const char *fileName, bool saveRecords)
+{
+    RecordFile recordFile;
+    if(!recordFile.open(fileName))
+        return false;
+
+    if(!dataSetExists("walk-times"))
+        createDatasets(FLAG_ALL_WALKERS, FLAG_ALL_WALKERS, FLAG_ALL_WALKERS);
+
+    vector<MCfloat> points, times, kVectors;
+    for (u_int64_t i = 0; i < recordFile.nChunks(); ++i) {
+        walkerType type = recordFile.chunkType(i);
+        u_int64_t n = recordFile.chunkSize(i);
+        const WalkerRecord *records = recordFile.chunkData(i);
+
+        points.resize(2 * n);
+        times.resize(n);
+        kVectors.resize(3 * n);
+        for (u_int64_t j = 0; j < n; ++j) {
+            const WalkerRecord *r = &records[j];
+            points[2 * j] = r->x;
+            points[2 * j + 1] = r->y;
+            times[j] = r->t;
+            kVectors[3 * j] = r->kx;
+            kVectors[3 * j + 1] = r->ky;
+            kVectors[3 * j + 2] = r->kz;
+        }
+        appendExitPoints(type, points.data(), points.size());
+        appendWalkTimes(type, times.data(), times.size());
+        appendExitKVectors(type, kVectors.data(), kVectors.size());
+        if(saveRecords)
+            appendWalkerRecords(type, records, n);
+    }
+    closeDataSet();
+    return true;
+}
+
 void H5OutputFile::appendTo1Ddataset(const char *datasetName, const MCfloat *buffer,
                                      const hsize_t size) {
     if(!size)
@@ -272,7 +514,17 @@ void H5OutputFile::writeVLenString(const char *datasetName, const string str)
     dset.close();
 }
 
-void H5OutputFile::saveRNGState(uint seed, const string str) {
+/**
+ * @brief Saves the RNG state of the given seed
+ * @param seed
+ * @param state A state returned by BaseRandom::binaryGeneratorState()
+ *
+ *
+ * States are stored in binary form. Files written by older versions, with
+ * the states as text, keep their format.
+ */
+
+void H5OutputFile::saveRNGState(uint seed, const vector<u_int64_t> &state) {
     openDataSet("RNGStates");
     if(seed > dims[0] - 1) {
         hsize_t extDims[ndims];
@@ -296,7 +548,23 @@ void H5OutputFile::saveRNGState(uint seed, const string str) {
     DataSpace memspace(ndims, mdims);
     memspace.selectHyperslab(H5S_SELECT_SET, mdims, _offset);
     dataSpace->selectHyperslab(H5S_SELECT_SET, mdims, offset);
-    dataSet->write(str.c_str(), dtype, memspace, *dataSpace);
+    if(dtype.getClass() == H5T_VLEN) {
+        hvl_t vl;
+        vl.len = state.size();
+        vl.p = (void *)state.data();
+        VarLenType memType(PredType::NATIVE_UINT64);
+        dataSet->write(&vl, memType, memspace, *dataSpace);
+    }
+    else {
+        MCEngine engine(0);
+        engine.setState(state);
+        stringstream ss;
+        ss << engine;
+        string str = ss.str();
+        vector<char> buf(dtype.getSize(), 0);
+        str.copy(buf.data(), buf.size() - 1);
+        dataSet->write(buf.data(), dtype, memspace, *dataSpace);
+    }
     memspace.close();
 
     closeDataSet();
@@ -341,36 +609,66 @@ bool H5OutputFile::openFile_impl()
     return true;
 }
 
-string H5OutputFile::readRNGState(const uint seed) const
+/**
+ * @brief The RNG state saved for the given seed
+ * @param seed
+ * @return An empty state if none was saved
+ *
+ *
+ * The state can be restored with BaseRandom::setBinaryGeneratorState().
+ */
+
+vector<u_int64_t> H5OutputFile::readBinaryRNGState(const uint seed) const
 {
+    vector<u_int64_t> state;
     DataSet dset = file->openDataSet("RNGStates");
     DataType dtype = dset.getDataType();
-
     DataSpace dspace = dset.getSpace();
 
-    int ndims = dspace.getSimpleExtentNdims();
+    hsize_t n, offset[1] = {seed}, mdims[1] = {1};
+    dspace.getSimpleExtentDims(&n);
+    if(seed >= n)
+        return state;
 
-    hsize_t offset[ndims], mdims[ndims];
-    offset[0] = seed;
-    mdims[0] = 1;
-
-    hsize_t _offset[ndims];
-    for (int i = 0; i < ndims; ++i)
-        _offset[i] = 0;
-
-    char buf[MAX_RNGSTATE_STR_LEN];
-
-    DataSpace memspace( ndims, mdims );
-    memspace.selectHyperslab(H5S_SELECT_SET, mdims, _offset);
+    DataSpace memspace(1, mdims);
     dspace.selectHyperslab(H5S_SELECT_SET, mdims, offset);
-    dset.read(buf, dtype, memspace, dspace);
+    if(dtype.getClass() == H5T_VLEN) {
+        hvl_t vl;
+        VarLenType memType(PredType::NATIVE_UINT64);
+        dset.read(&vl, memType, memspace, dspace);
+        const u_int64_t *words = (const u_int64_t *)vl.p;
+        state.assign(words, words + vl.len);
+        H5Dvlen_reclaim(memType.getId(), memspace.getId(), H5P_DEFAULT, &vl);
+    }
+    else {
+        // text states of older versions
+        vector<char> buf(dtype.getSize() + 1, 0);
+        dset.read(buf.data(), dtype, memspace, dspace);
+        MCEngine engine(0);
+        stringstream ss(buf.data());
+        ss >> engine;
+        if(!ss.fail())
+            state = engine.state();
+    }
+    return state;
+}
 
-    dspace.close();
-    dtype.close();
-    dset.close();
+/**
+ * @brief The RNG state saved for the given seed, in text form
+ * @param seed
+ * @return An empty string if no state was saved
+ *
+ *
+ * The state can be restored with BaseRandom::setGeneratorState().
+ */
 
+string H5OutputFile::readRNGState(const uint seed) const
+{
+    MCEngine engine(0);
+    if(!engine.setState(readBinaryRNGState(seed)))
+        return string();
     stringstream ss;
-    ss << buf;
+    ss << engine;
     return ss.str();
 }
 
@@ -399,6 +697,19 @@ void H5OutputFile::appendPhotonCounts(const u_int64_t *counters)
     dset.close();
 }
 
+/**
+ * @brief Overwrites the photon counters saved in the file
+ * @param counters Array of 4 elements, one per walkerType
+ */
+
+void H5OutputFile::savePhotonCounts(const u_int64_t *counters)
+{
+    memcpy(_photonCounters, counters, 4 * sizeof(u_int64_t));
+    DataSet dset = file->openDataSet("photon-counters");
+    dset.write(_photonCounters,dset.getDataType());
+    dset.close();
+}
+
 u_int64_t H5OutputFile::transmitted() const
 {
     return _photonCounters[TRANSMITTED];
@@ -473,82 +784,240 @@ void H5OutputFile::saveSample(const Sample *sample)
 
 }
 
+/**
+ * @brief Exposes the raw output saved in several shard files through virtual
+ * datasets
+ * @param shardFiles Paths of the shard files, in the order their data are
+ * concatenated
+ * @return false if any of the shard files cannot be opened
+ *
+ *
+ * For each raw output dataset found in at least one shard file, a virtual
+ * dataset with the same path is created in this file, mapping the datasets of
+ * all shard files one after the other. Only the base name of the shard files
+ * is stored, so they are looked up in the directory of this file. Existing
+ * virtual or empty datasets are replaced, while datasets already containing
+ * data are left untouched.
+ */
+
+bool H5OutputFile::linkShards(const vector<string> &shardFiles)
+{
+    const char *groups[4] = {"exit-points", "walk-times", "exit-k-vectors",
+                             "records"};
+    size_t nShards = shardFiles.size();
+    closeDataSet();
+
+    for (int g = 0; g < 4; ++g) {
+        for (uint type = 0; type < 4; ++type) {
+            string path = string(groups[g]) + "/" + walkerTypeToString(type);
+
+            hsize_t sizes[nShards];
+            hsize_t total = 0;
+            DataType dtype;
+            for (size_t i = 0; i < nShards; ++i) {
+                sizes[i] = 0;
+                try {
+                    H5File shard(shardFiles[i], H5F_ACC_RDONLY);
+                    if(H5Lexists(shard.getId(), groups[g], H5P_DEFAULT) > 0
+                            && H5Lexists(shard.getId(), path.c_str(),
+                                         H5P_DEFAULT) > 0) {
+                        DataSet dset = shard.openDataSet(path);
+                        dset.getSpace().getSimpleExtentDims(&sizes[i]);
+                        if(sizes[i] > 0 && total == 0)
+                            dtype = dset.getDataType();
+                        dset.close();
+                    }
+                    shard.close();
+                }
+                catch (const Exception &error) {
+                    logMessage("Cannot open shard %s", shardFiles[i].c_str());
+                    return false;
+                }
+                total += sizes[i];
+            }
+            if(total == 0)
+                continue;
+
+            if(dataSetExists(path.c_str())) {
+                DataSet dset = file->openDataSet(path);
+                DSetCreatPropList plist = dset.getCreatePlist();
+                hsize_t size;
+                dset.getSpace().getSimpleExtentDims(&size);
+                bool isVirtual = plist.getLayout() == H5D_VIRTUAL;
+                plist.close();
+                dset.close();
+                if(!isVirtual && size > 0) {
+                    logMessage("%s already contains data, shards not linked",
+                               path.c_str());
+                    continue;
+                }
+                unlink(path.c_str());
+            }
+            newGroup(groups[g]);
+
+            DataSpace vspace(1, &total);
+            DSetCreatPropList plist;
+            hsize_t offset = 0;
+            for (size_t i = 0; i < nShards; ++i) {
+                if(sizes[i] == 0)
+                    continue;
+                string shardName = shardFiles[i];
+                size_t slash = shardName.rfind('/');
+                if(slash != string::npos)
+                    shardName = shardName.substr(slash + 1);
+
+                DataSpace sspace(1, &sizes[i]);
+                vspace.selectHyperslab(H5S_SELECT_SET, &sizes[i], &offset);
+                H5Pset_virtual(plist.getId(), vspace.getId(),
+                               shardName.c_str(), path.c_str(),
+                               sspace.getId());
+                sspace.close();
+                offset += sizes[i];
+            }
+            vspace.selectAll();
+            DataSet dset = file->createDataSet(path, dtype, vspace, plist);
+            dset.close();
+            plist.close();
+            vspace.close();
+        }
+    }
+    return true;
+}
+
 bool H5OutputFile::createDatasets(uint walkTimesSaveFlags,
                                   uint exitPointsSaveFlags,
                                   uint exitKVectorsSaveFlags)
 {
-#define NWALKER_CHUNK sizeof(MCfloat) * 8192
-    int ndims = 1;
-    hsize_t dims[ndims], chunkDims[ndims];
     bool ret = false;
 
     createRNGDataset();
 
     if(exitPointsSaveFlags) {
         newGroup("exit-points");
-
-        dims[0] = 0; chunkDims[0] = 2 * NWALKER_CHUNK;
         if(exitPointsSaveFlags & FLAG_TRANSMITTED)
-            ret = newDataset("exit-points/transmitted", ndims, dims, chunkDims,
-                             MCH5FLOAT);
+            ret = newRawDataset("exit-points/transmitted", 2);
         if(exitPointsSaveFlags & FLAG_BALLISTIC)
-            ret = newDataset("exit-points/ballistic", ndims, dims, chunkDims,
-                             MCH5FLOAT);
+            ret = newRawDataset("exit-points/ballistic", 2);
         if(exitPointsSaveFlags & FLAG_REFLECTED)
-            ret = newDataset("exit-points/reflected", ndims, dims, chunkDims,
-                             MCH5FLOAT);
+            ret = newRawDataset("exit-points/reflected", 2);
         if(exitPointsSaveFlags & FLAG_BACKREFLECTED)
-            ret = newDataset("exit-points/back-reflected", ndims, dims,
-                             chunkDims, MCH5FLOAT);
+            ret = newRawDataset("exit-points/back-reflected", 2);
     }
 
     if(walkTimesSaveFlags) {
-        dims[0] = 0; chunkDims[0] = NWALKER_CHUNK;
         newGroup("walk-times");
         if(walkTimesSaveFlags & FLAG_TRANSMITTED)
-            ret = newDataset("walk-times/transmitted",ndims, dims, chunkDims,
-                             MCH5FLOAT);
+            ret = newRawDataset("walk-times/transmitted", 1);
         if(walkTimesSaveFlags & FLAG_BALLISTIC)
-            ret = newDataset("walk-times/ballistic", ndims, dims, chunkDims,
-                             MCH5FLOAT);
+            ret = newRawDataset("walk-times/ballistic", 1);
         if(walkTimesSaveFlags & FLAG_REFLECTED)
-            ret = newDataset("walk-times/reflected", ndims, dims, chunkDims,
-                             MCH5FLOAT);
+            ret = newRawDataset("walk-times/reflected", 1);
         if(walkTimesSaveFlags & FLAG_BACKREFLECTED)
-            ret = newDataset("walk-times/back-reflected", ndims, dims, chunkDims,
-                             MCH5FLOAT);
+            ret = newRawDataset("walk-times/back-reflected", 1);
     }
 
     if(exitKVectorsSaveFlags) {
-        dims[0] = 0; chunkDims[0] = 3 * NWALKER_CHUNK / 2;
         newGroup("exit-k-vectors");
         if(exitKVectorsSaveFlags & FLAG_TRANSMITTED)
-            ret = newDataset("exit-k-vectors/transmitted", ndims, dims,
-                             chunkDims, MCH5FLOAT);
+            ret = newRawDataset("exit-k-vectors/transmitted", 3);
         if(exitKVectorsSaveFlags & FLAG_BALLISTIC)
-            ret = newDataset("exit-k-vectors/ballistic", ndims, dims, chunkDims,
-                             MCH5FLOAT);
+            ret = newRawDataset("exit-k-vectors/ballistic", 3);
         if(exitKVectorsSaveFlags & FLAG_REFLECTED)
-            ret = newDataset("exit-k-vectors/reflected", ndims, dims, chunkDims,
-                             MCH5FLOAT);
+            ret = newRawDataset("exit-k-vectors/reflected", 3);
         if(exitKVectorsSaveFlags & FLAG_BACKREFLECTED)
-            ret = newDataset("exit-k-vectors/back-reflected", ndims, dims,
-                             chunkDims, MCH5FLOAT);
+            ret = newRawDataset("exit-k-vectors/back-reflected", 3);
     }
 
     return ret;
 }
 
+/**
+ * @brief Creates an empty, extensible raw output dataset according to the
+ * current RawOutputProfile
+ * @param datasetName
+ * @param valuesPerWalker Number of values saved for each walker, used to size
+ * the chunks (the exit k vectors may actually have less components)
+ * @param lossless If true, the storage type of the profile is ignored and the
+ * values are stored as MCfloat without the scale-offset filter
+ * @return false on error
+ */
+
+bool H5OutputFile::newRawDataset(const char *datasetName,
+                                 hsize_t valuesPerWalker, bool lossless)
+{
+    closeDataSet();
+
+    hsize_t dims[1] = {0};
+    hsize_t maxdims[1] = {H5S_UNLIMITED};
+    hsize_t chunkDims[1] = {profile.chunkWalkers * valuesPerWalker};
+    if(chunkDims[0] == 0)
+        chunkDims[0] = 1;
+
+    rawStorage storage = lossless ? STORAGE_DOUBLE : profile.storage;
+    PredType type = MCH5FLOAT;
+    if(storage == STORAGE_FLOAT32)
+        type = PredType::NATIVE_FLOAT;
+
+    try {
+        DSetCreatPropList plist;
+        double fillvalue = 0.;
+        plist.setFillValue(PredType::NATIVE_DOUBLE, &fillvalue);
+        plist.setChunk(1, chunkDims);
+
+        if(storage == STORAGE_FIXED_POINT) {
+            if(H5Zfilter_avail(H5Z_FILTER_SCALEOFFSET) > 0)
+                H5Pset_scaleoffset(plist.getId(), H5Z_SO_FLOAT_DSCALE,
+                                   profile.decimalDigits);
+            else
+                logMessage("Scale-offset filter not available, %s is stored "
+                           "losslessly", datasetName);
+        }
+        else if(profile.shuffle && H5Zfilter_avail(H5Z_FILTER_SHUFFLE) > 0)
+            plist.setShuffle();
+        if(profile.deflateLevel > 0 && H5Zfilter_avail(H5Z_FILTER_DEFLATE) > 0)
+            plist.setDeflate(profile.deflateLevel);
+        if(profile.fletcher32 && H5Zfilter_avail(H5Z_FILTER_FLETCHER32) > 0)
+            plist.setFletcher32();
+
+        DataSpace dspace(1, dims, maxdims);
+        DataSet dset = file->createDataSet(datasetName, type, dspace, plist);
+        dset.close();
+        dspace.close();
+        plist.close();
+    }
+    catch (const Exception &error) {
+        logMessage("Cannot create dataset %s.\n", datasetName);
+        return false;
+    }
+    return openDataSet(datasetName);
+}
+
+/**
+ * @brief Sets how raw output datasets are created by newFile()
+ * @param profile
+ *
+ *
+ * Existing datasets are not affected.
+ */
+
+void H5OutputFile::setRawOutputProfile(const RawOutputProfile &profile)
+{
+    this->profile = profile;
+}
+
+const RawOutputProfile *H5OutputFile::rawOutputProfile() const
+{
+    return &profile;
+}
+
 bool H5OutputFile::createRNGDataset()
 {
     int ndims = 1;
     hsize_t dims[ndims], maxdims[ndims], chkdims[ndims];
     dims[0] = 1;
     maxdims[0] = H5S_UNLIMITED;
-    chkdims[0] = 1000;
-    StrType dtype(H5T_C_S1, MAX_RNGSTATE_STR_LEN);
-    size_t size = MAX_RNGSTATE_STR_LEN;
-    dtype.setSize(size);
+    chkdims[0] = 64;
+    VarLenType dtype(PredType::NATIVE_UINT64);
     DataSpace dspace(1, dims, maxdims);
     stringstream ss;
     ss << "RNGStates";
@@ -558,7 +1027,6 @@ bool H5OutputFile::createRNGDataset()
 #endif
         DSetCreatPropList cparms;
         cparms.setChunk(ndims, chkdims);
-        cparms.setDeflate(9);
         file->createDataSet(ss.str(), dtype, dspace, cparms);
     }
     dtype.close();
@@ -566,3 +1034,205 @@ bool H5OutputFile::createRNGDataset()
 
     return true;
 }
+
+/**
+ * @brief Creates an empty, extendible 1D dataset of the given compound type
+ * @param datasetName
+ * @param type
+ * @return false on error
+ *
+ *
+ * Chunk size and filters are taken from the current RawOutputProfile, while
+ * its storage type is ignored: compound datasets are always stored
+ * losslessly.
+ */
+
+bool H5OutputFile::newCompoundDataset(const char *datasetName,
+                                      const CompType &type)
+{
+    closeDataSet();
+
+    hsize_t dims[1] = {0};
+    hsize_t maxdims[1] = {H5S_UNLIMITED};
+    hsize_t chunkDims[1] = {profile.chunkWalkers};
+    if(chunkDims[0] == 0)
+        chunkDims[0] = 1;
+    try {
+        DSetCreatPropList plist;
+        plist.setChunk(1, chunkDims);
+        if(profile.shuffle && H5Zfilter_avail(H5Z_FILTER_SHUFFLE) > 0)
+            plist.setShuffle();
+        if(profile.deflateLevel > 0 && H5Zfilter_avail(H5Z_FILTER_DEFLATE) > 0)
+            plist.setDeflate(profile.deflateLevel);
+        if(profile.fletcher32 && H5Zfilter_avail(H5Z_FILTER_FLETCHER32) > 0)
+            plist.setFletcher32();
+
+        DataSpace dspace(1, dims, maxdims);
+        DataSet dset = file->createDataSet(datasetName, type, dspace, plist);
+        dset.close();
+        dspace.close();
+        plist.close();
+    }
+    catch (const Exception &error) {
+        logMessage("Cannot create dataset %s.\n", datasetName);
+        return false;
+    }
+    return true;
+}
+
+void H5OutputFile::appendToCompoundDataset(const char *datasetName,
+                                           const void *buffer,
+                                           const hsize_t size,
+                                           const CompType &type)
+{
+    closeDataSet();
+
+    try {
+        DataSet dset = file->openDataSet(datasetName);
+        hsize_t offset[1];
+        dset.getSpace().getSimpleExtentDims(offset);
+        hsize_t newSize[1] = {offset[0] + size};
+        dset.extend(newSize);
+
+        DataSpace fspace = dset.getSpace();
+        fspace.selectHyperslab(H5S_SELECT_SET, &size, offset);
+        DataSpace mspace(1, &size);
+        dset.write(buffer, type, mspace, fspace);
+        mspace.close();
+        fspace.close();
+        dset.close();
+    }
+    catch (const Exception &error) {
+        logMessage("Cannot append to %s", datasetName);
+    }
+}
+
+/**
+ * @brief The HDF5 compound type matching TrajectoryInfo
+ * @return
+ */
+
+CompType H5OutputFile::trajectoryInfoType()
+{
+    CompType type(sizeof(TrajectoryInfo));
+    type.insertMember("offset", HOFFSET(TrajectoryInfo, offset),
+                      PredType::NATIVE_UINT64);
+    type.insertMember("nPoints", HOFFSET(TrajectoryInfo, nPoints),
+                      PredType::NATIVE_UINT64);
+    type.insertMember("walker", HOFFSET(TrajectoryInfo, walker),
+                      PredType::NATIVE_UINT64);
+    type.insertMember("thread", HOFFSET(TrajectoryInfo, thread),
+                      PredType::NATIVE_UINT32);
+    type.insertMember("type", HOFFSET(TrajectoryInfo, type),
+                      PredType::NATIVE_INT32);
+    return type;
+}
+
+/**
+ * @brief Creates the empty "trajectories" datasets
+ * @return false on error
+ *
+ *
+ * The "trajectories/points" dataset holds the coordinates (x, y, z) of the
+ * points of all the trajectories, the "trajectories/index" dataset one
+ * TrajectoryInfo per trajectory, whose offset is the index of its first point.
+ * Points are always stored losslessly, whatever the RawOutputProfile. Existing
+ * datasets are left untouched.
+ */
+
+bool H5OutputFile::createTrajectoryDatasets()
+{
+    closeDataSet();
+    newGroup("trajectories");
+    if(!dataSetExists("trajectories/points")
+            && !newRawDataset("trajectories/points", 3, true))
+        return false;
+    if(!dataSetExists("trajectories/index")
+            && !newCompoundDataset("trajectories/index", trajectoryInfoType()))
+        return false;
+    return true;
+}
+
+/**
+ * @brief Appends trajectories to the "trajectories" datasets
+ * @param points Three coordinates per point
+ * @param info Trajectories, whose offsets refer to points
+ * @param nTrajectories
+ *
+ *
+ * Offsets are shifted to refer to the "trajectories/points" dataset. The
+ * datasets are created if they do not exist.
+ */
+
+void H5OutputFile::appendTrajectories(const MCfloat *points,
+                                      const TrajectoryInfo *info,
+                                      const hsize_t nTrajectories)
+{
+    if(!nTrajectories)
+        return;
+    if(!createTrajectoryDatasets())
+        return;
+
+    openDataSet("trajectories/points");
+    hsize_t base = *extentDims() / 3;
+    const TrajectoryInfo *last = &info[nTrajectories - 1];
+    hsize_t nPoints = last->offset + last->nPoints;
+    appendTo1Ddataset("trajectories/points", points, 3 * nPoints);
+
+    vector<TrajectoryInfo> shifted(info, info + nTrajectories);
+    for (size_t i = 0; i < shifted.size(); ++i) {
+        shifted[i].offset += base;
+    }
+    appendToCompoundDataset("trajectories/index", shifted.data(),
+                            nTrajectories, trajectoryInfoType());
+}
+
+/**
+ * @brief The number of trajectories saved in the file
+ * @return
+ */
+
+hsize_t H5OutputFile::nTrajectories() const
+{
+    if(!dataSetExists("trajectories/index"))
+        return 0;
+    DataSet dset = file->openDataSet("trajectories/index");
+    hsize_t size;
+    dset.getSpace().getSimpleExtentDims(&size);
+    dset.close();
+    return size;
+}
+
+/**
+ * @brief Loads a trajectory saved with appendTrajectories()
+ * @param index From 0 to nTrajectories() - 1
+ * @param points Resized to three coordinates per point
+ * @param info If not NULL, the description of the trajectory
+ * @return false if there is no such trajectory
+ */
+
+bool H5OutputFile::loadTrajectory(hsize_t index, vector<MCfloat> *points,
+                                  TrajectoryInfo *info)
+{
+    if(index >= nTrajectories())
+        return false;
+    closeDataSet();
+
+    TrajectoryInfo ti;
+    DataSet dset = file->openDataSet("trajectories/index");
+    DataSpace fspace = dset.getSpace();
+    hsize_t count = 1;
+    fspace.selectHyperslab(H5S_SELECT_SET, &count, &index);
+    DataSpace mspace(1, &count);
+    dset.read(&ti, trajectoryInfoType(), mspace, fspace);
+    dset.close();
+
+    points->resize(3 * ti.nPoints);
+    hsize_t start = 3 * ti.offset;
+    hsize_t n = 3 * ti.nPoints;
+    if(!loadFrom1Ddataset("trajectories/points", points->data(), &start, &n))
+        return false;
+    if(info != NULL)
+        *info = ti;
+    return true;
+}
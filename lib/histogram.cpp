@@ -22,6 +22,7 @@
 
 #include <boost/math/constants/constants.hpp>
 #include <sstream>
+#include <limits>
 
 
 using namespace boost::math::constants;
@@ -41,6 +42,11 @@ Histogram::Histogram(BaseObject *parent) :
     binSize[1] = 0;
     histo = NULL;
     moments = NULL;
+    moments2 = NULL;
+    replicates = NULL;
+    replicates2 = NULL;
+    generation = 0;
+    nReplicates = 0;
     totExponents = 0;
     computeSpatialMoments = false;
     photonTypeFlags = -1;
@@ -56,6 +62,11 @@ Histogram::~Histogram()
     if(moments != NULL) {
         free(moments);
     }
+    if(moments2 != NULL) {
+        free(moments2);
+    }
+    free(replicates);
+    free(replicates2);
 }
 
 void Histogram::setDataDomain(const MCData type1, const MCData type2)
@@ -150,12 +161,24 @@ bool Histogram::initialize()
     else
         nBins[1] = 1;
     totBins = nBins[0]*nBins[1];
+    free(histo);
+    free(moments);
+    free(moments2);
+    free(replicates);
+    free(replicates2);
+    replicates = NULL;
+    replicates2 = NULL;
+    nReplicates = 0;
+    generation++;
     histo = (u_int64_t *)calloc(totBins, sizeof(u_int64_t));
     if(computeSpatialMoments) {
         moments = (MCfloat *)calloc(totExponents * totBins, sizeof(MCfloat));
+        moments2 = (MCfloat *)calloc(totExponents * totBins, sizeof(MCfloat));
     }
-    else
+    else {
         moments = NULL;
+        moments2 = NULL;
+    }
 
     firstBinEdge[0] = min[0];
     firstBinEdge[1] = min[1];
@@ -194,6 +217,10 @@ void Histogram::run(const Walker * const buf, size_t bufSize)
             index[0] = (w->walkTime - firstBinEdge[0]) / binSize[0];
             break;
 
+        case DATA_WAVELENGTH:
+            index[0] = (w->wavelength - firstBinEdge[0]) / binSize[0];
+            break;
+
         case DATA_NONE:
         default:
             return;
@@ -219,6 +246,10 @@ void Histogram::run(const Walker * const buf, size_t bufSize)
                 index[1] = (w->walkTime - firstBinEdge[1]) / binSize[1];
                 break;
 
+            case DATA_WAVELENGTH:
+                index[1] = (w->wavelength - firstBinEdge[1]) / binSize[1];
+                break;
+
             case DATA_NONE:
             default:
                 return;
@@ -232,7 +263,9 @@ void Histogram::run(const Walker * const buf, size_t bufSize)
         if(computeSpatialMoments) {
             MCfloat module = sqrt(pow(w->r0[0], 2) + pow(w->r0[1], 2));
             for (size_t i = 0; i < totExponents; ++i) {
-                moments[totBins * i + idx] += pow(module, momentExponents[i]);
+                MCfloat m = pow(module, momentExponents[i]);
+                moments[totBins * i + idx] += m;
+                moments2[totBins * i + idx] += m * m;
             }
         }
     }
@@ -248,19 +281,105 @@ bool Histogram::pickPhoton(const Walker * const w) const
 
 void Histogram::appendCounts(const Histogram *rhs)
 {
+    if(rhs->histo == NULL) //not initialized yet
+        return;
     for (size_t i = 0; i < totBins; ++i) {
         histo[i] += rhs->histo[i];
     }
+    // the replicates of rhs are replicates of the merged histogram, too
+    if(rhs->nReplicates > 0) {
+        allocateReplicates();
+        for (size_t i = 0; i < totBins; ++i) {
+            replicates[i] += rhs->replicates[i];
+            replicates2[i] += rhs->replicates2[i];
+        }
+        nReplicates += rhs->nReplicates;
+    }
     if(moments != NULL && rhs->moments!= NULL) {
         for (size_t i = 0; i < totExponents; ++i) {
                 for (size_t idx = 0; idx < totBins; ++idx) {
                     moments[totBins * i + idx]
                             += rhs->moments[totBins * i + idx];
+                    moments2[totBins * i + idx]
+                            += rhs->moments2[totBins * i + idx];
             }
         }
     }
 }
 
+/**
+ * @brief Adds the counts of an independent estimate of the histogram
+ * @param rhs
+ * @param nPhotons The number of photons simulated for rhs
+ *
+ *
+ * The counts are added as with appendCounts(); moreover, the fraction of
+ * photons in each bin is accumulated, so that the standard error saved by
+ * saveToFile() is computed from the spread of the replicates instead of the
+ * binomial variance. This is needed when the photons of a replicate are not
+ * independent, e.g. with a quasi-random source (see
+ * Source::setQuasiRandomSequence()).
+ */
+
+void Histogram::appendReplicate(const Histogram *rhs, u_int64_t nPhotons)
+{
+    appendCounts(rhs);
+    if(rhs->histo == NULL || histo == NULL || nPhotons == 0)
+        return;
+    allocateReplicates();
+    for (size_t i = 0; i < totBins; ++i) {
+        MCfloat f = 1. * rhs->histo[i] / nPhotons;
+        replicates[i] += f;
+        replicates2[i] += f * f;
+    }
+    nReplicates++;
+}
+
+/**
+ * @brief Makes the current counts the only replicate of the histogram
+ * @param nPhotons The number of photons simulated so far
+ *
+ *
+ * Used when a single estimate was computed from non-independent photons: the
+ * standard error saved by saveToFile() is then undefined (NaN), and merging
+ * with further replicates (see appendCounts()) gives the error from their
+ * spread.
+ */
+
+void Histogram::markAsReplicate(u_int64_t nPhotons)
+{
+    if(histo == NULL || nPhotons == 0)
+        return;
+    allocateReplicates();
+    for (size_t i = 0; i < totBins; ++i) {
+        MCfloat f = 1. * histo[i] / nPhotons;
+        replicates[i] = f;
+        replicates2[i] = f * f;
+    }
+    nReplicates = 1;
+}
+
+/**
+ * @brief The number of independent estimates merged in the histogram
+ * @return 0 if the error is computed from the binomial variance
+ *
+ *
+ * \see appendReplicate()
+ */
+
+u_int64_t Histogram::replicateCount() const
+{
+    return nReplicates;
+}
+
+void Histogram::allocateReplicates()
+{
+    if(replicates != NULL)
+        return;
+    replicates = (MCfloat *)calloc(totBins, sizeof(MCfloat));
+    replicates2 = (MCfloat *)calloc(totBins, sizeof(MCfloat));
+}
+
 void Histogram::dump() const
 {
     u_int64_t total = 0;
@@ -275,20 +394,410 @@ void Histogram::dump() const
     cout << "total: " << total << endl;
 }
 
+/**
+ * @brief Saves the histogram in the given H5 file
+ * @param fileName
+ *
+ *
+ * The normalized histogram is written in a dataset named after the histogram
+ * (see setName()). The first column contains the bin centers of the first
+ * axis, the following ones the counts divided by the total number of photons
+ * (see setScale()) and by the bin volume; in the case of 1D histograms in the
+ * time domain, the time-resolved spatial moments follow.
+ *
+ * The standard error of each column is written in a second dataset named
+ * <tt>\<name\>-stderr</tt> with the same layout. Since each photon
+ * contributes to a single bin, the standard error of the normalized counts
+ * follows from the binomial variance \f$ c (1 - c / N) \f$ of the bin counts
+ * \f$ c \f$ over \f$ N \f$ photons, while the standard error of the spatial
+ * moments is computed from the per-bin sums of squares accumulated during
+ * run(). Bins with less than two photons have an undefined moment error and
+ * are set to NaN.
+ *
+ * If the histogram was built from replicates (see appendReplicate()), the
+ * standard error of the normalized counts is instead the one of the mean over
+ * the replicates, and NaN if there are less than two of them.
+ */
+
 void Histogram::saveToFile(const char *fileName) const
 {
-    string _dsName = histName;
-    if(_dsName == "")
-        _dsName = "histogram";
+    boost::lock_guard<boost::recursive_mutex> h5Lock(h5Mutex);
     H5FileHelper *file = new H5FileHelper(0);
     if(access(fileName, F_OK)<0)
         file->newFile(fileName);
     else
         file->openFile(fileName);
+
+    saveToFile(file);
+
+    file->close();
+    delete file;
+}
+
+/**
+ * @brief Saves the histogram in an already open H5 file
+ * @param file
+ * @param datasetName The full path of the dataset to be written. If NULL, the
+ * histogram name is used.
+ *
+ *
+ * \see saveToFile(const char *fileName)
+ */
+
+void Histogram::saveToFile(H5FileHelper *file, const char *datasetName) const
+{
+    string _dsName = histName;
+    if(datasetName != NULL)
+        _dsName = datasetName;
+    if(_dsName == "")
+        _dsName = "histogram";
+
+    writeDataset(file, _dsName, false);
+    writeDataset(file, _dsName + "-stderr", true);
+}
+
+/**
+ * @brief Saves the raw (unnormalized) content of the histogram
+ * @param file
+ * @param groupName Full path of the group where the data are written
+ *
+ *
+ * The bin counts are written in the <tt>counts</tt> dataset, the sums of the
+ * spatial moments and of their squares, if any, in <tt>moments</tt> and
+ * <tt>moments2</tt>, the sums of the replicates and of their squares, if any
+ * (see appendReplicate()), in <tt>replicates</tt> and <tt>replicates2</tt>
+ * along with their number in <tt>n-replicates</tt>, and the configuration of
+ * the histogram in <tt>layout</tt> (see loadLayout()). Existing datasets are overwritten.
+ * Unlike saveToFile(), no information is lost, so that the histogram can be
+ * restored with loadRawCounts() and further photons can be added to it.
+ *
+ * \pre The histogram must be initialized
+ */
+
+void Histogram::saveRawCounts(H5FileHelper *file, const char *groupName) const
+{
+    string group = groupName;
+    file->newGroup(groupName);
+
+    hsize_t start[1] = {0};
+    hsize_t dims[1] = {totBins};
+    string dsName = group + "/counts";
+    if(!file->dataSetExists(dsName.c_str()))
+        file->newDataset(dsName.c_str(), 1, dims, PredType::NATIVE_UINT64);
+    file->openDataSet(dsName.c_str());
+    file->writeHyperSlab(start, dims, histo);
+
+    vector<MCfloat> l = layout();
+    dims[0] = l.size();
+    dsName = group + "/layout";
+    file->unlink(dsName.c_str());
+    file->newDataset(dsName.c_str(), 1, dims);
+    file->writeHyperSlab(start, dims, l.data());
+
+    if(nReplicates > 0) {
+        dims[0] = totBins;
+        const char *names[2] = {"/replicates", "/replicates2"};
+        const MCfloat *src[2] = {replicates, replicates2};
+        for (int i = 0; i < 2; ++i) {
+            dsName = group + names[i];
+            if(!file->dataSetExists(dsName.c_str()))
+                file->newDataset(dsName.c_str(), 1, dims);
+            file->openDataSet(dsName.c_str());
+            file->writeHyperSlab(start, dims, src[i]);
+        }
+        dims[0] = 1;
+        dsName = group + "/n-replicates";
+        if(!file->dataSetExists(dsName.c_str()))
+            file->newDataset(dsName.c_str(), 1, dims,
+                             PredType::NATIVE_UINT64);
+        file->openDataSet(dsName.c_str());
+        file->writeHyperSlab(start, dims, &nReplicates);
+    }
+
+    if(!computeSpatialMoments)
+        return;
+
+    dims[0] = totExponents * totBins;
+    dsName = group + "/moments";
+    if(!file->dataSetExists(dsName.c_str()))
+        file->newDataset(dsName.c_str(), 1, dims);
+    file->openDataSet(dsName.c_str());
+    file->writeHyperSlab(start, dims, moments);
+
+    dsName = group + "/moments2";
+    if(!file->dataSetExists(dsName.c_str()))
+        file->newDataset(dsName.c_str(), 1, dims);
+    file->openDataSet(dsName.c_str());
+    file->writeHyperSlab(start, dims, moments2);
+}
+
+/**
+ * @brief Configures the histogram as the one saved with saveRawCounts()
+ * @param file
+ * @param groupName
+ * @return false if the layout is missing or invalid
+ *
+ *
+ * Data domain, limits, bin sizes, photon type flags and moment exponents are
+ * restored, so that a histogram can be rebuilt from a result file without
+ * knowing how it was configured. The name is not changed. Call initialize()
+ * and loadRawCounts() afterwards to restore the content.
+ */
+
+bool Histogram::loadLayout(H5FileHelper *file, const char *groupName)
+{
+    string dsName = string(groupName) + "/layout";
+    if(!file->dataSetExists(dsName.c_str())) {
+        logMessage("Cannot find %s", dsName.c_str());
+        return false;
+    }
+    file->openDataSet(dsName.c_str());
+    size_t n = file->extentDims()[0];
+    if(file->getRank() != 1 || n < 9) {
+        logMessage("Invalid layout %s", dsName.c_str());
+        return false;
+    }
+    vector<MCfloat> l(n);
+    file->loadAll(l.data());
+
+    type[0] = (MCData)l[0];
+    type[1] = (MCData)l[1];
+    min[0] = l[2];
+    min[1] = l[3];
+    max[0] = l[4];
+    max[1] = l[5];
+    binSize[0] = l[6];
+    binSize[1] = l[7];
+    photonTypeFlags = l[8];
+    momentExponents.assign(l.begin() + 9, l.end());
+    return true;
+}
+
+/**
+ * @brief Checks whether two histograms have the same bins and select the
+ * same photons
+ * @param rhs
+ * @return
+ *
+ *
+ * Only histograms with the same layout can be merged with appendCounts().
+ */
+
+bool Histogram::hasSameLayout(const Histogram *rhs) const
+{
+    return layout() == rhs->layout();
+}
+
+/**
+ * @brief The bin counts
+ * @return Row-major array of nBinsAlong(0) x nBinsAlong(1) elements, or NULL
+ * if the histogram was not initialized
+ *
+ *
+ * The last bin along each axis is the overflow bin. The array is owned by the
+ * histogram and stays valid until it is initialized again or destroyed.
+ */
+
+const u_int64_t *Histogram::rawCounts() const
+{
+    return histo;
+}
+
+/**
+ * @brief The per-bin sums of the spatial moments
+ * @return Array of nMomentExponents() rows of nBinsAlong(0) elements, or NULL
+ * if no moments are computed
+ *
+ *
+ * \see rawCounts()
+ */
+
+const MCfloat *Histogram::rawMoments() const
+{
+    return moments;
+}
+
+/**
+ * @brief The per-bin sums of the squares of the spatial moments
+ * @return
+ *
+ *
+ * Same layout as rawMoments().
+ */
+
+const MCfloat *Histogram::rawMoments2() const
+{
+    return moments2;
+}
+
+/**
+ * @brief Counts the reallocations of the raw arrays
+ * @return A number that changes whenever the arrays returned by rawCounts(),
+ * rawMoments() and rawMoments2() are reallocated, i.e. at each initialize()
+ */
+
+u_int64_t Histogram::rawDataGeneration() const
+{
+    return generation;
+}
+
+/**
+ * @brief The number of bins along the given axis, including the overflow bin
+ * @param axis 0 or 1
+ * @return 1 along the second axis of 1D histograms
+ *
+ *
+ * \pre The histogram must be initialized
+ */
+
+size_t Histogram::nBinsAlong(uint axis) const
+{
+    return axis < 2 ? nBins[axis] : 0;
+}
+
+size_t Histogram::nMomentExponents() const
+{
+    return momentExponents.size();
+}
+
+/**
+ * @brief Restores the raw content of the histogram saved with saveRawCounts()
+ * @param file
+ * @param groupName
+ * @return false if the data are missing or do not match the histogram layout
+ *
+ *
+ * The loaded data replace the current content of the histogram.
+ *
+ * \pre The histogram must be initialized
+ */
+
+bool Histogram::loadRawCounts(H5FileHelper *file, const char *groupName)
+{
+    string group = groupName;
+    string dsName = group + "/counts";
+    if(!file->dataSetExists(dsName.c_str())) {
+        logMessage("Cannot find %s", dsName.c_str());
+        return false;
+    }
+    file->openDataSet(dsName.c_str());
+    if(file->getRank() != 1 || file->extentDims()[0] != totBins) {
+        logMessage("%s does not match the histogram size", dsName.c_str());
+        return false;
+    }
+    file->loadAll(histo);
+
+    free(replicates);
+    free(replicates2);
+    replicates = NULL;
+    replicates2 = NULL;
+    nReplicates = 0;
+    dsName = group + "/n-replicates";
+    if(file->dataSetExists(dsName.c_str())) {
+        file->openDataSet(dsName.c_str());
+        file->loadAll(&nReplicates);
+        allocateReplicates();
+        const char *names[2] = {"/replicates", "/replicates2"};
+        MCfloat *dest[2] = {replicates, replicates2};
+        for (int i = 0; i < 2; ++i) {
+            dsName = group + names[i];
+            if(!file->dataSetExists(dsName.c_str())) {
+                logMessage("Cannot find %s", dsName.c_str());
+                return false;
+            }
+            file->openDataSet(dsName.c_str());
+            if(file->extentDims()[0] != totBins) {
+                logMessage("%s does not match the histogram size",
+                           dsName.c_str());
+                return false;
+            }
+            file->loadAll(dest[i]);
+        }
+    }
+
+    if(!computeSpatialMoments)
+        return true;
+
+    const char *names[2] = {"/moments", "/moments2"};
+    MCfloat *dest[2] = {moments, moments2};
+    for (int i = 0; i < 2; ++i) {
+        dsName = group + names[i];
+        if(!file->dataSetExists(dsName.c_str())) {
+            logMessage("Cannot find %s", dsName.c_str());
+            return false;
+        }
+        file->openDataSet(dsName.c_str());
+        if(file->extentDims()[0] != totExponents * totBins) {
+            logMessage("%s does not match the histogram size",
+                       dsName.c_str());
+            return false;
+        }
+        file->loadAll(dest[i]);
+    }
+    return true;
+}
+
+vector<MCfloat> Histogram::layout() const
+{
+    MCfloat l[9] = {(MCfloat)type[0], (MCfloat)type[1], min[0], min[1], max[0],
+                    max[1], binSize[0], binSize[1], (MCfloat)photonTypeFlags};
+    vector<MCfloat> v(l, l + 9);
+    v.insert(v.end(), momentExponents.begin(), momentExponents.end());
+    return v;
+}
+
+/**
+ * @brief The normalization factor of the \f$ i \f$-th row of the histogram
+ * @param i
+ * @return The total number of photons multiplied by the bin volume, if any
+ */
+
+MCfloat Histogram::binScale(size_t i) const
+{
+    switch (type[0]) {
+    case DATA_K:
+        return scale * 4.0 *pi<MCfloat>()
+                * sin((i + 0.5) * binSize[0] / degPerRad)
+                * sin(binSize[0] / 2. /degPerRad);
+
+    case DATA_POINTS: {
+        MCfloat dr = binSize[0];
+        return scale * (2 * pi<MCfloat>() * (i + 0.5) * dr * dr);
+    }
+
+    case DATA_TIMES:
+    default:
+        return scale;
+    }
+}
+
+/**
+ * @brief Standard error of the mean fraction of photons in the given bin over
+ * the replicates
+ * @param idx
+ * @return
+ */
+
+MCfloat Histogram::replicateError(size_t idx) const
+{
+    if(nReplicates < 2)
+        return numeric_limits<MCfloat>::quiet_NaN();
+    MCfloat mean = replicates[idx] / nReplicates;
+    MCfloat var = (replicates2[idx] / nReplicates - mean * mean)
+            * nReplicates / (nReplicates - 1);
+    if(var < 0)
+        var = 0;
+    return sqrt(var / nReplicates);
+}
+
+void Histogram::writeDataset(H5FileHelper *file, const string &dsName,
+                             bool stdErr) const
+{
     hsize_t dims[2] = {nBins[0], nBins[1]+1};
     if(computeSpatialMoments)
         dims[1] += totExponents;
-    file->newDataset(_dsName.c_str(), 2, dims);
+    file->unlink(dsName.c_str());  // results of a resumed simulation
+    file->newDataset(dsName.c_str(), 2, dims);
 
     uint ncols = dims[1];
     string colNames[ncols];
@@ -310,43 +819,37 @@ void Histogram::saveToFile(const char *fileName) const
 
     file->writeHyperSlabDouble(start, count, data);
 
-
-
     switch (type[0]) {
     case DATA_K:
         colNames[0] = "k";
-        for (size_t i = 0; i < nBins[0]; ++i) {
-            MCfloat scale2 = scale * 4.0 *pi<MCfloat>()
-                    * sin((i + 0.5) * binSize[0] / degPerRad)
-                    * sin(binSize[0] / 2. /degPerRad);
-            for (size_t j = 0; j < nBins[1]; ++j)
-                data[i * nBins[1] + j] = 1. * histo[i * nBins[1] + j] / scale2;
-        }
         break;
-
     case DATA_TIMES:
         colNames[0] = "time";
-        for (size_t i = 0; i < nBins[0]; ++i) {
-            MCfloat scale2 = scale;
-            for (size_t j = 0; j < nBins[1]; ++j)
-                data[i * nBins[1] + j] = 1. * histo[i * nBins[1] + j] / scale2;
-        }
         break;
-
     case DATA_POINTS:
         colNames[0] = "um";
-        for (size_t i = 0; i < nBins[0]; ++i) {
-            MCfloat dr = binSize[0];
-            MCfloat scale2 = scale * (2 * pi<MCfloat>() * (i + 0.5) * dr * dr);
-            for (size_t j = 0; j < nBins[1]; ++j)
-               data[i*nBins[1] + j] = 1. * histo[i * nBins[1] + j] / scale2;
-        }
         break;
-
+    case DATA_WAVELENGTH:
+        colNames[0] = "wavelength";
+        break;
     default:
         break;
     }
 
+    for (size_t i = 0; i < nBins[0]; ++i) {
+        MCfloat scale2 = binScale(i);
+        for (size_t j = 0; j < nBins[1]; ++j) {
+            size_t idx = i * nBins[1] + j;
+            u_int64_t c = histo[idx];
+            if(stdErr && nReplicates > 0)
+                data[idx] = replicateError(idx) * scale / scale2;
+            else if(stdErr)
+                data[idx] = sqrt(c * (1. - 1. * c / scale)) / scale2;
+            else
+                data[idx] = 1. * c / scale2;
+        }
+    }
+
     start[0] = 0;
     start[1] = 1;
     count[0] = nBins[0];
@@ -354,8 +857,6 @@ void Histogram::saveToFile(const char *fileName) const
 
     file->writeHyperSlabDouble(start, count, data);
 
-
-
     if(computeSpatialMoments) {
         for (size_t i = 0; i < totExponents; ++i) {
 
@@ -364,8 +865,21 @@ void Histogram::saveToFile(const char *fileName) const
 
             colNames[2+i] = strs.str();
 
-            for (size_t idx = 0; idx < nBins[0]; ++idx)
-                    data[idx] = moments[totBins * i + idx] / histo[idx];
+            for (size_t idx = 0; idx < nBins[0]; ++idx) {
+                MCfloat m = moments[totBins * i + idx] / histo[idx];
+                if(!stdErr) {
+                    data[idx] = m;
+                    continue;
+                }
+                if(histo[idx] < 2) {
+                    data[idx] = numeric_limits<double>::quiet_NaN();
+                    continue;
+                }
+                MCfloat var = moments2[totBins * i + idx] / histo[idx] - m * m;
+                if(var < 0)
+                    var = 0;
+                data[idx] = sqrt(var / (histo[idx] - 1));
+            }
 
             start[0] = 0;
             start[1] = 2 + i;
@@ -387,10 +901,8 @@ void Histogram::saveToFile(const char *fileName) const
     }
 
     file->writeColumnNames(ncols, colNames);
-    file->close();
 
     free(data);
-    delete file;
 }
 
 void Histogram::setScale(u_int64_t totalPhotons)
@@ -403,6 +915,58 @@ void Histogram::setName(const char *name)
     histName = name;
 }
 
+string Histogram::name() const
+{
+    return histName;
+}
+
+/**
+ * @brief The largest relative standard error among the given bins
+ * @param totalPhotons The total number of photons simulated so far
+ * @param firstBin Index of the first bin along the first axis, clamped to the
+ * bins before the overflow bin
+ * @param lastBin Index of the last bin along the first axis (included). If
+ * negative, the last bin before the overflow bin is used.
+ * @return The maximum relative error, or infinity if any of the selected bins
+ * is empty or if no bins are selected
+ *
+ *
+ * For 2D histograms, all the bins along the second axis (except the overflow
+ * bin) are considered for each selected bin of the first axis. The relative
+ * error of a bin with \f$ c \f$ counts out of \f$ N \f$ photons is
+ * \f$ \sqrt{(1 - c / N) / c} \f$.
+ *
+ * \pre The histogram must be initialized
+ */
+
+MCfloat Histogram::maxRelativeError(u_int64_t totalPhotons, int firstBin,
+                                    int lastBin) const
+{
+    if(lastBin < 0 || lastBin > (int)nBins[0] - 2)
+        lastBin = nBins[0] - 2;
+    if(firstBin < 0)
+        firstBin = 0;
+    if(firstBin > (int)nBins[0] - 2)
+        firstBin = nBins[0] - 2;
+    // an empty selection must not count as converged
+    if(firstBin > lastBin || lastBin < 0)
+        return numeric_limits<MCfloat>::infinity();
+    size_t lastCol = is2D() ? nBins[1] - 2 : 0;
+
+    MCfloat ret = 0;
+    for (int i = firstBin; i <= lastBin; ++i) {
+        for (size_t j = 0; j <= lastCol; ++j) {
+            u_int64_t c = histo[i * nBins[1] + j];
+            if(c == 0)
+                return numeric_limits<MCfloat>::infinity();
+            MCfloat relErr = sqrt((1. - 1. * c / totalPhotons) / c);
+            if(relErr > ret)
+                ret = relErr;
+        }
+    }
+    return ret;
+}
+
 bool Histogram::pickPhoton_impl(const Walker * const w) const
 {
     return true;
@@ -422,6 +986,7 @@ BaseObject *Histogram::clone_impl() const
     h->computeSpatialMoments = computeSpatialMoments;
     h->photonTypeFlags = photonTypeFlags;
     h->scale = scale;
+    h->histName = histName;
 
     if(computeSpatialMoments) {
         for (size_t i = 0; i < totExponents; ++i) {
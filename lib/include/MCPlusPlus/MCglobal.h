@@ -87,6 +87,19 @@ enum MCData {
     DATA_POINTS,
     DATA_K,
     DATA_TIMES,
+    DATA_WAVELENGTH,  // not saved in the raw output
+};
+
+/**
+ * @brief The MCEngineType enum enumerates the random number engines, see
+ * BaseRandom::setEngineType()
+ */
+
+enum MCEngineType {
+    ENGINE_MT19937_64 = 0,  /**< @brief 64 bit Mersenne Twister (default)*/
+    ENGINE_XOSHIRO256PP,    /**< @brief xoshiro256++*/
+    ENGINE_PCG64,           /**< @brief PCG XSL-RR 128/64*/
+    ENGINE_SFMT19937        /**< @brief SIMD-oriented Fast Mersenne Twister*/
 };
 
 #define MC_ASSERT_MSG(x, msg) if(!(x)) { \
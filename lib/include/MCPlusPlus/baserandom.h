@@ -19,19 +19,15 @@
 #define BASERANDOM_H
 
 #include <boost/random.hpp>
+#include <boost/shared_ptr.hpp>
 #include "baseobject.h"
+#include "mcengine.h"
 
 using namespace boost;
 using namespace boost::random;
 
 namespace MCPP {
 
-/* using 64 bit version does not affect performance significantly (time spent
- * drawing numbers is negligible)
-*/
-
-typedef mt19937_64 MCEngine;
-
 /**
  * @brief The BaseRandom class is the base class for all the objects needing a
  * RNG.
@@ -61,6 +57,10 @@ typedef mt19937_64 MCEngine;
  * The methods loadGeneratorState() and setGeneratorState() allow to specify a
  * custom internal state of the RNG and can be used in place of setSeed(), with
  * everything described above still holding.
+ *
+ * The algorithm of the RNG is chosen with setEngineType() before calling
+ * setSeed(); the default is the 64 bit Mersenne Twister. Independent streams
+ * can be split from a single seed with jumpGenerator().
  */
 
 class BaseRandom : public BaseObject
@@ -71,18 +71,24 @@ public:
 
     void setSeed(unsigned int seed);
     unsigned int currentSeed() const;
+    void setEngineType(enum MCEngineType type);
+    enum MCEngineType engineType() const;
 
     void dumpGeneratorState(const char *fileName) const;
     void loadGeneratorState(const char *fileName);
     string generatorState() const;
     void setGeneratorState(string state);
+    vector<u_int64_t> binaryGeneratorState() const;
+    void setBinaryGeneratorState(const vector<u_int64_t> &state);
+    void jumpGenerator(u_int64_t n = 1);
 
 protected:
-    MCEngine* mt;
+    boost::shared_ptr<MCEngine> mt;
     unsigned int _currentSeed;
+    enum MCEngineType _engineType;
 
 private:
-    void setRNG(MCEngine *mt);
+    void setRNG(boost::shared_ptr<MCEngine> mt);
 
     virtual void setRNG_impl();
     virtual void setParent_impl(BaseObject *parent);
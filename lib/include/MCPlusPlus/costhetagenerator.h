@@ -33,6 +33,8 @@ public:
 
     void setg(double g);
     MCfloat spin() const;
+    virtual void fill(MCfloat *out, size_t n) const;
+    virtual MCfloat quantile(MCfloat u) const;
 
 private:
     virtual BaseObject *clone_impl() const;
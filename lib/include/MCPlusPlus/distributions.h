@@ -19,6 +19,8 @@
 #define DISTRIBUTIONS_H
 
 #include <cmath>
+#include <vector>
+#include <boost/shared_ptr.hpp>
 #include "baserandom.h"
 
 namespace MCPP {
@@ -39,7 +41,13 @@ namespace MCPP {
  * object, the RNG used can be internal or the parent's.
  *
  * A new random number can be drawn by calling the spin() method which must be
- * reimplemented by derived classes.
+ * reimplemented by derived classes. Many numbers can be drawn at once with
+ * fill(), which derived classes should reimplement with a faster bulk
+ * algorithm; fill() does not necessarily produce the same sequence as repeated
+ * calls to spin().
+ *
+ * Variates can also be obtained from given uniform numbers with quantile(),
+ * e.g. to transform low-discrepancy points (see QuasiRandomSequence).
  *
  * \ingroup Distributions
  */
@@ -57,10 +65,13 @@ public:
      * \pre The RNG has to be valid (see BaseRandom)
      */
     virtual MCfloat spin() const = 0;
+    virtual void fill(MCfloat *out, size_t n) const;
+    virtual MCfloat quantile(MCfloat u) const;
     virtual BaseObject *clone_impl() const = 0;
 
 protected:
     virtual void reconstructDistribution();
+    void fillOpenUnit(MCfloat *out, size_t n) const;
 
 private:
     void setRNG_impl();
@@ -83,6 +94,8 @@ public:
 
     void setCenter(double val);
     MCfloat spin() const;
+    virtual void fill(MCfloat *out, size_t n) const;
+    virtual MCfloat quantile(MCfloat u) const;
 
 private:
     MCfloat x0;
@@ -112,6 +125,8 @@ public:
     void setSigma(double value);
     void setFWHM(double value);
     virtual MCfloat spin() const;
+    virtual void fill(MCfloat *out, size_t n) const;
+    virtual MCfloat quantile(MCfloat u) const;
 
 private:
     void reconstructDistribution();
@@ -138,6 +153,8 @@ public:
 
     virtual MCfloat spin() const;
     MCfloat spinOpen() const;
+    virtual void fill(MCfloat *out, size_t n) const;
+    virtual MCfloat quantile(MCfloat u) const;
 
 private:    
     void reconstructDistribution();
@@ -166,6 +183,8 @@ public:
     void setBeta(double value);
     void setLambda(double value);
     MCfloat spin() const;
+    virtual void fill(MCfloat *out, size_t n) const;
+    virtual MCfloat quantile(MCfloat u) const;
 
 private:
     void reconstructDistribution();
@@ -198,11 +217,92 @@ public:
     void setScale(double value);
     void setFWHM(double value);
     MCfloat spin() const;
+    virtual void fill(MCfloat *out, size_t n) const;
+    virtual MCfloat quantile(MCfloat u) const;
 
 private:
     virtual BaseObject* clone_impl() const;
     MCfloat mean, scale;
 };
 
+
+
+
+// Tabulated distribution
+
+/**
+ * @brief Continuous distribution with a tabulated probability density
+ *
+ * The density is given at increasing abscissae \f$ x_i \f$ and linearly
+ * interpolated in between, e.g. a measured profile or a histogram. It does not
+ * need to be normalized. Variates are drawn by inverting the cumulative
+ * distribution: a guide table finds the interval in O(1) average time, where
+ * the quadratic cumulative distribution is inverted exactly.
+ *
+ * Tables are immutable and shared by clones, which are therefore cheap.
+ * \ingroup Distributions
+ */
+
+class TabulatedDistribution : public AbstractDistribution
+{
+public:
+    TabulatedDistribution(BaseObject *parent=NULL);
+
+    bool setTable(const MCfloat *x, const MCfloat *pdf, size_t n);
+    bool loadTable(const char *fileName, const char *dataSetName);
+    size_t tableSize() const;
+    virtual MCfloat quantile(MCfloat u) const;
+    virtual MCfloat spin() const;
+    virtual void fill(MCfloat *out, size_t n) const;
+
+private:
+    virtual BaseObject* clone_impl() const;
+    virtual void describe_impl() const;
+    virtual bool sanityCheck_impl() const;
+
+    struct Table {
+        vector<MCfloat> x, pdf, slope, cdf;
+        vector<u_int32_t> guide;
+        MCfloat area;
+    };
+    boost::shared_ptr<const Table> table;
+};
+
+
+
+
+// Alias distribution
+
+/**
+ * @brief Discrete distribution over a finite set of values with arbitrary
+ * weights
+ *
+ * Variates are drawn in O(1) time with Walker's alias method, the table being
+ * built with Vose's algorithm: a single uniform variate selects a column and
+ * decides between its value and its alias.
+ * \ingroup Distributions
+ */
+
+class AliasDistribution : public AbstractDistribution
+{
+public:
+    AliasDistribution(BaseObject *parent=NULL);
+
+    bool setTable(const MCfloat *values, const MCfloat *weights, size_t n);
+    bool loadTable(const char *fileName, const char *dataSetName);
+    size_t tableSize() const;
+    virtual MCfloat spin() const;
+    virtual void fill(MCfloat *out, size_t n) const;
+    virtual MCfloat quantile(MCfloat u) const;
+
+private:
+    virtual BaseObject* clone_impl() const;
+    virtual void describe_impl() const;
+    virtual bool sanityCheck_impl() const;
+
+    vector<MCfloat> values, prob;
+    vector<u_int32_t> alias;
+};
+
 }
 #endif // DISTRIBUTIONS_H
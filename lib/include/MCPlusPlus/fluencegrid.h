@@ -0,0 +1,128 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FLUENCEGRID_H
+#define FLUENCEGRID_H
+
+#include "baseobject.h"
+
+#include <vector>
+
+namespace MCPP {
+
+class H5FileHelper;
+
+/**
+ * @brief The gridGeometry enum enumerates the voxel geometries of a
+ * FluenceGrid
+ */
+
+enum gridGeometry {
+    GRID_CARTESIAN = 0,  /**< @brief (x, y, z) boxes*/
+    GRID_CYLINDRICAL     /**< @brief (rho, z) rings around the z axis*/
+};
+
+/**
+ * @brief The FluenceGrid class scores the path length of the walkers in each
+ * voxel of a 3D grid
+ *
+ * The grid is either cartesian, with bins along x, y and z, or cylindrical,
+ * with bins along the distance rho from the z axis and along z (see
+ * setGeometry()). The path length can optionally be resolved in time as well
+ * (see setTimeRange()). Each step of a walker is split where it crosses the
+ * voxel (and time bin) boundaries and each piece is added to the voxel that
+ * contains it; path lengths outside the grid are discarded.
+ *
+ * FluenceGrids are filled live during the simulation, see
+ * Simulation::addFluenceGrid(); each thread fills its own copy, and copies are
+ * summed with appendCounts(). Unlike saving the trajectories, memory usage only
+ * depends on the number of voxels.
+ *
+ * A saved grid can be rebuilt with loadLayout(), initialize() and
+ * loadCounts(), e.g. to add it to the grid of another run with the same
+ * layout.
+ *
+ * The path length per walker per unit volume is the fluence produced by a unit
+ * source (the fluence rate per unit time for time-resolved grids); multiplied
+ * by the absorption coefficient it gives the absorbed energy density. See
+ * saveToFile().
+ */
+
+class FluenceGrid : public BaseObject
+{
+public:
+    FluenceGrid(BaseObject *parent=NULL);
+    virtual ~FluenceGrid();
+
+    void setGeometry(enum gridGeometry geometry);
+    void setXRange(const MCfloat min, const MCfloat max, const MCfloat binSize);
+    void setYRange(const MCfloat min, const MCfloat max, const MCfloat binSize);
+    void setRhoRange(const MCfloat max, const MCfloat binSize);
+    void setZRange(const MCfloat min, const MCfloat max, const MCfloat binSize);
+    void setTimeRange(const MCfloat min, const MCfloat max,
+                      const MCfloat binSize);
+    void setName(const char *name);
+    string name() const;
+    bool isTimeResolved() const;
+    bool initialize();
+    void addSegment(const MCfloat *r, const MCfloat *k, const MCfloat length,
+                    const MCfloat t0, const MCfloat v);
+    void addWalkers(u_int64_t nWalkers);
+    u_int64_t nWalkers() const;
+    void appendCounts(const FluenceGrid *rhs);
+    bool hasSameLayout(const FluenceGrid *rhs) const;
+    const MCfloat *rawPathLengths() const;
+    u_int64_t rawDataGeneration() const;
+    size_t nBinsAlong(uint axis) const;
+    size_t nVoxels() const;
+    void saveToFile(const char *fileName) const;
+    void saveToFile(H5FileHelper *file, const char *groupName=NULL) const;
+    bool loadLayout(H5FileHelper *file, const char *groupName);
+    bool loadCounts(H5FileHelper *file, const char *groupName);
+
+private:
+    enum axis {AXIS_X = 0, AXIS_Y, AXIS_Z, AXIS_T};
+
+    virtual bool sanityCheck_impl() const;
+    virtual BaseObject* clone_impl() const;
+    void setRange(axis a, const MCfloat min, const MCfloat max,
+                  const MCfloat binSize);
+    void addPlaneCrossings(axis a, const MCfloat c0, const MCfloat dc,
+                           const MCfloat length);
+    void addCylinderCrossings(const MCfloat *r, const MCfloat *k,
+                              const MCfloat length);
+    long binIndex(axis a, const MCfloat c) const;
+    MCfloat voxelVolume(size_t iRho) const;
+    bool usesAxis(axis a) const;
+    const char *axisName(axis a) const;
+    vector<MCfloat> binEdges(axis a) const;
+
+    string gridName;
+    enum gridGeometry geometry;
+    MCfloat min[4], max[4];
+    MCfloat binSize[4];
+    size_t nBins[4];
+    size_t totVoxels;
+    MCfloat *pathLengths;
+    u_int64_t generation;  /**< @brief see rawDataGeneration()*/
+    u_int64_t _nWalkers;
+    vector<MCfloat> crossings;
+};
+
+}
+
+#endif // FLUENCEGRID_H
@@ -66,6 +66,8 @@ private:
     void init();
     virtual void spinDirection(Walker *walker) const;
     virtual void spinPosition(Walker *walker) const;
+    virtual void spinBatch_impl(Walker *walkers, size_t n) const;
+    MCfloat spinNormal(unsigned int coordinate) const;
     void setZWaist(double value);
     MCfloat zWaist();
     MCfloat zLens() const;
@@ -77,6 +79,7 @@ private:
     MCfloat d;
     MCfloat zWaistInEnvironment;
     UniformDistribution *uRand;
+    TabulatedDistribution *normal;
     Material *environment;
 };
 
@@ -20,6 +20,9 @@
 
 #include "baseobject.h"
 #include <H5Cpp.h>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/recursive_mutex.hpp>
+#include <vector>
 
 #define MCH5FLOAT PredType::NATIVE_DOUBLE
 
@@ -29,6 +32,21 @@ using namespace H5;
 
 namespace MCPP {
 
+#ifndef SWIG
+/**
+ * @brief Serializes all the HDF5 calls of the library, in every thread
+ *
+ * HDF5 is only safe to call from several threads at once when it is built
+ * thread-safe, which cannot be relied upon. Every part of the library that
+ * opens an HDF5 file (simulation threads and their writer threads, the
+ * monitor, RawHistogrammer, OutputMerger, ...) holds this lock until the file
+ * is closed, so that any number of them can run at the same time. Code that
+ * calls HDF5 while any of them may be running must hold it too. It is
+ * recursive, so functions holding it can call each other.
+ */
+extern boost::recursive_mutex h5Mutex;
+#endif
+
 /**
  * @brief The H5FileHelper class is a convenience wrapper around H5::H5File.
  */
@@ -42,6 +60,8 @@ public:
     void reopen();
     bool openDataSet(const char *dataSetName);
     void newGroup(const char *name);
+    hsize_t nChildren(const char *groupName) const;
+    string childName(const char *groupName, hsize_t index) const;
     virtual bool newFile(const char *fileName);
 #ifndef SWIG //this is to work around a link error
     bool newDataset(const char *datasetName, int ndims, const hsize_t *dims,
@@ -50,6 +70,8 @@ public:
                     PredType type=MCH5FLOAT);
 #endif
     bool dataSetExists(const char *dataSetName) const;
+    bool copyFrom(const H5FileHelper *src, const char *name);
+    void unlink(const char *name);
     void loadHyperSlab(const hsize_t *start, const hsize_t *count,
                        MCfloat *destBuffer);
     void writeHyperSlab(const hsize_t *start, const hsize_t *count,
@@ -57,8 +79,12 @@ public:
     void writeHyperSlab(const hsize_t *start, const hsize_t *count,
                         const u_int64_t *srcBuffer);
     void loadAll(MCfloat *destBuffer);
+    void loadAll(u_int64_t *destBuffer);
+    bool loadColumns(vector<MCfloat> *first, vector<MCfloat> *second);
     void close();
+    void flush();
     void closeDataSet();
+    void setSWMRWriteEnabled(bool enable);
     const hsize_t *extentDims() const;
 
     int getRank() const;
@@ -84,6 +110,7 @@ private:
 
     char *fName, *dName;
     bool opened, dsOpened;
+    bool swmrWrite;
 
     H5E_auto2_t Efunc;
     void *EclientData;
@@ -20,9 +20,56 @@
 
 #include "h5filehelper.h"
 #include "sample.h"
+#include "walker.h"
 
 namespace MCPP {
 
+/**
+ * @brief The rawStorage enum enumerates the types used to store raw output in
+ * the file
+ */
+
+enum rawStorage {
+    STORAGE_DOUBLE,       /**< @brief 64 bit floating point, lossless*/
+    STORAGE_FLOAT32,      /**< @brief 32 bit floating point*/
+    STORAGE_FIXED_POINT,  /**< @brief scaled fixed-point integers*/
+};
+
+/**
+ * @brief The RawOutputProfile struct specifies how the raw output datasets are
+ * chunked, filtered and stored
+ *
+ * Datasets are always read and written as #MCfloat, converting from and to the
+ * storage type on the fly. The quantization error of the lossy storage types
+ * is:
+ *
+ * - #STORAGE_FLOAT32: relative error below \f$ 2^{-24} \approx 6 \cdot
+ * 10^{-8} \f$ (about 7 significant digits), values beyond
+ * \f$ \approx 3.4 \cdot 10^{38} \f$ become infinite;
+ * - #STORAGE_FIXED_POINT: values are stored as integers with decimalDigits
+ * \f$ d \f$ digits after the decimal point (HDF5 scale-offset filter), hence
+ * an absolute error of the order of \f$ 10^{-d} \f$ in the units used by the
+ * simulation. The filter does not round exactly, so allow for errors up to
+ * \f$ 2 \cdot 10^{-d} \f$. NaN values are not supported.
+ *
+ * The default profile stores uncompressed doubles. Filters are only applied
+ * if available in the HDF5 library.
+ */
+
+struct RawOutputProfile {
+    RawOutputProfile();
+    static RawOutputProfile compressed(int deflateLevel = 4);
+    static RawOutputProfile float32(int deflateLevel = 4);
+    static RawOutputProfile fixedPoint(int decimalDigits, int deflateLevel = 4);
+
+    hsize_t chunkWalkers;  /**< @brief number of walkers per chunk*/
+    bool shuffle;          /**< @brief byte shuffle filter*/
+    int deflateLevel;      /**< @brief gzip level, 0 to disable*/
+    bool fletcher32;       /**< @brief checksum of each chunk*/
+    rawStorage storage;
+    int decimalDigits;     /**< @brief digits kept by #STORAGE_FIXED_POINT*/
+};
+
 /**
  * @brief The H5OutputFile class allows to manipulate the HDF5 files generated
  * by MCPlusPlus
@@ -34,9 +81,11 @@ namespace MCPP {
  * - photon-counters: an array of 4 elements (one per walkerType), containing
  * the total number of photons of that type
  *
- * The "RNGStates" group contains as many datasets as the maximum number of
- * threads used up to that moment. Each thread uses its own RNG, so the state
- * of each thread's RNG is saved in a dedicated dataset.
+ * - RNGStates: the final state of the RNG of each thread, indexed by the seed
+ * of the thread, as a variable length array of words (see
+ * BaseRandom::binaryGeneratorState()). Files written by older versions hold
+ * the states in text form instead; both are read by readBinaryRNGState() and
+ * readRNGState().
  *
  * Three other groups contain the actual simulated data: "exit-k-vectors",
  * "exit-points", "walk-times". Each group contains as many datasets as are the
@@ -45,6 +94,24 @@ namespace MCPP {
  * The "exit-points" dataset contains the exit \f$ (x,y) \f$ coordinates
  * written sequentially for each photon. The same applies for the saved
  * components of the exit k vectors.
+ *
+ * If the raw output was written in one shard file per thread (see
+ * Simulation::setRawOutputShardsEnabled()), these datasets are virtual
+ * datasets concatenating the ones of the shard files (see linkShards()) and
+ * can be read as usual, as long as the shard files are kept in the same
+ * directory.
+ *
+ * Raw output datasets are created according to the RawOutputProfile set with
+ * setRawOutputProfile().
+ *
+ * Optionally, the "records" group contains a compound dataset per walker type,
+ * with one WalkerRecord per photon (see walkerRecordType() for the schema).
+ * Unlike the datasets above, all the data of a photon are stored contiguously,
+ * so that they can be read with a single sequential scan.
+ *
+ * The "trajectories" group, if present, contains the trajectories of the
+ * walkers selected with Simulation::setTrajectorySampling() (see
+ * createTrajectoryDatasets()).
  */
 
 class H5OutputFile : public H5FileHelper
@@ -68,25 +135,53 @@ public:
                           const hsize_t *start=NULL, const hsize_t *count=NULL);
     bool loadData(MCData group, walkerType type, MCfloat *destBuffer,
                   const hsize_t *start=NULL, const hsize_t *count=NULL);
+    bool createWalkerRecordDatasets(uint walkerRecordsSaveFlags);
+    void appendWalkerRecords(walkerType type, const WalkerRecord *buffer,
+                             const hsize_t size);
+    bool loadWalkerRecords(walkerType type, WalkerRecord *destBuffer,
+                           const hsize_t *start=NULL,
+                           const hsize_t *count=NULL);
+    hsize_t nWalkerRecords(walkerType type) const;
+    bool importRecordFile(const char *fileName, bool saveRecords=false);
+    bool createTrajectoryDatasets();
+    void appendTrajectories(const MCfloat *points, const TrajectoryInfo *info,
+                            const hsize_t nTrajectories);
+    hsize_t nTrajectories() const;
+    bool loadTrajectory(hsize_t index, vector<MCfloat> *points,
+                        TrajectoryInfo *info=NULL);
+#ifndef SWIG
+    static CompType walkerRecordType();
+    static CompType trajectoryInfoType();
+#endif
 
-    void saveRNGState(const uint seed, const string s);
+    void saveRNGState(const uint seed, const vector<u_int64_t> &state);
+    vector<u_int64_t> readBinaryRNGState(const uint seed) const;
     string readRNGState(const uint seed) const;
     void appendPhotonCounts(const u_int64_t transmitted,
                             const u_int64_t ballistic,
                             const u_int64_t reflected,
                             const u_int64_t backReflected);
     void appendPhotonCounts(const u_int64_t *counters);
+    void savePhotonCounts(const u_int64_t *counters);
     u_int64_t transmitted() const;
     u_int64_t ballistic() const;
     u_int64_t reflected() const;
     u_int64_t backReflected() const;
     const u_int64_t *photonCounters() const;
     void saveSample(const Sample *sample);
+    bool linkShards(const vector<string> &shardFiles);
+    void setRawOutputProfile(const RawOutputProfile &profile);
+    const RawOutputProfile *rawOutputProfile() const;
 
 private:
     bool createDatasets(uint walkTimesSaveFlags, uint exitPointsSaveFlags,
                         uint exitKVectorsSaveFlags);
     bool createRNGDataset();
+    bool newRawDataset(const char *datasetName, hsize_t valuesPerWalker,
+                       bool lossless = false);
+    bool newCompoundDataset(const char *datasetName, const CompType &type);
+    void appendToCompoundDataset(const char *datasetName, const void *buffer,
+                                 const hsize_t size, const CompType &type);
     void appendTo1Ddataset(const char *datasetName, const MCfloat *buffer,
                            const hsize_t size);
     bool loadFrom1Ddataset(const char *datasetName, MCfloat *destBuffer,
@@ -96,6 +191,7 @@ private:
     bool openFile_impl();
 
     u_int64_t _photonCounters[4];
+    RawOutputProfile profile;
 };
 
 }
@@ -23,6 +23,8 @@
 
 namespace MCPP {
 
+class H5FileHelper;
+
 /**
  * @brief The Histogram class provides a flexible live histogramming interface
  *
@@ -40,6 +42,15 @@ namespace MCPP {
  * file in a dataset with that name at the end of the simulation. When saved,
  * data are scaled with the total number of simulated photons.
  *
+ * Along with the counts, every Histogram keeps the per-bin sums of squares
+ * needed to estimate the statistical uncertainty of its content. The standard
+ * error of each column is saved in a sibling dataset named
+ * <tt>\<name\>-stderr</tt>, having the same layout and column names as the
+ * main dataset (see saveToFile()). Histograms merged from independent
+ * replicates with appendReplicate() estimate the error from their spread;
+ * the replicates are kept by saveRawCounts() and by appendCounts(), so that
+ * they survive the merging of several output files.
+ *
  * \pre The following conditions must hold for a Histogram to be in a valid
  * state:
  * - data domain and photon type must be specified
@@ -75,16 +86,39 @@ public:
     void setPhotonTypeFlags(int value);
     void run(const Walker * const buf, size_t bufSize);
     void appendCounts(const Histogram *rhs);
+    void appendReplicate(const Histogram *rhs, u_int64_t nPhotons);
+    void markAsReplicate(u_int64_t nPhotons);
+    u_int64_t replicateCount() const;
     void dump() const;
     void saveToFile(const char *fileName) const;
+    void saveToFile(H5FileHelper *file, const char *datasetName=NULL) const;
+    void saveRawCounts(H5FileHelper *file, const char *groupName) const;
+    bool loadRawCounts(H5FileHelper *file, const char *groupName);
+    bool loadLayout(H5FileHelper *file, const char *groupName);
+    bool hasSameLayout(const Histogram *rhs) const;
+    const u_int64_t *rawCounts() const;
+    const MCfloat *rawMoments() const;
+    const MCfloat *rawMoments2() const;
+    u_int64_t rawDataGeneration() const;
+    size_t nBinsAlong(uint axis) const;
+    size_t nMomentExponents() const;
     void setScale(u_int64_t totalPhotons);
     void setName(const char *name);
+    string name() const;
+    MCfloat maxRelativeError(u_int64_t totalPhotons, int firstBin = 0,
+                             int lastBin = -1) const;
 
 private:
     virtual bool sanityCheck_impl() const;
     virtual bool pickPhoton_impl(const Walker * const w) const;
     virtual BaseObject* clone_impl() const;
+    vector<MCfloat> layout() const;
     bool pickPhoton(const Walker * const w) const;
+    MCfloat binScale(size_t i) const;
+    MCfloat replicateError(size_t idx) const;
+    void allocateReplicates();
+    void writeDataset(H5FileHelper *file, const string &dsName,
+                      bool stdErr) const;
 
     string histName;
 
@@ -98,12 +132,17 @@ private:
     MCfloat firstBinEdge[2];
     size_t nBins[2];
     MCfloat *moments;
+    MCfloat *moments2;
+    MCfloat *replicates;
+    MCfloat *replicates2;
+    u_int64_t nReplicates;
 
     MCfloat degPerRad;
     size_t totBins, totExponents;
     vector<double> momentExponents;
     u_int64_t scale;
     u_int64_t *histo;
+    u_int64_t generation;  /**< @brief see rawDataGeneration()*/
 };
 
 }
@@ -22,6 +22,8 @@
 
 namespace MCPP {
 
+class PhaseFunction;
+
 const MCfloat LIGHT_SPEED = 299.792458; // um/ps
 //const MCfloat INV_LIGHT_SPEED = 1.0/LIGHT_SPEED;
 
@@ -42,6 +44,9 @@ public:
                     \f$ g = \left\langle \cos \theta \right \rangle \f$ */
     double v;  /**< @brief phase velocity \note please beware of the difference
                     between phase, group and energy velocity */
+    PhaseFunction *phaseFunction;  /**< @brief replaces the Henyey-Greenstein
+                                        phase function given by g if not NULL
+                                        (not owned) */
 
     void setWavelength(double um);
 
@@ -0,0 +1,105 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MCENGINE_H
+#define MCENGINE_H
+
+#include "MCglobal.h"
+
+#include <vector>
+#include <sys/types.h>
+
+/* number of words generated at once by the engines, i.e. the state size of
+ * the 64 bit Mersenne Twisters */
+#define MCENGINE_BLOCK 312
+
+namespace MCPP {
+
+class MCEngineBackend;
+
+/**
+ * @brief Buffered 64 bit random number engine with a selectable algorithm
+ *
+ * The algorithm (see #MCEngineType) is chosen at construction. Words are
+ * generated in blocks of MCENGINE_BLOCK by a single virtual call and handed
+ * out one at a time by operator(), which is inlined, or in bulk by generate().
+ * MCEngine models the boost and standard uniform random number generator
+ * concepts, so it can be passed to any of their distributions.
+ *
+ * With ENGINE_MT19937_64 the words are the same as the ones of
+ * boost::random::mt19937_64 seeded with the same value.
+ *
+ * The state can be saved and restored exactly, in the middle of a block too,
+ * with state() and setState(), or with the stream operators in text form: the
+ * text starts with the name of the algorithm (see typeName()). A bare
+ * mt19937_64 state, as saved by older versions, is also accepted by both.
+ *
+ * jump() skips a fixed number of words, at least \f$ 2^{64} \f$, so that
+ * non-overlapping streams can be split from a single seed.
+ *
+ * draws() counts the words handed out, at no cost for operator().
+ */
+
+class MCEngine
+{
+public:
+    typedef u_int64_t result_type;
+
+    MCEngine(unsigned int seed, enum MCEngineType type = ENGINE_MT19937_64);
+    ~MCEngine();
+
+    static result_type min() { return 0; }
+    static result_type max() { return ~(result_type)0; }
+
+    result_type operator()() {
+        if(pos == MCENGINE_BLOCK)
+            refill();
+        return buf[pos++];
+    }
+    void generate(result_type *out, size_t n);
+    void jump(u_int64_t n = 1);
+    void jump(u_int64_t n, int log2Distance);
+
+    /** @brief The number of words handed out since construction, regardless
+     * of jumps and restored states */
+    u_int64_t draws() const { return drawsOffset + pos; }
+
+    enum MCEngineType type() const;
+    static const char *typeName(enum MCEngineType type);
+    vector<u_int64_t> state() const;
+    bool setState(const vector<u_int64_t> &state);
+
+    friend ostream &operator<<(ostream &os, const MCEngine &engine);
+    friend istream &operator>>(istream &is, MCEngine &engine);
+
+private:
+    MCEngine(const MCEngine &);
+    MCEngine &operator=(const MCEngine &);
+    void refill();
+
+    MCEngineBackend *backend;
+    result_type buf[MCENGINE_BLOCK];
+    size_t pos;
+    vector<u_int64_t> blockStart;  // state of the backend before buf
+    u_int64_t drawsOffset;  // draws() at the start of buf, modulo 2^64
+};
+
+ostream &operator<<(ostream &os, const MCEngine &engine);
+istream &operator>>(istream &is, MCEngine &engine);
+
+}
+#endif // MCENGINE_H
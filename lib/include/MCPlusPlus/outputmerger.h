@@ -0,0 +1,76 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OUTPUTMERGER_H
+#define OUTPUTMERGER_H
+
+#include "histogram.h"
+#include "fluencegrid.h"
+
+namespace MCPP {
+
+/**
+ * @brief The OutputMerger class combines the results of independent
+ * simulations
+ *
+ * Simulations of the same setup run in separate processes or on separate
+ * machines (with different seeds) can be combined as if they were a single
+ * simulation. Add their output files with addInputFile() and call merge().
+ *
+ * The raw histograms saved in the <tt>raw-histograms</tt> group of each file
+ * (see Simulation) are summed, and the photon counters of all files are
+ * added up. The output file contains the merged photon counters, the merged
+ * histograms normalized with the total number of photons (see
+ * Histogram::saveToFile()), their raw content and the sample description of
+ * the first input file; it can therefore be merged again with other files.
+ *
+ * Histograms are matched by name and must have the same layout (see
+ * Histogram::hasSameLayout()) in all input files. The fluence grids saved in
+ * the <tt>fluence</tt> group (see Simulation::addFluenceGrid()) are merged the
+ * same way: their path lengths and numbers of walkers are summed, and they must
+ * have the same bin edges in all input files (see
+ * FluenceGrid::hasSameLayout()). Raw output is not copied.
+ *
+ * Histograms of quasi-random simulations carry their replicates (see
+ * Histogram::appendReplicate()), which are merged as well, so that the error
+ * of the merged histograms comes from the spread of all the replicates. Such
+ * files cannot be merged with the ones of pseudo-random simulations.
+ */
+
+class OutputMerger : public BaseObject
+{
+public:
+    OutputMerger(BaseObject *parent=NULL);
+    virtual ~OutputMerger();
+
+    void addInputFile(const char *fileName);
+    bool merge(const char *outputFileName);
+    const u_int64_t *photonCounters() const;
+    u_int64_t totalPhotons() const;
+
+private:
+    bool mergeFile(const char *fileName, bool first);
+    void clear();
+
+    vector<string> inputFiles;
+    vector<Histogram *> hists;
+    vector<FluenceGrid *> grids;
+    u_int64_t _photonCounters[4];
+};
+
+}
+#endif // OUTPUTMERGER_H
@@ -0,0 +1,134 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHASEFUNCTION_H
+#define PHASEFUNCTION_H
+
+#include "distributions.h"
+
+namespace MCPP {
+
+/**
+ * @brief Base class for phase functions other than Henyey-Greenstein
+ *
+ * A phase function is assigned to a Material through Material::phaseFunction,
+ * replacing the Henyey-Greenstein one given by Material::g. At the start of a
+ * run, Simulation calls setWavelength(), which evaluates the phase function
+ * with tabulate() and builds the inverse cumulative distribution of
+ * \f$ \cos \theta \f$ once; each thread then samples its own copy of
+ * cosThetaDistribution() in O(1) time. Tables are cached for each wavelength
+ * and refractive index of the medium, so that each of them is built once also
+ * in spectral runs (see Source::setSpectrum()).
+ *
+ * Phase functions are not owned by materials, and the same one can be shared
+ * by several of them.
+ */
+
+class PhaseFunction : public BaseObject
+{
+public:
+    PhaseFunction();
+
+    bool setWavelength(double um, double mediumIndex=1);
+    void setNAngles(size_t n);
+    const TabulatedDistribution *cosThetaDistribution() const;
+    MCfloat anisotropy() const;
+
+protected:
+    void invalidateTables();
+    void angleGrid(vector<MCfloat> *cosTheta) const;
+
+private:
+    /**
+     * @brief Evaluates the phase function
+     * @param um Wavelength in vacuum
+     * @param mediumIndex Refractive index of the surrounding medium
+     * @param cosTheta Strictly increasing values of \f$ \cos \theta \f$, e.g.
+     * given by angleGrid()
+     * @param density Value of the phase function at each point, per unit solid
+     * angle and not necessarily normalized
+     * @return false on error
+     */
+    virtual bool tabulate(double um, double mediumIndex,
+                          vector<MCfloat> *cosTheta,
+                          vector<MCfloat> *density) const = 0;
+
+    struct CachedTable {
+        double um, mediumIndex;
+        TabulatedDistribution *distribution;
+        MCfloat g;
+    };
+    vector<CachedTable> tables;
+    size_t current;
+    size_t nAngles;
+};
+
+
+
+
+/**
+ * @brief Phase function of a dilute suspension of identical spheres, computed
+ * with Mie theory
+ *
+ * Scattering amplitudes are computed following the BHMIE algorithm of Bohren
+ * and Huffman, for spheres of the given radius and complex refractive index in
+ * the medium of the material.
+ */
+
+class MiePhaseFunction : public PhaseFunction
+{
+public:
+    MiePhaseFunction(double radius, double particleIndex,
+                     double particleAbsorption=0);
+
+    void setRadius(double um);
+    void setParticleIndex(double n, double k=0);
+
+private:
+    virtual bool tabulate(double um, double mediumIndex,
+                          vector<MCfloat> *cosTheta,
+                          vector<MCfloat> *density) const;
+    virtual void describe_impl() const;
+
+    double radius, particleIndex, particleAbsorption;
+};
+
+
+
+
+/**
+ * @brief Measured phase function, independent of the wavelength
+ */
+
+class TabulatedPhaseFunction : public PhaseFunction
+{
+public:
+    TabulatedPhaseFunction();
+
+    bool setTable(const MCfloat *theta, const MCfloat *value, size_t n);
+    bool loadTable(const char *fileName, const char *dataSetName);
+
+private:
+    virtual bool tabulate(double um, double mediumIndex,
+                          vector<MCfloat> *cosTheta,
+                          vector<MCfloat> *density) const;
+
+    vector<MCfloat> cosThetas, values;
+};
+
+}
+#endif // PHASEFUNCTION_H
@@ -32,6 +32,8 @@ public:
     IsotropicPsiGenerator(BaseObject *parent=NULL);
 
     virtual MCfloat spin() const;
+    virtual void fill(MCfloat *out, size_t n) const;
+    virtual MCfloat quantile(MCfloat u) const;
 
 private:
     virtual BaseObject* clone_impl() const;
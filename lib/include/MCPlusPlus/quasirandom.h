@@ -0,0 +1,125 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef QUASIRANDOM_H
+#define QUASIRANDOM_H
+
+#include "baserandom.h"
+
+namespace MCPP {
+
+/**
+ * @brief Base class of the randomized low-discrepancy sequences
+ *
+ * A QuasiRandomSequence generates points in the unit hypercube of the given
+ * dimension, each coordinate in the open interval \f$ (0, 1) \f$, which fill
+ * the hypercube more evenly than independent uniform variates. Averages of
+ * smooth functions over the points therefore converge faster than with
+ * pseudo-random numbers.
+ *
+ * The sequence is randomized with its RNG (see BaseRandom): every point is
+ * uniformly distributed, so that averages are unbiased, while the points keep
+ * their low discrepancy. A new randomization is drawn whenever the RNG is set
+ * and when randomize() is called; independent randomizations give independent
+ * estimates, from which the error can be computed. Each thread of a Simulation
+ * runs its own randomization, see Source::setQuasiRandomSequence().
+ */
+
+class QuasiRandomSequence : public BaseRandom
+{
+public:
+    QuasiRandomSequence(unsigned int dimension, BaseObject *parent=NULL);
+    virtual ~QuasiRandomSequence();
+
+    unsigned int dimension() const;
+    u_int64_t index() const;
+    void randomize();
+    void next(MCfloat *u);
+
+protected:
+    unsigned int dim;
+    u_int64_t maxPoints;
+
+private:
+    virtual void randomize_impl() = 0;
+    virtual void next_impl(u_int64_t index, MCfloat *u) = 0;
+    virtual void setRNG_impl();
+    virtual void describe_impl() const;
+
+    u_int64_t _index;
+    bool randomized;
+};
+
+
+
+
+/**
+ * @brief Sobol sequence with linear matrix scrambling and a digital shift
+ *
+ * Direction numbers are those of Joe and Kuo, up to maxDimension() dimensions;
+ * the first \f$ 2^m \f$ points of each randomization are stratified in every
+ * one-dimensional projection into \f$ 2^m \f$ intervals. Points are generated
+ * in Gray code order in O(1) time per coordinate. At most \f$ 2^{32} \f$
+ * points are drawn from each randomization, after which the sequence is
+ * randomized again.
+ */
+
+class SobolSequence : public QuasiRandomSequence
+{
+public:
+    SobolSequence(unsigned int dimension, BaseObject *parent=NULL);
+
+    static unsigned int maxDimension();
+
+private:
+    virtual void randomize_impl();
+    virtual void next_impl(u_int64_t index, MCfloat *u);
+    virtual BaseObject *clone_impl() const;
+
+    vector<u_int64_t> directions, scrambledDirections, state;
+};
+
+
+
+
+/**
+ * @brief Halton sequence with random digit permutations
+ *
+ * Coordinate \f$ i \f$ is the radical inverse of the point index in the
+ * \f$ i \f$-th prime base, each digit being mapped through a random
+ * permutation of \f$ \{0, \dots, b - 1\} \f$ drawn for each digit position.
+ * The scrambling removes the correlations between the coordinates of the
+ * unscrambled sequence in high dimension. Unlike SobolSequence, the number of
+ * points is not limited, but each coordinate costs one division per digit.
+ */
+
+class HaltonSequence : public QuasiRandomSequence
+{
+public:
+    HaltonSequence(unsigned int dimension, BaseObject *parent=NULL);
+
+private:
+    virtual void randomize_impl();
+    virtual void next_impl(u_int64_t index, MCfloat *u);
+    virtual BaseObject *clone_impl() const;
+
+    vector<unsigned int> bases, nDigits;
+    vector<vector<unsigned int> > permutations;
+};
+
+}
+#endif // QUASIRANDOM_H
@@ -0,0 +1,81 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAWDATAREADER_H
+#define RAWDATAREADER_H
+
+#include "baseobject.h"
+#include "walker.h"
+
+#include <vector>
+#include <H5Cpp.h>
+
+namespace MCPP {
+
+using namespace H5;
+
+/**
+ * @brief The RawDataReader class reads the raw output of an H5OutputFile in
+ * chunks of walkers
+ *
+ * Instead of loading a whole dataset at once (see H5OutputFile::loadData()),
+ * the raw output of each walker type is split in chunks of chunkSize()
+ * walkers, which can be read independently with readChunk() and are returned
+ * as Walker objects, ready to be fed to Histogram::run().
+ *
+ * If the file contains the "records" datasets (see
+ * Simulation::setWalkerRecordsSaveFlags()), walkers are read from them.
+ * Otherwise they are assembled from the exit-points, walk-times and
+ * exit-k-vectors datasets; exit k vectors are only used if all three
+ * components were saved. Values that were not saved are set to NaN.
+ *
+ * The file is opened read-only. Several readers, e.g. one per thread, can read
+ * the same file at the same time.
+ */
+
+class RawDataReader : public BaseObject
+{
+public:
+    RawDataReader(BaseObject *parent=NULL);
+    virtual ~RawDataReader();
+
+    bool open(const char *fileName);
+    void close();
+    void setChunkSize(hsize_t nWalkers);
+    hsize_t chunkSize() const;
+    hsize_t nWalkers(walkerType type) const;
+    hsize_t nChunks(walkerType type) const;
+    const u_int64_t *photonCounters() const;
+    hsize_t readChunk(walkerType type, hsize_t chunk, vector<Walker> *dest);
+
+private:
+    hsize_t datasetSize(const string &name) const;
+    void readValues(const string &name, hsize_t start, hsize_t count,
+                    MCfloat *dest);
+
+    H5File *file;
+    hsize_t _chunkSize;
+    hsize_t _nWalkers[4];
+    bool hasRecords[4];
+    bool hasPoints[4], hasTimes[4], hasKVectors[4];
+    u_int64_t _photonCounters[4];
+    vector<MCfloat> buffer;
+    vector<WalkerRecord> recordBuffer;
+};
+
+}
+#endif // RAWDATAREADER_H
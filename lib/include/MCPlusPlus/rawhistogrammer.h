@@ -0,0 +1,93 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAWHISTOGRAMMER_H
+#define RAWHISTOGRAMMER_H
+
+#include "histogram.h"
+#include "rawdatareader.h"
+
+#include <boost/thread/mutex.hpp>
+
+namespace MCPP {
+
+/**
+ * @brief The RawHistogrammer class computes Histograms from the raw output of
+ * finished simulations
+ *
+ * This allows to change the histogram binning after the fact, without running
+ * the simulation again. Add one or more output files with raw output (see
+ * Simulation::setRawOutputEnabled()) with addInputFile() and the Histograms
+ * to be computed with addHistogram(), then call run().
+ *
+ * The raw output is read in chunks (see RawDataReader) by setNThreads()
+ * threads, each one running its own copy of the histograms, which are merged
+ * at the end; the memory usage is therefore bounded by the chunk size
+ * regardless of the size of the input files. Since HDF5 is not necessarily
+ * built thread-safe, the chunks are read one at a time, holding h5Mutex, and
+ * only the binning runs in parallel. Use setPhotonTypeFlags() to skip
+ * reading the walker types that are not needed.
+ *
+ * Histograms are normalized with the sum of the photon counters of the input
+ * files, or with the value given to setTotalPhotons(), and can be saved with
+ * saveToFile().
+ */
+
+class RawHistogrammer : public BaseObject
+{
+public:
+    RawHistogrammer(BaseObject *parent=NULL);
+    virtual ~RawHistogrammer();
+
+    void addInputFile(const char *fileName);
+#ifdef SWIG
+    %apply SWIGTYPE *DISOWN {Histogram *hist};
+#endif
+    void addHistogram(Histogram *hist);
+    void setNThreads(uint value);
+    void setChunkSize(hsize_t nWalkers);
+    void setPhotonTypeFlags(int value);
+    void setTotalPhotons(u_int64_t N);
+    u_int64_t totalPhotons() const;
+    bool run();
+    void saveToFile(const char *fileName) const;
+
+private:
+    struct Task {
+        size_t fileIndex;
+        walkerType type;
+        hsize_t chunk;
+    };
+
+    void worker(vector<Histogram *> *threadHists);
+
+    vector<string> inputFiles;
+    vector<Histogram *> hists;
+    uint nThreads;
+    hsize_t chunkSize;
+    int photonTypeFlags;
+    u_int64_t _totalPhotons;
+    bool totalPhotonsSet;
+
+    vector<Task> tasks;
+    size_t nextTask;
+    boost::mutex taskMutex;
+    bool failed;
+};
+
+}
+#endif // RAWHISTOGRAMMER_H
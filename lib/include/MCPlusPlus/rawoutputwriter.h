@@ -0,0 +1,95 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAWOUTPUTWRITER_H
+#define RAWOUTPUTWRITER_H
+
+#include "baseobject.h"
+#include "walker.h"
+
+#include <deque>
+#include <vector>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace MCPP {
+
+class H5OutputFile;
+
+/**
+ * @brief The RawOutputBlock struct holds the raw output of a number of photons
+ * waiting to be written by a RawOutputWriter
+ */
+
+struct RawOutputBlock {
+    RawOutputBlock();
+
+    vector<MCfloat> exitPoints[4];
+    vector<MCfloat> walkTimes[4];
+    vector<MCfloat> exitKVectors[4];
+    vector<WalkerRecord> records[4];
+    bool pending;  /**< @brief true while the block is queued or written*/
+};
+
+/**
+ * @brief The RawOutputWriter class appends raw output to an H5OutputFile from
+ * a dedicated thread
+ *
+ * Simulation threads fill a RawOutputBlock with the per-photon data and hand it
+ * to the writer with push(), then go on simulating with a second block. Before
+ * reusing a block they call wait(), which returns as soon as the writer has
+ * appended its content to the file and emptied it. Each thread therefore
+ * needs at most two blocks, which keeps the memory usage bounded regardless of
+ * the number of simulated photons.
+ *
+ * Blocks are written in the order they are pushed. Every access to the output
+ * file is serialized with h5Mutex, so that other parts of the program can
+ * write the same file, or any other HDF5 file, while the writer is running.
+ */
+
+class RawOutputWriter : public BaseObject
+{
+public:
+    RawOutputWriter(BaseObject *parent=NULL);
+    virtual ~RawOutputWriter();
+
+    bool start(const char *fileName, bool swmr=false);
+    void stop();
+    void push(RawOutputBlock *block);
+    void wait(RawOutputBlock *block);
+    u_int64_t blocksWritten() const;
+
+private:
+    void run();
+    void write(RawOutputBlock *block);
+
+    char *fileName;
+    bool swmr;
+    H5OutputFile *swmrFile;  /**< @brief kept open while running in SWMR
+                                  mode*/
+
+    std::deque<RawOutputBlock *> queue;
+    boost::mutex queueMutex;
+    boost::condition_variable queueCondition;
+    boost::thread *thread;
+    bool stopped;
+    u_int64_t _blocksWritten;
+};
+
+}
+#endif // RAWOUTPUTWRITER_H
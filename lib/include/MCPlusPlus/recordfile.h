@@ -0,0 +1,162 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RECORDFILE_H
+#define RECORDFILE_H
+
+#include "baseobject.h"
+#include "walker.h"
+
+#define RECORDFILE_MAGIC "MCPPREC"
+#define RECORDFILE_VERSION 1
+#define RECORDFILE_HEADER_SIZE 4096
+#define RECORDFILE_CHUNK_HEADER_SIZE 64
+#define RECORDFILE_MAX_FIELDS 16
+
+namespace MCPP {
+
+/**
+ * @brief The recordFieldType enum enumerates the types of the fields of a
+ * RecordFile
+ *
+ * The floating point fields of the records are #MCfloat, hence their type
+ * depends on how the library was built.
+ */
+
+enum recordFieldType {
+    FIELD_FLOAT64 = 0,  /**< @brief 64 bit floating point*/
+    FIELD_UINT64 = 1,   /**< @brief unsigned 64 bit integer*/
+    FIELD_FLOAT32 = 2,  /**< @brief 32 bit floating point*/
+    FIELD_FLOAT80 = 3,  /**< @brief x87 80 bit extended precision, padded to
+                             16 bytes*/
+};
+
+/**
+ * @brief Description of a field of the records, as stored in the header of a
+ * RecordFile
+ */
+
+struct RecordFileField {
+    char name[16];       /**< @brief null terminated*/
+    u_int32_t type;      /**< @brief see recordFieldType*/
+    u_int32_t offset;    /**< @brief in bytes, from the start of the record*/
+};
+
+/**
+ * @brief The header at the beginning of a RecordFile
+ */
+
+struct RecordFileHeader {
+    char magic[8];          /**< @brief RECORDFILE_MAGIC*/
+    u_int32_t byteOrder;    /**< @brief 0x01020304 in native byte order*/
+    u_int32_t version;
+    u_int32_t headerSize;   /**< @brief offset of the first chunk*/
+    u_int32_t recordSize;   /**< @brief bytes per record*/
+    u_int64_t chunkRecords; /**< @brief capacity of each chunk, in records*/
+    u_int64_t chunkStride;  /**< @brief bytes between the start of two
+                                 consecutive chunks*/
+    u_int64_t nChunks;
+    u_int32_t nFields;
+    u_int32_t reserved;
+    RecordFileField fields[RECORDFILE_MAX_FIELDS];
+};
+
+/**
+ * @brief The header at the beginning of each chunk of a RecordFile
+ */
+
+struct RecordFileChunk {
+    u_int32_t type;      /**< @brief walkerType of all the records*/
+    u_int32_t reserved;
+    u_int64_t nRecords;  /**< @brief number of valid records*/
+};
+
+/**
+ * @brief The RecordFile class writes and reads WalkerRecords in a flat,
+ * memory-mapped binary file
+ *
+ * This is a lightweight alternative to the HDF5 raw output datasets for very
+ * high photon rates: each append() is a plain copy into a memory-mapped
+ * region. Each writer (e.g. each Simulation thread) must use its own file.
+ *
+ * <h2>Format</h2> All values are stored in native byte order. The file starts
+ * with a RecordFileHeader, padded to RECORDFILE_HEADER_SIZE bytes, holding the
+ * schema of the records (name, type and offset of each field, see
+ * WalkerRecord) and the chunk layout. It is followed by nChunks chunks, the
+ * i-th one starting at <tt>headerSize + i * chunkStride</tt>. Each chunk
+ * begins with a RecordFileChunk, padded to RECORDFILE_CHUNK_HEADER_SIZE bytes,
+ * telling the walker type and number of records it holds, followed by the
+ * records. The chunk headers therefore act as an index: the records of a given
+ * type can be located by reading a few bytes per chunk.
+ *
+ * Chunks are preallocated on disk when they are started, so that running out
+ * of disk space is reported by append() instead of crashing the program. The
+ * header and chunk counters are updated as records are appended, so a file
+ * left behind by a killed process is still readable.
+ *
+ * Use H5OutputFile::importRecordFile() to convert a record file to the usual
+ * HDF5 layout.
+ */
+
+class RecordFile : public BaseObject
+{
+public:
+    RecordFile(BaseObject *parent=NULL);
+    virtual ~RecordFile();
+
+    bool create(const char *fileName, u_int64_t chunkRecords = 65536);
+    bool openForAppend(const char *fileName);
+    bool open(const char *fileName);
+    void close();
+
+    inline bool append(walkerType type, const WalkerRecord &record)
+    {
+        if(currentCount[type] == NULL || *currentCount[type] == chunkRecords)
+            if(!newChunk(type))
+                return false;
+        currentData[type][(*currentCount[type])++] = record;
+        return true;
+    }
+
+    u_int64_t nChunks() const;
+    walkerType chunkType(u_int64_t chunk) const;
+    u_int64_t chunkSize(u_int64_t chunk) const;
+    const WalkerRecord *chunkData(u_int64_t chunk) const;
+    u_int64_t nRecords(walkerType type) const;
+
+private:
+    bool mapHeader();
+    bool checkHeader() const;
+    bool newChunk(walkerType type);
+    void unmapChunk(walkerType type);
+    const RecordFileChunk *chunk(u_int64_t index) const;
+
+    int fd;
+    bool writable;
+    RecordFileHeader *header;
+    char *readMap;  /**< @brief whole file, when opened for reading*/
+    size_t readMapSize;
+    u_int64_t chunkRecords;
+
+    // chunks currently being written, one per walker type
+    char *chunkMap[4];
+    u_int64_t *currentCount[4];
+    WalkerRecord *currentData[4];
+};
+
+}
+#endif // RECORDFILE_H
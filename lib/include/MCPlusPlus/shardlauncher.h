@@ -0,0 +1,60 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHARDLAUNCHER_H
+#define SHARDLAUNCHER_H
+
+#include "simulation.h"
+
+namespace MCPP {
+
+/**
+ * @brief The ShardLauncher class runs a Simulation in several local processes
+ *
+ * run() forks setNProcesses() worker processes, each one running one shard of
+ * the simulation (see Simulation::setShard()) in its own shard file, waits for
+ * them and merges the shard files in the output file of the simulation with
+ * OutputMerger. Since workers are separate processes, a crashing worker does
+ * not affect the others: shards that fail are run again from scratch up to
+ * setMaxRetries() times, which gives the same results since shards are
+ * deterministic.
+ *
+ * Shard files are left on disk together with their raw output, if any. No
+ * threads may be running in the calling process when run() is called.
+ */
+
+class ShardLauncher : public BaseObject
+{
+public:
+    ShardLauncher(BaseObject *parent=NULL);
+    virtual ~ShardLauncher();
+
+    void setSimulation(Simulation *sim);
+    void setNProcesses(uint value);
+    void setMaxRetries(uint value);
+    bool run();
+
+private:
+    pid_t spawn(uint index);
+
+    Simulation *sim;
+    uint nProcesses;
+    uint maxRetries;
+};
+
+}
+#endif // SHARDLAUNCHER_H
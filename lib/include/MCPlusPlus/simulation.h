@@ -21,7 +21,18 @@
 #include "source.h"
 #include "sample.h"
 #include "costhetagenerator.h"
+#include "phasefunction.h"
 #include "histogram.h"
+#include "rawoutputwriter.h"
+#include "h5outputfile.h"
+#include "recordfile.h"
+#include "trajectoryrecorder.h"
+#include "fluencegrid.h"
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/atomic.hpp>
 
 #define WALKER_BUFSIZE 1000
 
@@ -39,22 +50,99 @@ namespace MCPP {
  * raw output with the data of each single simulated photons can be enabled
  * using setRawOutputEnabled(). In the latter case output flags can be
  * specified with their setter functions: setWalkTimesSaveFlags(), etc.; keep
- * in mind that this causes heavy memory usage and big output file sizes.
+ * in mind that this causes heavy memory usage and big output file sizes. Use
+ * setRawOutputStreamingEnabled() to write raw output while the simulation is
+ * running, with bounded memory usage, and setRawOutputShardsEnabled() to let
+ * each thread write its own file.
  *
  * Before running the simulation, a RNG has to be initialized by either calling
  * setSeed(), loadGeneratorState() or setGeneratorState(). Use run() to start
  * the simulation.
  *
+ * The source and the transport share the RNG of each thread. Source walkers
+ * are drawn in batches of WALKER_BUFSIZE (see Source::spinBatch()) before
+ * their transport, so a given seed reproduces the same results only as long
+ * as WALKER_BUFSIZE is unchanged; with random sources the results differ from
+ * the ones of versions that drew the source variates walker by walker.
+ *
  * If you want to run the simulation in parallel threads, use setNThreads() to
  * specify the number of threads to be used. In this case multiple RNG states
  * can be loaded with setMultipleRNGStates(), otherwise sequential numbers from
- * 0 to the number of threads will be used as seeds for each thread.
+ * 0 to the number of threads will be used as seeds for each thread, or
+ * non-overlapping streams will be split from the seed if
+ * setStreamSplittingEnabled() was called.
+ *
+ * <h2>Stopping criteria</h2> The number of walkers specified with
+ * setNWalkers() is the maximum budget of the simulation. The simulation can be
+ * stopped as soon as a target statistical precision is reached by adding one or
+ * more criteria with addConvergenceCriterion(); a wall-clock limit can be set
+ * with setMaxWallTime(). Criteria are checked periodically (see
+ * setConvergenceCheckInterval()) by a monitor thread which merges the
+ * partial results of all threads. In any case, histograms are normalized with
+ * the number of walkers that were actually simulated.
+ *
+ * <h2>Snapshots</h2> Intermediate results can be saved while the simulation is
+ * running, see setSnapshotInterval() and setSnapshotWalkerInterval(). Each
+ * snapshot merges the partial histograms of all threads and writes them,
+ * normalized with the number of walkers simulated so far, in a new group
+ * <tt>snapshots/\<k\></tt> of the output file, together with the respective
+ * <tt>photon-counters</tt>.
+ *
+ * <h2>Checkpoints</h2> When each thread completes, its raw (unnormalized)
+ * histograms, photon counters, progress and RNG state are saved in the
+ * <tt>checkpoint/\<n\></tt> group of the output file; with
+ * setCheckpointInterval() this also happens periodically while the thread is
+ * running. A simulation terminated with SIGTERM (or killed after a checkpoint)
+ * can then be resumed with setResumeEnabled(), while setAppendEnabled() allows
+ * to add more walkers to an existing output file. In both cases the final
+ * results are normalized with the total number of walkers.
+ *
+ * <h2>Multiple processes</h2> With setShard(), a simulation only runs its own
+ * share of the walkers with its own RNG seeds, and writes its results in a
+ * separate shard file. Shards can be run by independent processes, e.g. jobs
+ * of a batch scheduler, and combined with OutputMerger; ShardLauncher does
+ * this on the local machine.
+ *
+ * <h2>Merging results</h2> Besides the normalized histograms, the merged raw
+ * histograms of all threads are saved in the <tt>raw-histograms</tt> group of
+ * the output file (see Histogram::saveRawCounts()). Output files of
+ * independent simulations of the same setup, e.g. run with different seeds on
+ * different machines, can then be combined exactly with OutputMerger.
+ *
+ * <h2>Fluence</h2> Where light travels inside the sample can be scored with
+ * one or more FluenceGrids, see addFluenceGrid(). They are filled during the
+ * simulation like histograms and saved in the <tt>fluence</tt> group of the
+ * output file.
+ *
+ * <h2>Trajectories</h2> The full trajectories of a sample of the walkers, e.g.
+ * one every thousand walkers keeping only the transmitted ones, can be saved
+ * in the <tt>trajectories</tt> group of the output file with
+ * setTrajectorySampling(). Each thread collects them in a TrajectoryRecorder
+ * of bounded size (see setTrajectoryBufferSize()), which is flushed to the
+ * output file whenever it fills up.
+ *
+ * <h2>Live statistics</h2> Each thread counts its walkers, scattering events,
+ * interface hits and exits by walker type in counters that other threads can
+ * read without locks. With setStatsFileName(), the monitor thread periodically
+ * sums them and replaces a JSON file with the totals, the throughput and the
+ * estimated time to completion (see setStatsInterval()), so that the
+ * simulation can be followed by polling the file.
+ *
+ * <h2>Performance report</h2> The wall-clock time of each thread, split into
+ * the time spent filling the histograms (<tt>flush-time</tt>) and writing to
+ * files (<tt>io-time</tt>), its throughput, the number of scattering events,
+ * interface hits and RNG draws, together with the load imbalance between the
+ * threads, are saved in the <tt>performance</tt> group of the output file.
+ * If the library is built with ENABLE_PERFORMANCE_COUNTERS, the group also
+ * holds the number of total internal reflections, Fresnel reflections,
+ * refractions and layer switches of each thread.
  *
  * <h2>Signals</h2> The progress of the simulation currently running can be
  * printed on stderr by sending the USR1 signal to the process instantiating a
  * Simulation object. Progress of all threads can be printed by sending
- * SIGUSR2. Finally the TERM signal causes the simulation to terminate
- * gracefully (see terminate()).
+ * SIGUSR2. The signal handlers only record the request, which is served by the
+ * monitor thread within half a second. Finally the TERM signal causes the
+ * simulation to terminate gracefully (see terminate()).
  */
 
 class Simulation : public BaseRandom
@@ -65,6 +153,9 @@ public:
 
     const Sample *sample() const;
     void setSaveTrajectoryEnabled(bool enabled = true);
+    void setTrajectorySampling(u_int64_t every,
+                               int photonTypeFlags = FLAG_ALL_WALKERS);
+    void setTrajectoryBufferSize(u_int64_t nPoints);
     void setNPhotons(const u_int64_t N);
     void setNWalkers(const u_int64_t N);
 #ifdef SWIG
@@ -80,7 +171,8 @@ public:
     u_int64_t nPhotons() const;
     u_int64_t currentPhoton() const;
     void setOutputFileName(const char *name);
-    void run();
+    const char *outputFileName() const;
+    bool run();
     void clear();
     const vector<vector<MCfloat> *> *trajectories() const;
     void reportProgress() const;
@@ -90,17 +182,53 @@ public:
     void setExitPointsSaveFlags(unsigned int value);
     void setExitKVectorsSaveFlags(unsigned int value);
     void setExitKVectorsDirsSaveFlags(unsigned int value);
+    void setWalkerRecordsSaveFlags(unsigned int value);
     void terminate();
     uint nThreads();
 #ifdef SWIG
     %apply SWIGTYPE *DISOWN {Histogram *hist};
 #endif
     void addHistogram(Histogram *hist);
+#ifdef SWIG
+    %apply SWIGTYPE *DISOWN {FluenceGrid *grid};
+#endif
+    void addFluenceGrid(FluenceGrid *grid);
     void setRawOutputEnabled(bool enable);
+    void setRawOutputStreamingEnabled(bool enable);
+    void setRawOutputBufferSize(u_int64_t nWalkers);
+    void setSWMREnabled(bool enable);
+    void setRawOutputShardsEnabled(bool enable);
+    void setRawOutputProfile(const RawOutputProfile &profile);
+    void setRecordFilesEnabled(bool enable);
+    void addConvergenceCriterion(const char *histName, double maxRelativeError,
+                                 int firstBin = 0, int lastBin = -1);
+    void addConvergenceCriterion(walkerType type, double maxRelativeError);
+    void setConvergenceCheckInterval(double seconds);
+    void setMaxWallTime(double seconds);
+    u_int64_t simulatedPhotons() const;
+    const u_int64_t *photonCounts() const;
+    void setRawOutputInMemoryEnabled(bool enable);
+    const vector<MCfloat> *rawExitPoints(walkerType type) const;
+    const vector<MCfloat> *rawWalkTimes(walkerType type) const;
+    const vector<MCfloat> *rawExitKVectors(walkerType type) const;
+    uint nExitKVectorComponents() const;
+    const vector<WalkerRecord> *rawWalkerRecords(walkerType type) const;
+    u_int64_t rawDataGeneration() const;
+    void setSnapshotInterval(double seconds);
+    void setSnapshotWalkerInterval(u_int64_t nWalkers);
+    void setCheckpointInterval(double seconds);
+    void setResumeEnabled(bool enable);
+    void setAppendEnabled(bool enable);
+    void setShard(uint index, uint count);
+    string shardOutputFileName(uint index) const;
+    void setStreamSplittingEnabled(bool enable);
+    void setStatsFileName(const char *name);
+    void setStatsInterval(double seconds);
 
 private:
     unsigned int layerAt(const MCfloat *r0) const;
     void handleInterface();
+    void scoreSegment(MCfloat length);
     void checkIfWalkerExitedSample();
     MCfloat reflectionProbability();
     void reflect();
@@ -112,13 +240,57 @@ private:
     void appendExitKVector(walkerType type);
     void appendWalker(walkerType type);
 
-    void runMultipleThreads();
+    bool runShard();
+    void keepRawOutput(Simulation *sim);
+    bool runMultipleThreads();
     bool runSingleThread();
+    bool prepareLayerTables();
 
     void switchToLayer(const uint layer);
+    void selectBand(const uint band);
     void updateLayerVariables(const uint layer);
     void flushHistogram();
     void saveRawOutput();
+    void saveTrajectories();
+    void streamRawOutput();
+    void stopRawOutputWriter();
+    string shardFileName(uint index, const char *extension = ".h5") const;
+    bool openShard();
+    bool openRecordFile();
+    void closeRecordFile();
+    void saveShard();
+    void linkShards(H5OutputFile *file);
+    void removeShards();
+
+    void startMonitor();
+    void stopMonitor();
+    void monitor();
+    double monitorPeriod() const;
+    void collectResults(vector<Histogram *> *dest, u_int64_t *counters);
+    u_int64_t collectPhotonCount();
+    bool convergenceReached();
+    void terminateAll();
+    void resetLiveCounters();
+    void handleProgressRequests();
+    bool writeStatsFile(double elapsed, double interval, u_int64_t *walkers,
+                        bool finished);
+    bool saveSnapshot();
+    void saveRawHistograms();
+    void saveFluenceGrids(bool addSaved);
+    bool loadCheckpoint();
+    void clearCheckpoints();
+    void writeCheckpoint(H5FileHelper *file);
+    void savePerformanceReport(double wallTime, double outputTime);
+
+    inline void publishLiveCounters()
+    {
+        live.walkers.store(n, boost::memory_order_relaxed);
+        live.scatterings.store(nScatterings, boost::memory_order_relaxed);
+        live.interfaceHits.store(nInterfaceHits, boost::memory_order_relaxed);
+        for (uint i = 0; i < 4; ++i) {
+            live.exits[i].store(nExits[i], boost::memory_order_relaxed);
+        }
+    }
 
     inline void swap_r0_r1()
     {
@@ -150,6 +322,7 @@ private:
     unsigned int exitPointsSaveFlags;
     unsigned int exitKVectorsDirsSaveFlags;
     unsigned int exitKVectorsSaveFlags;
+    unsigned int walkerRecordsSaveFlags;
     MCfloat timeOriginZ;
 
     //walker counters
@@ -165,12 +338,26 @@ private:
     vector<vector <MCfloat>*> *trajectoryPoints;
     vector<MCfloat> *currentTrajectory;
 
+    //sampled trajectories
+    u_int64_t trajectorySampling;
+    int trajectoryTypeFlags;
+    u_int64_t trajectoryBufferSize;
+    TrajectoryRecorder *trajRecorder;  /**< @brief owned by each thread*/
+    bool recordingTrajectory;
+
     vector<MCfloat> exitPoints[4];
     vector<MCfloat> walkTimes[4];
     vector<MCfloat> exitKVectors[4];
+    vector<WalkerRecord> records[4];
 
     //internal temporary variables
-    CosThetaGenerator deflCosine;
+    AbstractDistribution *deflCosine;
+    AbstractDistribution **deflCosines;  /**< @brief one for each layer */
+    AbstractDistribution **deflCosineTable;
+    const MCfloat *musTable;
+    MCfloat *timeOffsets;
+    unsigned int nBands;
+    unsigned int band0;
     MCfloat currLayerLowerBoundary, currLayerUpperBoundary;
     const Material *currentMaterial;
     const MCfloat *mus;
@@ -193,8 +380,127 @@ private:
     char *outputFile;
     vector<string> multipleRNGStates;
     vector<Histogram *> hists;
+    vector<FluenceGrid *> grids;
+    /** @brief the materials of all layers at each wavelength of the source,
+     * band after band */
+    vector<Material> layerTable;
+    vector<const TabulatedDistribution *> phaseTable;  /**< @brief NULL for
+                                                            Henyey-Greenstein */
     bool forceTermination;
     Walker walkerBuf[WALKER_BUFSIZE];
+    Walker sourceBuf[WALKER_BUFSIZE];
+    /** @brief RNG state before the batch in sourceBuf was drawn */
+    vector<u_int64_t> batchRNGState;
+    u_int64_t batchSize;  /**< @brief walkers in sourceBuf*/
+    u_int64_t batchEnd;  /**< @brief n at which the next batch is drawn*/
+
+    //stopping criteria
+    struct ConvergenceCriterion {
+        int histIndex;  /**< @brief index in hists, or -1 for photonCounters*/
+        string histName;
+        walkerType type;
+        MCfloat maxRelativeError;
+        int firstBin, lastBin;
+    };
+    vector<ConvergenceCriterion> criteria;
+    double convergenceCheckInterval;
+    double maxWallTime;
+
+    //snapshots
+    double snapshotInterval;
+    u_int64_t snapshotWalkerInterval;
+
+    //monitor thread
+    boost::mutex histMutex;  /**< @brief guards hists and photonCounters */
+    boost::mutex monitorMutex;
+    boost::condition_variable monitorCondition;
+    boost::thread *monitorThread;
+    bool monitorStopped;
+    bool terminationRequested;
+
+    //checkpoints
+    struct ThreadCheckpoint {
+        u_int64_t nWalkers;  /**< @brief walker budget of the thread*/
+        u_int64_t walkersDone;
+        u_int64_t counters[4];
+        vector<u_int64_t> rngState;
+        /** @brief RNG state before the interrupted source batch was drawn,
+         * empty if the thread stopped between two batches */
+        vector<u_int64_t> batchRNGState;
+        u_int64_t batchDone;  /**< @brief walkers of that batch simulated*/
+        u_int64_t batchSize;
+        vector<Histogram *> hists;
+    };
+    double checkpointInterval;
+    uint checkpointThreads;  /**< @brief threads of the checkpointed run*/
+    u_int64_t checkpointWalkers;  /**< @brief total budget of the run*/
+    double lastCheckpoint;
+    bool resumeEnabled;
+    bool appendEnabled;
+    vector<ThreadCheckpoint *> restoredThreads;
+    const ThreadCheckpoint *resumeState;
+    uint threadIndex;
+    u_int64_t resumedCounters[4];
+
+    //raw output streaming
+    bool rawOutputStreaming;
+    u_int64_t rawBufferSize;
+    bool swmrEnabled;
+    RawOutputWriter *rawWriter;  /**< @brief owned by the main Simulation*/
+    RawOutputBlock rawBlock;
+    u_int64_t rawStreamedWalkers;
+    RawOutputProfile rawProfile;
+
+    //raw output shards
+    bool rawOutputShards;
+    RawOutputWriter *shardWriter;  /**< @brief owned by each thread*/
+
+    //memory-mapped record files
+    bool recordFilesEnabled;
+    RecordFile *recordFile;
+
+    //raw output kept after run()
+    bool rawOutputInMemory;
+    u_int64_t generation;  /**< @brief see rawDataGeneration()*/
+
+    //multi-process shards
+    uint shardIndex, shardCount;
+
+    //RNG streams jumped from a single seed
+    bool streamSplitting;
+
+    //live statistics
+    struct LiveCounters {
+        boost::atomic<u_int64_t> walkers;
+        boost::atomic<u_int64_t> scatterings;
+        boost::atomic<u_int64_t> interfaceHits;
+        boost::atomic<u_int64_t> exits[4];
+    };
+    u_int64_t nScatterings, nInterfaceHits, nExits[4];  // of this thread
+    /** @brief copy of the counters above, published by the thread after each
+     * walker and read by the monitor thread. The main Simulation also adds
+     * the ones of the threads that completed. */
+    LiveCounters live;
+    char *statsFile;
+    double statsInterval;
+
+    //performance report
+    struct PerformanceCounters {
+        u_int64_t walkers;
+        double simulationTime;
+        double flushTime;
+        double ioTime;
+        u_int64_t scatterings;
+        u_int64_t interfaceHits;
+        u_int64_t rngDraws;
+        // only counted with ENABLE_PERFORMANCE_COUNTERS
+        u_int64_t totalInternalReflections;
+        u_int64_t fresnelReflections;
+        u_int64_t refractions;
+        u_int64_t layerSwitches;
+    };
+    PerformanceCounters perf;  /**< @brief of this thread */
+    vector<PerformanceCounters> threadPerf;  /**< @brief of all threads */
 };
 
 }
@@ -20,6 +20,7 @@
 
 #include "walker.h"
 #include "distributions.h"
+#include "quasirandom.h"
 
 namespace MCPP {
 
@@ -28,6 +29,33 @@ namespace MCPP {
  * given source term modeling.
  *
  * The default wavelength is set to \f$ \SI{1}{\micro\metre} \f$.
+ *
+ * Walkers can be constructed one at a time with spin() or in batches with
+ * spinBatch(). By default a batch is a loop over spin(); derived classes can
+ * reimplement spinBatch_impl() with a faster bulk path, which must then
+ * follow their own spinPosition(), spinDirection() and spinTime(). Classes
+ * that only set the source distributions can use spinDistributionsBatch().
+ * Bulk paths draw the random variates in a different order than repeated
+ * spin(), so their walkers depend on the batch size.
+ *
+ * A broadband source is described by a spectrum over a grid of wavelengths
+ * (see setSpectrum()), from which the wavelength of each walker is drawn;
+ * Simulation then tabulates the optical properties of the sample for each
+ * wavelength of the grid, so that the whole spectrum is simulated in a single
+ * run.
+ *
+ * The variates of each walker can be taken from a randomized low-discrepancy
+ * sequence instead of the RNG (see setQuasiRandomSequence()), through the
+ * quantile() of the source distributions. The coordinates of each point are
+ * used as follows:
+ * - 0, 1: position along \f$ x \f$ and \f$ y \f$
+ * - 2, 3: direction (\f$ \cos \theta \f$ and \f$ \psi \f$, or the
+ * point on the waist for GaussianRayBundleSource)
+ * - 4: time
+ * - 5: wavelength, for broadband sources
+ *
+ * Variates whose coordinate exceeds the dimension of the sequence are drawn
+ * from the RNG.
  */
 
 class Source : public BaseRandom
@@ -37,6 +65,7 @@ public:
     ~Source();
 
     void spin(Walker *walker) const;
+    void spinBatch(Walker *walkers, size_t n) const;
 
 #ifdef SWIG
     %apply SWIGTYPE *DISOWN {AbstractDistribution *x0Distribution,
@@ -59,8 +88,19 @@ public:
 
     virtual void setWavelength(double um);
     MCfloat wavelength() const;
+    bool setSpectrum(const MCfloat *wavelengths, const MCfloat *weights,
+                     size_t n);
+    void clearSpectrum();
+    size_t nBands() const;
+    MCfloat bandWavelength(size_t band) const;
     MCfloat z0() const;
 
+#ifdef SWIG
+    %apply SWIGTYPE *DISOWN {QuasiRandomSequence *sequence};
+#endif
+    void setQuasiRandomSequence(QuasiRandomSequence *sequence);
+    const QuasiRandomSequence *quasiRandomSequence() const;
+
 protected:
     AbstractDistribution *r0Distribution[3];
     AbstractDistribution *cosThetaDistribution;
@@ -69,12 +109,23 @@ protected:
     virtual void spinDirection(Walker *walker) const;
     virtual void spinPosition(Walker *walker) const;
     virtual void spinTime(Walker *walker) const;
+    virtual void spinBatch_impl(Walker *walkers, size_t n) const;
+    void spinDistributionsBatch(Walker *walkers, size_t n) const;
+    void spinWavelengths(Walker *walkers, size_t n) const;
     virtual BaseObject *clone_impl() const;
     void cloneInto(Source *src) const;
+    void cloneSamplingInto(Source *src) const;
+    bool quasiRandomCoordinate(unsigned int coordinate, MCfloat *u) const;
+    MCfloat draw(const AbstractDistribution *distribution,
+                 unsigned int coordinate) const;
     MCfloat _z0;
 
 private:
     MCfloat wl;
+    vector<MCfloat> spectrumWavelengths, spectrumWeights;
+    AliasDistribution *bandDistribution;
+    QuasiRandomSequence *sequence;
+    MCfloat *point;
 };
 
 
@@ -94,6 +145,7 @@ public:
 private:
     virtual void spinDirection(Walker *walker) const;
     virtual void spinPosition(Walker *walker) const;
+    virtual void spinBatch_impl(Walker *walkers, size_t n) const;
     virtual BaseObject *clone_impl() const;
 };
 
@@ -118,6 +170,7 @@ public:
     ~GaussianBeamSource();
 
 private:
+    virtual void spinBatch_impl(Walker *walkers, size_t n) const;
     virtual BaseObject *clone_impl() const;
 
     void init(MCfloat xFWHM, MCfloat yFWHM);
@@ -144,6 +197,7 @@ public:
     ~IsotropicPointSource();
 
 private:
+    virtual void spinBatch_impl(Walker *walkers, size_t n) const;
     virtual BaseObject *clone_impl() const;
 
     virtual void describe_impl() const;
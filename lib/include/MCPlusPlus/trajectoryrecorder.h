@@ -0,0 +1,87 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRAJECTORYRECORDER_H
+#define TRAJECTORYRECORDER_H
+
+#include "baseobject.h"
+#include "walker.h"
+
+#include <vector>
+
+namespace MCPP {
+
+/**
+ * @brief The TrajectoryRecorder class collects the trajectories of selected
+ * walkers of a single thread
+ *
+ * Points of all the trajectories are appended to a single preallocated arena,
+ * described by one TrajectoryInfo per trajectory. A trajectory is started with
+ * begin(), extended with append() at each step and completed with end() once
+ * the type of the walker is known; trajectories of walker types that are not
+ * selected with setPhotonTypeFlags() are dropped at this point. The content is
+ * meant to be written to the output file (see
+ * H5OutputFile::appendTrajectories()) and cleared whenever the arena fills up,
+ * so that memory usage does not grow with the number of walkers.
+ *
+ * See Simulation::setTrajectorySampling().
+ */
+
+class TrajectoryRecorder : public BaseObject
+{
+public:
+    TrajectoryRecorder(uint threadIndex = 0, BaseObject *parent=NULL);
+    virtual ~TrajectoryRecorder();
+
+    void setPhotonTypeFlags(int value);
+    void reserve(u_int64_t nPoints);
+
+    inline void begin(u_int64_t walker, const MCfloat *r) {
+        current.offset = _points.size() / 3;
+        current.walker = walker;
+        append(r);
+    }
+
+    inline void append(const MCfloat *r) {
+        _points.insert(_points.end(), r, r + 3);
+    }
+
+    inline void end(walkerType type) {
+        if(!(photonTypeFlags & walkerTypeToFlag(type))) {
+            _points.resize(current.offset * 3);
+            return;
+        }
+        current.nPoints = _points.size() / 3 - current.offset;
+        current.type = type;
+        _info.push_back(current);
+    }
+
+    u_int64_t nPoints() const;
+    u_int64_t nTrajectories() const;
+    const MCfloat *points() const;
+    const TrajectoryInfo *info() const;
+    void clear();
+
+private:
+    vector<MCfloat> _points;
+    vector<TrajectoryInfo> _info;
+    TrajectoryInfo current;
+    int photonTypeFlags;
+};
+
+}
+#endif // TRAJECTORYRECORDER_H
@@ -37,8 +37,44 @@ public:
     MCfloat k0[3];  /**< @brief direction unit vector for the
                                 \f$ (n-1) \f$-th step*/
     MCfloat walkTime;  /**< @brief total walk time */
+    MCfloat wavelength;  /**< @brief in vacuum (um) */
+    u_int32_t band;  /**< @brief index of the wavelength in the spectrum of the
+                          source, 0 for monochromatic sources */
     int type;
 };
 
+/**
+ * @brief The WalkerRecord struct holds the raw output of a single exiting
+ * walker
+ *
+ * This is the layout of the compound datasets in the "records" group of the
+ * output file (see H5OutputFile::walkerRecordType()); fields are named as the
+ * struct members.
+ */
+
+struct WalkerRecord {
+    MCfloat x, y;        /**< @brief exit point*/
+    MCfloat t;           /**< @brief walk time*/
+    MCfloat kx, ky, kz;  /**< @brief exit direction unit vector*/
+    u_int64_t nScatter;  /**< @brief number of scattering events*/
+};
+
+/**
+ * @brief The TrajectoryInfo struct describes a trajectory saved by a
+ * TrajectoryRecorder
+ *
+ * This is the layout of the "trajectories/index" dataset of the output file
+ * (see H5OutputFile::trajectoryInfoType()).
+ */
+
+struct TrajectoryInfo {
+    u_int64_t offset;   /**< @brief index of the first point*/
+    u_int64_t nPoints;  /**< @brief number of points, including the entry and
+                             the exit points*/
+    u_int64_t walker;   /**< @brief index of the walker within its thread*/
+    u_int32_t thread;   /**< @brief index of the thread*/
+    int32_t type;       /**< @brief walkerType of the walker*/
+};
+
 }
 #endif // WALKER_H
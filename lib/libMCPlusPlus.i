@@ -1,5 +1,5 @@
 /* File : pymcplusplus.i */
-%module pymcplusplus
+%module(threads="1") pymcplusplus
 
 namespace MCPP {}
 
@@ -9,10 +9,12 @@ namespace MCPP {}
 #include <MCPlusPlus/costhetagenerator.h>
 #include <MCPlusPlus/distributions.h>
 #include <MCPlusPlus/material.h>
+#include <MCPlusPlus/phasefunction.h>
 #include <MCPlusPlus/sample.h>
 #include <MCPlusPlus/gaussianraybundlesource.h>
 #include <MCPlusPlus/MCglobal.h>
 #include <MCPlusPlus/psigenerator.h>
+#include <MCPlusPlus/quasirandom.h>
 #include <MCPlusPlus/histogram.h>
 #include <MCPlusPlus/simulation.h>
 #include <MCPlusPlus/source.h>
@@ -20,6 +22,13 @@ namespace MCPP {}
 
 #include <MCPlusPlus/h5filehelper.h>
 #include <MCPlusPlus/h5outputfile.h>
+#include <MCPlusPlus/recordfile.h>
+#include <MCPlusPlus/rawdatareader.h>
+#include <MCPlusPlus/rawhistogrammer.h>
+#include <MCPlusPlus/outputmerger.h>
+#include <MCPlusPlus/shardlauncher.h>
+#include <MCPlusPlus/trajectoryrecorder.h>
+#include <MCPlusPlus/fluencegrid.h>
 
 #include <H5Cpp.h>
 #include <boost/random.hpp>
@@ -28,8 +37,203 @@ namespace MCPP {}
 #include <MCPlusPlus/h5outputfile.h>
 
 using namespace MCPP;
+
+/*
+ * Read-only views over arrays owned by C++ objects, exposed through the buffer
+ * protocol so that e.g. numpy.asarray() wraps them without copying. Each view
+ * is an MCPPBuffer, which holds a reference to the Python object the view was
+ * taken from, so that the array outlives the view. The arrays can still be
+ * reallocated, e.g. by the next run(), which changes the rawDataGeneration()
+ * of the C++ object: the view then raises BufferError instead of exporting a
+ * dangling buffer. Arrays already wrapping the view share its memory and must
+ * not be used after that either; take them again from a new view.
+ */
+
+static const char *mcppFloatFormat()
+{
+    if(sizeof(MCfloat) == sizeof(float))
+        return "f";
+    if(sizeof(MCfloat) == sizeof(double))
+        return "d";
+    return "g";
+}
+
+static const char *mcppRecordFormat()
+{
+    static string format;
+    if(format.empty()) {
+        string f = mcppFloatFormat();
+        format = "T{" + f + ":x:" + f + ":y:" + f + ":t:" + f + ":kx:" + f
+                + ":ky:" + f + ":kz:Q:nScatter:}";
+    }
+    return format.c_str();
+}
+
+typedef u_int64_t (*MCPPGeneration)(const void *object);
+
+template <class T>
+static u_int64_t mcppGeneration(const void *object)
+{
+    return ((const T *)object)->rawDataGeneration();
+}
+
+struct MCPPBuffer {
+    PyObject_HEAD
+    PyObject *owner;
+    const void *object;
+    MCPPGeneration generation;
+    u_int64_t created;  // generation of object when the view was taken
+    void *buf;
+    const char *format;
+    Py_ssize_t itemSize;
+    Py_ssize_t len;
+    int ndim;
+    Py_ssize_t shape[4];
+    Py_ssize_t strides[4];
+};
+
+// sets a BufferError if the array of the view was reallocated
+static bool mcppBufferStale(MCPPBuffer *b)
+{
+    if(b->generation(b->object) == b->created)
+        return false;
+    PyErr_SetString(PyExc_BufferError, "stale view, the array was reallocated");
+    return true;
+}
+
+static int mcppBufferGet(PyObject *self, Py_buffer *view, int flags)
+{
+    MCPPBuffer *b = (MCPPBuffer *)self;
+    if(flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "read-only view");
+        view->obj = NULL;
+        return -1;
+    }
+    if(mcppBufferStale(b)) {
+        view->obj = NULL;
+        return -1;
+    }
+    view->buf = b->buf;
+    view->obj = self;
+    Py_INCREF(self);
+    view->len = b->len;
+    view->itemsize = b->itemSize;
+    view->readonly = 1;
+    view->ndim = b->ndim;
+    view->format = flags & PyBUF_FORMAT ? (char *)b->format : NULL;
+    view->shape = flags & PyBUF_ND ? b->shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? b->strides
+                                                               : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+// NumPy falls back to the array interface when the buffer cannot be exported,
+// and would otherwise wrap a stale view in an array of objects
+static PyObject *mcppBufferArrayInterface(PyObject *self, void *)
+{
+    if(!mcppBufferStale((MCPPBuffer *)self))
+        PyErr_SetString(PyExc_AttributeError, "__array_interface__");
+    return NULL;
+}
+
+static void mcppBufferDealloc(PyObject *self)
+{
+    PyTypeObject *type = Py_TYPE(self);
+    Py_XDECREF(((MCPPBuffer *)self)->owner);
+    type->tp_free(self);
+    Py_DECREF(type);
+}
+
+static PyTypeObject *mcppBufferType()
+{
+    static PyTypeObject *type = NULL;
+    if(type == NULL) {
+        static PyGetSetDef getset[] = {
+            {(char *)"__array_interface__", mcppBufferArrayInterface, NULL,
+             NULL, NULL},
+            {NULL, NULL, NULL, NULL, NULL}
+        };
+        static PyType_Slot slots[] = {
+            {Py_bf_getbuffer, (void *)mcppBufferGet},
+            {Py_tp_dealloc, (void *)mcppBufferDealloc},
+            {Py_tp_getset, (void *)getset},
+            {0, NULL}
+        };
+        static PyType_Spec spec = {
+            "pymcplusplus.MCPPBuffer", sizeof(MCPPBuffer), 0,
+            Py_TPFLAGS_DEFAULT, slots
+        };
+        type = (PyTypeObject *)PyType_FromSpec(&spec);
+    }
+    return type;
+}
+
+template <class T>
+static PyObject *mcppView(PyObject *owner, const T *object, const void *data,
+                          const char *format, Py_ssize_t itemSize, int ndim,
+                          const Py_ssize_t *shape)
+{
+    static char empty;
+    PyTypeObject *type = mcppBufferType();
+    if(type == NULL)
+        return NULL;
+    MCPPBuffer *b = (MCPPBuffer *)type->tp_alloc(type, 0);
+    if(b == NULL)
+        return NULL;
+    b->len = itemSize;
+    for (int i = ndim - 1; i >= 0; --i) {
+        b->shape[i] = shape[i];
+        b->strides[i] = b->len;
+        b->len *= shape[i];
+    }
+    b->buf = data != NULL && b->len > 0 ? (void *)data : &empty;
+    b->format = format;
+    b->itemSize = itemSize;
+    b->ndim = ndim;
+    b->owner = owner;
+    Py_XINCREF(owner);
+    b->object = object;
+    b->generation = mcppGeneration<T>;
+    b->created = object->rawDataGeneration();
+    return (PyObject *)b;
+}
+
+template <class T>
+static PyObject *mcppFloatView(PyObject *owner, const T *object,
+                               const MCfloat *data, Py_ssize_t rows,
+                               Py_ssize_t cols = 0)
+{
+    Py_ssize_t shape[2] = {rows, cols};
+    return mcppView(owner, object, data, mcppFloatFormat(), sizeof(MCfloat),
+                    cols > 0 ? 2 : 1, shape);
+}
+
+// copies any sequence of numbers (e.g. a list or a numpy array)
+static bool mcppFloatVector(PyObject *seq, vector<MCfloat> *out)
+{
+    PyObject *fast = PySequence_Fast(seq, "expected a sequence of numbers");
+    if(fast == NULL)
+        return false;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(fast);
+    out->resize(n);
+    for (Py_ssize_t i = 0; i < n; ++i) {
+        (*out)[i] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(fast, i));
+    }
+    Py_DECREF(fast);
+    return !PyErr_Occurred();
+}
 %}
 
+// only long-running calls release the GIL, nothing in them calls back into
+// Python
+%nothread;
+%thread MCPP::Simulation::run;
+%thread MCPP::RawHistogrammer::run;
+%thread MCPP::OutputMerger::merge;
+%thread MCPP::ShardLauncher::run;
+
 
 namespace boost {
   namespace random {}
@@ -40,20 +244,214 @@ namespace H5 {}
 
 typedef long long int u_int64_t;
 
+// replaced by the sequence versions below
+%ignore MCPP::TabulatedDistribution::setTable(const MCfloat *, const MCfloat *, size_t);
+%ignore MCPP::AliasDistribution::setTable(const MCfloat *, const MCfloat *, size_t);
+%ignore MCPP::TabulatedPhaseFunction::setTable(const MCfloat *, const MCfloat *,
+                                               size_t);
+%ignore MCPP::Source::setSpectrum(const MCfloat *, const MCfloat *, size_t);
+
 %include "include/MCPlusPlus/walker.h"
 %include "include/MCPlusPlus/baseobject.h"
 %include "include/MCPlusPlus/baserandom.h"
 %include "include/MCPlusPlus/distributions.h"
 %include "include/MCPlusPlus/costhetagenerator.h"
 %include "include/MCPlusPlus/psigenerator.h"
+%include "include/MCPlusPlus/quasirandom.h"
 %include "include/MCPlusPlus/source.h"
 %include "include/MCPlusPlus/material.h"
+%include "include/MCPlusPlus/phasefunction.h"
 %include "include/MCPlusPlus/sample.h"
 %include "include/MCPlusPlus/gaussianraybundlesource.h"
 %include "include/MCPlusPlus/MCglobal.h"
 %include "include/MCPlusPlus/histogram.h"
+%include "include/MCPlusPlus/trajectoryrecorder.h"
+%include "include/MCPlusPlus/fluencegrid.h"
 %include "include/MCPlusPlus/simulation.h"
 %include <boost/random.hpp>
 %include <boost/property_tree/ptree.hpp>
 %include "include/MCPlusPlus/h5filehelper.h"
 %include "include/MCPlusPlus/h5outputfile.h"
+%include "include/MCPlusPlus/recordfile.h"
+%include "include/MCPlusPlus/rawdatareader.h"
+%include "include/MCPlusPlus/rawhistogrammer.h"
+%include "include/MCPlusPlus/outputmerger.h"
+%include "include/MCPlusPlus/shardlauncher.h"
+
+// the views are returned by private methods taking the proxy object that owns
+// the arrays, which the public methods below pass
+%extend MCPP::Histogram {
+    PyObject *_countsView(PyObject *owner) const {
+        Py_ssize_t shape[2] = {0, 0};
+        if($self->rawCounts() != NULL) {
+            shape[0] = $self->nBinsAlong(0);
+            shape[1] = $self->nBinsAlong(1);
+        }
+        return mcppView(owner, $self, $self->rawCounts(), "Q",
+                        sizeof(u_int64_t), $self->is2D() ? 2 : 1, shape);
+    }
+
+    PyObject *_momentsView(PyObject *owner) const {
+        if($self->rawMoments() == NULL)
+            return mcppFloatView(owner, $self, NULL, 0, 0);
+        return mcppFloatView(owner, $self, $self->rawMoments(),
+                             $self->nMomentExponents(), $self->nBinsAlong(0));
+    }
+
+    PyObject *_moments2View(PyObject *owner) const {
+        if($self->rawMoments2() == NULL)
+            return mcppFloatView(owner, $self, NULL, 0, 0);
+        return mcppFloatView(owner, $self, $self->rawMoments2(),
+                             $self->nMomentExponents(), $self->nBinsAlong(0));
+    }
+
+%pythoncode %{
+    def countsView(self):
+        return self._countsView(self)
+
+    def momentsView(self):
+        return self._momentsView(self)
+
+    def moments2View(self):
+        return self._moments2View(self)
+%}
+}
+
+%extend MCPP::TabulatedDistribution {
+    bool setTable(PyObject *x, PyObject *pdf) {
+        vector<MCfloat> xs, ps;
+        if(!mcppFloatVector(x, &xs) || !mcppFloatVector(pdf, &ps)) {
+            PyErr_Clear();
+            return false;
+        }
+        if(xs.size() != ps.size())
+            return false;
+        return $self->setTable(xs.data(), ps.data(), xs.size());
+    }
+}
+
+%extend MCPP::AliasDistribution {
+    bool setTable(PyObject *values, PyObject *weights) {
+        vector<MCfloat> vs, ws;
+        if(!mcppFloatVector(values, &vs) || !mcppFloatVector(weights, &ws)) {
+            PyErr_Clear();
+            return false;
+        }
+        if(vs.size() != ws.size())
+            return false;
+        return $self->setTable(vs.data(), ws.data(), vs.size());
+    }
+}
+
+%extend MCPP::TabulatedPhaseFunction {
+    bool setTable(PyObject *theta, PyObject *value) {
+        vector<MCfloat> ts, vs;
+        if(!mcppFloatVector(theta, &ts) || !mcppFloatVector(value, &vs)) {
+            PyErr_Clear();
+            return false;
+        }
+        if(ts.size() != vs.size())
+            return false;
+        return $self->setTable(ts.data(), vs.data(), ts.size());
+    }
+}
+
+%extend MCPP::Source {
+    bool setSpectrum(PyObject *wavelengths, PyObject *weights) {
+        vector<MCfloat> ls, ws;
+        if(!mcppFloatVector(wavelengths, &ls)
+                || !mcppFloatVector(weights, &ws)) {
+            PyErr_Clear();
+            return false;
+        }
+        if(ls.size() != ws.size())
+            return false;
+        return $self->setSpectrum(ls.data(), ws.data(), ls.size());
+    }
+}
+
+%extend MCPP::FluenceGrid {
+    PyObject *_pathLengthsView(PyObject *owner) const {
+        Py_ssize_t shape[4] = {0, 0, 0, 0};
+        if($self->rawPathLengths() != NULL) {
+            for (uint i = 0; i < 4; ++i) {
+                shape[i] = $self->nBinsAlong(i);
+            }
+        }
+        return mcppView(owner, $self, $self->rawPathLengths(),
+                        mcppFloatFormat(), sizeof(MCfloat), 4, shape);
+    }
+
+%pythoncode %{
+    def pathLengthsView(self):
+        return self._pathLengthsView(self)
+%}
+}
+
+%extend MCPP::Simulation {
+    PyObject *_photonCountersView(PyObject *owner) const {
+        Py_ssize_t shape[1] = {4};
+        return mcppView(owner, $self, $self->photonCounts(), "Q",
+                        sizeof(u_int64_t), 1, shape);
+    }
+
+    PyObject *_exitPointsView(PyObject *owner, MCPP::walkerType type) const {
+        const vector<MCfloat> *v = $self->rawExitPoints(type);
+        return mcppFloatView(owner, $self, v->data(), v->size() / 2, 2);
+    }
+
+    PyObject *_walkTimesView(PyObject *owner, MCPP::walkerType type) const {
+        const vector<MCfloat> *v = $self->rawWalkTimes(type);
+        return mcppFloatView(owner, $self, v->data(), v->size());
+    }
+
+    PyObject *_exitKVectorsView(PyObject *owner,
+                                MCPP::walkerType type) const {
+        const vector<MCfloat> *v = $self->rawExitKVectors(type);
+        Py_ssize_t n = $self->nExitKVectorComponents();
+        if(n == 0)
+            return mcppFloatView(owner, $self, NULL, 0, 0);
+        return mcppFloatView(owner, $self, v->data(), v->size() / n, n);
+    }
+
+    PyObject *_walkerRecordsView(PyObject *owner,
+                                 MCPP::walkerType type) const {
+        const vector<WalkerRecord> *v = $self->rawWalkerRecords(type);
+        Py_ssize_t shape[1] = {(Py_ssize_t)v->size()};
+        return mcppView(owner, $self, v->data(), mcppRecordFormat(),
+                        sizeof(WalkerRecord), 1, shape);
+    }
+
+    size_t nTrajectories() const {
+        const vector<vector<MCfloat> *> *t = $self->trajectories();
+        return t == NULL ? 0 : t->size();
+    }
+
+    PyObject *_trajectoryView(PyObject *owner, size_t index) const {
+        const vector<vector<MCfloat> *> *t = $self->trajectories();
+        if(t == NULL || index >= t->size())
+            return mcppFloatView(owner, $self, NULL, 0, 3);
+        const vector<MCfloat> *v = t->at(index);
+        return mcppFloatView(owner, $self, v->data(), v->size() / 3, 3);
+    }
+
+%pythoncode %{
+    def photonCountersView(self):
+        return self._photonCountersView(self)
+
+    def exitPointsView(self, type):
+        return self._exitPointsView(self, type)
+
+    def walkTimesView(self, type):
+        return self._walkTimesView(self, type)
+
+    def exitKVectorsView(self, type):
+        return self._exitKVectorsView(self, type)
+
+    def walkerRecordsView(self, type):
+        return self._walkerRecordsView(self, type)
+
+    def trajectoryView(self, index):
+        return self._trajectoryView(self, index)
+%}
+}
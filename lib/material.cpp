@@ -26,6 +26,7 @@ Material::Material()
     ls = numeric_limits<MCfloat>::infinity(); //non-scattering medium
     n = 1;
     v = LIGHT_SPEED;
+    phaseFunction = NULL;
 }
 
 Material::~Material()
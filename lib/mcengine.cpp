@@ -0,0 +1,1150 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/mcengine.h>
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <sstream>
+#include <string>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* first word of the states returned by MCEngine::state(), or-ed with the
+ * engine type; tells them apart from the bare mt19937_64 states saved by
+ * older versions */
+#define MCENGINE_MAGIC 0x4d43454e47494e00ULL
+
+using namespace MCPP;
+
+/* the state transition of the engines that are linear over GF(2), advanced
+ * one step at a time, in terms of which their jumps are computed */
+
+class LinearRecurrence
+{
+public:
+    virtual ~LinearRecurrence() {}
+
+    virtual void step() = 0;
+    /** @brief A bit of the state, i.e. a linear function of it */
+    virtual bool probe() const = 0;
+    /** @brief Adds the state, in the layout of MCEngineBackend::save() */
+    virtual void addTo(u_int64_t *words) const = 0;
+};
+
+namespace MCPP {
+
+/**
+ * @brief Interface of the algorithms behind MCEngine
+ */
+
+class MCEngineBackend
+{
+public:
+    virtual ~MCEngineBackend() {}
+
+    virtual enum MCEngineType type() const = 0;
+    /** @brief Generates MCENGINE_BLOCK words */
+    virtual void fill(u_int64_t *out) = 0;
+    virtual size_t stateSize() const = 0;
+    virtual void save(u_int64_t *words) const = 0;
+    virtual bool load(const u_int64_t *words) = 0;
+    /** @brief The base 2 logarithm of the number of steps of jump() */
+    virtual int jumpDistance() const = 0;
+    /** @brief Advances the state by n times 2^log2Distance steps */
+    virtual void jump(u_int64_t n, int log2Distance) = 0;
+    /** @brief The recurrence starting from the current state, NULL if the
+     * engine is not linear */
+    virtual LinearRecurrence *newRecurrence() const {
+        return NULL;
+    }
+};
+
+}
+
+/**
+ * @brief SplitMix64, used to expand 32 bit seeds into the state of the
+ * engines
+ * @param x
+ * @return
+ */
+
+static u_int64_t splitMix64(u_int64_t *x)
+{
+    u_int64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline u_int64_t rotl(u_int64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static void gf2Jump(MCEngineBackend *backend, u_int64_t n, int log2Distance);
+
+
+
+
+// Mersenne Twister
+
+#define MT_N 312
+#define MT_M 156
+
+/* the lower bits of the oldest word, then the upper bits of the next one */
+static inline u_int64_t mtMix(u_int64_t upper, u_int64_t lower, u_int64_t m)
+{
+    const u_int64_t upperMask = ~(u_int64_t)0 << 31;
+    u_int64_t y = (upper & upperMask) | (lower & ~upperMask);
+    return m ^ (y >> 1) ^ ((y & 1) * 0xb5026f5aa96619e9ULL);
+}
+
+class MTRecurrence : public LinearRecurrence
+{
+public:
+    MTRecurrence(const u_int64_t *words) {
+        memcpy(x, words, sizeof(x));
+        i = 0;
+    }
+
+    void step() {
+        x[i] = mtMix(x[i], x[(i + 1) % MT_N], x[(i + MT_M) % MT_N]);
+        i = (i + 1) % MT_N;
+    }
+
+    bool probe() const {
+        return x[i] & 1;
+    }
+
+    void addTo(u_int64_t *words) const {
+        for (int j = i; j < MT_N; ++j) {
+            words[j - i] ^= x[j];
+        }
+        for (int j = 0; j < i; ++j) {
+            words[MT_N - i + j] ^= x[j];
+        }
+    }
+
+private:
+    u_int64_t x[MT_N];
+    int i;
+};
+
+/* MT19937-64 of Nishimura and Matsumoto; each block is one twist of the whole
+ * state, so that the state saved between blocks is the same as that of
+ * boost::random::mt19937_64 right before its own twist. A jump is 2^64 words. */
+
+class MT19937Backend : public MCEngineBackend
+{
+public:
+    MT19937Backend(unsigned int seed) {
+        x[0] = seed;
+        for (u_int64_t i = 1; i < MT_N; ++i) {
+            x[i] = 6364136223846793005ULL * (x[i-1] ^ (x[i-1] >> 62)) + i;
+        }
+    }
+
+    enum MCEngineType type() const {
+        return ENGINE_MT19937_64;
+    }
+
+    void fill(u_int64_t *out) {
+        twist();
+        for (int i = 0; i < MT_N; ++i) {
+            u_int64_t y = x[i];
+            y ^= (y >> 29) & 0x5555555555555555ULL;
+            y ^= (y << 17) & 0x71d67fffeda60000ULL;
+            y ^= (y << 37) & 0xfff7eee000000000ULL;
+            out[i] = y ^ (y >> 43);
+        }
+    }
+
+    size_t stateSize() const {
+        return MT_N;
+    }
+
+    void save(u_int64_t *words) const {
+        memcpy(words, x, sizeof(x));
+    }
+
+    bool load(const u_int64_t *words) {
+        memcpy(x, words, sizeof(x));
+        return true;
+    }
+
+    int jumpDistance() const {
+        return 64;
+    }
+
+    void jump(u_int64_t n, int log2Distance) {
+        gf2Jump(this, n, log2Distance);
+    }
+
+    LinearRecurrence *newRecurrence() const {
+        return new MTRecurrence(x);
+    }
+
+private:
+    void twist() {
+        int i = 0;
+        for (; i < MT_N - MT_M; ++i) {
+            x[i] = mtMix(x[i], x[i + 1], x[i + MT_M]);
+        }
+        for (; i < MT_N - 1; ++i) {
+            x[i] = mtMix(x[i], x[i + 1], x[i + MT_M - MT_N]);
+        }
+        x[MT_N - 1] = mtMix(x[MT_N - 1], x[0], x[MT_M - 1]);
+    }
+
+    u_int64_t x[MT_N];
+};
+
+
+
+
+// xoshiro256++
+
+static inline void xoshiroStep(u_int64_t *s)
+{
+    const u_int64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+}
+
+class XoshiroRecurrence : public LinearRecurrence
+{
+public:
+    XoshiroRecurrence(const u_int64_t *words) {
+        memcpy(s, words, sizeof(s));
+    }
+
+    void step() {
+        xoshiroStep(s);
+    }
+
+    bool probe() const {
+        return s[0] & 1;
+    }
+
+    void addTo(u_int64_t *words) const {
+        for (int i = 0; i < 4; ++i) {
+            words[i] ^= s[i];
+        }
+    }
+
+private:
+    u_int64_t s[4];
+};
+
+/* xoshiro256++ of Blackman and Vigna; a jump is 2^128 words, as their jump() */
+
+class Xoshiro256Backend : public MCEngineBackend
+{
+public:
+    Xoshiro256Backend(unsigned int seed) {
+        u_int64_t x = seed;
+        for (int i = 0; i < 4; ++i) {
+            s[i] = splitMix64(&x);
+        }
+    }
+
+    enum MCEngineType type() const {
+        return ENGINE_XOSHIRO256PP;
+    }
+
+    void fill(u_int64_t *out) {
+        u_int64_t s0 = s[0], s1 = s[1], s2 = s[2], s3 = s[3];
+        for (int i = 0; i < MCENGINE_BLOCK; ++i) {
+            out[i] = rotl(s0 + s3, 23) + s0;
+            const u_int64_t t = s1 << 17;
+            s2 ^= s0;
+            s3 ^= s1;
+            s1 ^= s2;
+            s0 ^= s3;
+            s2 ^= t;
+            s3 = rotl(s3, 45);
+        }
+        s[0] = s0;
+        s[1] = s1;
+        s[2] = s2;
+        s[3] = s3;
+    }
+
+    size_t stateSize() const {
+        return 4;
+    }
+
+    void save(u_int64_t *words) const {
+        memcpy(words, s, sizeof(s));
+    }
+
+    bool load(const u_int64_t *words) {
+        if((words[0] | words[1] | words[2] | words[3]) == 0)
+            return false;
+        memcpy(s, words, sizeof(s));
+        return true;
+    }
+
+    int jumpDistance() const {
+        return 128;
+    }
+
+    void jump(u_int64_t n, int log2Distance) {
+        gf2Jump(this, n, log2Distance);
+    }
+
+    LinearRecurrence *newRecurrence() const {
+        return new XoshiroRecurrence(s);
+    }
+
+private:
+    u_int64_t s[4];
+};
+
+
+
+
+// PCG64
+
+typedef unsigned __int128 u_int128_t;
+
+/* PCG XSL-RR 128/64 of O'Neill, as numpy's PCG64; a jump is 2^64 words */
+
+class PCG64Backend : public MCEngineBackend
+{
+public:
+    /* same initialization as pcg_setseq_128_srandom_r(), with the initial
+     * state and the stream drawn from the seed */
+    PCG64Backend(unsigned int seed) {
+        u_int64_t x = seed;
+        u_int128_t initState = make(splitMix64(&x), splitMix64(&x));
+        u_int128_t initSeq = make(splitMix64(&x), splitMix64(&x));
+        inc = (initSeq << 1) | 1;
+        state = 0;
+        step();
+        state += initState;
+        step();
+    }
+
+    enum MCEngineType type() const {
+        return ENGINE_PCG64;
+    }
+
+    void fill(u_int64_t *out) {
+        for (int i = 0; i < MCENGINE_BLOCK; ++i) {
+            step();
+            u_int64_t x = (u_int64_t)(state >> 64) ^ (u_int64_t)state;
+            unsigned int rot = state >> 122;
+            out[i] = (x >> rot) | (x << ((-rot) & 63));
+        }
+    }
+
+    size_t stateSize() const {
+        return 4;
+    }
+
+    void save(u_int64_t *words) const {
+        words[0] = state >> 64;
+        words[1] = state;
+        words[2] = inc >> 64;
+        words[3] = inc;
+    }
+
+    bool load(const u_int64_t *words) {
+        if((words[3] & 1) == 0)
+            return false;
+        state = make(words[0], words[1]);
+        inc = make(words[2], words[3]);
+        return true;
+    }
+
+    int jumpDistance() const {
+        return 64;
+    }
+
+    /* the n * 2^log2Distance steps of the LCG, modulo its period of 2^128,
+     * are composed in O(log) time, see Brown, "Random number generation with
+     * arbitrary strides" */
+    void jump(u_int64_t n, int log2Distance) {
+        if(log2Distance >= 128)
+            return;
+        u_int128_t delta = (u_int128_t)n << log2Distance;
+        u_int128_t mult = multiplier(), plus = inc;
+        u_int128_t accMult = 1, accPlus = 0;
+        while(delta > 0) {
+            if(delta & 1) {
+                accMult *= mult;
+                accPlus = accPlus * mult + plus;
+            }
+            plus = (mult + 1) * plus;
+            mult *= mult;
+            delta >>= 1;
+        }
+        state = accMult * state + accPlus;
+    }
+
+private:
+    static u_int128_t make(u_int64_t high, u_int64_t low) {
+        return ((u_int128_t)high << 64) | low;
+    }
+
+    static u_int128_t multiplier() {
+        return make(2549297995355413924ULL, 4865540595714422341ULL);
+    }
+
+    void step() {
+        state = state * multiplier() + inc;
+    }
+
+    u_int128_t state, inc;
+};
+
+
+
+
+// SFMT
+
+#define SFMT_N 156
+#define SFMT_POS1 122
+#define SFMT_SL1 18
+#define SFMT_SL2 1
+#define SFMT_SR1 11
+#define SFMT_SR2 1
+#define SFMT_MSK1 0xdfffffefU
+#define SFMT_MSK2 0xddfecb7fU
+#define SFMT_MSK3 0xbffaffffU
+#define SFMT_MSK4 0xbffffff6U
+
+static void sfmtShift128(const u_int32_t *in, u_int32_t *out, bool left)
+{
+    u_int64_t th = ((u_int64_t)in[3] << 32) | in[2];
+    u_int64_t tl = ((u_int64_t)in[1] << 32) | in[0];
+    u_int64_t oh, ol;
+    if(left) {
+        oh = (th << (SFMT_SL2 * 8)) | (tl >> (64 - SFMT_SL2 * 8));
+        ol = tl << (SFMT_SL2 * 8);
+    }
+    else {
+        oh = th >> (SFMT_SR2 * 8);
+        ol = (tl >> (SFMT_SR2 * 8)) | (th << (64 - SFMT_SR2 * 8));
+    }
+    out[0] = ol;
+    out[1] = ol >> 32;
+    out[2] = oh;
+    out[3] = oh >> 32;
+}
+
+/* computes the new 128 bit word a from the old a, the one POS1 words after it
+ * (b) and the last two words (c, then d) */
+static inline void sfmtRecursion(u_int32_t *a, const u_int32_t *b,
+                                 const u_int32_t *c, const u_int32_t *d)
+{
+    static const u_int32_t mask[4] = {
+        SFMT_MSK1, SFMT_MSK2, SFMT_MSK3, SFMT_MSK4};
+    u_int32_t x[4], y[4];
+    sfmtShift128(a, x, true);
+    sfmtShift128(c, y, false);
+    for (int k = 0; k < 4; ++k) {
+        a[k] = a[k] ^ x[k] ^ ((b[k] >> SFMT_SR1) & mask[k]) ^ y[k]
+                ^ (d[k] << SFMT_SL1);
+    }
+}
+
+class SFMTRecurrence : public LinearRecurrence
+{
+public:
+    SFMTRecurrence(const u_int64_t *words) {
+        memcpy(s, words, sizeof(s));
+        i = 0;
+    }
+
+    void step() {
+        sfmtRecursion(s + 4 * i, s + 4 * ((i + SFMT_POS1) % SFMT_N),
+                      s + 4 * ((i + SFMT_N - 2) % SFMT_N),
+                      s + 4 * ((i + SFMT_N - 1) % SFMT_N));
+        i = (i + 1) % SFMT_N;
+    }
+
+    bool probe() const {
+        return s[4 * i] & 1;
+    }
+
+    void addTo(u_int64_t *words) const {
+        const u_int64_t *w = (const u_int64_t *)s;
+        for (int j = 2 * i; j < 2 * SFMT_N; ++j) {
+            words[j - 2 * i] ^= w[j];
+        }
+        for (int j = 0; j < 2 * i; ++j) {
+            words[2 * (SFMT_N - i) + j] ^= w[j];
+        }
+    }
+
+private:
+    u_int32_t s[4 * SFMT_N];
+    int i;
+};
+
+/* SFMT19937 of Saito and Matsumoto, whose whole state of 156 128 bit words is
+ * regenerated at each block (with SSE2 where available) and read as 312 64
+ * bit words. A jump is 2^64 128 bit words. */
+
+class SFMTBackend : public MCEngineBackend
+{
+public:
+    SFMTBackend(unsigned int seed) {
+        u_int32_t *s = state32();
+        s[0] = seed;
+        for (u_int32_t i = 1; i < 4 * SFMT_N; ++i) {
+            s[i] = 1812433253U * (s[i-1] ^ (s[i-1] >> 30)) + i;
+        }
+        certifyPeriod();
+    }
+
+    enum MCEngineType type() const {
+        return ENGINE_SFMT19937;
+    }
+
+    void fill(u_int64_t *out) {
+        generateAll();
+        const u_int32_t *s = state32();
+        for (int i = 0; i < MCENGINE_BLOCK; ++i) {
+            out[i] = s[2 * i] | ((u_int64_t)s[2 * i + 1] << 32);
+        }
+    }
+
+    size_t stateSize() const {
+        return 2 * SFMT_N;
+    }
+
+    void save(u_int64_t *words) const {
+        memcpy(words, state, sizeof(state));
+    }
+
+    bool load(const u_int64_t *words) {
+        memcpy(state, words, sizeof(state));
+        return true;
+    }
+
+    int jumpDistance() const {
+        return 64;
+    }
+
+    void jump(u_int64_t n, int log2Distance) {
+        gf2Jump(this, n, log2Distance);
+    }
+
+    LinearRecurrence *newRecurrence() const {
+        return new SFMTRecurrence(state);
+    }
+
+private:
+    u_int32_t *state32() {
+        return (u_int32_t *)state;
+    }
+
+    const u_int32_t *state32() const {
+        return (const u_int32_t *)state;
+    }
+
+    void certifyPeriod() {
+        static const u_int32_t parity[4] = {
+            0x00000001U, 0x00000000U, 0x00000000U, 0x13c9e684U};
+        u_int32_t *s = state32();
+        u_int32_t inner = 0;
+        for (int i = 0; i < 4; ++i) {
+            inner ^= s[i] & parity[i];
+        }
+        for (int i = 16; i > 0; i >>= 1) {
+            inner ^= inner >> i;
+        }
+        if(inner & 1)
+            return;
+        for (int i = 0; i < 4; ++i) {
+            for (u_int32_t work = 1; work != 0; work <<= 1) {
+                if(work & parity[i]) {
+                    s[i] ^= work;
+                    return;
+                }
+            }
+        }
+    }
+
+#ifdef __SSE2__
+    static inline __m128i recursion(__m128i a, __m128i b, __m128i c,
+                                    __m128i d, __m128i mask) {
+        __m128i y = _mm_and_si128(_mm_srli_epi32(b, SFMT_SR1), mask);
+        __m128i z = _mm_xor_si128(_mm_srli_si128(c, SFMT_SR2), a);
+        z = _mm_xor_si128(z, _mm_slli_epi32(d, SFMT_SL1));
+        z = _mm_xor_si128(z, _mm_slli_si128(a, SFMT_SL2));
+        return _mm_xor_si128(z, y);
+    }
+
+    void generateAll() {
+        __m128i *s = (__m128i *)state;
+        const __m128i mask = _mm_set_epi32(SFMT_MSK4, SFMT_MSK3, SFMT_MSK2,
+                                           SFMT_MSK1);
+        __m128i r1 = _mm_loadu_si128(&s[SFMT_N - 2]);
+        __m128i r2 = _mm_loadu_si128(&s[SFMT_N - 1]);
+        for (int i = 0; i < SFMT_N; ++i) {
+            int j = i < SFMT_N - SFMT_POS1 ? i + SFMT_POS1
+                                           : i + SFMT_POS1 - SFMT_N;
+            __m128i r = recursion(_mm_loadu_si128(&s[i]),
+                                  _mm_loadu_si128(&s[j]), r1, r2, mask);
+            _mm_storeu_si128(&s[i], r);
+            r1 = r2;
+            r2 = r;
+        }
+    }
+#else
+    void generateAll() {
+        u_int32_t *s = state32();
+        const u_int32_t *r1 = &s[4 * (SFMT_N - 2)];
+        const u_int32_t *r2 = &s[4 * (SFMT_N - 1)];
+        for (int i = 0; i < SFMT_N; ++i) {
+            int j = i < SFMT_N - SFMT_POS1 ? i + SFMT_POS1
+                                           : i + SFMT_POS1 - SFMT_N;
+            sfmtRecursion(&s[4 * i], &s[4 * j], r1, r2);
+            r1 = r2;
+            r2 = &s[4 * i];
+        }
+    }
+#endif
+
+    u_int64_t state[2 * SFMT_N];
+};
+
+
+
+
+// MCEngine
+
+static MCEngineBackend *newBackend(unsigned int seed, MCEngineType type)
+{
+    switch (type) {
+    case ENGINE_XOSHIRO256PP:
+        return new Xoshiro256Backend(seed);
+    case ENGINE_PCG64:
+        return new PCG64Backend(seed);
+    case ENGINE_SFMT19937:
+        return new SFMTBackend(seed);
+    case ENGINE_MT19937_64:
+    default:
+        return new MT19937Backend(seed);
+    }
+}
+
+
+
+
+// Jumps of the GF(2)-linear engines
+
+/* polynomials over GF(2): bit i % 64 of word i / 64 is the coefficient of x^i */
+typedef vector<u_int64_t> GF2Poly;
+
+struct JumpPolynomial
+{
+    int degree;
+    GF2Poly minimal;  // of the state transition
+    GF2Poly jump;  // x^(2^log2Distance) modulo minimal
+};
+
+static boost::mutex jumpMutex;
+
+static inline bool coefficient(const GF2Poly &p, size_t i)
+{
+    return (p[i / 64] >> (i % 64)) & 1;
+}
+
+static int degree(const GF2Poly &p)
+{
+    for (size_t w = p.size(); w-- > 0;) {
+        if(p[w])
+            return 64 * w + 63 - __builtin_clzll(p[w]);
+    }
+    return -1;
+}
+
+/* a += b x^shift, the terms beyond the size of a being dropped */
+static void addShifted(GF2Poly *a, const GF2Poly &b, size_t shift)
+{
+    u_int64_t *dest = a->data() + shift / 64;
+    const size_t room = a->size() - shift / 64;
+    const size_t n = std::min(b.size(), room);
+    const unsigned int bits = shift % 64;
+    if(bits == 0) {
+        for (size_t i = 0; i < n; ++i) {
+            dest[i] ^= b[i];
+        }
+        return;
+    }
+    dest[0] ^= b[0] << bits;
+    for (size_t i = 1; i < n; ++i) {
+        dest[i] ^= (b[i] << bits) | (b[i - 1] >> (64 - bits));
+    }
+    if(n < room)
+        dest[n] ^= b[n - 1] >> (64 - bits);
+}
+
+static GF2Poly reduce(GF2Poly c, const JumpPolynomial &j)
+{
+    for (int i = degree(c); i >= j.degree; --i) {
+        if(coefficient(c, i))
+            addShifted(&c, j.minimal, i - j.degree);
+    }
+    c.resize(j.degree / 64 + 1);
+    return c;
+}
+
+static GF2Poly multiply(const GF2Poly &a, const GF2Poly &b,
+                        const JumpPolynomial &j)
+{
+    GF2Poly c(a.size() + b.size(), 0);
+    for (int i = degree(a); i >= 0; --i) {
+        if(coefficient(a, i))
+            addShifted(&c, b, i);
+    }
+    return reduce(c, j);
+}
+
+/* squaring only spreads the bits, as the cross terms cancel */
+static GF2Poly square(const GF2Poly &a, const JumpPolynomial &j)
+{
+    GF2Poly c(2 * a.size());
+    for (size_t w = 0; w < a.size(); ++w) {
+        for (int half = 0; half < 2; ++half) {
+            u_int64_t v = (a[w] >> (32 * half)) & 0xffffffffULL;
+            v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+            v = (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+            v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+            v = (v | (v << 2)) & 0x3333333333333333ULL;
+            v = (v | (v << 1)) & 0x5555555555555555ULL;
+            c[2 * w + half] = v;
+        }
+    }
+    return reduce(c, j);
+}
+
+/**
+ * @brief Berlekamp-Massey algorithm: the minimal polynomial of a linearly
+ * recurring sequence of n bits, n being at least twice its degree
+ * @param s
+ * @param n
+ * @param j
+ */
+
+static void minimalPolynomial(const GF2Poly &s, size_t n, JumpPolynomial *j)
+{
+    // the sequence reversed, so that the discrepancy is the parity of the
+    // product of the connection polynomial with a window of it
+    GF2Poly r(n / 64 + 2, 0);
+    for (size_t i = 0; i < n; ++i) {
+        if(coefficient(s, i))
+            r[(n - 1 - i) / 64] |= (u_int64_t)1 << ((n - 1 - i) % 64);
+    }
+    GF2Poly c(n / 64 + 2, 0), b(n / 64 + 2, 0), t;
+    c[0] = b[0] = 1;
+    size_t L = 0, m = 1;
+    for (size_t k = 0; k < n; ++k) {
+        u_int64_t d = 0;
+        for (size_t w = 0; w <= L / 64; ++w) {
+            size_t offset = n - 1 - k + 64 * w;
+            unsigned int bits = offset % 64;
+            u_int64_t window = r[offset / 64] >> bits;
+            if(bits)
+                window |= r[offset / 64 + 1] << (64 - bits);
+            d ^= c[w] & window;
+        }
+        if(!__builtin_parityll(d)) {
+            ++m;
+        }
+        else if(2 * L <= k) {
+            t = c;
+            addShifted(&c, b, m);
+            L = k + 1 - L;
+            b = t;
+            m = 1;
+        }
+        else {
+            addShifted(&c, b, m);
+            ++m;
+        }
+    }
+
+    // the characteristic polynomial is the reciprocal of the connection one
+    j->degree = L;
+    j->minimal.assign(L / 64 + 1, 0);
+    for (size_t i = 0; i <= L; ++i) {
+        if(coefficient(c, L - i))
+            j->minimal[i / 64] |= (u_int64_t)1 << (i % 64);
+    }
+}
+
+/**
+ * @brief The jump polynomial of the given engine type and distance, computed
+ * on first use
+ * @param type
+ * @param log2Distance
+ * @return
+ *
+ *
+ * The minimal polynomial of the state transition is found once per engine
+ * type from the sequence of a bit of the state, starting from a seeded state,
+ * which has components along all its invariant subspaces.
+ */
+
+static const JumpPolynomial &jumpPolynomial(MCEngineType type,
+                                            int log2Distance)
+{
+    static JumpPolynomial minimal[ENGINE_SFMT19937 + 1];
+    static std::map<std::pair<int, int>, JumpPolynomial> cache;
+    boost::lock_guard<boost::mutex> lock(jumpMutex);
+    JumpPolynomial &j = cache[std::make_pair((int)type, log2Distance)];
+    if(!j.jump.empty())
+        return j;
+
+    JumpPolynomial &m = minimal[type];
+    if(m.minimal.empty()) {
+        MCEngineBackend *backend = newBackend(5489, type);
+        LinearRecurrence *r = backend->newRecurrence();
+        size_t n = 2 * 64 * backend->stateSize();
+        GF2Poly s(n / 64 + 1, 0);
+        for (size_t k = 0; k < n; ++k) {
+            if(r->probe())
+                s[k / 64] |= (u_int64_t)1 << (k % 64);
+            r->step();
+        }
+        delete r;
+        delete backend;
+        minimalPolynomial(s, n, &m);
+    }
+    j.degree = m.degree;
+    j.minimal = m.minimal;
+
+    GF2Poly p(j.degree / 64 + 1, 0);
+    p[0] = 2;
+    for (int i = 0; i < log2Distance; ++i) {
+        p = square(p, j);
+    }
+    j.jump = p;
+    return j;
+}
+
+/**
+ * @brief Advances a GF(2)-linear engine by n times 2^log2Distance steps
+ * @param backend
+ * @param n
+ * @param log2Distance
+ *
+ *
+ * With \f$ p(x) \f$ the minimal polynomial of the transition \f$ T \f$ and
+ * \f$ q(x) = x^k \bmod p(x) \f$, \f$ T^k = q(T) \f$: the jumped state is the
+ * sum of the states of the next \f$ \deg p \f$ steps selected by the
+ * coefficients of \f$ q \f$ (Haramoto et al., "Efficient jump ahead for
+ * F2-linear random number generators").
+ */
+
+static void gf2Jump(MCEngineBackend *backend, u_int64_t n, int log2Distance)
+{
+    if(n == 0)
+        return;
+    const JumpPolynomial &j = jumpPolynomial(backend->type(), log2Distance);
+    // q = jump^n, by squaring
+    GF2Poly q, power = j.jump;
+    while(true) {
+        if(n & 1)
+            q = q.empty() ? power : multiply(q, power, j);
+        n >>= 1;
+        if(n == 0)
+            break;
+        power = square(power, j);
+    }
+
+    vector<u_int64_t> sum(backend->stateSize(), 0);
+    LinearRecurrence *r = backend->newRecurrence();
+    for (int i = 0; i <= degree(q); ++i) {
+        if(coefficient(q, i))
+            r->addTo(sum.data());
+        r->step();
+    }
+    delete r;
+    backend->load(sum.data());
+}
+
+/**
+ * @brief Constructs an engine of the given type
+ * @param seed
+ * @param type
+ */
+
+MCEngine::MCEngine(unsigned int seed, MCEngineType type)
+{
+    backend = newBackend(seed, type);
+    blockStart.resize(backend->stateSize());
+    pos = MCENGINE_BLOCK;
+    drawsOffset = -(u_int64_t)MCENGINE_BLOCK;
+}
+
+MCEngine::~MCEngine()
+{
+    delete backend;
+}
+
+void MCEngine::refill()
+{
+    backend->save(blockStart.data());
+    backend->fill(buf);
+    drawsOffset += pos;
+    pos = 0;
+}
+
+/**
+ * @brief Generates n words at once
+ * @param out
+ * @param n
+ *
+ *
+ * The words are the same that n calls to operator() would return.
+ */
+
+void MCEngine::generate(result_type *out, size_t n)
+{
+    while(n > 0) {
+        if(pos == MCENGINE_BLOCK)
+            refill();
+        size_t m = std::min<size_t>(n, MCENGINE_BLOCK - pos);
+        memcpy(out, buf + pos, m * sizeof(result_type));
+        pos += m;
+        out += m;
+        n -= m;
+    }
+}
+
+MCEngineType MCEngine::type() const
+{
+    return backend->type();
+}
+
+/**
+ * @brief The name of the given engine type, as used in the text form of the
+ * state
+ * @param type
+ * @return
+ */
+
+const char *MCEngine::typeName(MCEngineType type)
+{
+    switch (type) {
+    case ENGINE_XOSHIRO256PP:
+        return "xoshiro256++";
+    case ENGINE_PCG64:
+        return "pcg64";
+    case ENGINE_SFMT19937:
+        return "sfmt19937";
+    case ENGINE_MT19937_64:
+    default:
+        return "mt19937_64";
+    }
+}
+
+/**
+ * @brief The state of the engine as an array of words
+ * @return
+ *
+ *
+ * The state holds the engine type, the number of words of the current block
+ * already handed out and the state of the algorithm at the start of the
+ * block, from which the block is generated again when the state is restored.
+ * Its size only depends on the engine type.
+ */
+
+vector<u_int64_t> MCEngine::state() const
+{
+    vector<u_int64_t> s(2 + backend->stateSize());
+    s[0] = MCENGINE_MAGIC | type();
+    s[1] = pos;
+    if(pos < MCENGINE_BLOCK)
+        std::copy(blockStart.begin(), blockStart.end(), s.begin() + 2);
+    else
+        backend->save(&s[2]);
+    return s;
+}
+
+/**
+ * @brief Restores a state returned by state()
+ * @param state
+ * @return false if the state is invalid, in which case the engine is left
+ * unchanged
+ *
+ *
+ * The engine takes the type of the state.
+ */
+
+bool MCEngine::setState(const vector<u_int64_t> &state)
+{
+    MCEngineBackend *b;
+    size_t position = MCENGINE_BLOCK;
+    const u_int64_t *words = state.data();
+    if(state.size() == MT_N && (state[0] & ~0xffULL) != MCENGINE_MAGIC) {
+        b = new MT19937Backend(0);  // older versions
+    }
+    else {
+        if(state.size() < 2 || (state[0] & ~0xffULL) != MCENGINE_MAGIC
+                || (state[0] & 0xff) > ENGINE_SFMT19937
+                || state[1] > MCENGINE_BLOCK)
+            return false;
+        b = newBackend(0, (MCEngineType)(state[0] & 0xff));
+        position = state[1];
+        words += 2;
+    }
+    if(state.size() != (size_t)(words - state.data()) + b->stateSize()
+            || !b->load(words)) {
+        delete b;
+        return false;
+    }
+    u_int64_t d = draws();
+    delete backend;
+    backend = b;
+    blockStart.resize(backend->stateSize());
+    pos = MCENGINE_BLOCK;
+    if(position < MCENGINE_BLOCK) {
+        refill();
+        pos = position;
+    }
+    drawsOffset = d - pos;
+    return true;
+}
+
+/**
+ * @brief Advances the engine by n jumps
+ * @param n
+ *
+ *
+ * A jump skips at least \f$ 2^{64} \f$ words: \f$ 2^{64} \f$ for
+ * ENGINE_MT19937_64 and ENGINE_PCG64, \f$ 2^{65} \f$ for ENGINE_SFMT19937 and
+ * \f$ 2^{128} \f$ for ENGINE_XOSHIRO256PP. Engines jumped by 0, 1, 2, ... jumps
+ * from the same state therefore generate non-overlapping streams, as long as
+ * each of them draws fewer words than that.
+ *
+ * The jumps of the Mersenne Twisters and xoshiro256++ are computed with the
+ * minimal polynomial of the engine, which is found on first use (a fraction
+ * of a second for the Mersenne Twisters); a jump of the Mersenne Twisters then
+ * takes a few milliseconds, those of the other engines are negligible.
+ */
+
+void MCEngine::jump(u_int64_t n)
+{
+    jump(n, backend->jumpDistance());
+}
+
+/**
+ * @brief Advances the engine by n times \f$ 2^{log2Distance} \f$ steps
+ * @param n
+ * @param log2Distance
+ *
+ *
+ * A step yields a word, except for ENGINE_SFMT19937, whose steps yield 2
+ * words. jump(n) is the same as jump(n, d) with the distance d of the engine
+ * (64, or 128 for ENGINE_XOSHIRO256PP). Short jumps are the same as discarding
+ * words, which is how the jumps of the Mersenne Twisters are tested.
+ */
+
+void MCEngine::jump(u_int64_t n, int log2Distance)
+{
+    if(pos == MCENGINE_BLOCK) {
+        backend->jump(n, log2Distance);
+        return;
+    }
+    size_t position = pos;
+    u_int64_t d = draws();
+    backend->load(blockStart.data());
+    backend->jump(n, log2Distance);
+    refill();
+    pos = position;
+    drawsOffset = d - pos;
+}
+
+/**
+ * @brief Writes the state of the engine in text form
+ * @param os
+ * @param engine
+ * @return
+ */
+
+ostream &MCPP::operator<<(ostream &os, const MCEngine &engine)
+{
+    vector<u_int64_t> s = engine.state();
+    os << MCEngine::typeName(engine.type());
+    for (size_t i = 1; i < s.size(); ++i) {
+        os << " " << s[i];
+    }
+    return os;
+}
+
+/**
+ * @brief Reads a state written by operator<<
+ * @param is
+ * @param engine
+ * @return
+ *
+ *
+ * The failbit is set if the state is invalid.
+ */
+
+istream &MCPP::operator>>(istream &is, MCEngine &engine)
+{
+    string name;
+    if(!(is >> name))
+        return is;
+    vector<u_int64_t> s;
+    size_t n = 0;
+    if(!name.empty() && isdigit(name[0])) {
+        // bare mt19937_64 state
+        s.push_back(strtoull(name.c_str(), NULL, 10));
+        n = MT_N;
+    }
+    else {
+        int type = 0;
+        while(type <= ENGINE_SFMT19937
+              && name != MCEngine::typeName((MCEngineType)type))
+            ++type;
+        if(type > ENGINE_SFMT19937) {
+            is.setstate(ios::failbit);
+            return is;
+        }
+        MCEngine tmp(0, (MCEngineType)type);
+        s.push_back(MCENGINE_MAGIC | type);
+        n = 2 + tmp.backend->stateSize();
+    }
+    u_int64_t w;
+    while(s.size() < n && is >> w) {
+        s.push_back(w);
+    }
+    if(s.size() < n || !engine.setState(s))
+        is.setstate(ios::failbit);
+    return is;
+}
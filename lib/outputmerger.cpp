@@ -0,0 +1,236 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/outputmerger.h>
+#include <MCPlusPlus/h5outputfile.h>
+
+using namespace MCPP;
+
+OutputMerger::OutputMerger(BaseObject *parent) :
+    BaseObject(parent)
+{
+    memset(_photonCounters, 0, 4 * sizeof(u_int64_t));
+}
+
+OutputMerger::~OutputMerger()
+{
+    clear();
+}
+
+/**
+ * @brief Adds a file to be merged
+ * @param fileName
+ *
+ *
+ * The file must not be the output file of merge().
+ */
+
+void OutputMerger::addInputFile(const char *fileName)
+{
+    inputFiles.push_back(fileName);
+}
+
+/**
+ * @brief Merges all the input files in a new file
+ * @param outputFileName Overwritten if it already exists
+ * @return false if an input file cannot be read or its histograms do not
+ * match the ones of the first input file
+ */
+
+bool OutputMerger::merge(const char *outputFileName)
+{
+    boost::lock_guard<boost::recursive_mutex> h5Lock(h5Mutex);
+    clear();
+    if(inputFiles.empty()) {
+        logMessage("No input files");
+        return false;
+    }
+    for (size_t i = 0; i < inputFiles.size(); ++i) {
+        if(!mergeFile(inputFiles[i].c_str(), i == 0))
+            return false;
+    }
+
+    H5OutputFile out;
+    if(!out.newFile(outputFileName, false))
+        return false;
+    out.savePhotonCounts(_photonCounters);
+
+    H5FileHelper first;
+    if(first.openFile(inputFiles[0].c_str())) {
+        out.copyFrom(&first, "sample");
+        first.close();
+    }
+
+    u_int64_t total = totalPhotons();
+    for (size_t i = 0; i < hists.size(); ++i) {
+        Histogram *h = hists[i];
+        h->setScale(total);
+        h->saveToFile(&out);
+        h->saveRawCounts(&out, ("raw-histograms/" + h->name()).c_str());
+    }
+    for (size_t i = 0; i < grids.size(); ++i) {
+        grids[i]->saveToFile(&out);
+    }
+    out.close();
+
+    logMessage("%lu files merged in %s (%llu walkers)", inputFiles.size(),
+               outputFileName, total);
+    return true;
+}
+
+/**
+ * @brief The merged photon counters
+ * @return Array of 4 elements, one per walkerType
+ *
+ *
+ * Only valid after merge().
+ */
+
+const u_int64_t *OutputMerger::photonCounters() const
+{
+    return _photonCounters;
+}
+
+/**
+ * @brief The total number of photons of all the input files
+ * @return
+ *
+ *
+ * This is the normalization of the merged histograms. Only valid after
+ * merge().
+ */
+
+u_int64_t OutputMerger::totalPhotons() const
+{
+    u_int64_t total = 0;
+    for (uint i = 0; i < 4; ++i) {
+        total += _photonCounters[i];
+    }
+    return total;
+}
+
+bool OutputMerger::mergeFile(const char *fileName, bool first)
+{
+    H5OutputFile file;
+    if(!file.openFile(fileName)) {
+        logMessage("Cannot open %s", fileName);
+        return false;
+    }
+    const u_int64_t *counters = file.photonCounters();
+    for (uint i = 0; i < 4; ++i) {
+        _photonCounters[i] += counters[i];
+    }
+
+    hsize_t n = file.nChildren("raw-histograms");
+    if(!first && n != hists.size()) {
+        logMessage("%s has %llu histograms instead of %lu", fileName, n,
+                   hists.size());
+        return false;
+    }
+
+    for (hsize_t i = 0; i < n; ++i) {
+        string name = file.childName("raw-histograms", i);
+        string group = "raw-histograms/" + name;
+        Histogram *h = new Histogram();
+        h->setName(name.c_str());
+        if(!h->loadLayout(&file, group.c_str()) || !h->initialize()
+                || !h->loadRawCounts(&file, group.c_str())) {
+            logMessage("Invalid histogram %s in %s", name.c_str(), fileName);
+            delete h;
+            return false;
+        }
+        if(first) {
+            hists.push_back(h);
+            continue;
+        }
+
+        Histogram *dest = NULL;
+        for (size_t j = 0; j < hists.size(); ++j) {
+            if(hists[j]->name() == name)
+                dest = hists[j];
+        }
+        if(dest == NULL || !dest->hasSameLayout(h)) {
+            logMessage("Histogram %s in %s does not match the first file",
+                       name.c_str(), fileName);
+            delete h;
+            return false;
+        }
+        // the errors of replicates and of independent walkers cannot be
+        // combined
+        if((dest->replicateCount() > 0) != (h->replicateCount() > 0)) {
+            logMessage("Histogram %s in %s mixes quasi-random and random "
+                       "results", name.c_str(), fileName);
+            delete h;
+            return false;
+        }
+        dest->appendCounts(h);
+        delete h;
+    }
+
+    n = file.nChildren("fluence");
+    if(!first && n != grids.size()) {
+        logMessage("%s has %llu fluence grids instead of %lu", fileName, n,
+                   grids.size());
+        return false;
+    }
+    for (hsize_t i = 0; i < n; ++i) {
+        string name = file.childName("fluence", i);
+        string group = "fluence/" + name;
+        FluenceGrid *g = new FluenceGrid();
+        g->setName(name.c_str());
+        if(!g->loadLayout(&file, group.c_str()) || !g->initialize()
+                || !g->loadCounts(&file, group.c_str())) {
+            logMessage("Invalid fluence grid %s in %s", name.c_str(),
+                       fileName);
+            delete g;
+            return false;
+        }
+        if(first) {
+            grids.push_back(g);
+            continue;
+        }
+
+        FluenceGrid *dest = NULL;
+        for (size_t j = 0; j < grids.size(); ++j) {
+            if(grids[j]->name() == name)
+                dest = grids[j];
+        }
+        if(dest == NULL || !dest->hasSameLayout(g)) {
+            logMessage("Fluence grid %s in %s does not match the first file",
+                       name.c_str(), fileName);
+            delete g;
+            return false;
+        }
+        dest->appendCounts(g);
+        delete g;
+    }
+    file.close();
+    return true;
+}
+
+void OutputMerger::clear()
+{
+    for (size_t i = 0; i < hists.size(); ++i) {
+        delete hists[i];
+    }
+    hists.clear();
+    for (size_t i = 0; i < grids.size(); ++i) {
+        delete grids[i];
+    }
+    grids.clear();
+    memset(_photonCounters, 0, 4 * sizeof(u_int64_t));
+}
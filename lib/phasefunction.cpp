@@ -0,0 +1,344 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/phasefunction.h>
+#include <MCPlusPlus/h5filehelper.h>
+
+#include <boost/math/constants/constants.hpp>
+#include <algorithm>
+#include <complex>
+
+using namespace boost::math::constants;
+using namespace MCPP;
+
+PhaseFunction::PhaseFunction() :
+    BaseObject()
+{
+    nAngles = 4001;
+    current = 0;
+}
+
+/**
+ * @brief Tabulates the phase function at the given wavelength
+ * @param um Wavelength in vacuum
+ * @param mediumIndex Refractive index of the surrounding medium
+ * @return false if the phase function cannot be evaluated
+ *
+ *
+ * The table becomes the one returned by cosThetaDistribution(). It is only
+ * built if not already cached.
+ */
+
+bool PhaseFunction::setWavelength(double um, double mediumIndex)
+{
+    for (size_t i = 0; i < tables.size(); ++i) {
+        if(tables[i].um == um && tables[i].mediumIndex == mediumIndex) {
+            current = i;
+            return true;
+        }
+    }
+
+    vector<MCfloat> mu, p;
+    if(!tabulate(um, mediumIndex, &mu, &p))
+        return false;
+    TabulatedDistribution *distribution = new TabulatedDistribution(this);
+    if(!distribution->setTable(mu.data(), p.data(), mu.size())) {
+        delete distribution;
+        return false;
+    }
+
+    // the density is linear in each interval, so Simpson's rule is exact
+    MCfloat area = 0, moment = 0;
+    for (size_t i = 0; i + 1 < mu.size(); ++i) {
+        MCfloat dmu = mu[i+1] - mu[i];
+        area += (p[i] + p[i+1]) * dmu / 2;
+        moment += (mu[i] * p[i] + (mu[i] + mu[i+1]) * (p[i] + p[i+1])
+                   + mu[i+1] * p[i+1]) * dmu / 6;
+    }
+    CachedTable t = {um, mediumIndex, distribution, moment / area};
+    tables.push_back(t);
+    current = tables.size() - 1;
+    return true;
+}
+
+/**
+ * @brief Sets the number of scattering angles used by angleGrid()
+ * @param n
+ *
+ *
+ * The default of 4001 points resolves forward peaks narrower than a degree;
+ * increase it for particles much larger than the wavelength.
+ */
+
+void PhaseFunction::setNAngles(size_t n)
+{
+    nAngles = std::max<size_t>(n, 2);
+    invalidateTables();
+}
+
+/**
+ * @brief Distribution of \f$ \cos \theta \f$ at the wavelength of the last
+ * call to setWavelength()
+ * @return NULL if no table was built
+ *
+ *
+ * Its RNG is not set: callers sample clones of it, see BaseObject::clone().
+ */
+
+const TabulatedDistribution *PhaseFunction::cosThetaDistribution() const
+{
+    return tables.empty() ? NULL : tables[current].distribution;
+}
+
+/**
+ * @brief Anisotropy factor \f$ g = \left\langle \cos \theta \right \rangle \f$
+ * of the tabulated phase function
+ * @return
+ */
+
+MCfloat PhaseFunction::anisotropy() const
+{
+    return tables.empty() ? 0 : tables[current].g;
+}
+
+/**
+ * @brief Drops the cached tables, which are rebuilt by the next calls to
+ * setWavelength()
+ *
+ *
+ * Subclasses must call this function whenever their parameters change.
+ */
+
+void PhaseFunction::invalidateTables()
+{
+    for (size_t i = 0; i < tables.size(); ++i) {
+        delete tables[i].distribution;
+    }
+    tables.clear();
+    current = 0;
+}
+
+/**
+ * @brief Values of \f$ \cos \theta \f$ for equally spaced scattering angles
+ * @param cosTheta
+ *
+ *
+ * The grid is uniform in \f$ \theta \f$, hence denser in \f$ \cos \theta \f$
+ * near the forward and backward directions where phase functions are sharply
+ * peaked.
+ */
+
+void PhaseFunction::angleGrid(vector<MCfloat> *cosTheta) const
+{
+    cosTheta->resize(nAngles);
+    for (size_t i = 0; i < nAngles; ++i) {
+        (*cosTheta)[i] = -cos(pi<MCfloat>() * i / (nAngles - 1));
+    }
+    cosTheta->front() = -1;
+    cosTheta->back() = 1;
+}
+
+
+
+
+// Mie phase function
+
+/**
+ * @brief Constructs the phase function of spheres of the given radius
+ * @param radius in micrometers
+ * @param particleIndex real part of the refractive index of the spheres
+ * @param particleAbsorption imaginary part of the refractive index of the
+ * spheres
+ */
+
+MiePhaseFunction::MiePhaseFunction(double radius, double particleIndex,
+                                   double particleAbsorption) :
+    PhaseFunction()
+{
+    setRadius(radius);
+    setParticleIndex(particleIndex, particleAbsorption);
+}
+
+void MiePhaseFunction::setRadius(double um)
+{
+    radius = um;
+    invalidateTables();
+}
+
+void MiePhaseFunction::setParticleIndex(double n, double k)
+{
+    particleIndex = n;
+    particleAbsorption = k;
+    invalidateTables();
+}
+
+bool MiePhaseFunction::tabulate(double um, double mediumIndex,
+                                vector<MCfloat> *cosTheta,
+                                vector<MCfloat> *density) const
+{
+    typedef std::complex<double> cplx;
+    if(!(radius > 0) || !(um > 0) || !(mediumIndex > 0)
+            || !(particleIndex > 0)) {
+        logMessage("Invalid parameters");
+        return false;
+    }
+    const double x = two_pi<double>() * radius * mediumIndex / um;
+    const cplx m = cplx(particleIndex, particleAbsorption) / mediumIndex;
+    const size_t nStop = x + 4 * cbrt(x) + 2;
+    const size_t nMax = std::max<double>(nStop, abs(m * x)) + 15;
+
+    // logarithmic derivative of the Riccati-Bessel function, downward
+    // recurrence
+    vector<cplx> D(nMax + 1);
+    D[nMax] = 0;
+    for (size_t n = nMax; n > 0; --n) {
+        cplx r = (double)n / (m * x);
+        D[n-1] = r - 1. / (D[n] + r);
+    }
+
+    vector<cplx> a(nStop + 1), b(nStop + 1);
+    double psi0 = cos(x), psi1 = sin(x);
+    double chi0 = -sin(x), chi1 = cos(x);
+    cplx xi1(psi1, -chi1);
+    for (size_t n = 1; n <= nStop; ++n) {
+        double psi = (2. * n - 1) / x * psi1 - psi0;
+        double chi = (2. * n - 1) / x * chi1 - chi0;
+        cplx xi(psi, -chi);
+        cplx da = D[n] / m + (double)n / x;
+        cplx db = D[n] * m + (double)n / x;
+        a[n] = (da * psi - psi1) / (da * xi - xi1);
+        b[n] = (db * psi - psi1) / (db * xi - xi1);
+        psi0 = psi1;
+        psi1 = psi;
+        chi0 = chi1;
+        chi1 = chi;
+        xi1 = xi;
+    }
+
+    // scattering amplitudes, with the angular functions pi_n and tau_n
+    // computed by upward recurrence
+    angleGrid(cosTheta);
+    density->resize(cosTheta->size());
+    for (size_t i = 0; i < cosTheta->size(); ++i) {
+        double mu = (*cosTheta)[i];
+        double piPrev = 0, piN = 1;
+        cplx s1 = 0, s2 = 0;
+        for (size_t n = 1; n <= nStop; ++n) {
+            double tauN = n * mu * piN - (n + 1) * piPrev;
+            double f = (2. * n + 1) / (n * (n + 1.));
+            s1 += f * (a[n] * piN + b[n] * tauN);
+            s2 += f * (a[n] * tauN + b[n] * piN);
+            double piNext = ((2. * n + 1) * mu * piN - (n + 1) * piPrev) / n;
+            piPrev = piN;
+            piN = piNext;
+        }
+        (*density)[i] = (norm(s1) + norm(s2)) / 2;
+    }
+    return true;
+}
+
+void MiePhaseFunction::describe_impl() const
+{
+    logMessage("radius = %f um, n = %f + %fi", radius, particleIndex,
+               particleAbsorption);
+}
+
+
+
+
+// Tabulated phase function
+
+TabulatedPhaseFunction::TabulatedPhaseFunction() :
+    PhaseFunction()
+{
+}
+
+/**
+ * @brief Sets the measured phase function
+ * @param theta Strictly increasing scattering angles in \f$ [0, \pi] \f$
+ * (radians)
+ * @param value Non-negative values of the phase function per unit solid angle,
+ * not necessarily normalized
+ * @param n Number of points, at least 2
+ * @return false if the table is invalid
+ *
+ *
+ * The phase function is linearly interpolated in \f$ \cos \theta \f$ and zero
+ * outside of the given range of angles.
+ */
+
+bool TabulatedPhaseFunction::setTable(const MCfloat *theta,
+                                      const MCfloat *value, size_t n)
+{
+    if(n < 2) {
+        logMessage("At least two points are needed");
+        return false;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if(!(theta[i] >= 0 && theta[i] <= pi<MCfloat>())
+                || (i > 0 && !(theta[i] > theta[i-1]))) {
+            logMessage("Angles must be strictly increasing in [0, pi]");
+            return false;
+        }
+    }
+    cosThetas.resize(n);
+    values.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        cosThetas[n - 1 - i] = cos(theta[i]);
+        values[n - 1 - i] = value[i];
+    }
+    invalidateTables();
+    return true;
+}
+
+/**
+ * @brief Loads the measured phase function from an HDF5 dataset
+ * @param fileName
+ * @param dataSetName A rank 2 dataset whose first two columns are scattering
+ * angles and values
+ * @return false on error
+ *
+ *
+ * \sa setTable()
+ */
+
+bool TabulatedPhaseFunction::loadTable(const char *fileName,
+                                       const char *dataSetName)
+{
+    vector<MCfloat> theta, value;
+    boost::lock_guard<boost::recursive_mutex> h5Lock(h5Mutex);
+    H5FileHelper file;
+    if(!file.openFile(fileName, dataSetName)
+            || !file.loadColumns(&theta, &value)) {
+        logMessage("Cannot load table %s from %s", dataSetName, fileName);
+        return false;
+    }
+    return setTable(theta.data(), value.data(), theta.size());
+}
+
+bool TabulatedPhaseFunction::tabulate(double um, double mediumIndex,
+                                      vector<MCfloat> *cosTheta,
+                                      vector<MCfloat> *density) const
+{
+    if(cosThetas.empty()) {
+        logMessage("No table set");
+        return false;
+    }
+    *cosTheta = cosThetas;
+    *density = values;
+    return true;
+}
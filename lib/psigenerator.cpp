@@ -32,6 +32,17 @@ MCfloat IsotropicPsiGenerator::spin() const {
     return uniform_01<MCfloat>()(*mt) * two_pi<MCfloat>(); //uniform in [0,2pi)
 }
 
+void IsotropicPsiGenerator::fill(MCfloat *out, size_t n) const {
+    fillOpenUnit(out, n);
+    for (size_t i = 0; i < n; ++i) {
+        out[i] *= two_pi<MCfloat>();
+    }
+}
+
+MCfloat IsotropicPsiGenerator::quantile(MCfloat u) const {
+    return u * two_pi<MCfloat>();
+}
+
 BaseObject *IsotropicPsiGenerator::clone_impl() const
 {
     return new IsotropicPsiGenerator();
@@ -0,0 +1,328 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/quasirandom.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+/* number of direction numbers per dimension of SobolSequence, i.e. the base 2
+ * logarithm of the number of points of a randomization */
+#define SOBOL_BITS 32
+
+using namespace MCPP;
+
+QuasiRandomSequence::QuasiRandomSequence(unsigned int dimension,
+                                         BaseObject *parent) :
+    BaseRandom(parent)
+{
+    dim = std::max(dimension, 1u);
+    maxPoints = numeric_limits<u_int64_t>::max();
+    _index = 0;
+    randomized = false;
+}
+
+QuasiRandomSequence::~QuasiRandomSequence()
+{
+
+}
+
+unsigned int QuasiRandomSequence::dimension() const
+{
+    return dim;
+}
+
+/**
+ * @brief The number of points drawn since the last randomization
+ * @return
+ */
+
+u_int64_t QuasiRandomSequence::index() const
+{
+    return _index;
+}
+
+/**
+ * @brief Draws a new randomization and restarts the sequence
+ *
+ *
+ * \pre The RNG has to be valid (see BaseRandom)
+ */
+
+void QuasiRandomSequence::randomize()
+{
+    randomize_impl();
+    _index = 0;
+    randomized = true;
+}
+
+/**
+ * @brief Generates the next point of the sequence
+ * @param u Array of dimension() elements
+ *
+ *
+ * The sequence is randomized before the first point and again when the
+ * points of a randomization are exhausted.
+ *
+ * \pre The RNG has to be valid (see BaseRandom)
+ */
+
+void QuasiRandomSequence::next(MCfloat *u)
+{
+    if(!randomized || _index == maxPoints)
+        randomize();
+    next_impl(_index++, u);
+}
+
+void QuasiRandomSequence::setRNG_impl()
+{
+    randomized = false;
+}
+
+void QuasiRandomSequence::describe_impl() const
+{
+    logMessage("dimension = %u", dim);
+}
+
+
+
+
+// Sobol sequence
+
+/* Joe and Kuo, new-joe-kuo-6.21201: degree s, coefficients a and initial
+ * direction numbers m of the primitive polynomials of dimensions 2 to 16 */
+static const unsigned int sobolDegree[] = {
+    1, 2, 3, 3, 4, 4, 5, 5, 5, 5, 5, 5, 6, 6, 6};
+static const unsigned int sobolCoefficients[] = {
+    0, 1, 1, 2, 1, 4, 2, 4, 7, 11, 13, 14, 1, 13, 16};
+static const unsigned int sobolInitial[][6] = {
+    {1},
+    {1, 3},
+    {1, 3, 1},
+    {1, 1, 1},
+    {1, 1, 3, 3},
+    {1, 3, 5, 13},
+    {1, 1, 5, 5, 17},
+    {1, 1, 5, 5, 5},
+    {1, 1, 7, 11, 19},
+    {1, 1, 5, 1, 1},
+    {1, 1, 1, 3, 11},
+    {1, 3, 5, 5, 31},
+    {1, 3, 3, 9, 7, 49},
+    {1, 1, 1, 15, 21, 21},
+    {1, 3, 1, 13, 27, 49}};
+
+/**
+ * @brief Constructs a Sobol sequence
+ * @param dimension At most maxDimension()
+ * @param parent
+ */
+
+SobolSequence::SobolSequence(unsigned int dimension, BaseObject *parent) :
+    QuasiRandomSequence(dimension, parent)
+{
+    if(dim > maxDimension()) {
+        logMessage("Only %u dimensions are available", maxDimension());
+        dim = maxDimension();
+    }
+    maxPoints = (u_int64_t)1 << SOBOL_BITS;
+
+    // the k-th direction number of each dimension holds the binary fraction
+    // m_k / 2^k in its most significant bits
+    directions.resize(dim * SOBOL_BITS);
+    for (int k = 0; k < SOBOL_BITS; ++k) {
+        directions[k] = (u_int64_t)1 << (63 - k);
+    }
+    for (unsigned int d = 1; d < dim; ++d) {
+        u_int64_t *v = &directions[d * SOBOL_BITS];
+        const unsigned int s = sobolDegree[d - 1];
+        const unsigned int a = sobolCoefficients[d - 1];
+        for (unsigned int k = 0; k < s; ++k) {
+            v[k] = (u_int64_t)sobolInitial[d - 1][k] << (63 - k);
+        }
+        for (unsigned int k = s; k < SOBOL_BITS; ++k) {
+            v[k] = v[k - s] ^ (v[k - s] >> s);
+            for (unsigned int i = 1; i < s; ++i) {
+                if((a >> (s - 1 - i)) & 1)
+                    v[k] ^= v[k - i];
+            }
+        }
+    }
+    scrambledDirections = directions;
+    state.assign(dim, 0);
+}
+
+unsigned int SobolSequence::maxDimension()
+{
+    return sizeof(sobolDegree) / sizeof(sobolDegree[0]) + 1;
+}
+
+/**
+ * @brief Draws a random nonsingular lower triangular matrix and a random
+ * digital shift for each dimension
+ *
+ *
+ * Row \f$ j \f$ of the matrix computes digit \f$ j \f$ of the scrambled
+ * point as a random combination of the digits \f$ i \le j \f$, so that also
+ * the trailing digits, which are zero in the unscrambled points, are random.
+ */
+
+void SobolSequence::randomize_impl()
+{
+    for (unsigned int d = 0; d < dim; ++d) {
+        u_int64_t rows[64];
+        for (int j = 0; j < 64; ++j) {
+            u_int64_t diagonal = (u_int64_t)1 << (63 - j);
+            u_int64_t upper = j == 0 ? 0 : ~(u_int64_t)0 << (64 - j);
+            rows[j] = diagonal | ((*mt)() & upper);
+        }
+        for (int k = 0; k < SOBOL_BITS; ++k) {
+            u_int64_t v = directions[d * SOBOL_BITS + k];
+            u_int64_t scrambled = 0;
+            for (int j = 0; j < 64; ++j) {
+                scrambled |= (u_int64_t)__builtin_parityll(rows[j] & v)
+                        << (63 - j);
+            }
+            scrambledDirections[d * SOBOL_BITS + k] = scrambled;
+        }
+        state[d] = (*mt)();
+    }
+}
+
+/**
+ * @brief Returns the current point and moves to the next one in Gray code
+ * order, which differs from it by a single direction number
+ * @param index
+ * @param u
+ */
+
+void SobolSequence::next_impl(u_int64_t index, MCfloat *u)
+{
+    const MCfloat scale = ldexp((MCfloat)1, -53);
+    for (unsigned int d = 0; d < dim; ++d) {
+        u[d] = ((state[d] >> 11) + (MCfloat)0.5) * scale;
+    }
+    int k = __builtin_ctzll(~index);
+    if(k >= SOBOL_BITS)
+        return;
+    for (unsigned int d = 0; d < dim; ++d) {
+        state[d] ^= scrambledDirections[d * SOBOL_BITS + k];
+    }
+}
+
+BaseObject *SobolSequence::clone_impl() const
+{
+    return new SobolSequence(dim);
+}
+
+
+
+
+// Halton sequence
+
+/**
+ * @brief Constructs a Halton sequence
+ * @param dimension
+ * @param parent
+ */
+
+HaltonSequence::HaltonSequence(unsigned int dimension, BaseObject *parent) :
+    QuasiRandomSequence(dimension, parent)
+{
+    for (unsigned int b = 2; bases.size() < dim; ++b) {
+        bool prime = true;
+        for (size_t i = 0; i < bases.size() && bases[i] * bases[i] <= b; ++i) {
+            if(b % bases[i] == 0) {
+                prime = false;
+                break;
+            }
+        }
+        if(prime)
+            bases.push_back(b);
+    }
+
+    // enough digits to resolve the precision of MCfloat
+    nDigits.resize(dim);
+    permutations.resize(dim);
+    for (unsigned int d = 0; d < dim; ++d) {
+        nDigits[d] = ceil(numeric_limits<MCfloat>::digits * log(2.)
+                          / log((double)bases[d]));
+        permutations[d].resize(nDigits[d] * bases[d]);
+        for (size_t i = 0; i < permutations[d].size(); ++i) {
+            permutations[d][i] = i % bases[d];
+        }
+    }
+}
+
+/**
+ * @brief Draws a random permutation of the digits for each digit position of
+ * each dimension
+ */
+
+void HaltonSequence::randomize_impl()
+{
+    for (unsigned int d = 0; d < dim; ++d) {
+        const unsigned int b = bases[d];
+        for (unsigned int k = 0; k < nDigits[d]; ++k) {
+            unsigned int *p = &permutations[d][k * b];
+            // start from the identity, so that the permutations only depend
+            // on the RNG state
+            for (unsigned int i = 0; i < b; ++i) {
+                p[i] = i;
+            }
+            for (unsigned int i = b - 1; i > 0; --i) {
+                boost::random::uniform_int_distribution<unsigned int> j(0, i);
+                std::swap(p[i], p[j(*mt)]);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Computes the scrambled radical inverse of the index in each base
+ * @param index
+ * @param u
+ *
+ *
+ * All the digit positions are permuted, including the leading zeros of the
+ * index, so that every coordinate is uniformly distributed. Adding half of
+ * the last digit keeps the coordinates away from 0, the rounding of the sum
+ * is clamped below 1.
+ */
+
+void HaltonSequence::next_impl(u_int64_t index, MCfloat *u)
+{
+    const MCfloat below1 = 1 - numeric_limits<MCfloat>::epsilon() / 2;
+    for (unsigned int d = 0; d < dim; ++d) {
+        const unsigned int b = bases[d];
+        const unsigned int *p = permutations[d].data();
+        u_int64_t n = index;
+        MCfloat x = 0, weight = 1. / b;
+        for (unsigned int k = 0; k < nDigits[d]; ++k) {
+            x += p[k * b + n % b] * weight;
+            n /= b;
+            weight /= b;
+        }
+        u[d] = std::min(x + weight * b / 2, below1);
+    }
+}
+
+BaseObject *HaltonSequence::clone_impl() const
+{
+    return new HaltonSequence(dim);
+}
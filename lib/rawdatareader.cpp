@@ -0,0 +1,294 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/rawdatareader.h>
+#include <MCPlusPlus/h5outputfile.h>
+
+#include <limits>
+
+using namespace MCPP;
+
+RawDataReader::RawDataReader(BaseObject *parent) :
+    BaseObject(parent)
+{
+    file = NULL;
+    _chunkSize = 65536;
+    for (uint i = 0; i < 4; ++i) {
+        _nWalkers[i] = 0;
+        hasRecords[i] = false;
+        hasPoints[i] = hasTimes[i] = hasKVectors[i] = false;
+        _photonCounters[i] = 0;
+    }
+}
+
+RawDataReader::~RawDataReader()
+{
+    close();
+}
+
+/**
+ * @brief Opens an output file for reading
+ * @param fileName
+ * @return false on error
+ */
+
+bool RawDataReader::open(const char *fileName)
+{
+    close();
+    try {
+        file = new H5File(fileName, H5F_ACC_RDONLY);
+    }
+    catch (const Exception &error) {
+        logMessage("Cannot open %s", fileName);
+        file = NULL;
+        return false;
+    }
+
+    if(datasetSize("photon-counters") == 4) {
+        try {
+            DataSet dset = file->openDataSet("photon-counters");
+            dset.read(_photonCounters, PredType::NATIVE_UINT64);
+            dset.close();
+        }
+        catch (const Exception &error) {
+            logMessage("Cannot read the photon counters of %s", fileName);
+            close();
+            return false;
+        }
+    }
+
+    for (uint type = 0; type < 4; ++type) {
+        string typeName = walkerTypeToString(type);
+        hsize_t nRecords = datasetSize("records/" + typeName);
+        hsize_t nPoints = datasetSize("exit-points/" + typeName);
+        hsize_t nTimes = datasetSize("walk-times/" + typeName);
+        hsize_t nK = datasetSize("exit-k-vectors/" + typeName);
+
+        hasRecords[type] = nRecords > 0;
+        if(hasRecords[type]) {
+            _nWalkers[type] = nRecords;
+            continue;
+        }
+
+        hsize_t n = nTimes;
+        if(n == 0)
+            n = nPoints / 2;
+        if(n == 0)
+            n = nK / 3;
+        _nWalkers[type] = n;
+        hasTimes[type] = n > 0 && nTimes == n;
+        hasPoints[type] = n > 0 && nPoints == 2 * n;
+        hasKVectors[type] = n > 0 && nK == 3 * n;
+        if(n > 0 && nK > 0 && !hasKVectors[type])
+            logMessage("Exit k vectors of %s photons were saved with %llu "
+                       "components per photon, they are ignored",
+                       typeName.c_str(), nK / n);
+    }
+    return true;
+}
+
+/**
+ * @brief Closes the file
+ */
+
+void RawDataReader::close()
+{
+    if(file == NULL)
+        return;
+    file->close();
+    delete file;
+    file = NULL;
+    for (uint i = 0; i < 4; ++i) {
+        _nWalkers[i] = 0;
+        _photonCounters[i] = 0;
+    }
+}
+
+/**
+ * @brief Sets the number of walkers per chunk
+ * @param nWalkers
+ *
+ *
+ * Defaults to 65536 walkers.
+ */
+
+void RawDataReader::setChunkSize(hsize_t nWalkers)
+{
+    _chunkSize = nWalkers > 0 ? nWalkers : 1;
+}
+
+hsize_t RawDataReader::chunkSize() const
+{
+    return _chunkSize;
+}
+
+/**
+ * @brief The number of walkers of the given type saved in the file
+ * @param type
+ * @return
+ */
+
+hsize_t RawDataReader::nWalkers(walkerType type) const
+{
+    return _nWalkers[type];
+}
+
+/**
+ * @brief The number of chunks of the given walker type
+ * @param type
+ * @return
+ */
+
+hsize_t RawDataReader::nChunks(walkerType type) const
+{
+    return (_nWalkers[type] + _chunkSize - 1) / _chunkSize;
+}
+
+/**
+ * @brief The photon counters of the simulation that produced the file
+ * @return
+ *
+ *
+ * These count all the simulated photons, including the ones whose raw output
+ * was not saved, and are the normalization of the histograms.
+ */
+
+const u_int64_t *RawDataReader::photonCounters() const
+{
+    return _photonCounters;
+}
+
+/**
+ * @brief Reads a chunk of walkers
+ * @param type
+ * @param chunk Index of the chunk, from 0 to nChunks() - 1
+ * @param dest Resized to the number of walkers in the chunk
+ * @return The number of walkers read
+ *
+ *
+ * Throws H5::Exception if the datasets cannot be read.
+ */
+
+hsize_t RawDataReader::readChunk(walkerType type, hsize_t chunk,
+                                 vector<Walker> *dest)
+{
+    hsize_t start = chunk * _chunkSize;
+    if(file == NULL || start >= _nWalkers[type]) {
+        dest->clear();
+        return 0;
+    }
+    hsize_t n = _nWalkers[type] - start;
+    if(n > _chunkSize)
+        n = _chunkSize;
+    dest->resize(n);
+    string typeName = walkerTypeToString(type);
+
+    if(hasRecords[type]) {
+        recordBuffer.resize(n);
+        DataSet dset = file->openDataSet("records/" + typeName);
+        DataSpace fspace = dset.getSpace();
+        fspace.selectHyperslab(H5S_SELECT_SET, &n, &start);
+        DataSpace mspace(1, &n);
+        dset.read(recordBuffer.data(), H5OutputFile::walkerRecordType(),
+                  mspace, fspace);
+        dset.close();
+
+        for (hsize_t i = 0; i < n; ++i) {
+            const WalkerRecord *r = &recordBuffer[i];
+            Walker *w = &(*dest)[i];
+            w->r0[0] = r->x;
+            w->r0[1] = r->y;
+            w->r0[2] = 0;
+            w->k0[0] = r->kx;
+            w->k0[1] = r->ky;
+            w->k0[2] = r->kz;
+            w->walkTime = r->t;
+            w->type = type;
+        }
+        return n;
+    }
+
+    const MCfloat nan = numeric_limits<MCfloat>::quiet_NaN();
+    for (hsize_t i = 0; i < n; ++i) {
+        Walker *w = &(*dest)[i];
+        w->r0[0] = w->r0[1] = nan;
+        w->r0[2] = 0;
+        w->k0[0] = w->k0[1] = w->k0[2] = nan;
+        w->walkTime = nan;
+        w->type = type;
+    }
+
+    if(hasPoints[type]) {
+        buffer.resize(2 * n);
+        readValues("exit-points/" + typeName, 2 * start, 2 * n, buffer.data());
+        for (hsize_t i = 0; i < n; ++i) {
+            (*dest)[i].r0[0] = buffer[2 * i];
+            (*dest)[i].r0[1] = buffer[2 * i + 1];
+        }
+    }
+    if(hasTimes[type]) {
+        buffer.resize(n);
+        readValues("walk-times/" + typeName, start, n, buffer.data());
+        for (hsize_t i = 0; i < n; ++i) {
+            (*dest)[i].walkTime = buffer[i];
+        }
+    }
+    if(hasKVectors[type]) {
+        buffer.resize(3 * n);
+        readValues("exit-k-vectors/" + typeName, 3 * start, 3 * n,
+                   buffer.data());
+        for (hsize_t i = 0; i < n; ++i) {
+            memcpy((*dest)[i].k0, &buffer[3 * i], 3 * sizeof(MCfloat));
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief The number of elements of a 1D dataset
+ * @param name
+ * @return 0 if the dataset does not exist
+ */
+
+hsize_t RawDataReader::datasetSize(const string &name) const
+{
+    size_t slash = name.find('/');
+    if(slash != string::npos && H5Lexists(file->getId(),
+                                          name.substr(0, slash).c_str(),
+                                          H5P_DEFAULT) <= 0)
+        return 0;
+    if(H5Lexists(file->getId(), name.c_str(), H5P_DEFAULT) <= 0)
+        return 0;
+    DataSet dset = file->openDataSet(name);
+    DataSpace dspace = dset.getSpace();
+    hsize_t size = 0;
+    if(dspace.getSimpleExtentNdims() == 1)
+        dspace.getSimpleExtentDims(&size);
+    dset.close();
+    return size;
+}
+
+void RawDataReader::readValues(const string &name, hsize_t start,
+                               hsize_t count, MCfloat *dest)
+{
+    DataSet dset = file->openDataSet(name);
+    DataSpace fspace = dset.getSpace();
+    fspace.selectHyperslab(H5S_SELECT_SET, &count, &start);
+    DataSpace mspace(1, &count);
+    dset.read(dest, MCH5FLOAT, mspace, fspace);
+    dset.close();
+}
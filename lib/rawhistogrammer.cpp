@@ -0,0 +1,274 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/rawhistogrammer.h>
+#include <MCPlusPlus/h5filehelper.h>
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#include <sstream>
+
+using namespace MCPP;
+
+RawHistogrammer::RawHistogrammer(BaseObject *parent) :
+    BaseObject(parent)
+{
+    nThreads = 1;
+    chunkSize = 65536;
+    photonTypeFlags = FLAG_ALL_WALKERS;
+    _totalPhotons = 0;
+    totalPhotonsSet = false;
+    nextTask = 0;
+    failed = false;
+}
+
+RawHistogrammer::~RawHistogrammer()
+{
+}
+
+/**
+ * @brief Adds an output file whose raw output is histogrammed
+ * @param fileName
+ */
+
+void RawHistogrammer::addInputFile(const char *fileName)
+{
+    inputFiles.push_back(fileName);
+}
+
+/**
+ * @brief Adds a histogram to be computed
+ * @param hist
+ *
+ *
+ * The RawHistogrammer takes ownership of the histogram. Unnamed histograms are
+ * named after their index, as in Simulation::addHistogram().
+ */
+
+void RawHistogrammer::addHistogram(Histogram *hist)
+{
+    if(hist->name() == "") {
+        stringstream ss;
+        ss << "histogram" << hists.size();
+        hist->setName(ss.str().c_str());
+    }
+    hists.push_back(hist);
+    hist->setParent(this);
+}
+
+/**
+ * @brief Sets the number of reading threads
+ * @param value
+ */
+
+void RawHistogrammer::setNThreads(uint value)
+{
+    nThreads = value > 0 ? value : 1;
+}
+
+/**
+ * @brief Sets the number of walkers read at once by each thread
+ * @param nWalkers
+ *
+ *
+ * Defaults to 65536 walkers.
+ */
+
+void RawHistogrammer::setChunkSize(hsize_t nWalkers)
+{
+    chunkSize = nWalkers;
+}
+
+/**
+ * @brief Selects the walker types to be read
+ * @param value See walkerFlags
+ *
+ *
+ * Defaults to all types. Histograms only use the types selected with
+ * Histogram::setPhotonTypeFlags() anyway, so this only saves reading data
+ * that no histogram needs.
+ */
+
+void RawHistogrammer::setPhotonTypeFlags(int value)
+{
+    photonTypeFlags = value;
+}
+
+/**
+ * @brief Sets the number of photons used to normalize the histograms
+ * @param N
+ *
+ *
+ * By default, the sum of the photon counters of the input files is used.
+ */
+
+void RawHistogrammer::setTotalPhotons(u_int64_t N)
+{
+    _totalPhotons = N;
+    totalPhotonsSet = true;
+}
+
+/**
+ * @brief The number of photons used to normalize the histograms
+ * @return
+ *
+ *
+ * Only known after run() unless set with setTotalPhotons().
+ */
+
+u_int64_t RawHistogrammer::totalPhotons() const
+{
+    return _totalPhotons;
+}
+
+/**
+ * @brief Reads all the input files and fills the histograms
+ * @return false if an input file cannot be read or a histogram is invalid;
+ * in that case the histograms are incomplete
+ *
+ *
+ * The histograms are cleared first, so run() can be called again after
+ * changing the input files or the histograms.
+ */
+
+bool RawHistogrammer::run()
+{
+    for (size_t i = 0; i < hists.size(); ++i) {
+        if(!hists[i]->sanityCheck() || !hists[i]->initialize()) {
+            logMessage("Invalid histogram %s", hists[i]->name().c_str());
+            return false;
+        }
+    }
+
+    tasks.clear();
+    nextTask = 0;
+    failed = false;
+    u_int64_t counted = 0;
+    for (size_t f = 0; f < inputFiles.size(); ++f) {
+        boost::lock_guard<boost::recursive_mutex> h5Lock(h5Mutex);
+        RawDataReader reader;
+        reader.setChunkSize(chunkSize);
+        if(!reader.open(inputFiles[f].c_str()))
+            return false;
+        for (uint type = 0; type < 4; ++type) {
+            counted += reader.photonCounters()[type];
+            if(!(photonTypeFlags & walkerTypeToFlag(type)))
+                continue;
+            for (hsize_t c = 0; c < reader.nChunks((walkerType)type); ++c) {
+                Task t = {f, (walkerType)type, c};
+                tasks.push_back(t);
+            }
+        }
+    }
+    if(!totalPhotonsSet)
+        _totalPhotons = counted;
+
+    vector<vector<Histogram *> > threadHists(nThreads);
+    vector<boost::thread *> threads;
+    for (uint n = 0; n < nThreads; ++n) {
+        for (size_t i = 0; i < hists.size(); ++i) {
+            Histogram *h = (Histogram *)hists[i]->clone();
+            h->initialize();
+            threadHists[n].push_back(h);
+        }
+        threads.push_back(new boost::thread(
+                              boost::bind(&RawHistogrammer::worker, this,
+                                          &threadHists[n])));
+    }
+
+    for (uint n = 0; n < nThreads; ++n) {
+        threads[n]->join();
+        delete threads[n];
+        for (size_t i = 0; i < hists.size(); ++i) {
+            hists[i]->appendCounts(threadHists[n][i]);
+            delete threadHists[n][i];
+        }
+    }
+
+    logMessage("%lu chunks of %lu files histogrammed", tasks.size(),
+               inputFiles.size());
+    return !failed;
+}
+
+/**
+ * @brief Saves the histograms, normalized with totalPhotons()
+ * @param fileName
+ *
+ *
+ * See Histogram::saveToFile().
+ */
+
+void RawHistogrammer::saveToFile(const char *fileName) const
+{
+    for (size_t i = 0; i < hists.size(); ++i) {
+        hists[i]->setScale(_totalPhotons);
+        hists[i]->saveToFile(fileName);
+    }
+}
+
+void RawHistogrammer::worker(vector<Histogram *> *threadHists)
+{
+    vector<RawDataReader *> readers(inputFiles.size(), NULL);
+    vector<Walker> walkers;
+
+    while(1) {
+        Task t;
+        {
+            boost::lock_guard<boost::mutex> lock(taskMutex);
+            if(nextTask >= tasks.size() || failed)
+                break;
+            t = tasks[nextTask++];
+        }
+
+        hsize_t n;
+        bool ok = true;
+        {
+            boost::lock_guard<boost::recursive_mutex> h5Lock(h5Mutex);
+            RawDataReader *reader = readers[t.fileIndex];
+            if(reader == NULL) {
+                reader = new RawDataReader();
+                reader->setChunkSize(chunkSize);
+                readers[t.fileIndex] = reader;
+                ok = reader->open(inputFiles[t.fileIndex].c_str());
+            }
+            try {
+                if(ok)
+                    n = reader->readChunk(t.type, t.chunk, &walkers);
+            }
+            catch (const Exception &error) {
+                logMessage("Cannot read chunk %llu of %s photons in %s",
+                           t.chunk, walkerTypeToString(t.type).c_str(),
+                           inputFiles[t.fileIndex].c_str());
+                ok = false;
+            }
+        }
+        if(!ok) {
+            boost::lock_guard<boost::mutex> lock(taskMutex);
+            failed = true;
+            break;
+        }
+        for (size_t i = 0; i < threadHists->size(); ++i) {
+            threadHists->at(i)->run(walkers.data(), n);
+        }
+    }
+
+    boost::lock_guard<boost::recursive_mutex> h5Lock(h5Mutex);
+    for (size_t i = 0; i < readers.size(); ++i) {
+        delete readers[i];
+    }
+}
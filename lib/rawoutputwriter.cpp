@@ -0,0 +1,222 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/rawoutputwriter.h>
+#include <MCPlusPlus/h5outputfile.h>
+
+#include <boost/bind.hpp>
+
+using namespace MCPP;
+
+RawOutputBlock::RawOutputBlock()
+{
+    pending = false;
+}
+
+RawOutputWriter::RawOutputWriter(BaseObject *parent) :
+    BaseObject(parent)
+{
+    fileName = NULL;
+    swmr = false;
+    swmrFile = NULL;
+    thread = NULL;
+    stopped = true;
+    _blocksWritten = 0;
+}
+
+RawOutputWriter::~RawOutputWriter()
+{
+    stop();
+    if(fileName != NULL)
+        free(fileName);
+}
+
+/**
+ * @brief Starts the writer thread
+ * @param fileName The output file, which must already contain the raw output
+ * datasets (see H5OutputFile::newFile())
+ * @param swmr If true, the file is kept open in SWMR write mode until stop()
+ * is called, and flushed after each block so that readers can follow it live
+ * (see H5FileHelper::setSWMRWriteEnabled())
+ * @return false if the file cannot be opened
+ */
+
+bool RawOutputWriter::start(const char *fileName, bool swmr)
+{
+    stop();
+    copyToInternalVariable(&this->fileName, fileName);
+    this->swmr = swmr;
+    _blocksWritten = 0;
+
+    if(swmr) {
+        boost::lock_guard<boost::recursive_mutex> fileLock(h5Mutex);
+        swmrFile = new H5OutputFile();
+        swmrFile->setSWMRWriteEnabled(true);
+        if(!swmrFile->openFile(fileName)) {
+            logMessage("Cannot open %s in SWMR mode", fileName);
+            delete swmrFile;
+            swmrFile = NULL;
+            return false;
+        }
+    }
+
+    stopped = false;
+    thread = new boost::thread(boost::bind(&RawOutputWriter::run, this));
+    return true;
+}
+
+/**
+ * @brief Writes all the pending blocks, then stops the writer thread
+ */
+
+void RawOutputWriter::stop()
+{
+    if(thread == NULL)
+        return;
+    {
+        boost::lock_guard<boost::mutex> lock(queueMutex);
+        stopped = true;
+    }
+    queueCondition.notify_all();
+    thread->join();
+    delete thread;
+    thread = NULL;
+
+    if(swmrFile != NULL) {
+        boost::lock_guard<boost::recursive_mutex> fileLock(h5Mutex);
+        swmrFile->close();
+        delete swmrFile;
+        swmrFile = NULL;
+    }
+}
+
+/**
+ * @brief Queues a block to be written
+ * @param block
+ *
+ *
+ * The block must not be modified until wait() returns.
+ */
+
+void RawOutputWriter::push(RawOutputBlock *block)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(queueMutex);
+        block->pending = true;
+        queue.push_back(block);
+    }
+    queueCondition.notify_all();
+}
+
+/**
+ * @brief Waits until the given block has been written and emptied
+ * @param block
+ *
+ *
+ * Returns immediately if the block was not pushed.
+ */
+
+void RawOutputWriter::wait(RawOutputBlock *block)
+{
+    boost::unique_lock<boost::mutex> lock(queueMutex);
+    while(block->pending)
+        queueCondition.wait(lock);
+}
+
+/**
+ * @brief The number of blocks written since the writer was started
+ * @return
+ */
+
+u_int64_t RawOutputWriter::blocksWritten() const
+{
+    return _blocksWritten;
+}
+
+void RawOutputWriter::run()
+{
+    boost::unique_lock<boost::mutex> lock(queueMutex);
+    while(1) {
+        while(queue.empty() && !stopped)
+            queueCondition.wait(lock);
+        if(queue.empty())
+            break;
+        RawOutputBlock *block = queue.front();
+
+        lock.unlock();
+        write(block);
+        lock.lock();
+
+        queue.pop_front();
+        block->pending = false;
+        _blocksWritten++;
+        queueCondition.notify_all();
+    }
+}
+
+/**
+ * @brief Appends the content of the block to the output file and empties it
+ * @param block
+ *
+ *
+ * The capacity of the block vectors is retained, so that the simulation
+ * threads do not need to allocate memory again.
+ */
+
+void RawOutputWriter::write(RawOutputBlock *block)
+{
+    boost::lock_guard<boost::recursive_mutex> fileLock(h5Mutex);
+
+    H5OutputFile localFile;
+    H5OutputFile *file = swmrFile;
+    if(file == NULL) {
+        if(!localFile.openFile(fileName)) {
+            logMessage("Cannot open %s, raw output lost", fileName);
+            file = NULL;
+        }
+        else
+            file = &localFile;
+    }
+
+    for (uint type = 0; type < 4; ++type) {
+        if(file != NULL) {
+            file->appendExitPoints((walkerType)type,
+                                   block->exitPoints[type].data(),
+                                   block->exitPoints[type].size());
+            file->appendWalkTimes((walkerType)type,
+                                  block->walkTimes[type].data(),
+                                  block->walkTimes[type].size());
+            file->appendExitKVectors((walkerType)type,
+                                     block->exitKVectors[type].data(),
+                                     block->exitKVectors[type].size());
+            file->appendWalkerRecords((walkerType)type,
+                                      block->records[type].data(),
+                                      block->records[type].size());
+        }
+        block->exitPoints[type].clear();
+        block->walkTimes[type].clear();
+        block->exitKVectors[type].clear();
+        block->records[type].clear();
+    }
+
+    if(file == swmrFile && file != NULL) {
+        file->closeDataSet();
+        file->flush();
+    }
+    else if(file != NULL)
+        file->close();
+}
@@ -0,0 +1,402 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/recordfile.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace MCPP;
+
+/**
+ * @brief The recordFieldType of #MCfloat
+ * @return
+ */
+
+static u_int32_t floatFieldType()
+{
+    switch (sizeof(MCfloat)) {
+    case 4:
+        return FIELD_FLOAT32;
+    case 8:
+        return FIELD_FLOAT64;
+    default:
+        return FIELD_FLOAT80;
+    }
+}
+
+static const char *fieldTypeName(u_int32_t type)
+{
+    switch (type) {
+    case FIELD_FLOAT64:
+        return "64 bit float";
+    case FIELD_UINT64:
+        return "64 bit unsigned integer";
+    case FIELD_FLOAT32:
+        return "32 bit float";
+    case FIELD_FLOAT80:
+        return "80 bit float";
+    default:
+        return "unknown type";
+    }
+}
+
+/**
+ * @brief Fills the schema of WalkerRecord
+ * @param fields At least RECORDFILE_MAX_FIELDS elements
+ * @return the number of fields
+ */
+
+static u_int32_t walkerRecordFields(RecordFileField *fields)
+{
+    const char *names[7] = {"x", "y", "t", "kx", "ky", "kz", "nScatter"};
+    const u_int32_t offsets[7] = {
+        offsetof(WalkerRecord, x), offsetof(WalkerRecord, y),
+        offsetof(WalkerRecord, t), offsetof(WalkerRecord, kx),
+        offsetof(WalkerRecord, ky), offsetof(WalkerRecord, kz),
+        offsetof(WalkerRecord, nScatter)};
+    memset(fields, 0, RECORDFILE_MAX_FIELDS * sizeof(RecordFileField));
+    for (uint i = 0; i < 7; ++i) {
+        strncpy(fields[i].name, names[i], sizeof(fields[i].name) - 1);
+        fields[i].type = i < 6 ? floatFieldType() : FIELD_UINT64;
+        fields[i].offset = offsets[i];
+    }
+    return 7;
+}
+
+RecordFile::RecordFile(BaseObject *parent) :
+    BaseObject(parent)
+{
+    fd = -1;
+    writable = false;
+    header = NULL;
+    readMap = NULL;
+    readMapSize = 0;
+    chunkRecords = 0;
+    for (uint i = 0; i < 4; ++i) {
+        chunkMap[i] = NULL;
+        currentCount[i] = NULL;
+        currentData[i] = NULL;
+    }
+}
+
+RecordFile::~RecordFile()
+{
+    close();
+}
+
+/**
+ * @brief Creates a new record file, overwriting any existing file
+ * @param fileName
+ * @param chunkRecords Number of records per chunk
+ * @return false on error
+ */
+
+bool RecordFile::create(const char *fileName, u_int64_t chunkRecords)
+{
+    close();
+    if(chunkRecords == 0)
+        chunkRecords = 1;
+
+    fd = ::open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        logMessage("Cannot create %s", fileName);
+        return false;
+    }
+
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t headerSize = RECORDFILE_HEADER_SIZE;
+    if(headerSize < pageSize)
+        headerSize = pageSize;
+    if(posix_fallocate(fd, 0, headerSize) != 0) {
+        logMessage("Cannot allocate %s", fileName);
+        close();
+        return false;
+    }
+    if(!mapHeader()) {
+        close();
+        return false;
+    }
+
+    memcpy(header->magic, RECORDFILE_MAGIC, sizeof(RECORDFILE_MAGIC));
+    header->byteOrder = 0x01020304;
+    header->version = RECORDFILE_VERSION;
+    header->headerSize = headerSize;
+    header->recordSize = sizeof(WalkerRecord);
+    header->chunkRecords = chunkRecords;
+    size_t chunkBytes = RECORDFILE_CHUNK_HEADER_SIZE
+            + chunkRecords * sizeof(WalkerRecord);
+    header->chunkStride = (chunkBytes + pageSize - 1) / pageSize * pageSize;
+    header->nChunks = 0;
+    header->nFields = walkerRecordFields(header->fields);
+
+    this->chunkRecords = chunkRecords;
+    return true;
+}
+
+/**
+ * @brief Opens an existing record file to append records to it
+ * @param fileName
+ * @return false on error
+ *
+ *
+ * Records are appended in new chunks, so that chunks partially filled by a
+ * previous writer are left untouched.
+ */
+
+bool RecordFile::openForAppend(const char *fileName)
+{
+    close();
+    fd = ::open(fileName, O_RDWR);
+    if(fd < 0) {
+        logMessage("Cannot open %s", fileName);
+        return false;
+    }
+    if(!mapHeader() || !checkHeader()) {
+        logMessage("%s is not a valid record file", fileName);
+        close();
+        return false;
+    }
+    chunkRecords = header->chunkRecords;
+    return true;
+}
+
+/**
+ * @brief Opens an existing record file for reading
+ * @param fileName
+ * @return false on error
+ *
+ *
+ * The whole file is mapped in memory.
+ */
+
+bool RecordFile::open(const char *fileName)
+{
+    close();
+    fd = ::open(fileName, O_RDONLY);
+    if(fd < 0) {
+        logMessage("Cannot open %s", fileName);
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(RecordFileHeader)) {
+        logMessage("%s is not a valid record file", fileName);
+        close();
+        return false;
+    }
+    readMapSize = st.st_size;
+    void *map = mmap(NULL, readMapSize, PROT_READ, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED) {
+        logMessage("Cannot map %s", fileName);
+        readMapSize = 0;
+        close();
+        return false;
+    }
+    readMap = (char *)map;
+    header = (RecordFileHeader *)readMap;
+
+    if(!checkHeader() || header->headerSize
+            + header->nChunks * header->chunkStride > readMapSize) {
+        logMessage("%s is not a valid record file", fileName);
+        close();
+        return false;
+    }
+    chunkRecords = header->chunkRecords;
+    return true;
+}
+
+/**
+ * @brief Unmaps and closes the file
+ */
+
+void RecordFile::close()
+{
+    for (uint i = 0; i < 4; ++i) {
+        unmapChunk((walkerType)i);
+    }
+    if(readMap != NULL) {
+        munmap(readMap, readMapSize);
+        readMap = NULL;
+        readMapSize = 0;
+    }
+    else if(header != NULL)
+        munmap(header, RECORDFILE_HEADER_SIZE);
+    header = NULL;
+    if(fd >= 0)
+        ::close(fd);
+    fd = -1;
+    writable = false;
+}
+
+/**
+ * @brief The number of chunks in the file
+ * @return
+ */
+
+u_int64_t RecordFile::nChunks() const
+{
+    return header == NULL ? 0 : header->nChunks;
+}
+
+/**
+ * @brief The walker type of the records of the given chunk
+ * @param chunk
+ * @return
+ *
+ *
+ * This and the following functions can only be used after open().
+ */
+
+walkerType RecordFile::chunkType(u_int64_t chunk) const
+{
+    return (walkerType)this->chunk(chunk)->type;
+}
+
+/**
+ * @brief The number of records of the given chunk
+ * @param chunk
+ * @return
+ */
+
+u_int64_t RecordFile::chunkSize(u_int64_t chunk) const
+{
+    u_int64_t n = this->chunk(chunk)->nRecords;
+    return n < chunkRecords ? n : chunkRecords;
+}
+
+/**
+ * @brief The records of the given chunk
+ * @param chunk
+ * @return
+ */
+
+const WalkerRecord *RecordFile::chunkData(u_int64_t chunk) const
+{
+    return (const WalkerRecord *)((const char *)this->chunk(chunk)
+                                  + RECORDFILE_CHUNK_HEADER_SIZE);
+}
+
+/**
+ * @brief The total number of records of the given type
+ * @param type
+ * @return
+ */
+
+u_int64_t RecordFile::nRecords(walkerType type) const
+{
+    u_int64_t n = 0;
+    for (u_int64_t i = 0; i < nChunks(); ++i) {
+        if(chunkType(i) == type)
+            n += chunkSize(i);
+    }
+    return n;
+}
+
+bool RecordFile::mapHeader()
+{
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < RECORDFILE_HEADER_SIZE)
+        return false;
+    void *map = mmap(NULL, RECORDFILE_HEADER_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED) {
+        logMessage("Cannot map the record file header");
+        return false;
+    }
+    header = (RecordFileHeader *)map;
+    writable = true;
+    return true;
+}
+
+bool RecordFile::checkHeader() const
+{
+    if(memcmp(header->magic, RECORDFILE_MAGIC, sizeof(RECORDFILE_MAGIC)) != 0
+            || header->byteOrder != 0x01020304
+            || header->version != RECORDFILE_VERSION)
+        return false;
+
+    // files written by a build with a different MCfloat
+    if(header->nFields > 0 && header->fields[0].type != floatFieldType()) {
+        logMessage("Records have %s fields, this build uses %s",
+                   fieldTypeName(header->fields[0].type),
+                   fieldTypeName(floatFieldType()));
+        return false;
+    }
+    if(header->recordSize != sizeof(WalkerRecord)
+            || header->chunkRecords == 0)
+        return false;
+
+    RecordFileField fields[RECORDFILE_MAX_FIELDS];
+    u_int32_t nFields = walkerRecordFields(fields);
+    return header->nFields == nFields
+            && memcmp(header->fields, fields, sizeof(fields)) == 0;
+}
+
+/**
+ * @brief Starts a new chunk for the given walker type, preallocating it on
+ * disk
+ * @param type
+ * @return false if the chunk cannot be allocated
+ */
+
+bool RecordFile::newChunk(walkerType type)
+{
+    if(!writable)
+        return false;
+    unmapChunk(type);
+
+    off_t offset = header->headerSize + header->nChunks * header->chunkStride;
+    if(posix_fallocate(fd, offset, header->chunkStride) != 0) {
+        logMessage("Cannot allocate a new chunk in the record file");
+        return false;
+    }
+    void *map = mmap(NULL, header->chunkStride, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, offset);
+    if(map == MAP_FAILED) {
+        logMessage("Cannot map a new chunk in the record file");
+        return false;
+    }
+
+    chunkMap[type] = (char *)map;
+    RecordFileChunk *c = (RecordFileChunk *)map;
+    c->type = type;
+    c->nRecords = 0;
+    currentCount[type] = &c->nRecords;
+    currentData[type] = (WalkerRecord *)(chunkMap[type]
+                                         + RECORDFILE_CHUNK_HEADER_SIZE);
+    header->nChunks++;
+    return true;
+}
+
+void RecordFile::unmapChunk(walkerType type)
+{
+    if(chunkMap[type] == NULL)
+        return;
+    munmap(chunkMap[type], header->chunkStride);
+    chunkMap[type] = NULL;
+    currentCount[type] = NULL;
+    currentData[type] = NULL;
+}
+
+const RecordFileChunk *RecordFile::chunk(u_int64_t index) const
+{
+    return (const RecordFileChunk *)(readMap + header->headerSize
+                                     + index * header->chunkStride);
+}
@@ -0,0 +1,169 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/shardlauncher.h>
+#include <MCPlusPlus/outputmerger.h>
+
+#include <algorithm>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace MCPP;
+
+ShardLauncher::ShardLauncher(BaseObject *parent) :
+    BaseObject(parent)
+{
+    sim = NULL;
+    nProcesses = 1;
+    maxRetries = 1;
+}
+
+ShardLauncher::~ShardLauncher()
+{
+}
+
+/**
+ * @brief Sets the simulation to be run
+ * @param sim
+ *
+ *
+ * The simulation is not owned by the launcher and is left unchanged in the
+ * calling process.
+ */
+
+void ShardLauncher::setSimulation(Simulation *sim)
+{
+    this->sim = sim;
+}
+
+/**
+ * @brief Sets the number of worker processes, i.e. of shards
+ * @param value
+ */
+
+void ShardLauncher::setNProcesses(uint value)
+{
+    nProcesses = value > 0 ? value : 1;
+}
+
+/**
+ * @brief Sets how many times a failed shard is run again
+ * @param value
+ *
+ *
+ * Defaults to 1.
+ */
+
+void ShardLauncher::setMaxRetries(uint value)
+{
+    maxRetries = value;
+}
+
+/**
+ * @brief Runs all the shards and merges their results
+ * @return false if the output file already exists or if some shards failed
+ * even after retrying. In the latter case the shards that completed are
+ * merged anyway, and normalized with the walkers they actually simulated.
+ */
+
+bool ShardLauncher::run()
+{
+    if(sim == NULL) {
+        logMessage("No simulation set");
+        return false;
+    }
+    if(sim->outputFileName() == NULL)
+        sim->setOutputFileName("output.h5");
+    string outputFile = sim->outputFileName();
+    if(access(outputFile.c_str(), F_OK) >= 0) {
+        logMessage("File %s already exists. Aborting.", outputFile.c_str());
+        return false;
+    }
+
+    vector<uint> pending;
+    for (uint i = 0; i < nProcesses; ++i) {
+        pending.push_back(i);
+    }
+
+    for (uint attempt = 0; attempt <= maxRetries && !pending.empty();
+         ++attempt) {
+        if(attempt > 0)
+            logMessage("Retrying %lu shards", pending.size());
+
+        vector<pid_t> pids;
+        for (size_t i = 0; i < pending.size(); ++i) {
+            remove(sim->shardOutputFileName(pending[i]).c_str());
+            pids.push_back(spawn(pending[i]));
+        }
+
+        vector<uint> failed;
+        for (size_t i = 0; i < pending.size(); ++i) {
+            int status = 0;
+            if(pids[i] < 0 || waitpid(pids[i], &status, 0) < 0
+                    || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                logMessage("Shard %u failed", pending[i]);
+                failed.push_back(pending[i]);
+            }
+        }
+        pending = failed;
+    }
+
+    OutputMerger merger;
+    uint nMerged = 0;
+    for (uint i = 0; i < nProcesses; ++i) {
+        if(find(pending.begin(), pending.end(), i) != pending.end())
+            continue;
+        merger.addInputFile(sim->shardOutputFileName(i).c_str());
+        nMerged++;
+    }
+    if(nMerged == 0 || !merger.merge(outputFile.c_str()))
+        return false;
+
+    if(!pending.empty()) {
+        logMessage("%lu of %u shards failed", pending.size(), nProcesses);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Forks a worker process running the given shard
+ * @param index
+ * @return The pid of the worker, or -1 on error
+ */
+
+pid_t ShardLauncher::spawn(uint index)
+{
+    // buffered output would be written twice
+    cout.flush();
+    cerr.flush();
+    fflush(NULL);
+
+    pid_t pid = fork();
+    if(pid < 0) {
+        logMessage("Cannot fork shard %u", index);
+        return -1;
+    }
+    if(pid > 0)
+        return pid;
+
+    sim->setShard(index, nProcesses);
+    bool ok = sim->run();
+    cout.flush();
+    cerr.flush();
+    _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -19,10 +19,15 @@
 #include <MCPlusPlus/distributions.h>
 #include <MCPlusPlus/psigenerator.h>
 #include <signal.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <map>
 
 #include <boost/math/special_functions/sign.hpp>
 #include <boost/math/constants/constants.hpp>
 #include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
 
 #include <MCPlusPlus/h5outputfile.h>
 
@@ -38,15 +43,95 @@
 #define COSZERO (1.0-1.0E-30)
 #endif
 
+/* how often the monitor thread checks for progress requests, in seconds */
+#define PROGRESS_POLL_PERIOD 0.5
+
+/* events of the transport loop only counted for the performance report if
+ * requested at compile time */
+#ifdef ENABLE_PERFORMANCE_COUNTERS
+#define COUNT_EVENT(counter) (counter)++
+#else
+#define COUNT_EVENT(counter)
+#endif
+
 using namespace boost;
 using namespace boost::math;
 using namespace boost::math::constants;
 using namespace MCPP;
 
 Simulation *mainSimulation=NULL;
-Simulation *mostRecentInstance=NULL;
+boost::atomic<Simulation *> mostRecentInstance(NULL);
 vector<boost::thread*> threads;
 vector<Simulation *> sims;
+boost::mutex simsMutex;  // guards sims and the results merged by mainSimulation
+
+/* set by the USR1 and USR2 handlers and served by the monitor thread, since
+ * printing is not async-signal-safe */
+volatile sig_atomic_t progressRequested = 0;
+volatile sig_atomic_t allProgressRequested = 0;
+
+double wallClock() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/* adds the wall-clock time spent in its scope to the given timer */
+class ScopedTimer {
+public:
+    ScopedTimer(double *timer) : timer(timer), start(wallClock()) {}
+    ~ScopedTimer() { *timer += wallClock() - start; }
+private:
+    double *timer;
+    double start;
+};
+
+/* increments a counter on construction and destruction, so that it changes
+ * both before and after the scope */
+class ScopedGeneration {
+public:
+    ScopedGeneration(u_int64_t *counter) : counter(counter) { (*counter)++; }
+    ~ScopedGeneration() { (*counter)++; }
+private:
+    u_int64_t *counter;
+};
+
+void writeUInt64Array(H5FileHelper *file, const string &name,
+                      const u_int64_t *data, hsize_t size) {
+    hsize_t start[1] = {0};
+    hsize_t dims[1] = {size};
+    // the size can change between writes (e.g. RNG states)
+    if(file->dataSetExists(name.c_str())) {
+        file->openDataSet(name.c_str());
+        if(file->extentDims()[0] != size)
+            file->unlink(name.c_str());
+    }
+    if(!file->dataSetExists(name.c_str()))
+        file->newDataset(name.c_str(), 1, dims, PredType::NATIVE_UINT64);
+    file->writeHyperSlab(start, dims, data);
+}
+
+void writeDoubleArray(H5FileHelper *file, const string &name,
+                      const double *data, hsize_t size) {
+    hsize_t start[1] = {0};
+    hsize_t dims[1] = {size};
+    file->unlink(name.c_str());
+    file->newDataset(name.c_str(), 1, dims, PredType::NATIVE_DOUBLE);
+    file->writeHyperSlabDouble(start, dims, data);
+}
+
+bool readUInt64Array(H5FileHelper *file, const string &name,
+                     vector<u_int64_t> *dest) {
+    if(!file->dataSetExists(name.c_str()))
+        return false;
+    file->openDataSet(name.c_str());
+    if(file->getRank() != 1)
+        return false;
+    dest->resize(file->extentDims()[0]);
+    if(!dest->empty())
+        file->loadAll(dest->data());
+    return true;
+}
 
 MCfloat module(const MCfloat *x) {
     return sqrt(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]);
@@ -57,23 +142,11 @@ MCfloat module2D(const MCfloat x, const MCfloat y) {
 }
 
 void sigUsr1Handler(int sig, siginfo_t *siginfo, void *context) {
-    Simulation *sim = mostRecentInstance;
-
-    if(sim == NULL)
-        return;
-
-    sim->reportProgress();
+    progressRequested = 1;
 }
 
 void sigUsr2Handler(int sig, siginfo_t *siginfo, void *context) {
-    fprintf(stderr,"===============================\n");
-    for (unsigned int n = 0; n < mainSimulation->nThreads(); ++n) {
-        Simulation *sim = sims.at(n);
-        if(sim == NULL)
-            continue;
-        sim->reportProgress();
-    }
-    fprintf(stderr,"===============================\n");
+    allProgressRequested = 1;
 }
 
 void installSigUSR1Handler() {
@@ -110,8 +183,8 @@ void installSigTermHandler() {
     sigaction(SIGTERM, &sa, NULL);
 }
 
-void workerFunc(Simulation *sim) {
-    sim->run();
+void workerFunc(Simulation *sim, char *ok) {
+    *ok = sim->run();
 }
 
 Simulation::Simulation(BaseObject *parent) :
@@ -123,6 +196,11 @@ Simulation::Simulation(BaseObject *parent) :
     layer0 = 0;
     trajectoryPoints = new vector<vector<MCfloat>*>();
     saveTrajectory = false;
+    trajectorySampling = 0;
+    trajectoryTypeFlags = FLAG_ALL_WALKERS;
+    trajectoryBufferSize = 100000;
+    trajRecorder = NULL;
+    recordingTrajectory = false;
     fresnelReflectionsEnabled = true;
     _nThreads = 1;
     _totalWalkers = 0;
@@ -131,15 +209,55 @@ Simulation::Simulation(BaseObject *parent) :
     exitPointsSaveFlags = 0;
     exitKVectorsDirsSaveFlags = 0;
     exitKVectorsSaveFlags = 0;
+    walkerRecordsSaveFlags = 0;
     timeOriginZ = 0;
-    deflCosine.setParent(this);
+    convergenceCheckInterval = 10;
+    maxWallTime = 0;
+    snapshotInterval = 0;
+    snapshotWalkerInterval = 0;
+    monitorThread = NULL;
+    monitorStopped = true;
+    terminationRequested = false;
+    checkpointInterval = 0;
+    lastCheckpoint = 0;
+    checkpointThreads = 1;
+    checkpointWalkers = 0;
+    resumeEnabled = false;
+    appendEnabled = false;
+    resumeState = NULL;
+    threadIndex = 0;
+    n = 0;
+    rawOutputStreaming = false;
+    rawBufferSize = 100000;
+    swmrEnabled = false;
+    rawWriter = NULL;
+    rawStreamedWalkers = 0;
+    rawOutputShards = false;
+    shardWriter = NULL;
+    recordFilesEnabled = false;
+    recordFile = NULL;
+    shardIndex = 0;
+    shardCount = 0;
+    streamSplitting = false;
+    statsFile = NULL;
+    statsInterval = 1;
+    memset(&perf, 0, sizeof(perf));
+    rawOutputInMemory = false;
+    generation = 0;
+    deflCosine = NULL;
+    deflCosines = NULL;
+    deflCosineTable = NULL;
+    musTable = NULL;
+    timeOffsets = NULL;
+    nBands = 1;
+    band0 = 0;
     setRawOutputEnabled(false);
     r0 = (MCfloat*)calloc(3, sizeof(MCfloat));
     r1 = (MCfloat*)calloc(3, sizeof(MCfloat));
     k0 = (MCfloat*)calloc(3, sizeof(MCfloat));
     k1 = (MCfloat*)calloc(3, sizeof(MCfloat));
     clear();
-    mostRecentInstance = this;
+    mostRecentInstance.store(this);
     installSigUSR1Handler();
     addObjectToCheck((const BaseObject**)&_sample);
     addObjectToCheck((const BaseObject**)&source);
@@ -150,10 +268,18 @@ Simulation::~Simulation() {
         delete trajectoryPoints->at(i);
     }
     delete trajectoryPoints;
-    if(mostRecentInstance == this)
-        mostRecentInstance = NULL;
+    delete trajRecorder;
+    Simulation *self = this;
+    mostRecentInstance.compare_exchange_strong(self, NULL);
     if(outputFile != NULL)
         free(outputFile);
+    if(statsFile != NULL)
+        free(statsFile);
+    clearCheckpoints();
+    if(shardWriter != NULL)
+        delete shardWriter;
+    if(recordFile != NULL)
+        delete recordFile;
     free(r0);
     free(r1);
     free(k0);
@@ -165,15 +291,34 @@ Simulation::~Simulation() {
  */
 
 void Simulation::clear() {
+    boost::lock_guard<boost::mutex> lock(histMutex);
     for (int i = 0; i < 4; ++i) {
         exitPoints[i].clear();
         exitKVectors[i].clear();
         walkTimes[i].clear();
+        records[i].clear();
         photonCounters[i] = 0;
+        resumedCounters[i] = 0;
     }
 
     _nInteractions = NULL;
     forceTermination = false;
+    resetLiveCounters();
+}
+
+/**
+ * @brief Zeroes the event counters of this thread and publishes them
+ */
+
+void Simulation::resetLiveCounters()
+{
+    n = 0;
+    nScatterings = 0;
+    nInterfaceHits = 0;
+    for (uint i = 0; i < 4; ++i) {
+        nExits[i] = 0;
+    }
+    publishLiveCounters();
 }
 
 /**
@@ -241,9 +386,17 @@ u_int64_t Simulation::nPhotons() const
     return _totalWalkers;
 }
 
+/**
+ * @brief The number of walkers completed so far by this thread
+ * @return
+ *
+ *
+ * It can be called from any thread while the simulation is running.
+ */
+
 u_int64_t Simulation::currentPhoton() const
 {
-    return n;
+    return live.walkers.load(boost::memory_order_relaxed);
 }
 
 void Simulation::setOutputFileName(const char *name)
@@ -251,51 +404,198 @@ void Simulation::setOutputFileName(const char *name)
     copyToInternalVariable(&outputFile,name);
 }
 
+const char *Simulation::outputFileName() const
+{
+    return outputFile;
+}
+
 /**
  * @brief Runs the simulation
  *
  * Defaults to single thread operation. Use setNThreads() to set the number of
  * parallel threads used to run the simulation. \pre The RNG has to be valid
  * (see BaseRandom)
+ *
+ * @return false if the simulation could not be set up or one of its threads
+ * failed; the results of the other threads are saved anyway
  */
 
-void Simulation::run() {
+bool Simulation::run() {
+    ScopedGeneration generationScope(&generation);
     if(outputFile == NULL) {
-        outputFile = "output.h5";
+        copyToInternalVariable(&outputFile, "output.h5");
         logMessage("No output file name provided, using %s", outputFile);
     }
-    if(access(outputFile,F_OK) >= 0) {
-        logMessage("File %s already exists. Aborting.", outputFile);
-        return;
+    if(shardCount > 0 && !wasCloned())
+        return runShard();
+    double runStart = wallClock();
+    threadPerf.clear();
+    if(!wasCloned() && !prepareLayerTables())
+        return false;
+    bool resuming = false;
+    if(!wasCloned()) {
+        if(access(outputFile,F_OK) >= 0) {
+            if(!resumeEnabled && !appendEnabled) {
+                logMessage("File %s already exists. Aborting.", outputFile);
+                return false;
+            }
+            resuming = true;
+        }
+        else {
+            // create the output file in advance, so that it can be written
+            // while the simulation is running
+            boost::lock_guard<boost::recursive_mutex> fileLock(h5Mutex);
+            H5OutputFile file;
+            file.setSWMRWriteEnabled(swmrEnabled && rawOutputStreaming);
+            file.setRawOutputProfile(rawProfile);
+            if(!file.newFile(outputFile, rawOutputEnabled)
+                    || (rawOutputEnabled && !file.createWalkerRecordDatasets(
+                            walkerRecordsSaveFlags))
+                    || (trajectorySampling > 0
+                        && !file.createTrajectoryDatasets())) {
+                logMessage("Cannot create %s. Aborting.", outputFile);
+                return false;
+            }
+            file.close();
+            if(rawOutputEnabled && (rawOutputShards || recordFilesEnabled))
+                removeShards();
+        }
     }
 
     installSigUSR2Handler();
     time(&startTime);
-    for (size_t i = 0; i < hists.size(); ++i) {
-        Histogram *h = hists[i];
-        h->setScale(nPhotons());
-        h->initialize();
+    {
+        boost::lock_guard<boost::mutex> lock(histMutex);
+        for (size_t i = 0; i < hists.size(); ++i) {
+            Histogram *h = hists[i];
+            h->setScale(nPhotons());
+            h->initialize();
+        }
+    }
+    for (size_t i = 0; i < grids.size(); ++i) {
+        if(!grids[i]->initialize()) {
+            logMessage("Cannot allocate fluence grid %s. Aborting.",
+                       grids[i]->name().c_str());
+            return false;
+        }
+    }
+
+    if(!wasCloned()) {
+        for (size_t i = 0; i < criteria.size(); ++i) {
+            ConvergenceCriterion *c = &criteria[i];
+            if(c->histName.empty())
+                continue;
+            c->histIndex = -1;
+            for (size_t j = 0; j < hists.size(); ++j) {
+                if(hists[j]->name() == c->histName)
+                    c->histIndex = j;
+            }
+            if(c->histIndex < 0) {
+                logMessage("No histogram named %s. Aborting.",
+                           c->histName.c_str());
+                return false;
+            }
+            // bins before the overflow bin
+            int nBins = hists[c->histIndex]->nBinsAlong(0) - 1;
+            int lastBin = c->lastBin < 0 ? nBins - 1 : c->lastBin;
+            if(c->firstBin < 0 || c->firstBin > lastBin || lastBin >= nBins) {
+                logMessage("Invalid bins %d to %d for histogram %s, which has "
+                           "%d bins. Aborting.", c->firstBin, lastBin,
+                           c->histName.c_str(), nBins);
+                return false;
+            }
+        }
+
+        clearCheckpoints();
+        if(resuming) {
+            if(!loadCheckpoint()) {
+                logMessage("Cannot resume from %s. Aborting.", outputFile);
+                return false;
+            }
+            if(!appendEnabled && !restoredThreads.empty()
+                    && _nThreads != restoredThreads.size()) {
+                logMessage("Resuming with %zu threads as in the checkpoint",
+                           restoredThreads.size());
+                _nThreads = restoredThreads.size();
+            }
+        }
+        if(restoredThreads.empty()) {
+            checkpointThreads = _nThreads;
+            checkpointWalkers = nPhotons();
+        }
+        else if(appendEnabled) {
+            checkpointThreads = max<uint>(checkpointThreads, _nThreads);
+            checkpointWalkers += nPhotons();
+        }
+
+        if(rawOutputEnabled && rawOutputStreaming && !rawOutputShards) {
+            if(swmrEnabled && (snapshotInterval > 0
+                               || snapshotWalkerInterval > 0))
+                logMessage("Snapshots are disabled in SWMR mode");
+            rawWriter = new RawOutputWriter();
+            if(!rawWriter->start(outputFile, swmrEnabled)) {
+                stopRawOutputWriter();
+                logMessage("Cannot stream raw output to %s. Aborting.",
+                           outputFile);
+                return false;
+            }
+        }
     }
 
+    bool ok = true;
     if(_nThreads == 1) {
+        // a resumed thread only runs what is left of its budget, which is
+        // restored after the run
+        u_int64_t totalWalkers = _totalWalkers;
         if(!wasCloned()) {
             mainSimulation = this;
             installSigTermHandler();
-            sims.clear();
-            sims.push_back(this);
+            {
+                boost::lock_guard<boost::mutex> lock(simsMutex);
+                sims.clear();
+                sims.push_back(this);
+            }
             if(multipleRNGStates.size() > 0)
                 setGeneratorState(multipleRNGStates[0]);
+            threadIndex = 0;
+            if(!restoredThreads.empty()) {
+                resumeState = restoredThreads[0];
+                if(!resumeState->rngState.empty())
+                    setBinaryGeneratorState(resumeState->rngState);
+                if(!appendEnabled)
+                    _totalWalkers = resumeState->nWalkers
+                            - resumeState->walkersDone;
+            }
+            startMonitor();
+        }
+
+        if(rawOutputEnabled && rawOutputShards)
+            ok = openShard();
+        if(ok && rawOutputEnabled && recordFilesEnabled)
+            ok = openRecordFile();
+        if(ok)
+            ok = runSingleThread();
+        if(rawOutputEnabled && rawOutputShards)
+            saveShard();
+        closeRecordFile();
+
+        if(!wasCloned()) {
+            stopMonitor();
+            stopRawOutputWriter();
+            _totalWalkers = totalWalkers;
         }
 
-        if(!runSingleThread())
-            return;
+        if(!ok)
+            return false;
 
-        if(!wasCloned())
+        if(!wasCloned()) {
             saveRawOutput();
+            threadPerf.push_back(perf);
+        }
     }
     else {
         mainSimulation = this;
-        runMultipleThreads();
+        ok = runMultipleThreads();
     }
 
     time_t now;
@@ -304,8 +604,36 @@ void Simulation::run() {
     if(wasCloned()) {
         logMessage("Thread using seed %u completed in %.f seconds",
                    currentSeed(), difftime(now, startTime));
-        return;
+        return true;
+    }
+
+    // with a quasi-random source, a single thread is a single replicate,
+    // whose error cannot be estimated
+    bool quasiRandom = source->quasiRandomSequence() != NULL;
+    if(quasiRandom && _nThreads == 1) {
+        logMessage("The errors of a quasi-random source need at least 2 "
+                   "threads or shards, they are saved as NaN");
+        for (size_t i = 0; i < hists.size(); ++i) {
+            hists[i]->markAsReplicate(simulatedPhotons());
+        }
+    }
+
+    // add the results of the checkpointed threads that were not resumed
+    for (size_t n = _nThreads; n < restoredThreads.size(); ++n) {
+        ThreadCheckpoint *c = restoredThreads[n];
+        u_int64_t nWalkers = 0;
+        for (uint i = 0; i < 4; ++i) {
+            photonCounters[i] += c->counters[i];
+            nWalkers += c->counters[i];
+        }
+        for (size_t i = 0; i < hists.size(); ++i) {
+            if(quasiRandom)
+                hists[i]->appendReplicate(c->hists[i], nWalkers);
+            else
+                hists[i]->appendCounts(c->hists[i]);
+        }
     }
+    resumeState = NULL;
 
     stringstream stream;
     stream << "\n\n================\n";
@@ -316,37 +644,156 @@ void Simulation::run() {
     logMessage("%s\nCompleted in %.f seconds\n================\n",
                stream.str().c_str(), difftime(now, startTime));
 
+    double outputStart = wallClock();
+
+    // threads append their own counts to the file, but only the merged ones
+    // account for all the checkpoints of a resumed simulation
+    {
+        boost::lock_guard<boost::recursive_mutex> fileLock(h5Mutex);
+        H5OutputFile file;
+        if(file.openFile(outputFile)) {
+            file.savePhotonCounts(photonCounters);
+            if(rawOutputEnabled && rawOutputShards)
+                linkShards(&file);
+        }
+    }
+
+    // the simulation may have been stopped before completing its budget
+    u_int64_t total = simulatedPhotons();
     for (size_t i = 0; i < hists.size(); ++i) {
         Histogram *h = hists[i];
+        h->setScale(total);
         h->saveToFile(outputFile);
     }
+    saveRawHistograms();
+    saveFluenceGrids(resuming);
+    double end = wallClock();
+    savePerformanceReport(end - runStart, end - outputStart);
+    return ok;
+}
+
+/**
+ * @brief Runs the share of walkers of this shard in its own output file
+ * @return The result of run()
+ *
+ *
+ * See setShard().
+ */
+
+bool Simulation::runShard()
+{
+    uint count = shardCount;
+    u_int64_t N = nPhotons();
+    unsigned int seed = currentSeed();
+    string fileName = outputFile;
+    string statsFileName = statsFile == NULL ? "" : statsFile;
+
+    u_int64_t nWalkers = N / count;
+    if(shardIndex < N % count)
+        nWalkers++;
+    setNPhotons(nWalkers);
+    // with stream splitting, the threads of this shard take the master stream
+    // jumped as many times as the threads of the previous shards
+    vector<u_int64_t> masterState;
+    if(streamSplitting) {
+        masterState = binaryGeneratorState();
+        jumpGenerator(shardIndex * _nThreads);
+        _currentSeed = seed + shardIndex * _nThreads;
+    }
+    else {
+        setSeed(seed + shardIndex * _nThreads);
+    }
+    setOutputFileName(shardOutputFileName(shardIndex).c_str());
+    if(statsFile != NULL) {
+        stringstream ss;
+        ss << statsFileName << ".shard" << shardIndex;
+        setStatsFileName(ss.str().c_str());
+    }
+    logMessage("Running shard %u of %u in %s", shardIndex, count, outputFile);
+
+    shardCount = 0;
+    bool ok = run();
+    shardCount = count;
+
+    setNPhotons(N);
+    setSeed(seed);
+    if(streamSplitting)
+        setBinaryGeneratorState(masterState);
+    setOutputFileName(fileName.c_str());
+    if(statsFile != NULL)
+        setStatsFileName(statsFileName.c_str());
+    return ok;
 }
 
-void Simulation::runMultipleThreads()
+bool Simulation::runMultipleThreads()
 {
     threads.clear();
-    sims.clear();
+    {
+        boost::lock_guard<boost::mutex> lock(simsMutex);
+        sims.clear();
+    }
     installSigTermHandler();
 
+    for (uint type = 0; type < 4; ++type) {
+        exitPoints[type].clear();
+        walkTimes[type].clear();
+        exitKVectors[type].clear();
+        records[type].clear();
+    }
+    resetLiveCounters();
+
     u_int64_t walkersPerThread = nPhotons()/_nThreads;
     u_int64_t remainder = nPhotons() % _nThreads;
+    vector<char> threadResults(_nThreads, false);
+
+    // a single stream, taken from the RNG of this simulation and jumped once
+    // per thread: thread n gets the master stream jumped n times
+    BaseRandom stream;
+    if(streamSplitting)
+        stream.setBinaryGeneratorState(binaryGeneratorState());
 
     for (unsigned int n = 0; n < _nThreads; ++n) {
         Simulation *sim = (Simulation *)clone();
         u_int64_t nWalkers = walkersPerThread;
         if(n<remainder)
             nWalkers++;
-        sim->setNPhotons(nWalkers);
         sim->setSeed(currentSeed()+n);
+        if(streamSplitting && n > 0)
+            stream.jumpGenerator();
         if(n<multipleRNGStates.size())
             sim->setGeneratorState(multipleRNGStates[n]);
+        else if(streamSplitting)
+            sim->setBinaryGeneratorState(stream.binaryGeneratorState());
+        sim->threadIndex = n;
+        sim->rawWriter = rawWriter;
+        if(n < restoredThreads.size()) {
+            const ThreadCheckpoint *c = restoredThreads[n];
+            sim->resumeState = c;
+            // threads without a checkpoint start over from their own seed
+            if(!c->rngState.empty())
+                sim->setBinaryGeneratorState(c->rngState);
+            if(!appendEnabled)
+                nWalkers = c->nWalkers - c->walkersDone;
+        }
+        sim->setNPhotons(nWalkers);
 
-        sims.push_back(sim);
+        {
+            boost::lock_guard<boost::mutex> lock(simsMutex);
+            sims.push_back(sim);
+        }
 
         //launch thread
-        threads.push_back(new boost::thread(workerFunc, sims.at(n)));
+        threads.push_back(new boost::thread(workerFunc, sim,
+                                            &threadResults[n]));
     }
 
+    startMonitor();
+
+    // no objects can be created in the output file while it is open in SWMR
+    // mode, so the threads are saved after the raw output writer is stopped
+    bool deferSave = rawWriter != NULL && swmrEnabled;
+    vector<Simulation *> finished;
+
     //wait for all threads to finish
     for (unsigned int n = 0; n < _nThreads; ++n) {
         boost::thread * thread = threads.at(n);
@@ -354,23 +801,105 @@ void Simulation::runMultipleThreads()
 
         Simulation *sim = sims.at(n);
 
-        for (uint i = 0; i < 4; ++i) {
-            photonCounters[i] += sim->photonCounters[i];
+        {
+            boost::lock_guard<boost::mutex> lock(simsMutex);
+            for (uint i = 0; i < 4; ++i) {
+                photonCounters[i] += sim->photonCounters[i];
+            }
+
+            // with a quasi-random source the threads are independent
+            // randomizations, whose spread gives the error
+            u_int64_t nWalkers = 0;
+            for (uint i = 0; i < 4; ++i) {
+                nWalkers += sim->photonCounters[i];
+            }
+            for (size_t i = 0; i < hists.size(); ++i) {
+                Histogram *h = hists[i];
+                if(source->quasiRandomSequence() != NULL)
+                    h->appendReplicate(sim->hists[i], nWalkers);
+                else
+                    h->appendCounts((sim->hists[i]));
+            }
+            sims.at(n) = NULL;
+
+            // the counters of this thread stay in the live totals
+            this->n += sim->n;
+            nScatterings += sim->nScatterings;
+            nInterfaceHits += sim->nInterfaceHits;
+            for (uint i = 0; i < 4; ++i) {
+                nExits[i] += sim->nExits[i];
+            }
+            publishLiveCounters();
         }
 
-        for (size_t i = 0; i < hists.size(); ++i) {
-            Histogram *h = hists[i];
-            h->appendCounts((sim->hists[i]));
+        // reduce the grids while the other threads are still running
+        for (size_t i = 0; i < grids.size(); ++i) {
+            grids[i]->appendCounts(sim->grids[i]);
         }
 
-        sim->saveRawOutput();
+        Simulation *expected = sim;
+        mostRecentInstance.compare_exchange_strong(expected, NULL);
 
-        if(mostRecentInstance == sim)
-            mostRecentInstance = NULL;
+        delete thread;
+
+        if(deferSave) {
+            finished.push_back(sim);
+            continue;
+        }
 
-        sims.at(n) = NULL;
+        sim->saveRawOutput();
+        threadPerf.push_back(sim->perf);
+        keepRawOutput(sim);
         delete sim;
-        delete thread;
+    }
+
+    stopMonitor();
+    stopRawOutputWriter();
+
+    for (size_t n = 0; n < finished.size(); ++n) {
+        finished[n]->saveRawOutput();
+        threadPerf.push_back(finished[n]->perf);
+        keepRawOutput(finished[n]);
+        delete finished[n];
+    }
+
+    bool ok = true;
+    for (unsigned int n = 0; n < _nThreads; ++n) {
+        if(!threadResults[n]) {
+            logMessage("Thread %u failed", n);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+template <typename T>
+static void moveAppend(vector<T> *dest, vector<T> *src)
+{
+    if(dest->empty())
+        dest->swap(*src);
+    else
+        dest->insert(dest->end(), src->begin(), src->end());
+}
+
+/**
+ * @brief Moves the raw output of a finished thread into this simulation
+ * @param sim
+ *
+ *
+ * See setRawOutputInMemoryEnabled().
+ */
+
+void Simulation::keepRawOutput(Simulation *sim)
+{
+    if(!rawOutputInMemory)
+        return;
+    boost::lock_guard<boost::mutex> lock(histMutex);
+    for (uint type = 0; type < 4; ++type) {
+        moveAppend(&exitPoints[type], &sim->exitPoints[type]);
+        moveAppend(&walkTimes[type], &sim->walkTimes[type]);
+        moveAppend(&exitKVectors[type], &sim->exitKVectors[type]);
+        moveAppend(&records[type], &sim->records[type]);
     }
 }
 
@@ -379,34 +908,73 @@ bool Simulation::runSingleThread() {
         return false;
 
     clear();
+    if(resumeState != NULL) {
+        boost::lock_guard<boost::mutex> lock(histMutex);
+        for (uint i = 0; i < 4; ++i) {
+            photonCounters[i] = resumeState->counters[i];
+            resumedCounters[i] = resumeState->counters[i];
+        }
+        for (size_t i = 0; i < hists.size(); ++i) {
+            hists[i]->appendCounts(resumeState->hists[i]);
+        }
+        logMessage("resuming after %llu walkers", resumeState->walkersDone);
+    }
+
+    // a thread stopped within a source batch draws it again from the RNG
+    // state saved before it, then goes on with the transport from where it
+    // was interrupted, as if it had never stopped
+    batchSize = 0;
+    batchEnd = 0;
+    batchRNGState.clear();
+    if(resumeState != NULL && !appendEnabled
+            && !resumeState->batchRNGState.empty()
+            && resumeState->batchDone < resumeState->batchSize
+            && resumeState->batchSize <= WALKER_BUFSIZE) {
+        vector<u_int64_t> state = binaryGeneratorState();
+        batchRNGState = resumeState->batchRNGState;
+        setBinaryGeneratorState(batchRNGState);
+        batchSize = resumeState->batchSize;
+        source->spinBatch(sourceBuf, batchSize);
+        batchEnd = batchSize - resumeState->batchDone;
+        setBinaryGeneratorState(state);
+    }
+    lastCheckpoint = wallClock();
+    memset(&perf, 0, sizeof(perf));
+    double simulationStart = wallClock();
+    u_int64_t draws0 = mt->draws();
     logMessage("starting... Number of walkers = %llu, original seed = %u",
                nPhotons(), currentSeed());
     nLayers = _sample->nLayers();
 
 
     MCfloat *uzb = (MCfloat*)malloc((nLayers + 2) * sizeof(MCfloat));
-    Material *mat = (Material*)malloc((nLayers + 2) * sizeof(Material));
-    MCfloat *mus = (MCfloat*)malloc((nLayers + 2) * sizeof(MCfloat));
 
     for (unsigned int i = 0; i < nLayers + 1; ++i) {
         uzb[i]=_sample->zBoundaries()->at(i);
     }
 
-    for (unsigned int i = 0; i < nLayers + 2; ++i) {
-        Material *m = _sample->material(i);
-        m->setWavelength(source->wavelength());
-        mat[i] = *m;
-        mus[i] = 1. / mat[i].ls;
+    // the materials were tabulated for each band by prepareLayerTables()
+    nBands = layerTable.size() / (nLayers + 2);
+    size_t nTable = layerTable.size();
+    MCfloat *mus = (MCfloat*)malloc(nTable * sizeof(MCfloat));
+    deflCosineTable = (AbstractDistribution**)malloc(
+                nTable * sizeof(AbstractDistribution*));
+    for (size_t i = 0; i < nTable; ++i) {
+        mus[i] = 1. / layerTable[i].ls;
+        if(phaseTable[i] != NULL) {
+            deflCosineTable[i] = (AbstractDistribution *)phaseTable[i]->clone();
+            deflCosineTable[i]->setParent(this);
+        }
+        else
+            deflCosineTable[i] = new CosThetaGenerator(layerTable[i].g, this);
     }
 
     upperZBoundaries = uzb;
-    materials = mat;
-    this->mus = mus;
+    musTable = mus;
 
     n = 0;
     nBuf = 0;
 
-    MCfloat timeOffset = 0;
     MCfloat pos[3];
     pos[0] = 0; pos[1] = 0;
 
@@ -424,28 +992,50 @@ bool Simulation::runSingleThread() {
         initialLayer = 0;
     }
     MCfloat rightPoint = max(source->z0(), timeOriginZ);
-    if(leftLayer != rightLayer) { //add first and last portion of distance
-        timeOffset += (upperZBoundaries[leftLayer] - leftPoint)
-                / materials[leftLayer].v;
-        timeOffset += (rightPoint - upperZBoundaries[rightLayer - 1])
-                / materials[rightLayer].v;
-        for (uint i = leftLayer + 1; i <= rightLayer - 1 ; ++i) {
-            timeOffset += (upperZBoundaries[i] - upperZBoundaries[i-1])
-                    / materials[i].v;
+    timeOffsets = (MCfloat*)malloc(nBands * sizeof(MCfloat));
+    for (uint band = 0; band < nBands; ++band) {
+        const Material *mat = &layerTable[band * (nLayers + 2)];
+        MCfloat timeOffset = 0;
+        if(leftLayer != rightLayer) { //add first and last portion of distance
+            timeOffset += (upperZBoundaries[leftLayer] - leftPoint)
+                    / mat[leftLayer].v;
+            timeOffset += (rightPoint - upperZBoundaries[rightLayer - 1])
+                    / mat[rightLayer].v;
+            for (uint i = leftLayer + 1; i <= rightLayer - 1 ; ++i) {
+                timeOffset += (upperZBoundaries[i] - upperZBoundaries[i-1])
+                        / mat[i].v;
+            }
         }
+        else {
+            timeOffset += fabs(rightPoint - leftPoint)
+                    / mat[leftLayer].v;
+        }
+        timeOffsets[band] = timeOffset
+                * -1 * sign<MCfloat>(timeOriginZ - source->z0());
     }
-    else {
-        timeOffset += fabs(rightPoint - leftPoint)
-                / materials[leftLayer].v;
-    }
-    timeOffset *= -1 * sign<MCfloat>(timeOriginZ - source->z0());
 
-    // layer0 must be initialized for updateLayerVariables()
-    layer0 = numeric_limits<unsigned int>::max();
+    // also initializes layer0 for updateLayerVariables()
+    selectBand(0);
+
+    rawStreamedWalkers = 0;
+
+    delete trajRecorder;
+    trajRecorder = NULL;
+    if(trajectorySampling > 0) {
+        trajRecorder = new TrajectoryRecorder(threadIndex);
+        trajRecorder->setPhotonTypeFlags(trajectoryTypeFlags);
+        trajRecorder->reserve(trajectoryBufferSize);
+    }
+    // in SWMR mode the output file cannot be opened while the raw output
+    // writer is running, so trajectories are only saved at the end
+    bool flushTrajectories = rawWriter == NULL || !swmrEnabled;
 
     while(n < _totalWalkers && !forceTermination) {
-        if(nBuf == WALKER_BUFSIZE)
+        if(nBuf == WALKER_BUFSIZE) {
             flushHistogram();
+            if(rawWriter != NULL && n - rawStreamedWalkers >= rawBufferSize)
+                streamRawOutput();
+        }
 
         walkerExitedSample = false;
         vector<u_int64_t> nInteractions;
@@ -453,13 +1043,29 @@ bool Simulation::runSingleThread() {
         if(saveTrajectory)
             currentTrajectory = new vector<MCfloat>();
 
-        source->spin(&walker);
+        // the source draws a whole batch before its transport, so the RNG
+        // sequence depends on WALKER_BUFSIZE. The state before the batch is
+        // kept for the checkpoints taken before it is completed
+        if(n == batchEnd) {
+            batchRNGState = binaryGeneratorState();
+            batchSize = min<u_int64_t>(WALKER_BUFSIZE, _totalWalkers - n);
+            source->spinBatch(sourceBuf, batchSize);
+            batchEnd = n + batchSize;
+        }
+        walker = sourceBuf[batchSize - (batchEnd - n)];
         memcpy(r0,walker.r0, 3 * sizeof(MCfloat));
         memcpy(k0,walker.k0, 3 * sizeof(MCfloat));
         if(r0[2] == -1 * numeric_limits<MCfloat>::infinity())
             r0[2] = leftPoint;
 
-        walker.walkTime += timeOffset;
+        if(walker.band != band0)
+            selectBand(walker.band);
+        walker.walkTime += timeOffsets[band0];
+
+        recordingTrajectory = trajRecorder != NULL
+                && n % trajectorySampling == 0;
+        if(recordingTrajectory)
+            trajRecorder->begin(n, r0);
 
         totalLengthInCurrentLayer = 0;
         updateLayerVariables(initialLayer);
@@ -488,8 +1094,9 @@ bool Simulation::runSingleThread() {
                 length = exponential_distribution<long double>(currentMus)(*mt);
                 if(kNeedsToBeScattered) {
                     nInteractions[layer0]++;
+                    nScatterings++;
 
-                    MCfloat cosTheta = deflCosine.spin();
+                    MCfloat cosTheta = deflCosine->spin();
                     MCfloat sinTheta = sqrt(1 - pow(cosTheta, 2));
                     //uniform in [0,2pi)
                     MCfloat psi = uniform_01<MCfloat>()(*mt) * two_pi<MCfloat>();
@@ -547,6 +1154,8 @@ bool Simulation::runSingleThread() {
             if(r1[2] >= currLayerLowerBoundary
                     && r1[2] <= currLayerUpperBoundary)
             {
+                if(!grids.empty())
+                    scoreSegment(length);
                 swap_r0_r1();
                 swap_k0_k1();
 
@@ -568,6 +1177,8 @@ bool Simulation::runSingleThread() {
             if(saveTrajectory)
                 appendTrajectoryPoint(r0);
 #endif
+            if(recordingTrajectory)
+                trajRecorder->append(r0);
 
             if(walkerExitedSample)
                 break;
@@ -577,16 +1188,45 @@ bool Simulation::runSingleThread() {
         if(saveTrajectory)
             trajectoryPoints->push_back(currentTrajectory);
 #endif
+        if(recordingTrajectory) {
+            trajRecorder->end((walkerType)walkerBuf[nBuf - 1].type);
+            if(flushTrajectories
+                    && trajRecorder->nPoints() >= trajectoryBufferSize)
+                saveTrajectories();
+        }
 
 #ifdef DEBUG_TRAJECTORY
         printf("\nwalker reached layer %d\n", layer0);
 #endif
         n++;
+        publishLiveCounters();
     }
     free(uzb);
-    free(mat);
     free(mus);
+    free(timeOffsets);
+    for (size_t i = 0; i < nTable; ++i) {
+        delete deflCosineTable[i];
+    }
+    free(deflCosineTable);
+    deflCosineTable = NULL;
+    deflCosines = NULL;
+    deflCosine = NULL;
+    musTable = NULL;
+    timeOffsets = NULL;
     flushHistogram();
+    for (size_t i = 0; i < grids.size(); ++i) {
+        grids[i]->addWalkers(n);
+    }
+    if(rawWriter != NULL) {
+        streamRawOutput();
+        ScopedTimer timer(&perf.ioTime);
+        rawWriter->wait(&rawBlock);
+    }
+    perf.walkers = n;
+    perf.simulationTime = wallClock() - simulationStart;
+    perf.scatterings = nScatterings;
+    perf.interfaceHits = nInterfaceHits;
+    perf.rngDraws = mt->draws() - draws0;
     return true;
 }
 
@@ -613,11 +1253,14 @@ unsigned int Simulation::layerAt(const MCfloat *r0) const {
  */
 
 void Simulation::handleInterface() {
+    nInterfaceHits++;
     MCfloat zBoundary = 0;
     layer1 = layer0 + sign(k1[2]);
     zBoundary = upperZBoundaries[min(layer0, layer1)];
 
     MCfloat t = (zBoundary - r0[2]) / k1[2];
+    if(!grids.empty())
+        scoreSegment(t);
     // move to intersection with interface, r1 is now meaningless
     for (int i = 0; i < 3; ++i) {
         r0[i] = r0[i] + k1[i] * t;
@@ -646,6 +1289,7 @@ void Simulation::handleInterface() {
 #ifdef DEBUG_TRAJECTORY
             printf("TIR ");
 #endif
+            COUNT_EVENT(perf.totalInternalReflections);
             reflect();
         }
         else {
@@ -655,13 +1299,19 @@ void Simulation::handleInterface() {
                 MCfloat r = reflectionProbability();
                 MCfloat xi = uniform_01<MCfloat>()(*mt);
 
-                if(xi <= r)
+                if(xi <= r) {
+                    COUNT_EVENT(perf.fresnelReflections);
                     reflect();
-                else
+                }
+                else {
+                    COUNT_EVENT(perf.refractions);
                     refract();
+                }
             }
-            else
+            else {
+                COUNT_EVENT(perf.refractions);
                 refract();
+            }
         }
     }
 }
@@ -788,12 +1438,14 @@ void Simulation::appendExitKVector(walkerType type)
 
 void Simulation::appendWalker(walkerType type)
 {
-    photonCounters[type]++;
     Walker *w = &walkerBuf[nBuf++];
+    nExits[type]++;
 
     memcpy(w->r0, r0, 3 * sizeof(MCfloat));
     memcpy(w->k0, k1, 3 * sizeof(MCfloat));
     w->walkTime = walker.walkTime;
+    w->wavelength = walker.wavelength;
+    w->band = walker.band;
     w->type = type;
 
     walkerFlags flags = walkerTypeToFlag(type);
@@ -806,6 +1458,28 @@ void Simulation::appendWalker(walkerType type)
 
     if(exitKVectorsSaveFlags & flags)
         appendExitKVector(type);
+
+    if(walkerRecordsSaveFlags & flags) {
+        WalkerRecord rec;
+        rec.x = r0[0];
+        rec.y = r0[1];
+        rec.t = walker.walkTime;
+        rec.kx = k1[0];
+        rec.ky = k1[1];
+        rec.kz = k1[2];
+        rec.nScatter = 0;
+        for (size_t i = 0; i < _nInteractions->size(); ++i) {
+            rec.nScatter += (*_nInteractions)[i];
+        }
+        if(recordFile == NULL)
+            records[type].push_back(rec);
+        else if(!recordFile->append(type, rec)) {
+            logMessage("Cannot write to the record file, keeping records in "
+                       "memory");
+            closeRecordFile();
+            records[type].push_back(rec);
+        }
+    }
 }
 
 /**
@@ -872,7 +1546,11 @@ void Simulation::setTimeOriginZ(const MCfloat z)
 BaseObject* Simulation::clone_impl() const
 {
     Simulation *sim = new Simulation(0);
+    sim->setEngineType(_engineType);
     sim->saveTrajectory = saveTrajectory;
+    sim->trajectorySampling = trajectorySampling;
+    sim->trajectoryTypeFlags = trajectoryTypeFlags;
+    sim->trajectoryBufferSize = trajectoryBufferSize;
     sim->fresnelReflectionsEnabled = fresnelReflectionsEnabled;
     sim->setSource((Source*)source->clone());
     sim->_sample = _sample;
@@ -881,12 +1559,28 @@ BaseObject* Simulation::clone_impl() const
     sim->walkTimesSaveFlags = walkTimesSaveFlags;
     sim->exitKVectorsSaveFlags = exitKVectorsSaveFlags;
     sim->exitKVectorsDirsSaveFlags = exitKVectorsDirsSaveFlags;
+    sim->walkerRecordsSaveFlags = walkerRecordsSaveFlags;
     sim->setTimeOriginZ(timeOriginZ);
     sim->setRawOutputEnabled(rawOutputEnabled);
+    sim->checkpointInterval = checkpointInterval;
+    sim->checkpointThreads = checkpointThreads;
+    sim->checkpointWalkers = checkpointWalkers;
+    sim->rawOutputStreaming = rawOutputStreaming;
+    sim->rawBufferSize = rawBufferSize;
+    sim->swmrEnabled = swmrEnabled;
+    sim->rawOutputShards = rawOutputShards;
+    sim->rawProfile = rawProfile;
+    sim->recordFilesEnabled = recordFilesEnabled;
+    sim->rawOutputInMemory = rawOutputInMemory;
     for (size_t i = 0; i < hists.size(); ++i) {
         Histogram *h = hists[i];
         sim->addHistogram((Histogram *)h->clone());
     }
+    for (size_t i = 0; i < grids.size(); ++i) {
+        sim->addFluenceGrid((FluenceGrid *)grids[i]->clone());
+    }
+    sim->layerTable = layerTable;
+    sim->phaseTable = phaseTable;
     return sim;
 }
 
@@ -897,6 +1591,10 @@ bool Simulation::sanityCheck_impl() const
         if(!h->sanityCheck())
             return false;
     }
+    for (size_t i = 0; i < grids.size(); ++i) {
+        if(!grids[i]->sanityCheck())
+            return false;
+    }
     return true;
 }
 
@@ -910,7 +1608,10 @@ bool Simulation::sanityCheck_impl() const
 
 void Simulation::saveRawOutput()
 {
+    ScopedTimer timer(&perf.ioTime);
+    boost::lock_guard<boost::recursive_mutex> fileLock(h5Mutex);
     H5OutputFile file;
+    file.setRawOutputProfile(rawProfile);
 
     if(access(outputFile, F_OK)<0) {
         file.newFile(outputFile, rawOutputEnabled);
@@ -921,17 +1622,29 @@ void Simulation::saveRawOutput()
     }
 
     file.saveSample(_sample);
-    file.appendPhotonCounts(photonCounters);
-
+    u_int64_t counters[4];
+    for (uint i = 0; i < 4; ++i) {
+        counters[i] = photonCounters[i] - resumedCounters[i];
+    }
+    file.appendPhotonCounts(counters);
+    writeCheckpoint(&file);
+
+    if(trajRecorder != NULL) {
+        file.appendTrajectories(trajRecorder->points(), trajRecorder->info(),
+                                trajRecorder->nTrajectories());
+        delete trajRecorder;
+        trajRecorder = NULL;
+    }
 
     if(!rawOutputEnabled) {
         file.close();
         return;
     }
 
-    file.saveRNGState(currentSeed(), generatorState());
+    file.saveRNGState(currentSeed(), binaryGeneratorState());
 
-    for (uint type = 0; type < 4; ++type) {
+    // the shard file of the thread already contains its raw output
+    for (uint type = 0; type < 4 && !rawOutputShards; ++type) {
         //exit points
         if(photonCounters[type] && exitPointsSaveFlags & walkerTypeToFlag(type))
             file.appendExitPoints((walkerType)type, exitPoints[type].data(),
@@ -945,6 +1658,11 @@ void Simulation::saveRawOutput()
                 && exitKVectorsSaveFlags & walkerTypeToFlag(type))
             file.appendExitKVectors((walkerType)type, exitKVectors[type].data(),
                                     exitKVectors[type].size());
+        //records
+        if(photonCounters[type]
+                && walkerRecordsSaveFlags & walkerTypeToFlag(type))
+            file.appendWalkerRecords((walkerType)type, records[type].data(),
+                                     records[type].size());
     }
 
     file.close();
@@ -952,6 +1670,42 @@ void Simulation::saveRawOutput()
     logMessage("Data written to %s", outputFile);
 }
 
+/**
+ * @brief Writes the trajectories collected so far to the output file and
+ * clears the TrajectoryRecorder
+ */
+
+void Simulation::saveTrajectories()
+{
+    ScopedTimer timer(&perf.ioTime);
+    boost::lock_guard<boost::recursive_mutex> fileLock(h5Mutex);
+    H5OutputFile file;
+    if(!file.openFile(outputFile)) {
+        logMessage("Cannot open %s, %llu trajectories discarded", outputFile,
+                   trajRecorder->nTrajectories());
+    }
+    else {
+        file.appendTrajectories(trajRecorder->points(), trajRecorder->info(),
+                                trajRecorder->nTrajectories());
+        file.close();
+    }
+    trajRecorder->clear();
+}
+
+/**
+ * @brief Scores the current step in the fluence grids
+ * @param length Length of the step, starting from r0 along k1
+ */
+
+void Simulation::scoreSegment(MCfloat length)
+{
+    MCfloat t0 = walker.walkTime
+            + totalLengthInCurrentLayer / currentMaterial->v;
+    for (size_t i = 0; i < grids.size(); ++i) {
+        grids[i]->addSegment(r0, k1, length, t0, currentMaterial->v);
+    }
+}
+
 void Simulation::describe_impl() const
 {
     logMessage("Sample description:");
@@ -960,6 +1714,55 @@ void Simulation::describe_impl() const
     source->describe();
 }
 
+/**
+ * @brief Tabulates the materials of the sample at each wavelength of the
+ * source
+ * @return false if a phase function cannot be evaluated
+ *
+ *
+ * Called once before the threads are started, which then share the tables
+ * (see Source::setSpectrum()): refractive indices, phase velocities and phase
+ * functions are computed once for each wavelength instead of once per thread,
+ * and the materials of the sample are only modified here.
+ *
+ * The materials are finally left at the nominal wavelength of the source,
+ * which the description of the sample in the output file refers to; their
+ * anisotropy factor is updated to the one of their phase function, if any.
+ */
+
+bool Simulation::prepareLayerTables()
+{
+    if(_sample == NULL || source == NULL)
+        return true;  // reported by sanityCheck()
+    unsigned int nMaterials = _sample->nLayers() + 2;
+    layerTable.clear();
+    phaseTable.clear();
+    for (size_t band = 0; band <= source->nBands(); ++band) {
+        // the last pass is for the nominal wavelength
+        bool nominal = band == source->nBands();
+        double um = nominal ? source->wavelength()
+                            : source->bandWavelength(band);
+        for (unsigned int i = 0; i < nMaterials; ++i) {
+            Material *m = _sample->material(i);
+            m->setWavelength(um);
+            PhaseFunction *pf = m->phaseFunction;
+            if(pf != NULL && !pf->setWavelength(um, m->n)) {
+                logMessage("Cannot tabulate the phase function of layer %u "
+                           "at %f um. Aborting.", i, um);
+                return false;
+            }
+            if(nominal) {
+                if(pf != NULL)
+                    m->g = pf->anisotropy();
+                continue;
+            }
+            layerTable.push_back(*m);
+            phaseTable.push_back(pf == NULL ? NULL : pf->cosThetaDistribution());
+        }
+    }
+    return true;
+}
+
 /**
  * @brief Switches to the adjacent layer when the photon crosses an interface.
  * @param layer
@@ -971,11 +1774,27 @@ void Simulation::describe_impl() const
 
 void Simulation::switchToLayer(const uint layer)
 {
+    COUNT_EVENT(perf.layerSwitches);
     walker.walkTime += totalLengthInCurrentLayer / currentMaterial->v;
     totalLengthInCurrentLayer = 0;
     updateLayerVariables(layer);
 }
 
+/**
+ * @brief Switches the layer tables to the given wavelength of the source
+ * @param band
+ */
+
+void Simulation::selectBand(const uint band)
+{
+    band0 = band;
+    materials = &layerTable[band * (nLayers + 2)];
+    mus = &musTable[band * (nLayers + 2)];
+    deflCosines = &deflCosineTable[band * (nLayers + 2)];
+    // forces updateLayerVariables()
+    layer0 = numeric_limits<unsigned int>::max();
+}
+
 /**
  * @brief Updates the internal variables caching the layer parameters
  * @param layer
@@ -989,7 +1808,7 @@ void Simulation::updateLayerVariables(const uint layer) {
         return;
     layer0=layer;
     currentMaterial = &materials[layer0];
-    deflCosine.setg(currentMaterial->g);
+    deflCosine = deflCosines[layer0];
     currentMus = mus[layer0];
     if(layer0 == 0)
         currLayerLowerBoundary = -numeric_limits<MCfloat>::infinity();
@@ -1001,13 +1820,43 @@ void Simulation::updateLayerVariables(const uint layer) {
         currLayerUpperBoundary = numeric_limits<MCfloat>::infinity();
 }
 
+/**
+ * @brief Updates the photon counters and the histograms with the walkers
+ * currently in the buffer, then empties the buffer
+ *
+ *
+ * Histograms and photon counters are only updated here while holding
+ * histMutex, so that the monitor thread can safely merge them with the ones of
+ * the other threads.
+ */
+
 void Simulation::flushHistogram()
 {
+    double start = wallClock();
+    boost::lock_guard<boost::mutex> lock(histMutex);
+    for (uint i = 0; i < nBuf; ++i) {
+        photonCounters[walkerBuf[i].type]++;
+    }
     for (size_t i = 0; i < hists.size(); ++i) {
         Histogram *h = hists[i];
         h->run(walkerBuf, nBuf);
     }
     nBuf = 0;
+    perf.flushTime += wallClock() - start;
+
+    // raw output is only written when the thread ends, a checkpoint taken now
+    // would not match it
+    if(checkpointInterval > 0 && !rawOutputEnabled
+            && wallClock() - lastCheckpoint >= checkpointInterval) {
+        ScopedTimer timer(&perf.ioTime);
+        boost::lock_guard<boost::recursive_mutex> fileLock(h5Mutex);
+        H5FileHelper file;
+        if(file.openFile(outputFile)) {
+            writeCheckpoint(&file);
+            file.close();
+        }
+        lastCheckpoint = wallClock();
+    }
 }
 
 void Simulation::setRNG_impl()
@@ -1032,6 +1881,25 @@ void Simulation::setExitKVectorsDirsSaveFlags(unsigned int value)
     exitKVectorsDirsSaveFlags = value;
 }
 
+/**
+ * @brief Selects the walker types whose raw output is also saved as compound
+ * records
+ * @param value See walkerFlags
+ *
+ *
+ * For each selected type, a WalkerRecord with exit point, walk time, exit
+ * direction and number of scattering events of every photon is appended to
+ * the <tt>records/\<type\></tt> dataset of the output file (see
+ * H5OutputFile). This is independent of the other save flags, which can be
+ * set to 0 to avoid saving the same data twice. Only used if raw output is
+ * enabled.
+ */
+
+void Simulation::setWalkerRecordsSaveFlags(unsigned int value)
+{
+    walkerRecordsSaveFlags = value;
+}
+
 /**
  * @brief Gracefully terminates the currently running simulation
  *
@@ -1059,15 +1927,50 @@ uint Simulation::nThreads()
  * The simulation is automatically set as the histogram's parent. Histograms are
  * performed live during the simulation, At the end of the simulation, histograms
  * are saved in the H5 output file specified using setOutputFileName(), each in
- * a different dataset according to their names.
+ * a different dataset according to their names. Unnamed histograms are named
+ * after their index, e.g. <tt>histogram0</tt>, so that they do not overwrite
+ * each other.
  */
 
 void Simulation::addHistogram(Histogram *hist)
 {
+    if(hist->name() == "") {
+        stringstream ss;
+        ss << "histogram" << hists.size();
+        hist->setName(ss.str().c_str());
+    }
     hists.push_back(hist);
     hist->setParent(this);
 }
 
+/**
+ * @brief Adds a grid scoring the path length of the walkers inside the sample
+ * @param grid
+ *
+ *
+ * The simulation is automatically set as the grid's parent. Each thread fills
+ * its own copy of the grid, and copies are summed as threads complete. At the
+ * end of the simulation, grids are saved in the output file (see
+ * FluenceGrid::saveToFile()). When resuming or appending (see
+ * setResumeEnabled() and setAppendEnabled()), the grids already saved in the
+ * output file are added to the ones of this run(), so that they cover the same
+ * walkers as the histograms. Grids are not saved in checkpoints, though: the
+ * walkers of a run killed before saving its grids are missing from them, which
+ * their <tt>n-walkers</tt> dataset accounts for. Unnamed grids are named after
+ * their index, e.g. <tt>grid0</tt>.
+ */
+
+void Simulation::addFluenceGrid(FluenceGrid *grid)
+{
+    if(grid->name() == "") {
+        stringstream ss;
+        ss << "grid" << grids.size();
+        grid->setName(ss.str().c_str());
+    }
+    grids.push_back(grid);
+    grid->setParent(this);
+}
+
 /**
  * @brief Enables raw output
  * @param enable
@@ -1075,7 +1978,7 @@ void Simulation::addHistogram(Histogram *hist)
  * If enabled, per photon values are saved in the output file according to the
  * specified flags. See setWalkTimesSaveFlags(), setExitPointsSaveFlags(),
  * setExitKVectorsSaveFlags(). Keep in mind that this causes heavy memory usage
- * and big output file sizes.
+ * and big output file sizes, unless setRawOutputStreamingEnabled() is used.
  */
 
 void Simulation::setRawOutputEnabled(bool enable)
@@ -1096,12 +1999,55 @@ void Simulation::setWalkTimesSaveFlags(unsigned int value)
  *
  * This function works only if the library is compiled with the
  * ENABLE_TRAJECTORY option, which defaults to false for performance reasons.
+ * All the trajectories are kept in memory: use setTrajectorySampling() to save
+ * a subset of them to the output file instead.
  */
 
 void Simulation::setSaveTrajectoryEnabled(bool enabled) {
     saveTrajectory = enabled;
 }
 
+/**
+ * @brief Saves the trajectory of one walker every given number of walkers
+ * @param every Sampling interval, counted separately by each thread; 0
+ * disables trajectory saving (default)
+ * @param photonTypeFlags Only trajectories of walkers of these types are
+ * saved (see walkerFlags)
+ *
+ *
+ * Trajectories are written in the <tt>trajectories</tt> group of the output
+ * file: <tt>trajectories/points</tt> holds the (x, y, z) coordinates of the
+ * entry point, of each scattering event or interface crossing and of the exit
+ * point of all the saved walkers, one after the other, while
+ * <tt>trajectories/index</tt> holds a TrajectoryInfo for each of them (see
+ * H5OutputFile::loadTrajectory()). Note that walkers of the other types are
+ * still counted by the sampling interval.
+ *
+ * This does not require compiling with ENABLE_TRAJECTORY and has no cost when
+ * disabled.
+ */
+
+void Simulation::setTrajectorySampling(u_int64_t every, int photonTypeFlags)
+{
+    trajectorySampling = every;
+    trajectoryTypeFlags = photonTypeFlags;
+}
+
+/**
+ * @brief Sets the number of trajectory points kept in memory by each thread
+ * @param nPoints
+ *
+ *
+ * When the buffer fills up, the trajectories are written to the output file;
+ * in SWMR mode (see setSWMREnabled()) this only happens at the end of the
+ * simulation. Defaults to 100000 points.
+ */
+
+void Simulation::setTrajectoryBufferSize(u_int64_t nPoints)
+{
+    trajectoryBufferSize = nPoints;
+}
+
 /**
  * @brief Returns the trajectories of the simulated photons
  * @return
@@ -1110,3 +2056,1593 @@ void Simulation::setSaveTrajectoryEnabled(bool enabled) {
 const vector< vector <MCfloat>*> *Simulation::trajectories() const {
     return trajectoryPoints;
 }
+
+/**
+ * @brief Adds a stopping criterion on the relative error of a histogram
+ * @param histName The name of the histogram (see Histogram::setName())
+ * @param maxRelativeError Target relative standard error
+ * @param firstBin First bin of the histogram to be checked
+ * @param lastBin Last bin of the histogram to be checked (included). If
+ * negative, the last bin before the overflow bin is used.
+ *
+ *
+ * The simulation stops when the relative standard error of each of the selected
+ * bins is less than maxRelativeError and all the other criteria are satisfied,
+ * or when the number of walkers specified with setNWalkers() has been
+ * simulated. See Histogram::maxRelativeError(). run() fails if the selected
+ * bins are not within the ones of the first axis of the histogram, overflow bin
+ * excluded, or if lastBin is before firstBin.
+ */
+
+void Simulation::addConvergenceCriterion(const char *histName,
+                                         double maxRelativeError,
+                                         int firstBin, int lastBin)
+{
+    ConvergenceCriterion c;
+    c.histIndex = -1;
+    c.histName = histName;
+    c.type = TRANSMITTED;
+    c.maxRelativeError = maxRelativeError;
+    c.firstBin = firstBin;
+    c.lastBin = lastBin;
+    criteria.push_back(c);
+}
+
+/**
+ * @brief Adds a stopping criterion on the relative error of a photon counter
+ * @param type The photon type
+ * @param maxRelativeError Target relative standard error
+ *
+ *
+ * The relative error of the fraction of photons of the given type is
+ * \f$ \sqrt{(1 - c / N) / c} \f$, \f$ c \f$ being the number of
+ * photons of that type out of \f$ N \f$ simulated photons.
+ */
+
+void Simulation::addConvergenceCriterion(walkerType type,
+                                         double maxRelativeError)
+{
+    ConvergenceCriterion c;
+    c.histIndex = -1;
+    c.type = type;
+    c.maxRelativeError = maxRelativeError;
+    c.firstBin = 0;
+    c.lastBin = -1;
+    criteria.push_back(c);
+}
+
+/**
+ * @brief Sets how often the stopping criteria are checked
+ * @param seconds
+ *
+ *
+ * Defaults to 10 seconds.
+ */
+
+void Simulation::setConvergenceCheckInterval(double seconds)
+{
+    convergenceCheckInterval = seconds;
+}
+
+/**
+ * @brief Sets a wall-clock limit to the simulation
+ * @param seconds
+ *
+ *
+ * When the limit is reached, all the threads are terminated gracefully as with
+ * terminate(). A value of 0 (the default) means no limit.
+ */
+
+void Simulation::setMaxWallTime(double seconds)
+{
+    maxWallTime = seconds;
+}
+
+/**
+ * @brief The number of walkers that have been simulated so far
+ * @return
+ *
+ *
+ * This can be less than nPhotons() if the simulation has been terminated or
+ * stopped by one of the stopping criteria.
+ */
+
+u_int64_t Simulation::simulatedPhotons() const
+{
+    u_int64_t total = 0;
+    for (uint i = 0; i < 4; ++i) {
+        total += photonCounters[i];
+    }
+    return total;
+}
+
+/**
+ * @brief The photon counters of the last run()
+ * @return Array of 4 elements, one per walkerType
+ */
+
+const u_int64_t *Simulation::photonCounts() const
+{
+    return photonCounters;
+}
+
+/**
+ * @brief Keeps the raw output in memory after run()
+ * @param enable
+ *
+ *
+ * Raw output is always written to the output file. A single-threaded
+ * simulation also keeps it in memory until the next run(), while the raw output
+ * of each thread of a multi-threaded one is discarded when the thread ends. If
+ * enabled, it is moved to this object instead, so that it can be accessed with
+ * rawExitPoints(), rawWalkTimes(), rawExitKVectors() and rawWalkerRecords()
+ * (e.g. as NumPy arrays from Python) without reading the output file. The
+ * walkers of each thread are contiguous, in thread order.
+ *
+ * Raw output that is streamed (see setRawOutputStreamingEnabled()), written to
+ * shards or to record files is not kept in memory.
+ */
+
+void Simulation::setRawOutputInMemoryEnabled(bool enable)
+{
+    rawOutputInMemory = enable;
+}
+
+/**
+ * @brief The exit points of the given walker type kept in memory
+ * @param type
+ * @return Two values (x, y) per walker
+ *
+ *
+ * See setRawOutputInMemoryEnabled().
+ */
+
+const vector<MCfloat> *Simulation::rawExitPoints(walkerType type) const
+{
+    return &exitPoints[type];
+}
+
+/**
+ * @brief The walk times of the given walker type kept in memory
+ * @param type
+ * @return
+ *
+ *
+ * See setRawOutputInMemoryEnabled().
+ */
+
+const vector<MCfloat> *Simulation::rawWalkTimes(walkerType type) const
+{
+    return &walkTimes[type];
+}
+
+/**
+ * @brief The exit k vectors of the given walker type kept in memory
+ * @param type
+ * @return nExitKVectorComponents() values per walker
+ *
+ *
+ * See setRawOutputInMemoryEnabled().
+ */
+
+const vector<MCfloat> *Simulation::rawExitKVectors(walkerType type) const
+{
+    return &exitKVectors[type];
+}
+
+/**
+ * @brief The number of components of the exit k vectors saved per walker
+ * @return
+ *
+ *
+ * See setExitKVectorsDirsSaveFlags().
+ */
+
+uint Simulation::nExitKVectorComponents() const
+{
+    uint n = 0;
+    if(exitKVectorsDirsSaveFlags & DIR_X)
+        n++;
+    if(exitKVectorsDirsSaveFlags & DIR_Y)
+        n++;
+    if(exitKVectorsDirsSaveFlags & DIR_Z)
+        n++;
+    return n;
+}
+
+/**
+ * @brief The walker records of the given walker type kept in memory
+ * @param type
+ * @return
+ *
+ *
+ * See setRawOutputInMemoryEnabled() and setWalkerRecordsSaveFlags().
+ */
+
+const vector<WalkerRecord> *Simulation::rawWalkerRecords(walkerType type) const
+{
+    return &records[type];
+}
+
+/**
+ * @brief Counts the runs that may have reallocated the raw output
+ * @return A number that changes when run() starts and when it returns, since
+ * the vectors returned by rawExitPoints(), rawWalkTimes(), rawExitKVectors(),
+ * rawWalkerRecords() and trajectories() are reallocated in between
+ */
+
+u_int64_t Simulation::rawDataGeneration() const
+{
+    return generation;
+}
+
+/**
+ * @brief How often the monitor thread wakes up, in seconds
+ * @return
+ */
+
+double Simulation::monitorPeriod() const
+{
+    double period = PROGRESS_POLL_PERIOD;
+    if(!criteria.empty() || maxWallTime > 0)
+        period = min(period, convergenceCheckInterval);
+    if(snapshotInterval > 0)
+        period = min(period, snapshotInterval);
+    if(statsFile != NULL)
+        period = min(period, statsInterval);
+    return period;
+}
+
+/**
+ * @brief Starts the monitor thread
+ *
+ * \see monitor()
+ */
+
+void Simulation::startMonitor()
+{
+    progressRequested = 0;
+    allProgressRequested = 0;
+    monitorStopped = false;
+    terminationRequested = false;
+    monitorThread = new boost::thread(boost::bind(&Simulation::monitor, this));
+}
+
+void Simulation::stopMonitor()
+{
+    if(monitorThread == NULL)
+        return;
+    {
+        boost::lock_guard<boost::mutex> lock(monitorMutex);
+        monitorStopped = true;
+    }
+    monitorCondition.notify_all();
+    monitorThread->join();
+    delete monitorThread;
+    monitorThread = NULL;
+}
+
+/**
+ * @brief Body of the monitor thread
+ *
+ *
+ * The monitor thread runs in the main Simulation object while the walkers are
+ * being simulated. It prints the progress requested with the USR1 and USR2
+ * signals, writes the stats file (see setStatsFileName()) and saves the
+ * snapshots. Every convergenceCheckInterval seconds it checks the wall-clock
+ * limit and the stopping criteria, terminating all the threads when any of
+ * them is met.
+ */
+
+void Simulation::monitor()
+{
+    boost::unique_lock<boost::mutex> lock(monitorMutex);
+    double period = monitorPeriod();
+    const double start = wallClock();
+    double lastCheck = start;
+    double lastSnapshot = start;
+    u_int64_t lastSnapshotWalkers = 0;
+    double lastStats = start;
+    u_int64_t statsWalkers = 0;
+    bool statsEnabled = statsFile != NULL
+            && writeStatsFile(0, 0, &statsWalkers, false);
+
+    while(!monitorStopped) {
+        monitorCondition.timed_wait(
+                    lock, boost::posix_time::milliseconds(
+                        (long)(period * 1000)));
+        if(monitorStopped)
+            break;
+
+        double now = wallClock();
+
+        handleProgressRequests();
+
+        if(statsEnabled && now - lastStats >= statsInterval) {
+            statsEnabled = writeStatsFile(now - start, now - lastStats,
+                                          &statsWalkers, false);
+            lastStats = now;
+        }
+
+        if(snapshotInterval > 0 || snapshotWalkerInterval > 0) {
+            bool snapshotDue =
+                    snapshotInterval > 0
+                    && now - lastSnapshot >= snapshotInterval;
+            if(!snapshotDue && snapshotWalkerInterval > 0) {
+                u_int64_t walkers = collectPhotonCount();
+                snapshotDue = walkers - lastSnapshotWalkers
+                        >= snapshotWalkerInterval;
+            }
+            // retried at the next poll if nothing could be saved
+            if(snapshotDue && saveSnapshot()) {
+                lastSnapshot = now;
+                lastSnapshotWalkers = collectPhotonCount();
+            }
+        }
+
+        if(now - lastCheck < convergenceCheckInterval)
+            continue;
+        lastCheck = now;
+
+        if(!terminationRequested && maxWallTime > 0) {
+            time_t now;
+            time(&now);
+            if(difftime(now, startTime) >= maxWallTime) {
+                logMessage("Maximum wall time reached, terminating...");
+                terminationRequested = true;
+            }
+        }
+
+        if(!terminationRequested && !criteria.empty()
+                && convergenceReached()) {
+            logMessage("Target precision reached, terminating...");
+            terminationRequested = true;
+        }
+
+        // keep on terminating, threads may have started in the meantime
+        if(terminationRequested)
+            terminateAll();
+    }
+
+    handleProgressRequests();
+    if(statsEnabled) {
+        double now = wallClock();
+        writeStatsFile(now - start, now - lastStats, &statsWalkers, true);
+    }
+}
+
+/**
+ * @brief Prints the progress requested with the USR1 and USR2 signals
+ *
+ *
+ * USR1 prints the progress of the most recently created thread that is still
+ * running, USR2 the one of all running threads.
+ */
+
+void Simulation::handleProgressRequests()
+{
+    bool one = progressRequested;
+    bool all = allProgressRequested;
+    if(!one && !all)
+        return;
+    progressRequested = 0;
+    allProgressRequested = 0;
+
+    // threads are only deleted after being removed from sims
+    boost::lock_guard<boost::mutex> lock(simsMutex);
+    Simulation *recent = mostRecentInstance.load();
+    if(one && recent != NULL
+            && find(sims.begin(), sims.end(), recent) != sims.end())
+        recent->reportProgress();
+    if(all) {
+        fprintf(stderr,"===============================\n");
+        for (size_t i = 0; i < sims.size(); ++i) {
+            if(sims[i] != NULL)
+                sims[i]->reportProgress();
+        }
+        fprintf(stderr,"===============================\n");
+    }
+}
+
+/**
+ * @brief Sums the live counters of all threads and replaces the stats file
+ * with them
+ * @param elapsed Seconds since the monitor started
+ * @param interval Seconds since the previous call
+ * @param walkers The total number of completed walkers at the previous call,
+ * updated with the current one
+ * @param finished Whether all threads have completed
+ * @return false if the file cannot be written
+ *
+ *
+ * The file is written under a temporary name and then renamed, so that it can
+ * be read at any time without seeing a partial update.
+ */
+
+bool Simulation::writeStatsFile(double elapsed, double interval,
+                                u_int64_t *walkers, bool finished)
+{
+    const boost::memory_order relaxed = boost::memory_order_relaxed;
+    u_int64_t done = 0, remaining = 0, scatterings = 0, interfaceHits = 0;
+    u_int64_t exits[4] = {0, 0, 0, 0};
+    stringstream threadStats;
+    {
+        boost::lock_guard<boost::mutex> lock(simsMutex);
+        // unless it runs the walkers itself, the main simulation holds the
+        // counters of the threads that completed
+        vector<const Simulation *> sources(sims.begin(), sims.end());
+        bool completedThreads =
+                find(sims.begin(), sims.end(), this) == sims.end();
+        if(completedThreads)
+            sources.push_back(this);
+        for (size_t i = 0; i < sources.size(); ++i) {
+            const Simulation *sim = sources[i];
+            if(sim == NULL)
+                continue;
+            u_int64_t w = sim->live.walkers.load(relaxed);
+            done += w;
+            scatterings += sim->live.scatterings.load(relaxed);
+            interfaceHits += sim->live.interfaceHits.load(relaxed);
+            for (uint j = 0; j < 4; ++j) {
+                exits[j] += sim->live.exits[j].load(relaxed);
+            }
+            if(sim == this && completedThreads)
+                continue;
+            if(w < sim->nPhotons())
+                remaining += sim->nPhotons() - w;
+            if(threadStats.tellp() > 0)
+                threadStats << ",";
+            threadStats << "\n    {\"index\": " << sim->threadIndex
+                        << ", \"seed\": " << sim->currentSeed()
+                        << ", \"walkers\": " << w
+                        << ", \"budget\": " << sim->nPhotons() << "}";
+        }
+    }
+    if(finished)
+        remaining = 0;
+
+    double throughput = interval > 0 ? (done - *walkers) / interval : 0;
+    double meanThroughput = elapsed > 0 ? done / elapsed : 0;
+    *walkers = done;
+
+    string tmpName = string(statsFile) + ".tmp";
+    FILE *f = fopen(tmpName.c_str(), "w");
+    if(f == NULL) {
+        logMessage("Cannot write %s, live statistics disabled", statsFile);
+        return false;
+    }
+    fprintf(f, "{\n");
+    fprintf(f, "  \"time\": %ld,\n", (long)time(NULL));
+    fprintf(f, "  \"finished\": %s,\n", finished ? "true" : "false");
+    fprintf(f, "  \"elapsed\": %.3f,\n", elapsed);
+    fprintf(f, "  \"walkers\": %llu,\n", (unsigned long long)done);
+    fprintf(f, "  \"remaining\": %llu,\n", (unsigned long long)remaining);
+    fprintf(f, "  \"throughput\": %.1f,\n", throughput);
+    fprintf(f, "  \"mean-throughput\": %.1f,\n", meanThroughput);
+    if(meanThroughput > 0)
+        fprintf(f, "  \"eta\": %.1f,\n", remaining / meanThroughput);
+    else
+        fprintf(f, "  \"eta\": null,\n");
+    fprintf(f, "  \"scattering-events\": %llu,\n",
+            (unsigned long long)scatterings);
+    fprintf(f, "  \"interface-hits\": %llu,\n",
+            (unsigned long long)interfaceHits);
+    fprintf(f, "  \"exits\": {");
+    for (uint i = 0; i < 4; ++i) {
+        fprintf(f, "%s\"%s\": %llu", i == 0 ? "" : ", ",
+                walkerTypeToString(i).c_str(), (unsigned long long)exits[i]);
+    }
+    fprintf(f, "},\n");
+    fprintf(f, "  \"threads\": [%s\n  ]\n", threadStats.str().c_str());
+    fprintf(f, "}\n");
+    bool ok = fclose(f) == 0 && rename(tmpName.c_str(), statsFile) == 0;
+    if(!ok)
+        logMessage("Cannot write %s, live statistics disabled", statsFile);
+    return ok;
+}
+
+/**
+ * @brief Merges the partial results of all the running threads
+ * @param dest The merged histograms are appended to this vector, in the same
+ * order as hists. The caller takes ownership of them.
+ * @param counters Array of 4 elements where the merged photon counters are
+ * stored
+ */
+
+void Simulation::collectResults(vector<Histogram *> *dest,
+                                u_int64_t *counters)
+{
+    for (uint i = 0; i < 4; ++i) {
+        counters[i] = 0;
+    }
+    for (size_t i = 0; i < hists.size(); ++i) {
+        Histogram *h = (Histogram *)hists[i]->clone();
+        h->initialize();
+        dest->push_back(h);
+    }
+
+    boost::lock_guard<boost::mutex> simsLock(simsMutex);
+
+    // in multi-thread runs, this object holds the results of the threads that
+    // have already been joined
+    vector<Simulation *> sources;
+    sources.push_back(this);
+    for (size_t i = 0; i < sims.size(); ++i) {
+        if(sims[i] != NULL && sims[i] != this)
+            sources.push_back(sims[i]);
+    }
+
+    for (size_t n = 0; n < sources.size(); ++n) {
+        Simulation *sim = sources[n];
+        boost::lock_guard<boost::mutex> lock(sim->histMutex);
+        for (uint i = 0; i < 4; ++i) {
+            counters[i] += sim->photonCounters[i];
+        }
+        for (size_t i = 0; i < sim->hists.size(); ++i) {
+            dest->at(i)->appendCounts(sim->hists[i]);
+        }
+    }
+
+    // checkpointed threads that were not resumed
+    for (size_t n = _nThreads; n < restoredThreads.size(); ++n) {
+        ThreadCheckpoint *c = restoredThreads[n];
+        for (uint i = 0; i < 4; ++i) {
+            counters[i] += c->counters[i];
+        }
+        for (size_t i = 0; i < hists.size(); ++i) {
+            dest->at(i)->appendCounts(c->hists[i]);
+        }
+    }
+}
+
+/**
+ * @brief The total number of walkers simulated so far by all threads
+ * @return
+ */
+
+u_int64_t Simulation::collectPhotonCount()
+{
+    u_int64_t total = 0;
+    boost::lock_guard<boost::mutex> simsLock(simsMutex);
+    if(find(sims.begin(), sims.end(), this) == sims.end()) {
+        boost::lock_guard<boost::mutex> lock(histMutex);
+        total += simulatedPhotons();
+    }
+    for (size_t i = 0; i < sims.size(); ++i) {
+        if(sims[i] == NULL)
+            continue;
+        boost::lock_guard<boost::mutex> lock(sims[i]->histMutex);
+        total += sims[i]->simulatedPhotons();
+    }
+    return total;
+}
+
+/**
+ * @brief Checks all the stopping criteria on the merged partial results
+ * @return true if all criteria are satisfied
+ */
+
+bool Simulation::convergenceReached()
+{
+    vector<Histogram *> results;
+    u_int64_t counters[4];
+    collectResults(&results, counters);
+
+    u_int64_t total = 0;
+    for (uint i = 0; i < 4; ++i) {
+        total += counters[i];
+    }
+
+    bool converged = total > 0;
+    for (size_t i = 0; converged && i < criteria.size(); ++i) {
+        const ConvergenceCriterion *c = &criteria[i];
+        MCfloat relErr;
+        if(c->histIndex < 0) {
+            u_int64_t count = counters[c->type];
+            if(count == 0)
+                relErr = numeric_limits<MCfloat>::infinity();
+            else
+                relErr = sqrt((1. - 1. * count / total) / count);
+        }
+        else
+            relErr = results[c->histIndex]->maxRelativeError(
+                        total, c->firstBin, c->lastBin);
+        if(relErr > c->maxRelativeError)
+            converged = false;
+    }
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        delete results[i];
+    }
+    return converged;
+}
+
+void Simulation::terminateAll()
+{
+    boost::lock_guard<boost::mutex> lock(simsMutex);
+    for (size_t i = 0; i < sims.size(); ++i) {
+        if(sims[i] != NULL)
+            sims[i]->terminate();
+    }
+}
+
+/**
+ * @brief Saves a snapshot of the results of all threads every given amount of
+ * time
+ * @param seconds
+ *
+ *
+ * A value of 0 (the default) disables time-based snapshots. See also
+ * setSnapshotWalkerInterval().
+ */
+
+void Simulation::setSnapshotInterval(double seconds)
+{
+    snapshotInterval = seconds;
+}
+
+/**
+ * @brief Saves a snapshot of the results of all threads every given number of
+ * simulated walkers
+ * @param nWalkers
+ *
+ *
+ * The number of walkers is checked each time the monitor thread polls, i.e.
+ * every PROGRESS_POLL_PERIOD seconds or more often if a shorter interval is
+ * set for the other checks (see setConvergenceCheckInterval(),
+ * setSnapshotInterval() and setStatsInterval()). Snapshots are therefore
+ * taken shortly after the given number of walkers has been simulated. A value
+ * of 0 (the default) disables walker-based snapshots.
+ */
+
+void Simulation::setSnapshotWalkerInterval(u_int64_t nWalkers)
+{
+    snapshotWalkerInterval = nWalkers;
+}
+
+/**
+ * @brief Merges the partial results of all threads and writes them in a new
+ * group of the output file
+ * @return false if nothing was saved, e.g. because no walker has completed yet
+ * and the histograms cannot be normalized
+ *
+ *
+ * Snapshots are numbered sequentially in the <tt>snapshots</tt> group. Worker
+ * threads are only blocked while their histograms are being merged.
+ */
+
+bool Simulation::saveSnapshot()
+{
+    if(rawWriter != NULL && swmrEnabled)
+        return false;
+
+    vector<Histogram *> results;
+    u_int64_t counters[4];
+    collectResults(&results, counters);
+
+    u_int64_t total = 0;
+    for (uint i = 0; i < 4; ++i) {
+        total += counters[i];
+    }
+    if(total == 0) {
+        for (size_t i = 0; i < results.size(); ++i) {
+            delete results[i];
+        }
+        return false;
+    }
+
+    bool saved = false;
+
+    {
+        boost::lock_guard<boost::recursive_mutex> fileLock(h5Mutex);
+        H5FileHelper file;
+        if(file.openFile(outputFile)) {
+            file.newGroup("snapshots");
+            stringstream ss;
+            ss << "snapshots/" << file.nChildren("snapshots");
+            string group = ss.str();
+            file.newGroup(group.c_str());
+
+            hsize_t dims[1] = {4};
+            string dsName = group + "/photon-counters";
+            file.newDataset(dsName.c_str(), 1, dims, PredType::NATIVE_UINT64);
+            hsize_t start[1] = {0};
+            file.writeHyperSlab(start, dims, counters);
+
+            for (size_t i = 0; i < results.size(); ++i) {
+                Histogram *h = results[i];
+                h->setScale(total);
+                h->saveToFile(&file, (group + "/" + h->name()).c_str());
+            }
+            file.close();
+            logMessage("Snapshot %s saved (%llu walkers)", group.c_str(),
+                       total);
+            saved = true;
+        }
+    }
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        delete results[i];
+    }
+    return saved;
+}
+
+/**
+ * @brief Saves the raw content of the final histograms in the
+ * <tt>raw-histograms</tt> group of the output file
+ *
+ *
+ * Unlike the normalized histograms, these can be summed over several output
+ * files, see OutputMerger.
+ */
+
+void Simulation::saveRawHistograms()
+{
+    if(hists.empty())
+        return;
+    boost::lock_guard<boost::recursive_mutex> fileLock(h5Mutex);
+    H5FileHelper file;
+    if(!file.openFile(outputFile))
+        return;
+    for (size_t i = 0; i < hists.size(); ++i) {
+        string name = hists[i]->name();
+        hists[i]->saveRawCounts(&file, ("raw-histograms/" + name).c_str());
+    }
+    file.close();
+}
+
+/**
+ * @brief Saves the fluence grids in the output file
+ * @param addSaved If true, the grids already saved in the file by previous
+ * runs are added first, so that the grids cover the same walkers as the
+ * histograms
+ *
+ *
+ * A saved grid whose bin edges do not match the ones of the grid is replaced.
+ */
+
+void Simulation::saveFluenceGrids(bool addSaved)
+{
+    if(grids.empty())
+        return;
+    boost::lock_guard<boost::recursive_mutex> fileLock(h5Mutex);
+    H5FileHelper file;
+    if(!file.openFile(outputFile))
+        return;
+    for (size_t i = 0; i < grids.size(); ++i) {
+        FluenceGrid *grid = grids[i];
+        string group = "fluence/" + grid->name();
+        if(addSaved && file.dataSetExists(group.c_str())) {
+            FluenceGrid saved;
+            if(!saved.loadLayout(&file, group.c_str())
+                    || !grid->hasSameLayout(&saved) || !saved.initialize()
+                    || !saved.loadCounts(&file, group.c_str()))
+                logMessage("Fluence grid %s in %s does not match, replacing "
+                           "it", grid->name().c_str(), outputFile);
+            else
+                grid->appendCounts(&saved);
+        }
+        grid->saveToFile(&file, group.c_str());
+    }
+    file.close();
+}
+
+/**
+ * @brief Saves the performance counters of all threads in the
+ * <tt>performance</tt> group of the output file
+ * @param wallTime Seconds spent in run()
+ * @param outputTime Seconds spent saving the merged results after the threads
+ * completed
+ *
+ *
+ * Each dataset named after a field of the counters has one element per
+ * thread. The group also holds the scalars <tt>wall-time</tt>,
+ * <tt>output-time</tt>, the overall <tt>walkers-per-second</tt> and the
+ * <tt>load-imbalance</tt>, i.e. the ratio of the longest simulation time of a
+ * thread to the mean one, minus one. A previous report is overwritten.
+ */
+
+void Simulation::savePerformanceReport(double wallTime, double outputTime)
+{
+    size_t nThreads = threadPerf.size();
+    if(nThreads == 0)
+        return;
+    vector<u_int64_t> walkers(nThreads), scatterings(nThreads),
+            interfaceHits(nThreads), rngDraws(nThreads);
+    vector<double> simulationTime(nThreads), walkersPerSecond(nThreads),
+            flushTime(nThreads), ioTime(nThreads);
+    u_int64_t totalWalkers = 0;
+    double maxTime = 0, meanTime = 0;
+    for (size_t i = 0; i < nThreads; ++i) {
+        const PerformanceCounters *p = &threadPerf[i];
+        walkers[i] = p->walkers;
+        scatterings[i] = p->scatterings;
+        interfaceHits[i] = p->interfaceHits;
+        rngDraws[i] = p->rngDraws;
+        simulationTime[i] = p->simulationTime;
+        walkersPerSecond[i] = p->simulationTime > 0
+                ? p->walkers / p->simulationTime : 0;
+        flushTime[i] = p->flushTime;
+        ioTime[i] = p->ioTime;
+        totalWalkers += p->walkers;
+        maxTime = max(maxTime, p->simulationTime);
+        meanTime += p->simulationTime / nThreads;
+    }
+    double rate = wallTime > 0 ? totalWalkers / wallTime : 0;
+    double imbalance = meanTime > 0 ? maxTime / meanTime - 1 : 0;
+
+    boost::lock_guard<boost::recursive_mutex> fileLock(h5Mutex);
+    H5FileHelper file;
+    if(!file.openFile(outputFile))
+        return;
+    file.unlink("performance");
+    file.newGroup("performance");
+    writeUInt64Array(&file, "performance/walkers", walkers.data(), nThreads);
+    writeDoubleArray(&file, "performance/simulation-time",
+                     simulationTime.data(), nThreads);
+    writeDoubleArray(&file, "performance/thread-walkers-per-second",
+                     walkersPerSecond.data(), nThreads);
+    writeDoubleArray(&file, "performance/flush-time", flushTime.data(),
+                     nThreads);
+    writeDoubleArray(&file, "performance/io-time", ioTime.data(), nThreads);
+    writeUInt64Array(&file, "performance/scattering-events",
+                     scatterings.data(), nThreads);
+    writeUInt64Array(&file, "performance/interface-hits",
+                     interfaceHits.data(), nThreads);
+    writeUInt64Array(&file, "performance/rng-draws", rngDraws.data(),
+                     nThreads);
+#ifdef ENABLE_PERFORMANCE_COUNTERS
+    vector<u_int64_t> tir(nThreads), reflections(nThreads),
+            refractions(nThreads), layerSwitches(nThreads);
+    for (size_t i = 0; i < nThreads; ++i) {
+        tir[i] = threadPerf[i].totalInternalReflections;
+        reflections[i] = threadPerf[i].fresnelReflections;
+        refractions[i] = threadPerf[i].refractions;
+        layerSwitches[i] = threadPerf[i].layerSwitches;
+    }
+    writeUInt64Array(&file, "performance/total-internal-reflections",
+                     tir.data(), nThreads);
+    writeUInt64Array(&file, "performance/fresnel-reflections",
+                     reflections.data(), nThreads);
+    writeUInt64Array(&file, "performance/refractions", refractions.data(),
+                     nThreads);
+    writeUInt64Array(&file, "performance/layer-switches",
+                     layerSwitches.data(), nThreads);
+#endif
+    writeDoubleArray(&file, "performance/wall-time", &wallTime, 1);
+    writeDoubleArray(&file, "performance/output-time", &outputTime, 1);
+    writeDoubleArray(&file, "performance/walkers-per-second", &rate, 1);
+    writeDoubleArray(&file, "performance/load-imbalance", &imbalance, 1);
+    file.close();
+}
+
+/**
+ * @brief Periodically saves a checkpoint of each thread while the simulation
+ * is running
+ * @param seconds
+ *
+ *
+ * Each thread saves its own checkpoint in the output file every given amount
+ * of time, so that the simulation can be resumed even if the process is
+ * killed (see setResumeEnabled()). Checkpoints are also saved when each thread
+ * completes, regardless of this setting. Periodic checkpoints are skipped if
+ * raw output is enabled, since they could not be matched with the raw data
+ * written so far.
+ * A value of 0 (the default) disables periodic checkpoints.
+ */
+
+void Simulation::setCheckpointInterval(double seconds)
+{
+    checkpointInterval = seconds;
+}
+
+/**
+ * @brief Resumes an interrupted simulation
+ * @param enable
+ *
+ *
+ * If enabled and the output file already exists, run() restores the state
+ * saved in its checkpoint and simulates the walkers that were still missing
+ * when the simulation was interrupted, using the same number of threads and
+ * continuing their RNG sequences, instead of aborting. Threads interrupted
+ * within a source batch draw it again, so that the results are the same as
+ * the ones of an uninterrupted run. Threads that were interrupted before
+ * saving their first checkpoint are run again from their original seed with
+ * their whole budget. The number of walkers set with
+ * setNWalkers() is ignored in this case. If the output file does not exist, a
+ * new simulation is started.
+ */
+
+void Simulation::setResumeEnabled(bool enable)
+{
+    resumeEnabled = enable;
+}
+
+/**
+ * @brief Adds walkers to an existing simulation
+ * @param enable
+ *
+ *
+ * If enabled and the output file already exists, run() simulates nPhotons()
+ * additional walkers and adds them to the results saved in the checkpoint of
+ * the output file. Threads continue the RNG sequences of the checkpointed
+ * ones. This takes precedence over setResumeEnabled(). If the output file does
+ * not exist, a new simulation is started.
+ */
+
+void Simulation::setAppendEnabled(bool enable)
+{
+    appendEnabled = enable;
+}
+
+/**
+ * @brief Runs only one part of the simulation
+ * @param index Index of the shard, from 0 to count - 1
+ * @param count Total number of shards; 0 runs the whole simulation
+ *
+ *
+ * The walkers set with setNWalkers() are split evenly among the shards, and
+ * each one runs its share with setNThreads() threads seeded with
+ * <tt>seed + index * nThreads</tt> onwards, where <tt>seed</tt> is the one set
+ * with setSeed(), or with the corresponding streams if stream splitting is
+ * enabled (see setStreamSplittingEnabled()). Shards therefore never share RNG
+ * sequences, and the
+ * combination of all of them gives the same results as a single run of
+ * <tt>count * nThreads</tt> threads whenever the walkers divide evenly.
+ * Explicit RNG states (see setMultipleRNGStates()) are not supported.
+ *
+ * Results are written in the file given by shardOutputFileName() instead of
+ * the output file. The shard files of all the shards can be combined with
+ * OutputMerger (see also ShardLauncher).
+ */
+
+void Simulation::setShard(uint index, uint count)
+{
+    shardIndex = index;
+    shardCount = count;
+}
+
+/**
+ * @brief Splits the RNG streams of the threads and shards from a single seed
+ * @param enable
+ *
+ *
+ * By default, thread \f$ n \f$ is seeded with <tt>seed + n</tt>, and streams
+ * drawn from different seeds have no guarantee of being independent. If
+ * stream splitting is enabled, the RNG of thread \f$ n \f$ is instead the one
+ * of the first thread jumped \f$ n \f$ times (see BaseRandom::jumpGenerator()),
+ * so that no two threads can draw overlapping sequences. Shards (see
+ * setShard()) take the streams of the threads they stand for. The seed of
+ * each thread is still reported as <tt>seed + n</tt>, which also indexes its
+ * final RNG state in the output file.
+ *
+ * Results differ from those of the same seed without stream splitting.
+ * States given with setMultipleRNGStates() are used as they are.
+ */
+
+void Simulation::setStreamSplittingEnabled(bool enable)
+{
+    streamSplitting = enable;
+}
+
+/**
+ * @brief Periodically writes the live statistics of the simulation to the
+ * given JSON file
+ * @param name
+ *
+ *
+ * While the simulation is running, the file is replaced every
+ * setStatsInterval() seconds with an object holding the total number of
+ * completed walkers (<tt>walkers</tt>), the ones left (<tt>remaining</tt>),
+ * the throughput in walkers per second over the last interval and since the
+ * start (<tt>throughput</tt>, <tt>mean-throughput</tt>), the estimated
+ * seconds to completion (<tt>eta</tt>), the number of scattering events and
+ * interface hits, the exits by walker type and, in <tt>threads</tt>, the
+ * progress of each running thread. A last update with <tt>finished</tt> set
+ * to true is written when all threads have completed.
+ *
+ * The counters are read without locking the threads, which are not slowed
+ * down by frequent polling. Shards (see setShard()) append
+ * <tt>.shard\<index\></tt> to the name.
+ */
+
+void Simulation::setStatsFileName(const char *name)
+{
+    copyToInternalVariable(&statsFile, name);
+}
+
+/**
+ * @brief How often the stats file is written, in seconds
+ * @param seconds
+ *
+ *
+ * The default is 1 second. See setStatsFileName().
+ */
+
+void Simulation::setStatsInterval(double seconds)
+{
+    if(seconds <= 0) {
+        logMessage("The stats interval must be positive");
+        return;
+    }
+    statsInterval = seconds;
+}
+
+/**
+ * @brief The output file of the given shard
+ * @param index
+ * @return The name of the output file, with <tt>.shard\<index\></tt> inserted
+ * before the <tt>.h5</tt> extension
+ */
+
+string Simulation::shardOutputFileName(uint index) const
+{
+    string name = outputFile == NULL ? "output.h5" : outputFile;
+    if(name.size() > 3 && name.compare(name.size() - 3, 3, ".h5") == 0)
+        name.erase(name.size() - 3);
+    stringstream ss;
+    ss << name << ".shard" << index << ".h5";
+    return ss.str();
+}
+
+/**
+ * @brief Loads the checkpoint of all threads from the output file
+ * @return false if the checkpoint is missing or invalid
+ *
+ *
+ * If the output file has no checkpoint and no walkers were saved in it (i.e.
+ * the simulation was killed before any checkpoint was taken), the file is
+ * overwritten and a new simulation is started.
+ *
+ * \pre histograms must be initialized
+ */
+
+bool Simulation::loadCheckpoint()
+{
+    boost::lock_guard<boost::recursive_mutex> fileLock(h5Mutex);
+    H5OutputFile file;
+    if(!file.openFile(outputFile))
+        return false;
+
+    hsize_t nCheckpoints = file.nChildren("checkpoint");
+    if(nCheckpoints == 0) {
+        const u_int64_t *counters = file.photonCounters();
+        if(counters[0] + counters[1] + counters[2] + counters[3] > 0) {
+            logMessage("No checkpoint found in %s", outputFile);
+            return false;
+        }
+        logMessage("No checkpoint found in %s, starting a new simulation",
+                   outputFile);
+        file.setRawOutputProfile(rawProfile);
+        return file.newFile(outputFile, rawOutputEnabled);
+    }
+
+    // thread indices are read from the group names, since threads that were
+    // killed before their first checkpoint leave gaps
+    map<uint, ThreadCheckpoint *> loaded;
+    bool ok = true;
+    bool hasLayout = true;
+    for (hsize_t k = 0; ok && k < nCheckpoints; ++k) {
+        string name = file.childName("checkpoint", k);
+        char *end;
+        unsigned long index = strtoul(name.c_str(), &end, 10);
+        if(name.empty() || *end != '\0') {
+            logMessage("Invalid checkpoint checkpoint/%s", name.c_str());
+            ok = false;
+            break;
+        }
+        string group = "checkpoint/" + name;
+
+        ThreadCheckpoint *c = new ThreadCheckpoint;
+        restoredThreads.push_back(c);
+        loaded[index] = c;
+
+        vector<u_int64_t> buf;
+        ok = readUInt64Array(&file, group + "/progress", &buf)
+                && (buf.size() == 2 || buf.size() == 4);
+        if(ok) {
+            c->nWalkers = buf[0];
+            c->walkersDone = buf[1];
+            if(buf.size() == 4) {
+                checkpointThreads = buf[2];
+                checkpointWalkers = buf[3];
+            }
+            else {
+                hasLayout = false;
+            }
+        }
+        ok = ok && readUInt64Array(&file, group + "/photon-counters", &buf)
+                && buf.size() == 4;
+        if(ok)
+            memcpy(c->counters, buf.data(), 4 * sizeof(u_int64_t));
+        ok = ok && readUInt64Array(&file, group + "/rng-state", &c->rngState);
+        c->batchDone = 0;
+        c->batchSize = 0;
+        if(ok && file.dataSetExists((group + "/batch").c_str())) {
+            ok = readUInt64Array(&file, group + "/batch", &buf)
+                    && buf.size() == 2
+                    && readUInt64Array(&file, group + "/batch-rng-state",
+                                       &c->batchRNGState);
+            if(ok) {
+                c->batchDone = buf[0];
+                c->batchSize = buf[1];
+            }
+        }
+
+        for (size_t i = 0; ok && i < hists.size(); ++i) {
+            Histogram *h = (Histogram *)hists[i]->clone();
+            h->initialize();
+            c->hists.push_back(h);
+            stringstream hs;
+            hs << group << "/histograms/" << i;
+            ok = h->loadRawCounts(&file, hs.str().c_str());
+        }
+        if(!ok)
+            logMessage("Invalid checkpoint %s", group.c_str());
+    }
+    file.close();
+
+    // without the layout of the simulation, the budget of the missing
+    // threads is unknown
+    uint nThreads = loaded.empty() ? 0 : loaded.rbegin()->first + 1;
+    if(ok && !hasLayout && nThreads != loaded.size()) {
+        logMessage("Missing thread checkpoints in %s", outputFile);
+        ok = false;
+    }
+    if(ok && hasLayout && nThreads > checkpointThreads) {
+        logMessage("Invalid checkpoint layout in %s", outputFile);
+        ok = false;
+    }
+
+    if(!ok) {
+        clearCheckpoints();
+        return false;
+    }
+
+    if(!hasLayout) {
+        checkpointThreads = nThreads;
+        checkpointWalkers = 0;
+        for (size_t n = 0; n < restoredThreads.size(); ++n) {
+            checkpointWalkers += restoredThreads[n]->nWalkers;
+        }
+    }
+
+    // threads are restored in order; the ones without a checkpoint get their
+    // full budget and start from their original seed
+    restoredThreads.clear();
+    for (uint n = 0; n < checkpointThreads; ++n) {
+        map<uint, ThreadCheckpoint *>::iterator it = loaded.find(n);
+        if(it != loaded.end()) {
+            restoredThreads.push_back(it->second);
+            continue;
+        }
+        ThreadCheckpoint *c = new ThreadCheckpoint;
+        c->nWalkers = checkpointWalkers / checkpointThreads;
+        if(n < checkpointWalkers % checkpointThreads)
+            c->nWalkers++;
+        c->walkersDone = 0;
+        c->batchDone = 0;
+        c->batchSize = 0;
+        memset(c->counters, 0, 4 * sizeof(u_int64_t));
+        for (size_t i = 0; i < hists.size(); ++i) {
+            Histogram *h = (Histogram *)hists[i]->clone();
+            h->initialize();
+            c->hists.push_back(h);
+        }
+        restoredThreads.push_back(c);
+        logMessage("No checkpoint for thread %u, restarting it", n);
+    }
+
+    u_int64_t done = 0;
+    for (size_t n = 0; n < restoredThreads.size(); ++n) {
+        done += restoredThreads[n]->walkersDone;
+    }
+    logMessage("Checkpoint of %zu threads loaded (%llu walkers)",
+               restoredThreads.size(), done);
+    return true;
+}
+
+void Simulation::clearCheckpoints()
+{
+    for (size_t n = 0; n < restoredThreads.size(); ++n) {
+        ThreadCheckpoint *c = restoredThreads[n];
+        for (size_t i = 0; i < c->hists.size(); ++i) {
+            delete c->hists[i];
+        }
+        delete c;
+    }
+    restoredThreads.clear();
+    resumeState = NULL;
+}
+
+/**
+ * @brief Saves the state of this thread in the <tt>checkpoint/\<n\></tt>
+ * group of the given file
+ * @param file
+ *
+ *
+ * The group contains the raw histograms (see Histogram::saveRawCounts()), the
+ * photon counters, the RNG state and <tt>progress</tt>: the walker budget of
+ * the thread, the number of walkers simulated so far, the number of threads
+ * and the total budget of the simulation, from which the budget of threads
+ * that have no checkpoint yet is recovered. Previous checkpoints of the same
+ * thread are overwritten.
+ *
+ * If the thread is within a source batch, <tt>batch</tt> holds the number of
+ * walkers of the batch already simulated and its size, and
+ * <tt>batch-rng-state</tt> the RNG state before the batch was drawn, so that
+ * a resumed thread draws the same walkers again.
+ *
+ * \pre Histograms and photon counters must be consistent with the RNG state,
+ * i.e. the walker buffer must be empty.
+ */
+
+void Simulation::writeCheckpoint(H5FileHelper *file)
+{
+    stringstream ss;
+    ss << "checkpoint/" << threadIndex;
+    string group = ss.str();
+    file->newGroup(group.c_str());
+
+    u_int64_t offset = 0;
+    if(resumeState != NULL)
+        offset = resumeState->walkersDone;
+    u_int64_t progress[4] = {offset + _totalWalkers, offset + n,
+                             checkpointThreads, checkpointWalkers};
+    writeUInt64Array(file, group + "/progress", progress, 4);
+    writeUInt64Array(file, group + "/photon-counters", photonCounters, 4);
+    vector<u_int64_t> state = binaryGeneratorState();
+    writeUInt64Array(file, group + "/rng-state", state.data(), state.size());
+    if(n < batchEnd) {
+        u_int64_t batch[2] = {batchSize - (batchEnd - n), batchSize};
+        writeUInt64Array(file, group + "/batch", batch, 2);
+        writeUInt64Array(file, group + "/batch-rng-state",
+                         batchRNGState.data(), batchRNGState.size());
+    }
+    else {
+        file->unlink((group + "/batch").c_str());
+        file->unlink((group + "/batch-rng-state").c_str());
+    }
+
+    for (size_t i = 0; i < hists.size(); ++i) {
+        stringstream hs;
+        hs << group << "/histograms/" << i;
+        hists[i]->saveRawCounts(file, hs.str().c_str());
+    }
+    file->closeDataSet();
+}
+
+/**
+ * @brief Writes raw output while the simulation is running
+ * @param enable
+ *
+ *
+ * By default, raw output (see setRawOutputEnabled()) is kept in memory until
+ * each thread completes. If streaming is enabled, each thread instead hands
+ * its raw data to a dedicated writer thread every setRawOutputBufferSize()
+ * walkers and goes on simulating with a second buffer, so that at most two
+ * buffers per thread are kept in memory. If the writer cannot keep up, threads
+ * wait for their previous buffer to be written. See also setSWMREnabled().
+ */
+
+void Simulation::setRawOutputStreamingEnabled(bool enable)
+{
+    rawOutputStreaming = enable;
+}
+
+/**
+ * @brief Sets the number of walkers after which each thread hands its raw
+ * output to the writer thread
+ * @param nWalkers
+ *
+ *
+ * Only used with setRawOutputStreamingEnabled(). Defaults to 100000 walkers.
+ */
+
+void Simulation::setRawOutputBufferSize(u_int64_t nWalkers)
+{
+    rawBufferSize = nWalkers;
+}
+
+/**
+ * @brief Enables the HDF5 single-writer / multiple-reader mode for raw output
+ * streaming
+ * @param enable
+ *
+ *
+ * If enabled along with setRawOutputStreamingEnabled(), the output file is
+ * created in the latest HDF5 format and kept open in SWMR write mode while the
+ * simulation is running, so that the raw datasets can be read live by opening
+ * the file with the H5F_ACC_SWMR_READ flag (e.g. <tt>h5py.File(name, "r",
+ * swmr=True)</tt>). Data are flushed after each buffer is written.
+ *
+ * Since HDF5 does not allow to create new objects in a file open in SWMR mode,
+ * snapshots are disabled and the data of each thread other than raw output
+ * (see saveRawOutput()) are written after all threads have completed.
+ */
+
+void Simulation::setSWMREnabled(bool enable)
+{
+    swmrEnabled = enable;
+}
+
+/**
+ * @brief Hands the raw output collected so far to the writer thread
+ *
+ *
+ * Waits until the buffer handed previously has been written, then swaps it
+ * with the current one.
+ */
+
+void Simulation::streamRawOutput()
+{
+    {
+        ScopedTimer timer(&perf.ioTime);
+        rawWriter->wait(&rawBlock);
+    }
+    for (uint type = 0; type < 4; ++type) {
+        exitPoints[type].swap(rawBlock.exitPoints[type]);
+        walkTimes[type].swap(rawBlock.walkTimes[type]);
+        exitKVectors[type].swap(rawBlock.exitKVectors[type]);
+        records[type].swap(rawBlock.records[type]);
+    }
+    rawWriter->push(&rawBlock);
+    rawStreamedWalkers = n;
+}
+
+void Simulation::stopRawOutputWriter()
+{
+    if(rawWriter == NULL)
+        return;
+    rawWriter->stop();
+    delete rawWriter;
+    rawWriter = NULL;
+}
+
+/**
+ * @brief Writes the raw output of each thread to its own shard file
+ * @param enable
+ *
+ *
+ * If enabled along with setRawOutputEnabled(), each thread saves its raw output
+ * in a separate file named after the output file, e.g.
+ * <tt>output.thread0.h5</tt>, <tt>output.thread1.h5</tt>, etc. for
+ * <tt>output.h5</tt>. Threads write their shards as soon as they complete (or
+ * stream them with their own writer thread, see
+ * setRawOutputStreamingEnabled()), without waiting for the other threads to
+ * complete. As every HDF5 access, the writes of the shards are serialized with
+ * h5Mutex.
+ *
+ * When the simulation completes, the raw output datasets of the main file are
+ * replaced with HDF5 virtual datasets mapping the shards one after the other
+ * (see H5OutputFile::linkShards()), so that readers see the same dataset paths
+ * as without shards. Shard files must be kept in the same directory of the
+ * main file. SWMR mode (see setSWMREnabled()) is not used for shards.
+ */
+
+void Simulation::setRawOutputShardsEnabled(bool enable)
+{
+    rawOutputShards = enable;
+}
+
+/**
+ * @brief The name of the raw output shard file of the given thread
+ * @param index
+ * @return
+ */
+
+string Simulation::shardFileName(uint index, const char *extension) const
+{
+    string name = outputFile;
+    if(name.size() > 3 && name.compare(name.size() - 3, 3, ".h5") == 0)
+        name.erase(name.size() - 3);
+    stringstream ss;
+    ss << name << ".thread" << index << extension;
+    return ss.str();
+}
+
+/**
+ * @brief Opens the shard file of this thread, creating it if needed, and
+ * starts its writer thread if raw output streaming is enabled
+ * @return false if the shard file cannot be created
+ */
+
+bool Simulation::openShard()
+{
+    string name = shardFileName(threadIndex);
+    bool ok;
+    {
+        boost::lock_guard<boost::recursive_mutex> fileLock(h5Mutex);
+        H5OutputFile file;
+        file.setRawOutputProfile(rawProfile);
+        if(access(name.c_str(), F_OK) >= 0)
+            ok = file.openFile(name.c_str());
+        else
+            ok = file.newFile(name.c_str(), true)
+                    && file.createWalkerRecordDatasets(walkerRecordsSaveFlags);
+        file.close();
+    }
+    if(!ok) {
+        logMessage("Cannot create shard %s", name.c_str());
+        return false;
+    }
+
+    if(!rawOutputStreaming)
+        return true;
+
+    shardWriter = new RawOutputWriter();
+    if(!shardWriter->start(name.c_str())) {
+        logMessage("Cannot stream raw output to %s", name.c_str());
+        delete shardWriter;
+        shardWriter = NULL;
+        return false;
+    }
+    rawWriter = shardWriter;
+    return true;
+}
+
+/**
+ * @brief Writes the raw output of this thread to its shard file
+ *
+ *
+ * If streaming, the raw output has already been handed to the writer thread of
+ * the shard, which is stopped.
+ */
+
+void Simulation::saveShard()
+{
+    ScopedTimer timer(&perf.ioTime);
+    if(shardWriter != NULL) {
+        shardWriter->stop();
+        delete shardWriter;
+        shardWriter = NULL;
+        rawWriter = NULL;
+        return;
+    }
+
+    string name = shardFileName(threadIndex);
+    boost::lock_guard<boost::recursive_mutex> fileLock(h5Mutex);
+    H5OutputFile file;
+    if(!file.openFile(name.c_str())) {
+        logMessage("Cannot open shard %s, raw output lost", name.c_str());
+        return;
+    }
+
+    for (uint type = 0; type < 4; ++type) {
+        walkerFlags flag = walkerTypeToFlag(type);
+        if(exitPointsSaveFlags & flag)
+            file.appendExitPoints((walkerType)type, exitPoints[type].data(),
+                                  exitPoints[type].size());
+        if(walkTimesSaveFlags & flag)
+            file.appendWalkTimes((walkerType)type, walkTimes[type].data(),
+                                 walkTimes[type].size());
+        if(exitKVectorsSaveFlags & flag)
+            file.appendExitKVectors((walkerType)type, exitKVectors[type].data(),
+                                    exitKVectors[type].size());
+        if(walkerRecordsSaveFlags & flag)
+            file.appendWalkerRecords((walkerType)type, records[type].data(),
+                                     records[type].size());
+        vector<MCfloat>().swap(exitPoints[type]);
+        vector<MCfloat>().swap(walkTimes[type]);
+        vector<MCfloat>().swap(exitKVectors[type]);
+        vector<WalkerRecord>().swap(records[type]);
+    }
+    file.close();
+}
+
+/**
+ * @brief Links the raw output of all the existing shard files in the given
+ * output file
+ * @param file
+ */
+
+void Simulation::linkShards(H5OutputFile *file)
+{
+    size_t nShards = max((size_t)_nThreads, restoredThreads.size());
+    vector<string> shardFiles;
+    for (size_t i = 0; i < nShards; ++i) {
+        string name = shardFileName(i);
+        if(access(name.c_str(), F_OK) >= 0)
+            shardFiles.push_back(name);
+    }
+    if(!file->linkShards(shardFiles))
+        logMessage("Cannot link raw output shards to %s", outputFile);
+}
+
+/**
+ * @brief Removes the shard and record files left over by a previous
+ * simulation with the same output file name
+ *
+ *
+ * All the files of the threads of this simulation are removed, even if some
+ * are missing, as well as the ones of further threads up to the first missing
+ * file.
+ */
+
+void Simulation::removeShards()
+{
+    size_t nShards = max((size_t)_nThreads, restoredThreads.size());
+    const char *extensions[2] = {".h5", ".rec"};
+    for (uint e = 0; e < 2; ++e) {
+        for (uint i = 0; ; ++i) {
+            string name = shardFileName(i, extensions[e]);
+            if(access(name.c_str(), F_OK) < 0) {
+                if(i < nShards)
+                    continue;
+                break;
+            }
+            logMessage("Removing stale shard %s", name.c_str());
+            remove(name.c_str());
+        }
+    }
+}
+
+/**
+ * @brief Sets chunking, compression and storage type of the raw output
+ * datasets
+ * @param profile
+ *
+ *
+ * The profile is used when the output file (or the shard files, see
+ * setRawOutputShardsEnabled()) is created; when appending to an existing file
+ * its datasets are kept as they are. See RawOutputProfile for the
+ * quantization error of the lossy profiles.
+ */
+
+void Simulation::setRawOutputProfile(const RawOutputProfile &profile)
+{
+    rawProfile = profile;
+}
+
+/**
+ * @brief Writes the walker records of each thread to a memory-mapped file
+ * @param enable
+ *
+ *
+ * If enabled along with setRawOutputEnabled(), the records selected with
+ * setWalkerRecordsSaveFlags() are not kept in memory nor written to the HDF5
+ * output file: each thread copies them directly into its own RecordFile, named
+ * after the output file as the shards (e.g. <tt>output.thread0.rec</tt>, see
+ * setRawOutputShardsEnabled()), which is the cheapest way to save raw output.
+ * The size of the chunks of the record files is taken from the
+ * RawOutputProfile.
+ *
+ * Record files can be read directly (e.g. with <tt>numpy.memmap</tt>, see
+ * RecordFile for the format) or converted to the usual HDF5 layout with
+ * H5OutputFile::importRecordFile(). When resuming or appending to a
+ * simulation, records are appended to the existing files.
+ */
+
+void Simulation::setRecordFilesEnabled(bool enable)
+{
+    recordFilesEnabled = enable;
+}
+
+/**
+ * @brief Opens the record file of this thread, creating it if needed
+ * @return false on error
+ */
+
+bool Simulation::openRecordFile()
+{
+    string name = shardFileName(threadIndex, ".rec");
+    recordFile = new RecordFile();
+    bool ok;
+    if(access(name.c_str(), F_OK) >= 0)
+        ok = recordFile->openForAppend(name.c_str());
+    else
+        ok = recordFile->create(name.c_str(), rawProfile.chunkWalkers);
+    if(!ok) {
+        logMessage("Cannot open record file %s", name.c_str());
+        closeRecordFile();
+    }
+    return ok;
+}
+
+void Simulation::closeRecordFile()
+{
+    if(recordFile == NULL)
+        return;
+    delete recordFile;
+    recordFile = NULL;
+}
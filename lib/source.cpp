@@ -38,19 +38,22 @@ Source::Source(BaseObject *parent) :
         addObjectToCheck((const BaseObject**)&r0Distribution[i]);
     }
     _z0 = 0;
+    bandDistribution = NULL;
+    sequence = NULL;
+    point = NULL;
     setWavelength(1);
 
 }
 
 Source::~Source()
 {
-
+    free(point);
 }
 
 void Source::spinDirection(Walker *walker) const {
-    MCfloat cosTheta = cosThetaDistribution->spin();
+    MCfloat cosTheta = draw(cosThetaDistribution, 2);
     MCfloat sinTheta = sqrt(1 - pow(cosTheta, 2));
-    MCfloat psi = psiDistribution->spin();
+    MCfloat psi = draw(psiDistribution, 3);
     MCfloat cosPsi = cos(psi);
     MCfloat sinPsi = sin(psi);
 
@@ -60,13 +63,72 @@ void Source::spinDirection(Walker *walker) const {
 }
 
 void Source::spinPosition(Walker *walker) const {
-    for (int i = 0; i < 3; ++i) {
-        walker->r0[i] = r0Distribution[i]->spin();
-    }
+    walker->r0[0] = draw(r0Distribution[0], 0);
+    walker->r0[1] = draw(r0Distribution[1], 1);
+    walker->r0[2] = r0Distribution[2]->spin();
 }
 
 void Source::spinTime(Walker *walker) const {
-    walker->walkTime = walkTimeDistribution->spin();    // overwrapping?
+    walker->walkTime = draw(walkTimeDistribution, 4);    // overwrapping?
+}
+
+/**
+ * @brief Constructs a batch of walkers
+ * @param walkers
+ * @param n
+ *
+ *
+ * The default implementation calls spin() for each walker, so that derived
+ * classes reimplementing spinPosition(), spinDirection() or spinTime() are
+ * always honored.
+ */
+
+void Source::spinBatch_impl(Walker *walkers, size_t n) const {
+    for (size_t i = 0; i < n; ++i) {
+        spin(&walkers[i]);
+    }
+}
+
+/**
+ * @brief Constructs a batch of walkers from the source distributions
+ * @param walkers
+ * @param n
+ *
+ *
+ * Batch counterpart of the default spinPosition(), spinDirection(),
+ * spinTime() and of the wavelength assignment, for derived classes that only
+ * set the source distributions. Each distribution draws the variates of the
+ * whole batch at once with AbstractDistribution::fill(), one distribution
+ * after the other. The trigonometry is done in loops without calls to the
+ * distributions, which the compiler can vectorize.
+ */
+
+void Source::spinDistributionsBatch(Walker *walkers, size_t n) const {
+    vector<MCfloat> u(n);
+    for (int j = 0; j < 3; ++j) {
+        r0Distribution[j]->fill(u.data(), n);
+        for (size_t i = 0; i < n; ++i) {
+            walkers[i].r0[j] = u[i];
+        }
+    }
+    cosThetaDistribution->fill(u.data(), n);
+    for (size_t i = 0; i < n; ++i) {
+        walkers[i].k0[2] = u[i];
+    }
+    psiDistribution->fill(u.data(), n);
+    for (size_t i = 0; i < n; ++i) {
+        Walker *w = &walkers[i];
+        MCfloat cosTheta = w->k0[2];
+        MCfloat sinTheta = sqrt(1 - cosTheta * cosTheta);
+        w->k0[0] = sinTheta * cos(u[i]);
+        w->k0[1] = sinTheta * sin(u[i]);
+    }
+    walkTimeDistribution->fill(u.data(), n);
+    for (size_t i = 0; i < n; ++i) {
+        walkers[i].walkTime = u[i];
+        walkers[i].type = -1;
+    }
+    spinWavelengths(walkers, n);
 }
 
 BaseObject *Source::clone_impl() const
@@ -90,6 +152,58 @@ void Source::cloneInto(Source *src) const
         src->setWalkTimeDistribution(
                     (AbstractDistribution*)walkTimeDistribution->clone());
     src->setWavelength(wl);
+    cloneSamplingInto(src);
+}
+
+/**
+ * @brief Copies the spectrum and the quasi-random sequence to the given source
+ * @param src
+ *
+ *
+ * The copy of the sequence is randomized anew, see QuasiRandomSequence.
+ */
+
+void Source::cloneSamplingInto(Source *src) const
+{
+    if(bandDistribution != NULL)
+        src->setSpectrum(spectrumWavelengths.data(), spectrumWeights.data(),
+                         spectrumWavelengths.size());
+    if(sequence != NULL)
+        src->setQuasiRandomSequence(
+                    (QuasiRandomSequence *)sequence->clone());
+}
+
+/**
+ * @brief The given coordinate of the quasi-random point of the current walker
+ * @param coordinate
+ * @param u
+ * @return false if there is no such coordinate, in which case the caller must
+ * use the RNG
+ */
+
+bool Source::quasiRandomCoordinate(unsigned int coordinate, MCfloat *u) const
+{
+    if(sequence == NULL || coordinate >= sequence->dimension())
+        return false;
+    *u = point[coordinate];
+    return true;
+}
+
+/**
+ * @brief Draws a variate of the given distribution for the current walker
+ * @param distribution
+ * @param coordinate The coordinate of the quasi-random point to be used, see
+ * Source
+ * @return
+ */
+
+MCfloat Source::draw(const AbstractDistribution *distribution,
+                     unsigned int coordinate) const
+{
+    MCfloat u;
+    if(quasiRandomCoordinate(coordinate, &u))
+        return distribution->quantile(u);
+    return distribution->spin();
 }
 
 /**
@@ -99,11 +213,71 @@ void Source::cloneInto(Source *src) const
 
 void Source::spin(Walker *walker) const {
     walker->reset();
+    if(sequence != NULL)
+        sequence->next(point);
     // the calling order is critical! GaussianRayBundleSource must spin the
     // walker's position BEFORE calculating the direction vector
     spinPosition(walker);
     spinDirection(walker);
     spinTime(walker);
+    spinWavelengths(walker, 1);
+}
+
+/**
+ * @brief Constructs n walkers at once
+ * @param walkers Array of at least n walkers
+ * @param n
+ *
+ *
+ * The walkers follow the same distributions as the ones constructed by
+ * spin(). Sources with a dedicated batch path (PencilBeamSource,
+ * GaussianBeamSource, IsotropicPointSource and GaussianRayBundleSource) draw
+ * the random variates in bulk, distribution by distribution, with a lower
+ * per-walker overhead: their walkers then depend on the batch size and are not
+ * the ones that n calls to spin() would construct. With a quasi-random
+ * sequence the walkers are always constructed one at a time by spin().
+ */
+
+void Source::spinBatch(Walker *walkers, size_t n) const {
+    if(sequence != NULL) {
+        Source::spinBatch_impl(walkers, n);
+        return;
+    }
+    spinBatch_impl(walkers, n);
+}
+
+/**
+ * @brief Assigns a wavelength to each walker
+ * @param walkers
+ * @param n
+ *
+ *
+ * No random numbers are drawn for monochromatic sources.
+ */
+
+void Source::spinWavelengths(Walker *walkers, size_t n) const {
+    if(bandDistribution == NULL) {
+        for (size_t i = 0; i < n; ++i) {
+            walkers[i].wavelength = wl;
+            walkers[i].band = 0;
+        }
+        return;
+    }
+    if(sequence != NULL) {
+        for (size_t i = 0; i < n; ++i) {
+            u_int32_t band = draw(bandDistribution, 5);
+            walkers[i].band = band;
+            walkers[i].wavelength = spectrumWavelengths[band];
+        }
+        return;
+    }
+    vector<MCfloat> bands(n);
+    bandDistribution->fill(bands.data(), n);
+    for (size_t i = 0; i < n; ++i) {
+        u_int32_t band = bands[i];
+        walkers[i].band = band;
+        walkers[i].wavelength = spectrumWavelengths[band];
+    }
 }
 
 void Source::setr0Distribution(AbstractDistribution *x0Distribution,
@@ -138,11 +312,120 @@ MCfloat Source::wavelength() const {
     return wl;
 }
 
+/**
+ * @brief Turns this source into a broadband one
+ * @param wavelengths Wavelengths of the grid in vacuum (um)
+ * @param weights Relative spectral intensity at each wavelength, not
+ * necessarily normalized
+ * @param n Number of wavelengths
+ * @return false if the spectrum is invalid, in which case the source is left
+ * unchanged
+ *
+ *
+ * The wavelength of each walker is drawn from the given discrete spectrum with
+ * the alias method (see AliasDistribution). Histograms can be resolved in
+ * wavelength with the DATA_WAVELENGTH domain. The wavelength set with
+ * setWavelength() is still used for the description of the sample saved in the
+ * output file.
+ */
+
+bool Source::setSpectrum(const MCfloat *wavelengths, const MCfloat *weights,
+                         size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        if(!(wavelengths[i] > 0)) {
+            logMessage("Invalid wavelength at index %zu", i);
+            return false;
+        }
+    }
+    vector<MCfloat> bands(n);
+    for (size_t i = 0; i < n; ++i) {
+        bands[i] = i;
+    }
+    AliasDistribution *d = new AliasDistribution(this);
+    if(!d->setTable(bands.data(), weights, n)) {
+        delete d;
+        return false;
+    }
+    delete bandDistribution;
+    bandDistribution = d;
+    spectrumWavelengths.assign(wavelengths, wavelengths + n);
+    spectrumWeights.assign(weights, weights + n);
+    return true;
+}
+
+/**
+ * @brief Turns this source back into a monochromatic one
+ */
+
+void Source::clearSpectrum()
+{
+    delete bandDistribution;
+    bandDistribution = NULL;
+    spectrumWavelengths.clear();
+    spectrumWeights.clear();
+}
+
+/**
+ * @brief Number of wavelengths of the spectrum
+ * @return 1 for monochromatic sources
+ */
+
+size_t Source::nBands() const
+{
+    return bandDistribution == NULL ? 1 : spectrumWavelengths.size();
+}
+
+/**
+ * @brief Wavelength of the given band of the spectrum
+ * @param band
+ * @return
+ */
+
+MCfloat Source::bandWavelength(size_t band) const
+{
+    return bandDistribution == NULL ? wl : spectrumWavelengths[band];
+}
+
 MCfloat Source::z0() const
 {
     return _z0;
 }
 
+/**
+ * @brief Draws the variates of the walkers from a low-discrepancy sequence
+ * @param sequence A sequence of dimension up to 6 (see Source), or NULL to
+ * use the RNG again
+ *
+ *
+ * The source takes ownership of the sequence. Each thread of a Simulation
+ * randomizes its own copy of the sequence, so that the threads give
+ * independent estimates: the errors of the histograms are then computed from
+ * their spread, see Histogram::appendReplicate().
+ *
+ * Only the source is affected: the scattering and the interfaces still use the
+ * RNG.
+ */
+
+void Source::setQuasiRandomSequence(QuasiRandomSequence *sequence)
+{
+    if(this->sequence == sequence)
+        return;
+    delete this->sequence;
+    this->sequence = sequence;
+    free(point);
+    point = NULL;
+    if(sequence == NULL)
+        return;
+    sequence->setParent(this);
+    point = (MCfloat *)calloc(sequence->dimension(), sizeof(MCfloat));
+}
+
+const QuasiRandomSequence *Source::quasiRandomSequence() const
+{
+    return sequence;
+}
+
 
 
 
@@ -168,6 +451,23 @@ void PencilBeamSource::spinPosition(Walker *walker) const {
     walker->r0[2] = _z0;
 }
 
+void PencilBeamSource::spinBatch_impl(Walker *walkers, size_t n) const {
+    vector<MCfloat> t(n);
+    walkTimeDistribution->fill(t.data(), n);
+    for (size_t i = 0; i < n; ++i) {
+        Walker *w = &walkers[i];
+        w->r0[0] = 0;
+        w->r0[1] = 0;
+        w->r0[2] = _z0;
+        w->k0[0] = 0;
+        w->k0[1] = 0;
+        w->k0[2] = 1;
+        w->walkTime = t[i];
+        w->type = -1;
+    }
+    spinWavelengths(walkers, n);
+}
+
 BaseObject *PencilBeamSource::clone_impl() const
 {
     PencilBeamSource *src = new PencilBeamSource();
@@ -211,6 +511,11 @@ GaussianBeamSource::~GaussianBeamSource()
 
 }
 
+void GaussianBeamSource::spinBatch_impl(Walker *walkers, size_t n) const
+{
+    spinDistributionsBatch(walkers, n);
+}
+
 BaseObject *GaussianBeamSource::clone_impl() const
 {
     GaussianBeamSource *src = new GaussianBeamSource(xFWHM,yFWHM);
@@ -257,6 +562,11 @@ IsotropicPointSource::~IsotropicPointSource()
 
 }
 
+void IsotropicPointSource::spinBatch_impl(Walker *walkers, size_t n) const
+{
+    spinDistributionsBatch(walkers, n);
+}
+
 BaseObject *IsotropicPointSource::clone_impl() const
 {
     IsotropicPointSource *src = new IsotropicPointSource(z0());
@@ -0,0 +1,106 @@
+/*
+  This file is part of MCPlusPlus.
+
+  MCPlusPlus is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Mcplusplus is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with MCPlusPlus.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <MCPlusPlus/trajectoryrecorder.h>
+
+using namespace MCPP;
+
+TrajectoryRecorder::TrajectoryRecorder(uint threadIndex, BaseObject *parent) :
+    BaseObject(parent)
+{
+    memset(&current, 0, sizeof(TrajectoryInfo));
+    current.thread = threadIndex;
+    photonTypeFlags = FLAG_ALL_WALKERS;
+}
+
+TrajectoryRecorder::~TrajectoryRecorder()
+{
+}
+
+/**
+ * @brief Selects the walker types whose trajectories are kept
+ * @param value See walkerFlags
+ */
+
+void TrajectoryRecorder::setPhotonTypeFlags(int value)
+{
+    photonTypeFlags = value;
+}
+
+/**
+ * @brief Preallocates the arena
+ * @param nPoints
+ *
+ *
+ * The arena grows as needed if more points are appended.
+ */
+
+void TrajectoryRecorder::reserve(u_int64_t nPoints)
+{
+    _points.reserve(3 * nPoints);
+}
+
+/**
+ * @brief The number of points of the completed trajectories
+ * @return
+ */
+
+u_int64_t TrajectoryRecorder::nPoints() const
+{
+    if(_info.empty())
+        return 0;
+    const TrajectoryInfo *last = &_info.back();
+    return last->offset + last->nPoints;
+}
+
+u_int64_t TrajectoryRecorder::nTrajectories() const
+{
+    return _info.size();
+}
+
+/**
+ * @brief The points of the completed trajectories
+ * @return Three coordinates (x, y, z) per point
+ */
+
+const MCfloat *TrajectoryRecorder::points() const
+{
+    return _points.data();
+}
+
+/**
+ * @brief The description of the completed trajectories
+ * @return nTrajectories() elements, whose offsets refer to points()
+ */
+
+const TrajectoryInfo *TrajectoryRecorder::info() const
+{
+    return _info.data();
+}
+
+/**
+ * @brief Drops all the trajectories, keeping the arena allocated
+ *
+ *
+ * \pre No trajectory must be in progress
+ */
+
+void TrajectoryRecorder::clear()
+{
+    _points.clear();
+    _info.clear();
+}
@@ -34,5 +34,7 @@ void Walker::reset()
     memset(r0, 0, 3 * sizeof(MCfloat));
     memset(k0, 0, 3 * sizeof(MCfloat));
     walkTime = 0;
+    wavelength = 0;
+    band = 0;
     type = -1;
 }
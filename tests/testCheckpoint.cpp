@@ -0,0 +1,206 @@
+#include "tests.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace MCPP;
+
+const char referenceFileName[] = "testCheckpoint-reference.h5";
+const char outputFileName[] = "testCheckpoint.h5";
+const char randomReferenceFileName[] = "testCheckpoint-random-reference.h5";
+const char randomFileName[] = "testCheckpoint-random.h5";
+
+const u_int64_t nWalkers = 200000;
+const uint nTimesRows = 51;
+const uint nTimesCols = 3;
+
+void cleanup() {
+    remove(referenceFileName);
+    remove(outputFileName);
+    remove(randomReferenceFileName);
+    remove(randomFileName);
+}
+
+void pass() {
+    cout << "testCheckpoint PASSED" << endl;
+    cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    cleanup();
+    exit(EXIT_FAILURE);
+}
+
+u_int64_t loadResults(const char *fileName, u_int64_t *counters,
+                      MCfloat *times) {
+    H5OutputFile file;
+    if(!file.openFile(fileName))
+        fail();
+    u_int64_t total = 0;
+    for (uint i = 0; i < 4; ++i) {
+        counters[i] = file.photonCounters()[i];
+        total += counters[i];
+    }
+    file.openDataSet("times");
+    file.loadAll(times);
+    return total;
+}
+
+// with a target precision, the run is interrupted after a few tens of
+// thousands of walkers, which stops every thread like SIGTERM would. With a
+// random source, the walkers also depend on the RNG state before each batch
+void runBilayer(const char *fileName, bool resume, bool append,
+                u_int64_t N, double maxRelativeError = 0,
+                bool randomSource = false) {
+    Simulation *sim = bilayerSimulation(fileName);
+    if(randomSource) {
+        Source *src = new GaussianBeamSource(20);
+        src->setWalkTimeDistribution(new NormalDistribution(0, 1));
+        sim->setSource(src);
+    }
+    sim->setNPhotons(N);
+    sim->setNThreads(4);
+    sim->setSeed(0);
+    sim->setResumeEnabled(resume);
+    sim->setAppendEnabled(append);
+    if(maxRelativeError > 0) {
+        sim->addConvergenceCriterion(REFLECTED, maxRelativeError);
+        sim->setConvergenceCheckInterval(0.01);
+    }
+    sim->run();
+    delete sim;
+}
+
+// interrupts the run before its budget is completed
+void runInterrupted(const char *fileName, bool randomSource = false) {
+    runBilayer(fileName, false, false, nWalkers, 2e-3, randomSource);
+    u_int64_t counters[4];
+    MCfloat times[nTimesRows * nTimesCols];
+    if(loadResults(fileName, counters, times) >= nWalkers)
+        fail();
+}
+
+// whether a thread was interrupted within a source batch
+bool interruptedWithinBatch(const char *fileName) {
+    H5FileHelper file;
+    if(!file.openFile(fileName))
+        fail();
+    bool within = false;
+    for (hsize_t i = 0; i < file.nChildren("checkpoint"); ++i) {
+        string group = "checkpoint/" + file.childName("checkpoint", i);
+        u_int64_t progress[4];
+        file.openDataSet((group + "/progress").c_str());
+        file.loadAll(progress);
+        if(progress[1] % WALKER_BUFSIZE != 0
+                && file.dataSetExists((group + "/batch-rng-state").c_str()))
+            within = true;
+    }
+    file.close();
+    return within;
+}
+
+// the results of the resumed run must be identical to the reference
+void compareWithReference(const char *refFileName = referenceFileName,
+                          const char *fileName = outputFileName) {
+    u_int64_t refCounters[4], counters[4];
+    MCfloat refTimes[nTimesRows * nTimesCols], times[nTimesRows * nTimesCols];
+    if(loadResults(refFileName, refCounters, refTimes) != nWalkers)
+        fail();
+    if(loadResults(fileName, counters, times) != nWalkers)
+        fail();
+
+    for (uint i = 0; i < 4; ++i) {
+        if(counters[i] != refCounters[i]) fail();
+    }
+    for (uint i = 0; i < nTimesRows * nTimesCols; ++i) {
+        if(times[i] != refTimes[i] && !(isnan(times[i]) && isnan(refTimes[i])))
+            fail();
+    }
+}
+
+
+int main() {
+    cleanup();
+
+    // uninterrupted run
+    runBilayer(referenceFileName, false, false, nWalkers);
+
+    // the same run interrupted, then resumed: threads continue their RNG
+    // sequences, so results must be identical
+    runInterrupted(outputFileName);
+    runBilayer(outputFileName, true, false, 0);
+    compareWithReference();
+
+    // threads without a checkpoint are run again from their seed with their
+    // full budget, including the last one
+    remove(outputFileName);
+    runInterrupted(outputFileName);
+    H5FileHelper helper;
+    if(!helper.openFile(outputFileName))
+        fail();
+    helper.unlink("checkpoint/1");
+    helper.unlink("checkpoint/3");
+    helper.close();
+    runBilayer(outputFileName, true, false, 0);
+    compareWithReference();
+
+    // a random source draws each batch of walkers before their transport: a
+    // thread interrupted within a batch draws it again when resumed
+    runBilayer(randomReferenceFileName, false, false, nWalkers, 0, true);
+    runInterrupted(randomFileName, true);
+    if(!interruptedWithinBatch(randomFileName))
+        fail();
+    runBilayer(randomFileName, true, false, 0, 0, true);
+    compareWithReference(randomReferenceFileName, randomFileName);
+
+    // add more walkers with a different number of threads
+    const u_int64_t moreWalkers = 50000;
+    Simulation *sim = bilayerSimulation(outputFileName);
+    sim->setNPhotons(moreWalkers);
+    sim->setNThreads(2);
+    sim->setSeed(0);
+    sim->setAppendEnabled(true);
+    sim->run();
+    delete sim;
+
+    u_int64_t refCounters[4], counters[4];
+    MCfloat refTimes[nTimesRows * nTimesCols], times[nTimesRows * nTimesCols];
+    loadResults(referenceFileName, refCounters, refTimes);
+    u_int64_t total = loadResults(outputFileName, counters, times);
+    if(total != nWalkers + moreWalkers) fail();
+    if(counters[TRANSMITTED] <= refCounters[TRANSMITTED]) fail();
+
+    MCfloat sum = 0;
+    for (uint i = 0; i < nTimesRows; ++i) {
+        sum += times[i * nTimesCols + 1];
+    }
+    MCfloat expected = 1. * counters[TRANSMITTED] / total;
+    if(fabs((sum - expected) / expected) > 1e-12) fail();
+
+    // a single thread resumes with what is left of its budget, but keeps the
+    // configured one
+    remove(outputFileName);
+    sim = bilayerSimulation(outputFileName);
+    sim->setNPhotons(nWalkers);
+    sim->setSeed(0);
+    sim->addConvergenceCriterion(REFLECTED, 4e-3);
+    sim->setConvergenceCheckInterval(0.01);
+    sim->run();
+    delete sim;
+    if(loadResults(outputFileName, counters, times) >= nWalkers)
+        fail();
+    sim = bilayerSimulation(outputFileName);
+    sim->setNPhotons(nWalkers);
+    sim->setSeed(0);
+    sim->setResumeEnabled(true);
+    sim->run();
+    if(sim->nPhotons() != nWalkers) fail();
+    delete sim;
+    if(loadResults(outputFileName, counters, times) != nWalkers)
+        fail();
+
+    pass();
+    return 0;
+}
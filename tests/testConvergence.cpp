@@ -0,0 +1,77 @@
+#include "tests.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testConvergence.h5";
+
+void pass() {
+    cout << "testConvergence PASSED" << endl;
+    remove(outputFileName);
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    remove(outputFileName);
+    exit(EXIT_FAILURE);
+}
+
+int main() {
+    remove(outputFileName);
+
+    const u_int64_t budget = 100000000;
+    Simulation *sim = bilayerSimulation(outputFileName);
+    sim->setNPhotons(budget);
+    sim->setNThreads(2);
+    sim->setSeed(0);
+    sim->addConvergenceCriterion(TRANSMITTED, 0.03);
+    sim->addConvergenceCriterion("times", 0.1, 3, 8);
+    sim->setConvergenceCheckInterval(0.2);
+    sim->run();
+    delete sim;
+
+    H5OutputFile file;
+    file.openFile(outputFileName);
+
+    const u_int64_t *counters = file.photonCounters();
+    u_int64_t total = 0;
+    for (uint i = 0; i < 4; ++i) {
+        total += counters[i];
+    }
+    if(total == 0 || total >= budget) fail();
+
+    MCfloat transmitted = counters[TRANSMITTED];
+    if(sqrt((1 - transmitted / total) / transmitted) > 0.03) fail();
+
+    // histograms must be normalized with the number of simulated walkers
+    MCfloat buf[51*3];
+    file.openDataSet("times");
+    file.loadAll(buf);
+    MCfloat sum = 0;
+    for (uint i = 0; i < 51; ++i) {
+        sum += buf[i * 3 + 1];
+    }
+    MCfloat relativeError = fabs((sum - transmitted / total)
+                                 / (transmitted / total));
+    if(relativeError > 1e-12) fail();
+    file.close();
+
+    // the selected bins must exist, overflow bin excluded, and be at least one
+    const int invalidBins[3][2] = {{-1, 8}, {8, 3}, {3, 50}};
+    for (uint i = 0; i < 3; ++i) {
+        remove(outputFileName);
+        sim = bilayerSimulation(outputFileName);
+        sim->setNPhotons(1000);
+        sim->addConvergenceCriterion("times", 0.1, invalidBins[i][0],
+                                     invalidBins[i][1]);
+        bool ok = sim->run();
+        delete sim;
+        if(ok) fail();
+    }
+
+    pass();
+    return 0;
+}
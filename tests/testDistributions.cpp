@@ -0,0 +1,112 @@
+#include "tests.h"
+
+#include <MCPlusPlus/distributions.h>
+#include <MCPlusPlus/costhetagenerator.h>
+#include <MCPlusPlus/psigenerator.h>
+
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+using namespace MCPP;
+
+const size_t nSamples = 400000;
+
+void pass() {
+    cout << "testDistributions PASSED" << endl;
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    exit(EXIT_FAILURE);
+}
+
+struct Moments {
+    double min, max, mean, var;
+};
+
+Moments moments(const MCfloat *x, size_t n) {
+    Moments m = {x[0], x[0], 0, 0};
+    for (size_t i = 0; i < n; ++i) {
+        m.min = std::min<double>(m.min, x[i]);
+        m.max = std::max<double>(m.max, x[i]);
+        m.mean += x[i];
+    }
+    m.mean /= n;
+    for (size_t i = 0; i < n; ++i) {
+        m.var += (x[i] - m.mean) * (x[i] - m.mean);
+    }
+    m.var /= n - 1;
+    return m;
+}
+
+// compares the variates of fill() with the ones of repeated spin(): both must
+// lie in [lo, hi] and have the same mean and variance within the statistical
+// error
+void check(AbstractDistribution *d, double lo, double hi) {
+    MCfloat *a = (MCfloat *)malloc(nSamples * sizeof(MCfloat));
+    MCfloat *b = (MCfloat *)malloc(nSamples * sizeof(MCfloat));
+    d->setSeed(1);
+    d->fill(a, nSamples);
+    for (size_t i = 0; i < nSamples; ++i) {
+        b[i] = d->spin();
+    }
+    Moments ma = moments(a, nSamples);
+    Moments mb = moments(b, nSamples);
+    free(a);
+    free(b);
+
+    if(ma.min < lo || ma.max > hi || mb.min < lo || mb.max > hi)
+        fail();
+    double meanErr = sqrt(2 * mb.var / nSamples);
+    if(fabs(ma.mean - mb.mean) > 5 * meanErr + 1e-12)
+        fail();
+    // the variance of the sample variance is about 2 var^2 / n for
+    // distributions with moderate tails
+    double varErr = mb.var * sqrt(8. / nSamples);
+    if(fabs(ma.var - mb.var) > 5 * varErr + 1e-12)
+        fail();
+}
+
+int main() {
+    DeltaDistribution delta(3);
+    check(&delta, 3, 3);
+
+    NormalDistribution normal(1, 2);
+    check(&normal, -HUGE_VAL, HUGE_VAL);
+
+    UniformDistribution uniform(-1, 3);
+    check(&uniform, -1, 3);
+
+    ExponentialDistribution exponential(0.5);
+    check(&exponential, 0, HUGE_VAL);
+
+    Sech2Distribution sech2(2, 0.5);
+    check(&sech2, -HUGE_VAL, HUGE_VAL);
+
+    MCfloat x[3] = {0, 1, 2};
+    MCfloat pdf[3] = {0, 1, 0};
+    TabulatedDistribution tabulated;
+    if(!tabulated.setTable(x, pdf, 3))
+        fail();
+    check(&tabulated, 0, 2);
+
+    MCfloat values[4] = {10, 20, 30, 40};
+    MCfloat weights[4] = {1, 0, 3, 4};
+    AliasDistribution alias;
+    if(!alias.setTable(values, weights, 4))
+        fail();
+    check(&alias, 10, 40);
+
+    const double g[4] = {0, 0.8, -0.5, 0.99};
+    for (int i = 0; i < 4; ++i) {
+        CosThetaGenerator cosTheta(g[i]);
+        check(&cosTheta, -1, 1);
+    }
+
+    IsotropicPsiGenerator psi;
+    check(&psi, 0, 2 * M_PI);
+
+    pass();
+}
@@ -0,0 +1,169 @@
+#include "tests.h"
+
+#include <MCPlusPlus/mcengine.h>
+
+#include <cmath>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+using namespace MCPP;
+
+const u_int64_t nWalkers = 50000;
+
+void pass() {
+    cout << "testEngines PASSED" << endl;
+    remove("testEngines.h5");
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    remove("testEngines.h5");
+    exit(EXIT_FAILURE);
+}
+
+// replaces the state of the algorithm, at the start of a block
+void setWords(MCEngine *engine, const u_int64_t *words, size_t n) {
+    vector<u_int64_t> s = engine->state();
+    s.resize(2);
+    s[1] = MCENGINE_BLOCK;
+    s.insert(s.end(), words, words + n);
+    if(!engine->setState(s))
+        fail();
+}
+
+int main() {
+    // reference outputs
+    mt19937_64 reference(42);
+    MCEngine mt(42);
+    for (int i = 0; i < 1000; ++i) {
+        if(mt() != reference())
+            fail();
+    }
+
+    MCEngine xoshiro(0, ENGINE_XOSHIRO256PP);
+    const u_int64_t xoshiroState[4] = {1, 2, 3, 4};
+    setWords(&xoshiro, xoshiroState, 4);
+    if(xoshiro() != 41943041)
+        fail();
+
+    MCEngine pcg(0, ENGINE_PCG64);
+    const u_int64_t pcgState[4] = {0x0123456789abcdefULL, 0xfedcba9876543210ULL,
+                                   0x1111111111111111ULL, 0x2222222222222223ULL};
+    setWords(&pcg, pcgState, 4);
+    if(pcg() != 17201788592418073757ULL)
+        fail();
+
+    MCEngine sfmt(1234, ENGINE_SFMT19937);
+    u_int64_t w = sfmt();
+    if((w & 0xffffffff) != 3440181298U || (w >> 32) != 1564997079U)
+        fail();
+
+    // states saved in the middle of a block, and older bare MT states
+    for (int type = 0; type <= ENGINE_SFMT19937; ++type) {
+        MCEngine a(7, (MCEngineType)type), b(0), c(0);
+        for (int i = 0; i < 100; ++i) {
+            a();
+        }
+        stringstream ss;
+        ss << a;
+        ss >> b;
+        if(ss.fail() || !c.setState(a.state()) || b.type() != type)
+            fail();
+        u_int64_t buf[1000];
+        b.generate(buf, 1000);
+        for (int i = 0; i < 1000; ++i) {
+            u_int64_t x = a();
+            if(buf[i] != x || c() != x)
+                fail();
+        }
+    }
+    stringstream ss;
+    ss << reference;
+    ss >> mt;
+    if(ss.fail() || mt() != reference())
+        fail();
+
+    // jumps: the jump() of xoshiro256++, numpy's PCG64.advance(3 * 2**64), and
+    // composition of jumps in the middle of a block
+    setWords(&xoshiro, xoshiroState, 4);
+    xoshiro.jump();
+    if(xoshiro() != 17043750140134683703ULL)
+        fail();
+    setWords(&pcg, pcgState, 4);
+    pcg.jump(3);
+    if(pcg() != 7449244962521904123ULL)
+        fail();
+    for (int type = 0; type <= ENGINE_SFMT19937; ++type) {
+        MCEngine a(5, (MCEngineType)type), b(5, (MCEngineType)type);
+        for (int i = 0; i < 100; ++i) {
+            a();
+            b();
+        }
+        a.jump();
+        a.jump();
+        b.jump(2);
+        for (int i = 0; i < 1000; ++i) {
+            if(a() != b())
+                fail();
+        }
+
+        // draws are counted across jumps, bulk generation and restored states
+        u_int64_t words[500];
+        b.generate(words, 500);
+        if(!b.setState(b.state()) || a.draws() != 1100 || b.draws() != 1600)
+            fail();
+    }
+
+    // short jumps of the Mersenne Twisters, at a block boundary and in the
+    // middle of a block, are the same as discarding words: a step of SFMT
+    // yields 2 words
+    const MCEngineType twisters[2] = {ENGINE_MT19937_64, ENGINE_SFMT19937};
+    const u_int64_t jumpReference[2] = {15445493678876401045ULL,
+                                        7859101026804753995ULL};
+    for (int k = 0; k < 2; ++k) {
+        const MCEngineType type = twisters[k];
+        const size_t wordsPerStep = type == ENGINE_SFMT19937 ? 2 : 1;
+        for (int start = 0; start <= 100; start += 100) {
+            for (u_int64_t n = 1; n <= 3; n += 2) {
+                MCEngine a(9, type), b(9, type);
+                u_int64_t words[3 * 2048];
+                a.generate(words, start);
+                b.generate(words, start);
+                a.jump(n, 10);
+                b.generate(words, n * 1024 * wordsPerStep);
+                for (int i = 0; i < 1000; ++i) {
+                    if(a() != b())
+                        fail();
+                }
+            }
+        }
+
+        // the jump of 2^64 steps, also taken as 2^54 jumps of 2^10 steps
+        MCEngine a(9, type), b(9, type);
+        a.jump();
+        b.jump((u_int64_t)1 << 54, 10);
+        if(a() != jumpReference[k] || b() != jumpReference[k])
+            fail();
+    }
+
+    // simulations with different engines agree within the statistical error
+    u_int64_t transmitted[2];
+    for (int i = 0; i < 2; ++i) {
+        remove("testEngines.h5");
+        Simulation *sim = bilayerSimulation("testEngines.h5");
+        sim->setNPhotons(nWalkers);
+        sim->setNThreads(2);
+        sim->setEngineType(i == 0 ? ENGINE_MT19937_64 : ENGINE_XOSHIRO256PP);
+        sim->setStreamSplittingEnabled(i == 1);
+        sim->setSeed(0);
+        sim->run();
+        transmitted[i] = sim->photonCounts()[0];
+        delete sim;
+    }
+    if(fabs((MCfloat)transmitted[0] - transmitted[1]) > 5 * sqrt(2. * nWalkers))
+        fail();
+
+    pass();
+}
@@ -0,0 +1,176 @@
+#include "tests.h"
+
+#include <MCPlusPlus/fluencegrid.h>
+#include <MCPlusPlus/outputmerger.h>
+
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testFluence.h5";
+const char secondFileName[] = "testFluence-second.h5";
+const char thirdFileName[] = "testFluence-third.h5";
+const char mergedFileName[] = "testFluence-merged.h5";
+
+const u_int64_t nWalkers = 20000;
+
+void cleanup() {
+    remove(outputFileName);
+    remove(secondFileName);
+    remove(thirdFileName);
+    remove(mergedFileName);
+}
+
+void pass() {
+    cout << "testFluence PASSED" << endl;
+    cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    cleanup();
+    exit(EXIT_FAILURE);
+}
+
+MCfloat totalPathLength(const FluenceGrid *grid) {
+    MCfloat total = 0;
+    for (size_t i = 0; i < grid->nVoxels(); ++i) {
+        total += grid->rawPathLengths()[i];
+    }
+    return total;
+}
+
+// the path lengths and the number of walkers of a saved grid
+u_int64_t loadGrid(const char *fileName, const char *name,
+                   vector<MCfloat> *pathLengths) {
+    H5FileHelper file;
+    if(!file.openFile(fileName))
+        fail();
+    string group = string("fluence/") + name;
+    FluenceGrid grid;
+    if(!grid.loadLayout(&file, group.c_str()) || !grid.initialize()
+            || !grid.loadCounts(&file, group.c_str()))
+        fail();
+    pathLengths->assign(grid.rawPathLengths(),
+                        grid.rawPathLengths() + grid.nVoxels());
+    return grid.nWalkers();
+}
+
+// a run with a single cylindrical grid, appended to the given file if it
+// exists
+void runCylindrical(const char *fileName, unsigned int seed) {
+    Simulation *sim = bilayerSimulation(fileName);
+    sim->setNPhotons(nWalkers);
+    sim->setNThreads(2);
+    sim->setSeed(seed);
+    sim->setAppendEnabled(true);
+    FluenceGrid *grid = new FluenceGrid();
+    grid->setName("cylindrical");
+    grid->setGeometry(GRID_CYLINDRICAL);
+    grid->setRhoRange(1e4, 3);
+    grid->setZRange(0, 80, 3);
+    sim->addFluenceGrid(grid);
+    sim->run();
+    delete sim;
+}
+
+int main() {
+    cleanup();
+
+    Simulation *sim = bilayerSimulation(outputFileName);
+    sim->setNPhotons(nWalkers);
+    sim->setNThreads(2);
+    sim->setSeed(0);
+
+    // three grids covering the whole sample, split along different boundaries
+    FluenceGrid *cartesian = new FluenceGrid();
+    cartesian->setName("cartesian");
+    cartesian->setXRange(-1e4, 1e4, 200);
+    cartesian->setYRange(-1e4, 1e4, 200);
+    cartesian->setZRange(0, 80, 7);
+    sim->addFluenceGrid(cartesian);
+
+    FluenceGrid *cylindrical = new FluenceGrid();
+    cylindrical->setName("cylindrical");
+    cylindrical->setGeometry(GRID_CYLINDRICAL);
+    cylindrical->setRhoRange(1e4, 3);
+    cylindrical->setZRange(0, 80, 3);
+    sim->addFluenceGrid(cylindrical);
+
+    FluenceGrid *timeResolved = new FluenceGrid();
+    timeResolved->setName("time-resolved");
+    timeResolved->setXRange(-1e4, 1e4, 2e4);
+    timeResolved->setYRange(-1e4, 1e4, 2e4);
+    timeResolved->setZRange(0, 80, 80);
+    timeResolved->setTimeRange(-1e6, 1e6, 100);
+    sim->addFluenceGrid(timeResolved);
+
+    sim->run();
+
+    if(cartesian->nWalkers() != nWalkers)
+        fail();
+
+    MCfloat reference = totalPathLength(cartesian);
+    if(!(reference > 0))
+        fail();
+    if(fabs(totalPathLength(cylindrical) / reference - 1) > 1e-9)
+        fail();
+    if(fabs(totalPathLength(timeResolved) / reference - 1) > 1e-9)
+        fail();
+
+    // normalization of the saved fluence
+    H5FileHelper file;
+    if(!file.openFile(outputFileName, "fluence/cylindrical/fluence"))
+        fail();
+    MCfloat *fluence = (MCfloat *)malloc(
+                cylindrical->nVoxels() * sizeof(MCfloat));
+    file.loadAll(fluence);
+    size_t i = cylindrical->nBinsAlong(2) + 1;  // rho = [3, 6), z = [3, 6)
+    MCfloat volume = M_PI * (6 * 6 - 3 * 3) * 3;
+    MCfloat expected = cylindrical->rawPathLengths()[i] / nWalkers / volume;
+    bool ok = fabs(fluence[i] / expected - 1) < 1e-9;
+    free(fluence);
+    delete sim;
+
+    if(!ok)
+        fail();
+
+    // merged files and appended runs add up the saved grids
+    vector<MCfloat> first, second, sum;
+    if(loadGrid(outputFileName, "cylindrical", &first) != nWalkers)
+        fail();
+    runCylindrical(secondFileName, 7);
+    if(loadGrid(secondFileName, "cylindrical", &second) != nWalkers)
+        fail();
+    runCylindrical(thirdFileName, 0);
+
+    OutputMerger merger;
+    merger.addInputFile(thirdFileName);
+    merger.addInputFile(secondFileName);
+    if(!merger.merge(mergedFileName))
+        fail();
+    if(loadGrid(mergedFileName, "cylindrical", &sum) != 2 * nWalkers)
+        fail();
+    for (size_t i = 0; i < sum.size(); ++i) {
+        if(fabs(sum[i] - first[i] - second[i]) > 1e-9 * fabs(sum[i]))
+            fail();
+    }
+
+    // the walkers of an appended run follow the ones already in the file
+    runCylindrical(outputFileName, 7);
+    if(loadGrid(outputFileName, "cylindrical", &sum) != 2 * nWalkers)
+        fail();
+    MCfloat totals[2] = {0, 0};
+    for (size_t i = 0; i < sum.size(); ++i) {
+        if(sum[i] < first[i])
+            fail();
+        totals[0] += sum[i];
+        totals[1] += first[i] + second[i];
+    }
+    if(fabs(totals[0] / totals[1] - 1) > 0.05)
+        fail();
+    pass();
+}
@@ -53,6 +53,15 @@ int main() {
     relativeError = fabs((result - expectedResult) / expectedResult);
     if(relativeError > 1e-13) fail();
 
+    // binomial standard error of the normalized counts
+    idx = 29*3+1;
+    expectedResult = sqrt(buf[idx] * (1 - buf[idx]) / 1000000);
+    file.openDataSet("times-stderr");
+    file.loadAll(buf);
+    result = buf[idx];
+    relativeError = fabs((result - expectedResult) / expectedResult);
+    if(relativeError > 1e-12) fail();
+
     file.openDataSet("k");
     file.loadAll(buf);
     idx = 16*2+1;
@@ -0,0 +1,135 @@
+#include "tests.h"
+
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testHistogramErrors.h5";
+
+void cleanup() {
+    remove(outputFileName);
+}
+
+void pass() {
+    cout << "testHistogramErrors PASSED" << endl;
+    cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    cleanup();
+    exit(EXIT_FAILURE);
+}
+
+bool closeTo(MCfloat value, MCfloat expected) {
+    if(isnan(expected))
+        return isnan(value);
+    return fabs(value - expected) <= 1e-12 * (1 + fabs(expected));
+}
+
+bool loadDataset(H5FileHelper *file, const char *dsName,
+                 vector<MCfloat> &values, hsize_t rows, hsize_t cols) {
+    if(!file->openDataSet(dsName))
+        return false;
+    if(file->getRank() != 2 || file->extentDims()[0] != rows
+            || file->extentDims()[1] != cols)
+        return false;
+    values.resize(rows * cols);
+    file->loadAll(values.data());
+    return true;
+}
+
+Walker walker(MCfloat t, MCfloat x, MCfloat y, int type = TRANSMITTED) {
+    Walker w;
+    w.reset();
+    w.r0[0] = x;
+    w.r0[1] = y;
+    w.walkTime = t;
+    w.type = type;
+    return w;
+}
+
+int main() {
+    cleanup();
+
+    // time bins [0,1), [1,2), [2,3) and the overflow bin, spatial moments of
+    // the radial exit distance with exponents 1 and 2
+    Histogram *hist = new Histogram();
+    hist->setDataDomain(DATA_TIMES);
+    hist->setPhotonTypeFlags(FLAG_TRANSMITTED);
+    hist->setMax(3);
+    hist->setBinSize(1);
+    hist->addMomentExponent(1);
+    hist->addMomentExponent(2);
+    hist->setName("times");
+    if(!hist->initialize())
+        fail();
+
+    const Walker buf[] = {
+        walker(0.5, 1, 0),
+        walker(0.2, 0, 2),
+        walker(0.7, 0, -3),
+        walker(0.5, 10, 0, REFLECTED),  // not picked
+        walker(1.5, 3, 4),
+        walker(2.1, 1, 0),
+        walker(2.9, 3, 0),
+        walker(10, 7, 0),               // overflow
+    };
+    hist->run(buf, sizeof(buf) / sizeof(buf[0]));
+
+    const u_int64_t totalPhotons = 10;
+    hist->setScale(totalPhotons);
+    hist->saveToFile(outputFileName);
+    delete hist;
+
+    // hand-computed from the walkers above:
+    // bin 0: radii 1, 2, 3
+    //   exponent 1: mean 2, variance 14/3 - 4 = 2/3, error sqrt(2/3 / 2)
+    //   exponent 2: mean 14/3, variance 98/3 - 196/9 = 98/9, error 7/3
+    // bin 1: radius 5 only, the error of the moments is undefined
+    // bin 2: radii 1, 3
+    //   exponent 1: mean 2, variance 5 - 4 = 1, error 1
+    //   exponent 2: mean 5, variance 41 - 25 = 16, error 4
+    // bin 3: radius 7 only
+    const MCfloat nan = numeric_limits<MCfloat>::quiet_NaN();
+    const MCfloat counts[4] = {3, 1, 2, 1};
+    const MCfloat mom1[4] = {2, 5, 2, 7};
+    const MCfloat mom2[4] = {14. / 3, 25, 5, 49};
+    const MCfloat mom1Err[4] = {sqrt(1. / 3), nan, 1, nan};
+    const MCfloat mom2Err[4] = {7. / 3, nan, 4, nan};
+
+    H5FileHelper file;
+    if(!file.openFile(outputFileName))
+        fail();
+    vector<MCfloat> values, errors;
+    if(!loadDataset(&file, "times", values, 4, 4)
+            || !loadDataset(&file, "times-stderr", errors, 4, 4))
+        fail();
+    file.close();
+
+    for (int i = 0; i < 4; ++i) {
+        const MCfloat *v = &values[4 * i];
+        const MCfloat *e = &errors[4 * i];
+        MCfloat c = counts[i];
+        MCfloat N = totalPhotons;
+        if(!closeTo(v[0], i + 0.5) || !closeTo(e[0], i + 0.5))
+            fail();
+
+        // binomial error of the normalized counts
+        if(!closeTo(v[1], c / N)
+                || !closeTo(e[1], sqrt(c * (1 - c / N)) / N))
+            fail();
+
+        // standard error of the mean of the moments
+        if(!closeTo(v[2], mom1[i]) || !closeTo(e[2], mom1Err[i]))
+            fail();
+        if(!closeTo(v[3], mom2[i]) || !closeTo(e[3], mom2Err[i]))
+            fail();
+    }
+
+    pass();
+}
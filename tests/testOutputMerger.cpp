@@ -0,0 +1,115 @@
+#include "tests.h"
+
+#include <MCPlusPlus/outputmerger.h>
+
+#include <iostream>
+
+using namespace std;
+using namespace MCPP;
+
+const uint nInputs = 2;
+const char *inputFileNames[nInputs] = {"testOutputMerger-0.h5",
+                                       "testOutputMerger-1.h5"};
+const char outputFileName[] = "testOutputMerger.h5";
+
+// the unnamed histograms added after the four of bilayerSimulation()
+const uint nUnnamed = 2;
+const char *unnamed[nUnnamed] = {"histogram4", "histogram5"};
+const uint nBins[nUnnamed] = {51, 11};
+
+void cleanup() {
+    for (uint i = 0; i < nInputs; ++i) {
+        remove(inputFileNames[i]);
+    }
+    remove(outputFileName);
+}
+
+void pass() {
+    cout << "testOutputMerger PASSED" << endl;
+    cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    cleanup();
+    exit(EXIT_FAILURE);
+}
+
+vector<u_int64_t> loadCounts(H5OutputFile *file, const char *name) {
+    string dsName = string("raw-histograms/") + name + "/counts";
+    if(!file->openDataSet(dsName.c_str()))
+        fail();
+    vector<u_int64_t> counts(file->extentDims()[0]);
+    file->loadAll(counts.data());
+    return counts;
+}
+
+int main() {
+    cleanup();
+
+    for (uint i = 0; i < nInputs; ++i) {
+        Simulation *sim = bilayerSimulation(inputFileNames[i]);
+        sim->setNPhotons(20000);
+        sim->setSeed(i);
+        // two histograms with different layouts and no name
+        for (uint j = 0; j < nUnnamed; ++j) {
+            Histogram *hist = new Histogram();
+            hist->setDataDomain(DATA_TIMES);
+            hist->setPhotonTypeFlags(FLAG_TRANSMITTED);
+            hist->setMax(50);
+            hist->setBinSize(50. / (nBins[j] - 1));
+            sim->addHistogram(hist);
+        }
+        bool ok = sim->run();
+        delete sim;
+        if(!ok)
+            fail();
+    }
+
+    OutputMerger merger;
+    for (uint i = 0; i < nInputs; ++i) {
+        merger.addInputFile(inputFileNames[i]);
+    }
+    if(!merger.merge(outputFileName))
+        fail();
+
+    H5OutputFile out;
+    if(!out.openFile(outputFileName))
+        fail();
+    if(out.nChildren("raw-histograms") != 4 + nUnnamed)
+        fail();
+    vector<vector<u_int64_t> > merged;
+    for (uint j = 0; j < nUnnamed; ++j) {
+        if(!out.dataSetExists(unnamed[j]))
+            fail();
+        merged.push_back(loadCounts(&out, unnamed[j]));
+        if(merged[j].size() != nBins[j])
+            fail();
+    }
+    out.close();
+
+    // each merged histogram is the sum of the histograms with the same name
+    vector<vector<u_int64_t> > sums(nUnnamed);
+    for (uint i = 0; i < nInputs; ++i) {
+        H5OutputFile in;
+        if(!in.openFile(inputFileNames[i]))
+            fail();
+        for (uint j = 0; j < nUnnamed; ++j) {
+            vector<u_int64_t> counts = loadCounts(&in, unnamed[j]);
+            if(counts.size() != nBins[j])
+                fail();
+            sums[j].resize(nBins[j]);
+            for (uint k = 0; k < nBins[j]; ++k) {
+                sums[j][k] += counts[k];
+            }
+        }
+        in.close();
+    }
+    for (uint j = 0; j < nUnnamed; ++j) {
+        if(sums[j] != merged[j])
+            fail();
+    }
+
+    pass();
+}
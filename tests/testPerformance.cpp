@@ -0,0 +1,90 @@
+#include "tests.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testPerformance.h5";
+const uint nThreads = 3;
+
+void cleanup() {
+    remove(outputFileName);
+}
+
+void pass() {
+    cout << "testPerformance PASSED" << endl;
+    cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    cleanup();
+    exit(EXIT_FAILURE);
+}
+
+hsize_t size(H5FileHelper *file, const char *dsName) {
+    if(!file->openDataSet(dsName) || file->getRank() != 1)
+        fail();
+    return file->extentDims()[0];
+}
+
+int main() {
+    cleanup();
+
+    Simulation *sim = bilayerSimulation(outputFileName);
+    sim->setNPhotons(30000);
+    sim->setNThreads(nThreads);
+    u_int64_t nPhotons = sim->nPhotons();
+    bool ok = sim->run();
+    delete sim;
+    if(!ok)
+        fail();
+
+    H5FileHelper file;
+    if(!file.openFile(outputFileName))
+        fail();
+
+    const char *perThread[] = {"performance/walkers",
+                               "performance/simulation-time",
+                               "performance/thread-walkers-per-second",
+                               "performance/flush-time",
+                               "performance/io-time",
+                               "performance/scattering-events",
+                               "performance/interface-hits",
+                               "performance/rng-draws"};
+    for (size_t i = 0; i < sizeof(perThread) / sizeof(perThread[0]); ++i) {
+        if(size(&file, perThread[i]) != nThreads)
+            fail();
+    }
+    const char *scalars[] = {"performance/wall-time",
+                             "performance/output-time",
+                             "performance/walkers-per-second",
+                             "performance/load-imbalance"};
+    for (size_t i = 0; i < sizeof(scalars) / sizeof(scalars[0]); ++i) {
+        if(size(&file, scalars[i]) != 1)
+            fail();
+    }
+
+    u_int64_t walkers[nThreads];
+    size(&file, "performance/walkers");
+    file.loadAll(walkers);
+    u_int64_t total = 0;
+    for (uint i = 0; i < nThreads; ++i) {
+        if(walkers[i] == 0)
+            fail();
+        total += walkers[i];
+    }
+    if(total != nPhotons)
+        fail();
+
+    MCfloat imbalance;
+    size(&file, "performance/load-imbalance");
+    file.loadAll(&imbalance);
+    if(imbalance < 0)
+        fail();
+    file.close();
+
+    pass();
+}
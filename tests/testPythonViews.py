@@ -0,0 +1,103 @@
+import os
+import sys
+
+import h5py
+import numpy as np
+
+from pymcplusplus import *
+
+outputFileName = "testPythonViews.h5"
+
+
+def cleanup():
+    if os.path.exists(outputFileName):
+        os.remove(outputFileName)
+
+
+def fail(message):
+    print("FAILED: " + message)
+    cleanup()
+    sys.exit(1)
+
+
+def check(condition, message):
+    if not condition:
+        fail(message)
+
+
+cleanup()
+
+mat = Material()
+mat.n = 1.5
+mat.ls = 1
+mat.g = 0
+air = Air()
+sample = Sample()
+sample.addLayer(mat, 20)
+sample.setSurroundingEnvironment(air)
+
+source = PencilBeamSource()
+source.setWalkTimeDistribution(DeltaDistribution(0))
+
+sim = Simulation()
+sim.setSample(sample)
+sim.setSource(source)
+sim.setOutputFileName(outputFileName)
+sim.setNPhotons(5000)
+sim.setSeed(0)
+sim.setRawOutputEnabled(True)
+sim.setRawOutputInMemoryEnabled(True)
+sim.setExitPointsSaveFlags(FLAG_TRANSMITTED)
+sim.setWalkTimesSaveFlags(FLAG_TRANSMITTED)
+
+hist = Histogram()
+hist.setDataDomain(DATA_POINTS, DATA_TIMES)
+hist.setPhotonTypeFlags(FLAG_TRANSMITTED)
+hist.setMax(200, 100)
+hist.setBinSize(10, 5)
+hist.setName("points_vs_times")
+sim.addHistogram(hist)
+
+check(sim.run(), "run() failed")
+
+counters = np.asarray(sim.photonCountersView())
+counts = np.asarray(hist.countsView())
+exitPoints = np.asarray(sim.exitPointsView(TRANSMITTED))
+walkTimes = np.asarray(sim.walkTimesView(TRANSMITTED))
+
+with h5py.File(outputFileName, "r") as f:
+    check(counters.shape == (4,), "photon counters shape")
+    check(np.array_equal(counters, f["photon-counters"][:]),
+          "photon counters")
+
+    check(counts.shape == (hist.nBinsAlong(0), hist.nBinsAlong(1)),
+          "histogram counts shape")
+    check(np.array_equal(counts.ravel(),
+                         f["raw-histograms/points_vs_times/counts"][:]),
+          "histogram counts")
+
+    nTransmitted = counters[TRANSMITTED]
+    check(exitPoints.shape == (nTransmitted, 2), "exit points shape")
+    check(np.array_equal(exitPoints.ravel(),
+                         f["exit-points/transmitted"][:].ravel()),
+          "exit points")
+    check(walkTimes.shape == (nTransmitted,), "walk times shape")
+    check(np.array_equal(walkTimes, f["walk-times/transmitted"][:].ravel()),
+          "walk times")
+
+# the next run reallocates the arrays: the old views refuse to export them
+view = sim.exitPointsView(TRANSMITTED)
+histView = hist.countsView()
+cleanup()
+check(sim.run(), "second run() failed")
+for v in (view, histView):
+    try:
+        np.asarray(v)
+        fail("stale view exported")
+    except BufferError:
+        pass
+check(np.asarray(sim.exitPointsView(TRANSMITTED)).shape[1] == 2,
+      "new view after run()")
+
+print("testPythonViews PASSED")
+cleanup()
@@ -0,0 +1,216 @@
+#include "tests.h"
+
+#include <MCPlusPlus/quasirandom.h>
+#include <MCPlusPlus/outputmerger.h>
+
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testQuasiRandom.h5";
+const char shardFileNames[2][32] = {"testQuasiRandom-0.h5",
+                                    "testQuasiRandom-1.h5"};
+const unsigned int dim = 6;
+const unsigned int primes[dim] = {2, 3, 5, 7, 11, 13};
+const uint nTimesBins = 51;
+
+void cleanup() {
+    remove(outputFileName);
+    remove(shardFileNames[0]);
+    remove(shardFileNames[1]);
+}
+
+void pass() {
+    cout << "testQuasiRandom PASSED" << endl;
+    cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    cleanup();
+    exit(EXIT_FAILURE);
+}
+
+// the first n points of every coordinate fall one in each of n intervals
+void checkStratified(QuasiRandomSequence *seq, unsigned int coordinate,
+                     size_t n) {
+    vector<int> hits(n, 0);
+    MCfloat u[dim];
+    seq->randomize();
+    for (size_t i = 0; i < n; ++i) {
+        seq->next(u);
+        if(u[coordinate] <= 0 || u[coordinate] >= 1)
+            fail();
+        size_t k = u[coordinate] * n;
+        if(hits[k]++ > 0)
+            fail();
+    }
+}
+
+// root mean square error of the estimate of the mean of u0 * u1 (1 / 4) over
+// independent randomizations
+double integrationError(QuasiRandomSequence *seq, size_t n,
+                        unsigned int nRandomizations) {
+    double err2 = 0;
+    MCfloat u[dim];
+    for (unsigned int r = 0; r < nRandomizations; ++r) {
+        seq->randomize();
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i) {
+            seq->next(u);
+            sum += u[0] * u[1];
+        }
+        double e = sum / n - 0.25;
+        err2 += e * e;
+    }
+    return sqrt(err2 / nRandomizations);
+}
+
+void checkSequence(QuasiRandomSequence *seq, QuasiRandomSequence *other) {
+    // same seed, same points; different seeds, different points
+    MCfloat u[dim], v[dim];
+    seq->setSeed(1);
+    other->setSeed(1);
+    seq->randomize();
+    other->randomize();
+    seq->next(u);
+    other->next(v);
+    for (unsigned int j = 0; j < dim; ++j) {
+        if(u[j] != v[j])
+            fail();
+    }
+    other->setSeed(2);
+    other->randomize();
+    other->next(v);
+    if(u[0] == v[0])
+        fail();
+
+    // every point is uniformly distributed over the randomizations
+    const unsigned int nRandomizations = 4000;
+    double mean[dim] = {0, 0, 0, 0, 0, 0};
+    for (unsigned int r = 0; r < nRandomizations; ++r) {
+        seq->randomize();
+        seq->next(u);
+        for (unsigned int j = 0; j < dim; ++j) {
+            mean[j] += u[j] / nRandomizations;
+        }
+    }
+    for (unsigned int j = 0; j < dim; ++j) {
+        if(fabs(mean[j] - 0.5) > 5 * sqrt(1. / 12 / nRandomizations))
+            fail();
+    }
+
+    // much smaller error than the one of pseudo-random points, which is
+    // sqrt(7 / 144 / n)
+    const size_t n = 4096;
+    if(integrationError(seq, n, 20) > sqrt(7. / 144 / n) / 10)
+        fail();
+}
+
+// a quasi-random simulation in a single thread, whose file holds a single
+// replicate
+void runReplicate(const char *fileName, unsigned int seed) {
+    Simulation *sim = bilayerSimulation(fileName);
+    Source *src = new IsotropicPointSource(20);
+    src->setWalkTimeDistribution(new DeltaDistribution(0));
+    src->setQuasiRandomSequence(new SobolSequence(dim));
+    sim->setSource(src);
+    sim->setNPhotons(4000);
+    sim->setSeed(seed);
+    sim->run();
+    delete sim;
+}
+
+void loadTimes(const char *fileName, u_int64_t *total, u_int64_t *counts,
+               MCfloat *times, MCfloat *stdErr) {
+    H5OutputFile file;
+    if(!file.openFile(fileName))
+        fail();
+    *total = 0;
+    for (uint i = 0; i < 4; ++i) {
+        *total += file.photonCounters()[i];
+    }
+    if(!file.openDataSet("raw-histograms/times/counts"))
+        fail();
+    file.loadAll(counts);
+    if(!file.openDataSet("times"))
+        fail();
+    file.loadAll(times);
+    if(!file.openDataSet("times-stderr"))
+        fail();
+    file.loadAll(stdErr);
+}
+
+int main() {
+    cleanup();
+
+    SobolSequence sobol(dim), sobol2(dim);
+    sobol.setSeed(0);
+    for (unsigned int j = 0; j < dim; ++j) {
+        checkStratified(&sobol, j, 1024);
+    }
+    checkSequence(&sobol, &sobol2);
+
+    HaltonSequence halton(dim), halton2(dim);
+    halton.setSeed(0);
+    for (unsigned int j = 0; j < dim; ++j) {
+        size_t n = primes[j];
+        while(n * primes[j] <= 2200)
+            n *= primes[j];
+        checkStratified(&halton, j, n);
+    }
+    checkSequence(&halton, &halton2);
+
+    // a single replicate has no error; merging two of them gives the error
+    // from their spread
+    runReplicate(shardFileNames[0], 0);
+    runReplicate(shardFileNames[1], 1);
+    OutputMerger merger;
+    merger.addInputFile(shardFileNames[0]);
+    merger.addInputFile(shardFileNames[1]);
+    if(!merger.merge(outputFileName))
+        fail();
+
+    u_int64_t total[2], counts[2][nTimesBins], mergedTotal;
+    u_int64_t mergedCounts[nTimesBins];
+    MCfloat times[nTimesBins * 3], stdErr[nTimesBins * 3];
+    for (int k = 0; k < 2; ++k) {
+        loadTimes(shardFileNames[k], &total[k], counts[k], times, stdErr);
+        for (uint i = 0; i < nTimesBins; ++i) {
+            if(!isnan(stdErr[i * 3 + 1]))
+                fail();
+        }
+    }
+    loadTimes(outputFileName, &mergedTotal, mergedCounts, times, stdErr);
+    bool nonZero = false;
+    for (uint i = 0; i < nTimesBins; ++i) {
+        MCfloat f0 = 1. * counts[0][i] / total[0];
+        MCfloat f1 = 1. * counts[1][i] / total[1];
+        // standard error of the mean of two replicates
+        MCfloat expected = fabs(f0 - f1) / 2;
+        if(fabs(stdErr[i * 3 + 1] - expected) > 1e-12 * (1 + expected))
+            fail();
+        nonZero = nonZero || expected > 0;
+    }
+    if(!nonZero)
+        fail();
+
+    // quasi-random and pseudo-random results cannot be merged
+    remove(outputFileName);
+    Simulation *sim = bilayerSimulation(outputFileName);
+    sim->setNPhotons(4000);
+    sim->setSeed(0);
+    sim->run();
+    delete sim;
+    OutputMerger mixed;
+    mixed.addInputFile(shardFileNames[0]);
+    mixed.addInputFile(outputFileName);
+    if(mixed.merge("testQuasiRandom-mixed.h5"))
+        fail();
+    remove("testQuasiRandom-mixed.h5");
+
+    pass();
+}
@@ -0,0 +1,136 @@
+#include "tests.h"
+
+#include <MCPlusPlus/rawhistogrammer.h>
+
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testRawHistogrammer.h5";
+const char invalidFileName[] = "testRawHistogrammer-invalid.h5";
+
+const char *histNames[] = {"times", "points", "k", "points_vs_time"};
+const uint nHists = 4;
+
+void cleanup() {
+    remove(outputFileName);
+    remove(invalidFileName);
+}
+
+void pass() {
+    cout << "testRawHistogrammer PASSED" << endl;
+    cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    cleanup();
+    exit(EXIT_FAILURE);
+}
+
+size_t nBins(const Histogram *hist) {
+    return hist->nBinsAlong(0) * (hist->is2D() ? hist->nBinsAlong(1) : 1);
+}
+
+// histograms the raw output of a simulation and compares the result with the
+// histograms computed during the run, which must have the same counts bin by
+// bin
+void testRoundTrip() {
+    Simulation *sim = bilayerSimulation(outputFileName);
+    sim->setNPhotons(100000);
+    sim->setNThreads(2);
+    sim->setSeed(0);
+    sim->setRawOutputEnabled(true);
+    sim->setWalkTimesSaveFlags(FLAG_TRANSMITTED);
+    sim->setExitPointsSaveFlags(FLAG_TRANSMITTED);
+    sim->setExitKVectorsSaveFlags(FLAG_TRANSMITTED);
+    sim->setExitKVectorsDirsSaveFlags(DIR_X | DIR_Y | DIR_Z);
+    bool ok = sim->run();
+    delete sim;
+    if(!ok)
+        fail();
+
+    H5OutputFile file;
+    if(!file.openFile(outputFileName))
+        fail();
+    RawHistogrammer histogrammer;
+    histogrammer.addInputFile(outputFileName);
+    histogrammer.setNThreads(3);
+    histogrammer.setChunkSize(1000);
+    vector<Histogram *> hists;
+    for (uint i = 0; i < nHists; ++i) {
+        Histogram *hist = new Histogram();
+        string group = string("raw-histograms/") + histNames[i];
+        if(!hist->loadLayout(&file, group.c_str()))
+            fail();
+        hist->setName(histNames[i]);
+        histogrammer.addHistogram(hist);
+        hists.push_back(hist);
+    }
+    if(!histogrammer.run())
+        fail();
+    if(histogrammer.totalPhotons() != 100000)
+        fail();
+
+    for (uint i = 0; i < nHists; ++i) {
+        Histogram ref;
+        string group = string("raw-histograms/") + histNames[i];
+        if(!ref.loadLayout(&file, group.c_str()) || !ref.initialize()
+                || !ref.loadRawCounts(&file, group.c_str()))
+            fail();
+        if(nBins(&ref) != nBins(hists[i]))
+            fail();
+        u_int64_t total = 0;
+        for (size_t j = 0; j < nBins(&ref); ++j) {
+            if(ref.rawCounts()[j] != hists[i]->rawCounts()[j])
+                fail();
+            total += ref.rawCounts()[j];
+        }
+        if(total == 0)
+            fail();
+        size_t nMoments = nBins(&ref) * ref.nMomentExponents();
+        for (size_t j = 0; j < nMoments; ++j) {
+            MCfloat a = ref.rawMoments()[j], b = hists[i]->rawMoments()[j];
+            if(fabs(a - b) > 1e-9 * fabs(a))
+                fail();
+        }
+    }
+    file.close();
+}
+
+// a dataset that cannot be converted to floating point must make run() fail
+// instead of terminating the reading threads
+void testUnreadableInput() {
+    hsize_t n = 10;
+    {
+        H5File f(invalidFileName, H5F_ACC_TRUNC);
+        f.createGroup("walk-times");
+        StrType strType(PredType::C_S1, 8);
+        DataSpace space(1, &n);
+        f.createDataSet("walk-times/transmitted", strType, space);
+        f.close();
+    }
+    Exception::dontPrint();
+
+    RawHistogrammer histogrammer;
+    histogrammer.addInputFile(invalidFileName);
+    histogrammer.setNThreads(2);
+    Histogram *hist = new Histogram();
+    hist->setDataDomain(DATA_TIMES);
+    hist->setPhotonTypeFlags(FLAG_TRANSMITTED);
+    hist->setMax(50);
+    hist->setBinSize(1);
+    histogrammer.addHistogram(hist);
+    if(histogrammer.run())
+        fail();
+}
+
+int main() {
+    cleanup();
+    testRoundTrip();
+    testUnreadableInput();
+    pass();
+}
@@ -0,0 +1,111 @@
+#include "tests.h"
+
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testRawProfiles.h5";
+
+const hsize_t nValues = 100000;
+
+void cleanup() {
+    remove(outputFileName);
+}
+
+void pass() {
+    cout << "testRawProfiles PASSED" << endl;
+    cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    cleanup();
+    exit(EXIT_FAILURE);
+}
+
+// writes walk times and exit points with the given profile, reads them back
+// and returns the largest absolute and relative errors
+void roundTrip(const RawOutputProfile &profile, const vector<MCfloat> &values,
+               MCfloat *absError, MCfloat *relError, size_t *storageSize) {
+    cleanup();
+    H5OutputFile file;
+    file.setRawOutputProfile(profile);
+    if(!file.newFile(outputFileName))
+        fail();
+    // several appends, not aligned with the chunks
+    hsize_t blocks[3] = {1000, 33333, nValues - 34333};
+    hsize_t offset = 0;
+    for (uint i = 0; i < 3; ++i) {
+        file.appendWalkTimes(TRANSMITTED, &values[offset], blocks[i]);
+        file.appendExitPoints(TRANSMITTED, &values[offset], blocks[i]);
+        offset += blocks[i];
+    }
+    file.close();
+
+    if(!file.openFile(outputFileName))
+        fail();
+    vector<MCfloat> times(nValues), points(nValues);
+    if(!file.loadWalkTimes(TRANSMITTED, times.data())
+            || !file.loadExitPoints(TRANSMITTED, points.data()))
+        fail();
+    file.close();
+
+    H5File h5(outputFileName, H5F_ACC_RDONLY);
+    DataSet dset = h5.openDataSet("walk-times/transmitted");
+    *storageSize = dset.getDataType().getSize();
+    dset.close();
+    h5.close();
+
+    // the datasets have different chunks, hence the scale-offset filter can
+    // round them differently
+    *absError = *relError = 0;
+    for (hsize_t i = 0; i < nValues; ++i) {
+        MCfloat err = max(fabs(times[i] - values[i]),
+                          fabs(points[i] - values[i]));
+        *absError = max(*absError, err);
+        if(values[i] != 0)
+            *relError = max(*relError, err / fabs(values[i]));
+    }
+}
+
+int main() {
+    // values spanning several orders of magnitude, of both signs
+    vector<MCfloat> values(nValues);
+    for (hsize_t i = 0; i < nValues; ++i) {
+        values[i] = sin(0.37 * i) * pow(10., (int)(i % 7) - 2);
+    }
+
+    MCfloat absError, relError;
+    size_t size;
+
+    // lossless profiles
+    roundTrip(RawOutputProfile(), values, &absError, &relError, &size);
+    if(absError != 0 || size != sizeof(MCfloat))
+        fail();
+    roundTrip(RawOutputProfile::compressed(), values, &absError, &relError,
+              &size);
+    if(absError != 0 || size != sizeof(MCfloat))
+        fail();
+
+    // single precision: relative error below 2^-24
+    roundTrip(RawOutputProfile::float32(), values, &absError, &relError,
+              &size);
+    if(relError > pow(2., -24) || size != 4)
+        fail();
+
+    // fixed point: absolute error below 2 * 10^-d
+    for (int d = 1; d <= 6; ++d) {
+        roundTrip(RawOutputProfile::fixedPoint(d), values, &absError,
+                  &relError, &size);
+        if(absError > 2 * pow(10., -d))
+            fail();
+        // values are actually quantized
+        if(d < 4 && absError < 0.1 * pow(10., -d))
+            fail();
+    }
+
+    pass();
+}
@@ -0,0 +1,113 @@
+#include "tests.h"
+
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testRawShards.h5";
+const uint nThreads = 3;
+const u_int64_t nWalkers = 30000;
+
+// see Simulation::setRawOutputShardsEnabled()
+string shardName(uint index) {
+    stringstream ss;
+    ss << "testRawShards.thread" << index << ".h5";
+    return ss.str();
+}
+
+void cleanup() {
+    remove(outputFileName);
+    for (uint i = 0; i < nThreads + 1; ++i) {
+        remove(shardName(i).c_str());
+    }
+}
+
+void pass() {
+    cout << "testRawShards PASSED" << endl;
+    cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    cleanup();
+    exit(EXIT_FAILURE);
+}
+
+vector<MCfloat> loadValues(H5OutputFile *file, const char *dsName) {
+    vector<MCfloat> values;
+    if(!file->dataSetExists(dsName))
+        return values;
+    file->openDataSet(dsName);
+    values.resize(file->extentDims()[0]);
+    file->loadAll(values.data());
+    return values;
+}
+
+int main() {
+    cleanup();
+
+    // stale shard of a previous run, after a missing one: it must be removed
+    // instead of being appended to
+    {
+        H5OutputFile stale;
+        if(!stale.newFile(shardName(1).c_str()))
+            fail();
+        vector<MCfloat> times(1000, -1);
+        stale.appendWalkTimes(TRANSMITTED, times.data(), times.size());
+        stale.close();
+    }
+
+    Simulation *sim = bilayerSimulation(outputFileName);
+    sim->setNPhotons(nWalkers);
+    sim->setNThreads(nThreads);
+    sim->setSeed(0);
+    sim->setRawOutputEnabled(true);
+    sim->setRawOutputShardsEnabled(true);
+    sim->setWalkTimesSaveFlags(FLAG_TRANSMITTED);
+    sim->setExitPointsSaveFlags(FLAG_TRANSMITTED);
+    bool ok = sim->run();
+    delete sim;
+    if(!ok)
+        fail();
+
+    // each shard only contains the raw output selected by the save flags
+    vector<MCfloat> times, points;
+    for (uint i = 0; i < nThreads; ++i) {
+        H5OutputFile shard;
+        if(!shard.openFile(shardName(i).c_str()))
+            fail();
+        vector<MCfloat> t = loadValues(&shard, "walk-times/transmitted");
+        vector<MCfloat> p = loadValues(&shard, "exit-points/transmitted");
+        if(t.empty() || p.size() != 2 * t.size())
+            fail();
+        times.insert(times.end(), t.begin(), t.end());
+        points.insert(points.end(), p.begin(), p.end());
+        if(!loadValues(&shard, "walk-times/reflected").empty()
+                || !loadValues(&shard, "exit-points/reflected").empty()
+                || !loadValues(&shard, "exit-k-vectors/transmitted").empty())
+            fail();
+        shard.close();
+    }
+    if(access(shardName(nThreads).c_str(), F_OK) >= 0)
+        fail();
+
+    // the main file maps the shards one after the other
+    H5OutputFile file;
+    if(!file.openFile(outputFileName))
+        fail();
+    if(times.size() != file.photonCounters()[TRANSMITTED])
+        fail();
+    if(loadValues(&file, "walk-times/transmitted") != times)
+        fail();
+    if(loadValues(&file, "exit-points/transmitted") != points)
+        fail();
+    if(!loadValues(&file, "walk-times/reflected").empty())
+        fail();
+    file.close();
+
+    pass();
+}
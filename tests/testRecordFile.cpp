@@ -0,0 +1,140 @@
+#include "tests.h"
+
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+using namespace MCPP;
+
+const char recordFileName[] = "testRecordFile.rec";
+const char outputFileName[] = "testRecordFile.h5";
+
+const u_int64_t chunkRecords = 100;
+const u_int64_t nRecords = 1000;
+
+void cleanup() {
+    remove(recordFileName);
+    remove(outputFileName);
+}
+
+void pass() {
+    cout << "testRecordFile PASSED" << endl;
+    cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    cleanup();
+    exit(EXIT_FAILURE);
+}
+
+WalkerRecord makeRecord(u_int64_t i) {
+    WalkerRecord r;
+    r.x = i;
+    r.y = -1. * i;
+    r.t = 0.5 * i;
+    r.kx = 1;
+    r.ky = 2;
+    r.kz = 3;
+    r.nScatter = i;
+    return r;
+}
+
+int main() {
+    cleanup();
+
+    // write records of two interleaved types, then append some more
+    RecordFile *file = new RecordFile();
+    if(!file->create(recordFileName, chunkRecords))
+        fail();
+    for (u_int64_t i = 0; i < nRecords; ++i) {
+        if(!file->append(i % 3 ? REFLECTED : TRANSMITTED, makeRecord(i)))
+            fail();
+    }
+    delete file;
+
+    file = new RecordFile();
+    if(!file->openForAppend(recordFileName))
+        fail();
+    for (u_int64_t i = nRecords; i < nRecords + 10; ++i) {
+        file->append(REFLECTED, makeRecord(i));
+    }
+    delete file;
+
+    RecordFile reader;
+    if(!reader.open(recordFileName))
+        fail();
+    u_int64_t nReflected = reader.nRecords(REFLECTED);
+    u_int64_t nTransmitted = reader.nRecords(TRANSMITTED);
+    if(nTransmitted != 334 || nReflected != 676)
+        fail();
+
+    // records of each type keep their order across chunks
+    u_int64_t last = 0;
+    bool first = true;
+    for (u_int64_t c = 0; c < reader.nChunks(); ++c) {
+        if(reader.chunkType(c) != REFLECTED)
+            continue;
+        const WalkerRecord *r = reader.chunkData(c);
+        for (u_int64_t j = 0; j < reader.chunkSize(c); ++j) {
+            if(!first && r[j].nScatter <= last)
+                fail();
+            if(r[j].t != 0.5 * r[j].nScatter)
+                fail();
+            last = r[j].nScatter;
+            first = false;
+        }
+    }
+    reader.close();
+
+    // convert to the usual HDF5 layout
+    H5OutputFile h5;
+    h5.newFile(outputFileName, true);
+    if(!h5.importRecordFile(recordFileName, true))
+        fail();
+    if(h5.nWalkerRecords(REFLECTED) != nReflected)
+        fail();
+
+    MCfloat points[2 * nTransmitted];
+    MCfloat kVectors[3 * nTransmitted];
+    if(!h5.loadExitPoints(TRANSMITTED, points))
+        fail();
+    if(!h5.loadExitKVectors(TRANSMITTED, kVectors))
+        fail();
+    for (u_int64_t i = 0; i < nTransmitted; ++i) {
+        if(points[2 * i] != 3 * i || points[2 * i + 1] != -3. * i)
+            fail();
+        if(kVectors[3 * i + 2] != 3)
+            fail();
+    }
+
+    // the schema tells the type of the floating point fields...
+    FILE *f = fopen(recordFileName, "r+b");
+    if(f == NULL)
+        fail();
+    RecordFileHeader header;
+    if(fread(&header, sizeof(header), 1, f) != 1)
+        fail();
+    u_int32_t floatType = sizeof(MCfloat) == 4 ? FIELD_FLOAT32
+                        : sizeof(MCfloat) == 8 ? FIELD_FLOAT64 : FIELD_FLOAT80;
+    if(header.fields[0].type != floatType
+            || header.fields[6].type != FIELD_UINT64)
+        fail();
+
+    // ...and files written with a different one are rejected
+    header.fields[0].type =
+            floatType == FIELD_FLOAT64 ? FIELD_FLOAT32 : FIELD_FLOAT64;
+    rewind(f);
+    if(fwrite(&header, sizeof(header), 1, f) != 1)
+        fail();
+    fclose(f);
+    if(reader.open(recordFileName))
+        fail();
+    RecordFile appender;
+    if(appender.openForAppend(recordFileName))
+        fail();
+
+    pass();
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include "tests.h"
+
+#include <MCPlusPlus/shardlauncher.h>
+
+#include <iostream>
+
+using namespace std;
+using namespace MCPP;
+
+const char referenceFileName[] = "testShards-reference.h5";
+const char outputFileName[] = "testShards.h5";
+
+const u_int64_t nWalkers = 200000;
+const uint nShards = 2;
+const uint nTimesBins = 51;
+
+void cleanup() {
+    remove(referenceFileName);
+    remove(outputFileName);
+    Simulation sim;
+    sim.setOutputFileName(outputFileName);
+    for (uint i = 0; i < nShards; ++i) {
+        remove(sim.shardOutputFileName(i).c_str());
+    }
+}
+
+void pass() {
+    cout << "testShards PASSED" << endl;
+    cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    cleanup();
+    exit(EXIT_FAILURE);
+}
+
+void loadResults(const char *fileName, u_int64_t *counters,
+                 u_int64_t *times) {
+    H5OutputFile file;
+    if(!file.openFile(fileName))
+        fail();
+    for (uint i = 0; i < 4; ++i) {
+        counters[i] = file.photonCounters()[i];
+    }
+    if(!file.openDataSet("raw-histograms/times/counts"))
+        fail();
+    file.loadAll(times);
+}
+
+// runs the same simulation in a single process with nShards * nThreads
+// threads and with the launcher in nShards processes of nThreads threads,
+// which must give the same counts bin by bin
+void compareRuns(uint nThreads, bool streamSplitting) {
+    cleanup();
+
+    Simulation *sim = bilayerSimulation(referenceFileName);
+    sim->setNPhotons(nWalkers);
+    sim->setNThreads(nShards * nThreads);
+    sim->setStreamSplittingEnabled(streamSplitting);
+    sim->setSeed(0);
+    sim->run();
+    delete sim;
+
+    sim = bilayerSimulation(outputFileName);
+    sim->setNPhotons(nWalkers);
+    sim->setNThreads(nThreads);
+    sim->setStreamSplittingEnabled(streamSplitting);
+    sim->setSeed(0);
+    ShardLauncher launcher;
+    launcher.setSimulation(sim);
+    launcher.setNProcesses(nShards);
+    bool ok = launcher.run();
+    delete sim;
+    if(!ok)
+        fail();
+
+    u_int64_t refCounters[4], counters[4];
+    u_int64_t refTimes[nTimesBins], times[nTimesBins];
+    loadResults(referenceFileName, refCounters, refTimes);
+    loadResults(outputFileName, counters, times);
+
+    for (uint i = 0; i < 4; ++i) {
+        if(counters[i] != refCounters[i])
+            fail();
+    }
+    for (uint i = 0; i < nTimesBins; ++i) {
+        if(times[i] != refTimes[i])
+            fail();
+    }
+}
+
+int main() {
+    // one thread per shard
+    compareRuns(1, false);
+
+    // 2 shards of 2 threads against 4 threads, all split from one stream
+    compareRuns(2, true);
+
+    // shards whose run() fails are reported even if they wrote their file
+    cleanup();
+    Simulation *sim = bilayerSimulation(outputFileName);
+    sim->setNPhotons(1000);
+    sim->setSeed(0);
+    sim->addConvergenceCriterion("missing", 0.1);
+    ShardLauncher launcher;
+    launcher.setSimulation(sim);
+    launcher.setNProcesses(nShards);
+    launcher.setMaxRetries(0);
+    bool ok = launcher.run();
+    delete sim;
+    if(ok)
+        fail();
+
+    pass();
+}
@@ -0,0 +1,108 @@
+#include "tests.h"
+
+#include <cmath>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testSnapshots.h5";
+
+void cleanup() {
+    remove(outputFileName);
+}
+
+void pass() {
+    cout << "testSnapshots PASSED" << endl;
+    cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    cleanup();
+    exit(EXIT_FAILURE);
+}
+
+bool allFinite(H5FileHelper *file, const string &dsName) {
+    if(!file->openDataSet(dsName.c_str()))
+        return false;
+    size_t n = 1;
+    for (int i = 0; i < file->getRank(); ++i) {
+        n *= file->extentDims()[i];
+    }
+    vector<MCfloat> values(n);
+    file->loadAll(values.data());
+    for (size_t i = 0; i < n; ++i) {
+        if(!isfinite(values[i]))
+            return false;
+    }
+    return true;
+}
+
+int main() {
+    cleanup();
+
+    // a thick diffusive slab, so that the first snapshots are due long before
+    // any walker completes
+    static Material mat;
+    static Air air;
+    mat.n = 1.5;
+    mat.ls = 1;
+    mat.g = 0;
+    Sample *sample = new Sample();
+    sample->addLayer(&mat, 200);
+    sample->setSurroundingEnvironment(&air);
+
+    Source *src = new PencilBeamSource();
+    src->setWalkTimeDistribution(new DeltaDistribution(0));
+
+    Simulation *sim = new Simulation();
+    sim->setSample(sample);
+    sim->setSource(src);
+    sim->setOutputFileName(outputFileName);
+    sim->setNPhotons(2 * WALKER_BUFSIZE);
+    sim->setNThreads(2);
+    sim->setSeed(0);
+    sim->setSnapshotInterval(0.01);
+
+    Histogram *hist = new Histogram();
+    hist->setDataDomain(DATA_TIMES);
+    hist->setPhotonTypeFlags(FLAG_REFLECTED);
+    hist->setMax(100);
+    hist->setBinSize(1);
+    hist->setName("times");
+    sim->addHistogram(hist);
+
+    bool ok = sim->run();
+    delete sim;
+    if(!ok)
+        fail();
+
+    // snapshots are only saved once walkers have completed, and are therefore
+    // always normalized
+    H5OutputFile file;
+    if(!file.openFile(outputFileName))
+        fail();
+    hsize_t n = file.nChildren("snapshots");
+    if(n == 0)
+        fail();
+    for (hsize_t i = 0; i < n; ++i) {
+        stringstream ss;
+        ss << "snapshots/" << i;
+        string group = ss.str();
+        if(!file.openDataSet((group + "/photon-counters").c_str()))
+            fail();
+        u_int64_t counters[4];
+        file.loadAll(counters);
+        if(counters[0] + counters[1] + counters[2] + counters[3] == 0)
+            fail();
+        if(!allFinite(&file, group + "/times")
+                || !allFinite(&file, group + "/times-stderr"))
+            fail();
+    }
+    file.close();
+
+    pass();
+}
@@ -0,0 +1,169 @@
+#include "tests.h"
+
+#include <MCPlusPlus/gaussianraybundlesource.h>
+#include <MCPlusPlus/psigenerator.h>
+
+#include <iostream>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testSources.h5";
+
+const size_t nBatch = 1000;
+const size_t nBatches = 100;
+
+// reference counts of the isotropic point source simulation below, with seed
+// 0 and batches of WALKER_BUFSIZE walkers
+const u_int64_t referenceCounts[4] = {7780, 0, 12220, 0};
+
+void pass() {
+    cout << "testSources PASSED" << endl;
+    remove(outputFileName);
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    remove(outputFileName);
+    exit(EXIT_FAILURE);
+}
+
+// reimplements only spinPosition(), so it relies on the default batch path
+class OffsetSource : public Source
+{
+public:
+    OffsetSource() {
+        setr0Distribution(new DeltaDistribution(0), new DeltaDistribution(0),
+                          1);
+        setk0Distribution(new CosThetaGenerator(0, this),
+                          new IsotropicPsiGenerator(this));
+        setWalkTimeDistribution(new ExponentialDistribution(1, this));
+    }
+
+protected:
+    virtual void spinPosition(Walker *walker) const {
+        walker->r0[0] = 5;
+        walker->r0[1] = -2;
+        walker->r0[2] = _z0 + walker->r0[2];
+    }
+};
+
+bool sameWalker(const Walker &a, const Walker &b) {
+    for (int j = 0; j < 3; ++j) {
+        if(a.r0[j] != b.r0[j] || a.k0[j] != b.k0[j])
+            return false;
+    }
+    return a.walkTime == b.walkTime && a.wavelength == b.wavelength
+            && a.band == b.band;
+}
+
+void testDefaultBatch() {
+    OffsetSource src;
+    Walker batch[nBatch], single[nBatch];
+    src.setSeed(3);
+    src.spinBatch(batch, nBatch);
+    src.setSeed(3);
+    for (size_t i = 0; i < nBatch; ++i) {
+        src.spin(&single[i]);
+    }
+    for (size_t i = 0; i < nBatch; ++i) {
+        if(batch[i].r0[0] != 5 || batch[i].r0[1] != -2 || batch[i].r0[2] != 1)
+            fail();
+        if(!sameWalker(batch[i], single[i]))
+            fail();
+    }
+}
+
+// the bulk path of GaussianBeamSource must follow the same distributions as
+// spin()
+void testGaussianBatch() {
+    const MCfloat FWHM = 10;
+    const MCfloat sigma = FWHM / (2 * sqrt(2 * log(2.)));
+    GaussianBeamSource src(FWHM);
+    src.setWalkTimeDistribution(new DeltaDistribution(0));
+    src.setSeed(0);
+    Walker batch[nBatch], single;
+    double m[2] = {0, 0}, m2[2] = {0, 0};
+    for (size_t k = 0; k < nBatches; ++k) {
+        src.spinBatch(batch, nBatch);
+        for (size_t i = 0; i < nBatch; ++i) {
+            if(batch[i].k0[0] != 0 || batch[i].k0[1] != 0
+                    || batch[i].k0[2] != 1)
+                fail();
+            m[0] += batch[i].r0[0];
+            m2[0] += batch[i].r0[0] * batch[i].r0[0];
+            src.spin(&single);
+            m[1] += single.r0[0];
+            m2[1] += single.r0[0] * single.r0[0];
+        }
+    }
+    const double n = nBatch * nBatches;
+    for (int j = 0; j < 2; ++j) {
+        m[j] /= n;
+        m2[j] /= n;
+        if(fabs(m[j]) > 5 * sigma / sqrt(n))
+            fail();
+        if(fabs(sqrt(m2[j] - m[j] * m[j]) - sigma) > 5 * sigma / sqrt(2 * n))
+            fail();
+    }
+}
+
+// each clone of a GaussianRayBundleSource draws the walk times from its own
+// RNG, so that spinning it leaves the original unchanged
+void testRayBundleClone() {
+    GaussianRayBundleSource src(10, 1, 100);
+    src.setWalkTimeDistribution(new ExponentialDistribution(1));
+    src.setSeed(4);
+    Walker reference[nBatch], batch[nBatch];
+    src.spinBatch(reference, nBatch);
+
+    src.setSeed(4);
+    Source *copy = (Source *)src.clone();
+    copy->setSeed(4);
+    copy->spinBatch(batch, nBatch);
+    for (size_t i = 0; i < nBatch; ++i) {
+        if(batch[i].walkTime != reference[i].walkTime)
+            fail();
+    }
+    delete copy;
+    src.spinBatch(batch, nBatch);
+    for (size_t i = 0; i < nBatch; ++i) {
+        if(!sameWalker(batch[i], reference[i]))
+            fail();
+    }
+}
+
+void runIsotropic(u_int64_t *counts) {
+    Simulation *sim = bilayerSimulation(outputFileName);
+    Source *src = new IsotropicPointSource(20);
+    src->setWalkTimeDistribution(new DeltaDistribution(0));
+    sim->setSource(src);
+    sim->setNPhotons(20000);
+    sim->setNThreads(2);
+    sim->setSeed(0);
+    sim->run();
+    memcpy(counts, sim->photonCounts(), 4 * sizeof(u_int64_t));
+    delete sim;
+    remove(outputFileName);
+}
+
+int main() {
+    remove(outputFileName);
+    testDefaultBatch();
+    testGaussianBatch();
+    testRayBundleClone();
+
+    // a seeded simulation with a random source is reproducible
+    u_int64_t counts[4], counts2[4];
+    runIsotropic(counts);
+    runIsotropic(counts2);
+    for (int i = 0; i < 4; ++i) {
+        if(counts[i] != counts2[i] || counts[i] != referenceCounts[i])
+            fail();
+    }
+
+    pass();
+}
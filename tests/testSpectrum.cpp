@@ -0,0 +1,117 @@
+#include "tests.h"
+
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testSpectrum.h5";
+
+const u_int64_t nWalkers = 200000;
+const uint nBands = 2;
+const MCfloat wavelengths[nBands] = {0.5, 1.5};
+const MCfloat weights[nBands] = {1, 3};
+const MCfloat indices[nBands] = {1.5, 2.5};
+
+// non-scattering material whose refractive index differs in the two bands
+class TwoBandMaterial : public Material
+{
+private:
+    virtual MCfloat dispersionRelation(MCfloat lambda_um) {
+        return lambda_um < 1 ? indices[0] : indices[1];
+    }
+};
+
+void cleanup() {
+    remove(outputFileName);
+}
+
+void pass() {
+    cout << "testSpectrum PASSED" << endl;
+    cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    cleanup();
+    exit(EXIT_FAILURE);
+}
+
+void addWavelengthHistogram(Simulation *sim, const char *name, int flags) {
+    Histogram *hist = new Histogram();
+    hist->setDataDomain(DATA_WAVELENGTH);
+    hist->setPhotonTypeFlags(flags);
+    hist->setMax(2);
+    hist->setBinSize(1);
+    hist->setName(name);
+    sim->addHistogram(hist);
+}
+
+void loadCounts(H5OutputFile *file, const char *name, u_int64_t *counts) {
+    string dsName = string("raw-histograms/") + name + "/counts";
+    if(!file->openDataSet(dsName.c_str()) || file->extentDims()[0] != 3)
+        fail();
+    file->loadAll(counts);
+}
+
+int main() {
+    cleanup();
+
+    static TwoBandMaterial mat;
+    static Vacuum vacuum;
+    Sample *sample = new Sample();
+    sample->addLayer(&mat, 10);
+    sample->setSurroundingEnvironment(&vacuum);
+
+    Source *src = new PencilBeamSource();
+    src->setWalkTimeDistribution(new DeltaDistribution(0));
+    if(!src->setSpectrum(wavelengths, weights, nBands))
+        fail();
+
+    Simulation *sim = new Simulation();
+    sim->setSample(sample);
+    sim->setSource(src);
+    sim->setOutputFileName(outputFileName);
+    sim->setNPhotons(nWalkers);
+    sim->setNThreads(2);
+    sim->setSeed(0);
+    addWavelengthHistogram(sim, "all", FLAG_ALL_WALKERS);
+    addWavelengthHistogram(sim, "reflected",
+                           FLAG_REFLECTED | FLAG_BACKREFLECTED);
+    bool ok = sim->run();
+    delete sim;
+    if(!ok)
+        fail();
+
+    H5OutputFile file;
+    if(!file.openFile(outputFileName))
+        fail();
+    u_int64_t all[3], reflected[3];
+    loadCounts(&file, "all", all);
+    loadCounts(&file, "reflected", reflected);
+    file.close();
+
+    // every walker is binned at the wavelength of its own band, which is
+    // drawn with the weights of the spectrum
+    if(all[0] + all[1] != nWalkers || all[2] != 0)
+        fail();
+    MCfloat fraction = (MCfloat)all[0] / nWalkers;
+    MCfloat expected = weights[0] / (weights[0] + weights[1]);
+    if(fabs(fraction - expected)
+            > 5 * sqrt(expected * (1 - expected) / nWalkers))
+        fail();
+
+    // incoherent reflectance of a non-scattering slab in vacuum, which must
+    // use the refractive index of the band of each walker
+    for (uint b = 0; b < nBands; ++b) {
+        MCfloat r = pow((indices[b] - 1) / (indices[b] + 1), 2);
+        MCfloat R = 2 * r / (1 + r);
+        MCfloat measured = (MCfloat)reflected[b] / all[b];
+        if(fabs(measured - R) > 5 * sqrt(R * (1 - R) / all[b]))
+            fail();
+    }
+
+    pass();
+}
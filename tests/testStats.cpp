@@ -0,0 +1,105 @@
+#include "tests.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testStats.h5";
+const char statsFileName[] = "testStats.json";
+const char tmpFileName[] = "testStats.json.tmp";
+const char linkFileName[] = "testStats.json.link";
+
+void cleanup() {
+    remove(outputFileName);
+    remove(statsFileName);
+    remove(tmpFileName);
+    remove(linkFileName);
+}
+
+void pass() {
+    cout << "testStats PASSED" << endl;
+    cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    cleanup();
+    exit(EXIT_FAILURE);
+}
+
+string readFile(const char *name) {
+    ifstream f(name);
+    stringstream ss;
+    ss << f.rdbuf();
+    return ss.str();
+}
+
+bool hasField(const string &json, const string &field) {
+    return json.find("\"" + field + "\": ") != string::npos;
+}
+
+// value of a top level integer field
+unsigned long long field(const string &json, const string &name) {
+    size_t pos = json.find("\"" + name + "\": ");
+    if(pos == string::npos)
+        fail();
+    return strtoull(json.c_str() + pos + name.size() + 4, NULL, 10);
+}
+
+int main() {
+    cleanup();
+
+    // the stats file is replaced by renaming, so another name linked to the
+    // previous file keeps its content
+    const string placeholder = "placeholder\n";
+    {
+        ofstream f(statsFileName);
+        f << placeholder;
+    }
+    if(link(statsFileName, linkFileName) != 0)
+        fail();
+
+    Simulation *sim = bilayerSimulation(outputFileName);
+    sim->setNPhotons(20000);
+    sim->setNThreads(2);
+    sim->setStatsFileName(statsFileName);
+    sim->setStatsInterval(0.01);
+    u_int64_t nPhotons = sim->nPhotons();
+    bool ok = sim->run();
+    delete sim;
+    if(!ok)
+        fail();
+
+    if(readFile(linkFileName) != placeholder)
+        fail();
+    if(ifstream(tmpFileName).good())
+        fail();
+
+    string json = readFile(statsFileName);
+    const char *fields[] = {"time", "finished", "elapsed", "walkers",
+                            "remaining", "throughput", "mean-throughput",
+                            "eta", "scattering-events", "interface-hits",
+                            "exits", "threads"};
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i) {
+        if(!hasField(json, fields[i]))
+            fail();
+    }
+    if(json.find("\"finished\": true") == string::npos)
+        fail();
+    if(field(json, "walkers") != nPhotons || field(json, "remaining") != 0)
+        fail();
+
+    unsigned long long exits = 0;
+    for (uint i = 0; i < 4; ++i) {
+        exits += field(json, walkerTypeToString(i));
+    }
+    if(exits != nPhotons)
+        fail();
+
+    pass();
+}
@@ -0,0 +1,123 @@
+#include "tests.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+using namespace MCPP;
+
+const uint nRuns = 3;
+const char *outputFileNames[nRuns] = {"testStreaming-memory.h5",
+                                      "testStreaming-stream.h5",
+                                      "testStreaming-swmr.h5"};
+
+const u_int64_t nWalkers = 50000;
+
+void cleanup() {
+    for (uint i = 0; i < nRuns; ++i) {
+        remove(outputFileNames[i]);
+    }
+}
+
+void pass() {
+    cout << "testStreaming PASSED" << endl;
+    cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    cleanup();
+    exit(EXIT_FAILURE);
+}
+
+struct Exit {
+    MCfloat t, x, y;
+    bool operator<(const Exit &rhs) const {
+        if(t != rhs.t)
+            return t < rhs.t;
+        if(x != rhs.x)
+            return x < rhs.x;
+        return y < rhs.y;
+    }
+    bool operator!=(const Exit &rhs) const {
+        return t != rhs.t || x != rhs.x || y != rhs.y;
+    }
+};
+
+void runSimulation(uint run, bool streaming, bool swmr) {
+    Simulation *sim = bilayerSimulation(outputFileNames[run]);
+    sim->setNPhotons(nWalkers);
+    sim->setNThreads(2);
+    sim->setSeed(0);
+    sim->setRawOutputEnabled(true);
+    sim->setWalkTimesSaveFlags(FLAG_TRANSMITTED);
+    sim->setExitPointsSaveFlags(FLAG_TRANSMITTED);
+    sim->setRawOutputStreamingEnabled(streaming);
+    sim->setRawOutputBufferSize(1000);
+    sim->setSWMREnabled(swmr);
+    bool ok = sim->run();
+    delete sim;
+    if(!ok)
+        fail();
+}
+
+// the exits of the transmitted walkers, sorted: blocks written by the threads
+// interleave in any order
+vector<Exit> loadExits(const char *fileName) {
+    H5OutputFile file;
+    if(!file.openFile(fileName))
+        fail();
+    u_int64_t n = file.photonCounters()[TRANSMITTED];
+    if(n == 0 || !file.openDataSet("walk-times/transmitted")
+            || file.extentDims()[0] != n)
+        fail();
+    vector<MCfloat> times(n), points(2 * n);
+    file.loadAll(times.data());
+    if(!file.openDataSet("exit-points/transmitted")
+            || file.extentDims()[0] != 2 * n)
+        fail();
+    file.loadAll(points.data());
+    file.close();
+
+    vector<Exit> exits(n);
+    for (u_int64_t i = 0; i < n; ++i) {
+        exits[i].t = times[i];
+        exits[i].x = points[2 * i];
+        exits[i].y = points[2 * i + 1];
+    }
+    sort(exits.begin(), exits.end());
+    return exits;
+}
+
+int main() {
+    cleanup();
+
+    runSimulation(0, false, false);
+    runSimulation(1, true, false);
+    runSimulation(2, true, true);
+
+    // streamed raw output holds the same walkers as the one kept in memory,
+    // with exit points and walk times still matching walker by walker
+    vector<Exit> reference = loadExits(outputFileNames[0]);
+    for (uint i = 1; i < nRuns; ++i) {
+        vector<Exit> exits = loadExits(outputFileNames[i]);
+        if(exits.size() != reference.size())
+            fail();
+        for (size_t j = 0; j < exits.size(); ++j) {
+            if(exits[j] != reference[j])
+                fail();
+        }
+    }
+
+    // the SWMR file can be opened by SWMR readers
+    try {
+        H5File f(outputFileNames[2], H5F_ACC_RDONLY | H5F_ACC_SWMR_READ);
+        f.close();
+    }
+    catch (const Exception &error) {
+        fail();
+    }
+
+    pass();
+}
@@ -0,0 +1,91 @@
+#include "tests.h"
+
+#include <MCPlusPlus/distributions.h>
+#include <MCPlusPlus/phasefunction.h>
+
+#include <iostream>
+#include <cmath>
+
+using namespace std;
+using namespace MCPP;
+
+const char outputFileName[] = "testTabulated.h5";
+
+const size_t nSamples = 1000000;
+
+void pass() {
+    cout << "testTabulated PASSED" << endl;
+    remove(outputFileName);
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    remove(outputFileName);
+    exit(EXIT_FAILURE);
+}
+
+int main() {
+    remove(outputFileName);
+
+    // triangular density on [0, 2], written as a two-column dataset
+    MCfloat table[3][2] = {{0, 0}, {1, 1}, {2, 0}};
+    H5FileHelper file;
+    hsize_t dims[2] = {3, 2};
+    hsize_t start[2] = {0, 0};
+    file.newFile(outputFileName);
+    file.newDataset("triangle", 2, dims);
+    file.writeHyperSlab(start, dims, &table[0][0]);
+    file.close();
+
+    TabulatedDistribution tab;
+    tab.setSeed(0);
+    if(!tab.loadTable(outputFileName, "triangle") || tab.tableSize() != 3)
+        fail();
+    if(fabs(tab.quantile(0.125) - 0.5) > 1e-12)
+        fail();
+    if(fabs(tab.quantile(0.5) - 1) > 1e-12)
+        fail();
+
+    MCfloat *buf = (MCfloat *)malloc(nSamples * sizeof(MCfloat));
+    tab.fill(buf, nSamples);
+    MCfloat m = 0, m2 = 0;
+    for (size_t i = 0; i < nSamples; ++i) {
+        m += buf[i];
+        m2 += buf[i] * buf[i];
+    }
+    m /= nSamples;
+    m2 /= nSamples;
+    if(fabs(m - 1) > 3e-3 || fabs(m2 - m * m - 1. / 6) > 3e-3)
+        fail();
+
+    MCfloat values[4] = {10, 20, 30, 40};
+    MCfloat weights[4] = {1, 0, 3, 4};
+    AliasDistribution alias;
+    alias.setSeed(0);
+    if(!alias.setTable(values, weights, 4))
+        fail();
+    alias.fill(buf, nSamples);
+    size_t counts[4] = {0, 0, 0, 0};
+    for (size_t i = 0; i < nSamples; ++i) {
+        counts[(int)buf[i] / 10 - 1]++;
+    }
+    free(buf);
+    if(counts[1] != 0)
+        fail();
+    for (int i = 0; i < 4; ++i) {
+        if(fabs(counts[i] / (MCfloat)nSamples - weights[i] / 8) > 3e-3)
+            fail();
+    }
+
+    if(tab.setTable(values, weights, 1) || alias.setTable(values, weights, 0))
+        fail();
+
+    // example of Bohren and Huffman, g = 0.633
+    MiePhaseFunction mie(0.525, 1.55);
+    if(!mie.setWavelength(0.6328))
+        fail();
+    if(fabs(mie.anisotropy() - 0.633) > 1e-3)
+        fail();
+    pass();
+}
@@ -0,0 +1,90 @@
+#include "tests.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace MCPP;
+
+const uint nRuns = 2;
+const char *outputFileNames[nRuns] = {"testTrajectories-double.h5",
+                                      "testTrajectories-fixed.h5"};
+
+void cleanup() {
+    for (uint i = 0; i < nRuns; ++i) {
+        remove(outputFileNames[i]);
+    }
+}
+
+void pass() {
+    cout << "testTrajectories PASSED" << endl;
+    cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    cleanup();
+    exit(EXIT_FAILURE);
+}
+
+void runSimulation(uint run, const RawOutputProfile &profile) {
+    Simulation *sim = bilayerSimulation(outputFileNames[run]);
+    sim->setNPhotons(2000);
+    sim->setSeed(0);
+    sim->setRawOutputEnabled(true);
+    sim->setRawOutputProfile(profile);
+    sim->setWalkTimesSaveFlags(FLAG_TRANSMITTED);
+    sim->setTrajectorySampling(100);
+    bool ok = sim->run();
+    delete sim;
+    if(!ok)
+        fail();
+}
+
+int main() {
+    cleanup();
+
+    // the same walkers, with raw output stored as doubles and with one decimal
+    // digit
+    runSimulation(0, RawOutputProfile());
+    runSimulation(1, RawOutputProfile::fixedPoint(1));
+
+    H5OutputFile files[nRuns];
+    for (uint i = 0; i < nRuns; ++i) {
+        if(!files[i].openFile(outputFileNames[i]))
+            fail();
+    }
+
+    // the profile applies to the raw output...
+    vector<MCfloat> times[nRuns];
+    for (uint i = 0; i < nRuns; ++i) {
+        if(!files[i].openDataSet("walk-times/transmitted"))
+            fail();
+        times[i].resize(files[i].extentDims()[0]);
+        files[i].loadAll(times[i].data());
+    }
+    if(times[0].empty() || times[0].size() != times[1].size()
+            || times[0] == times[1])
+        fail();
+
+    // ...but trajectories are always lossless
+    hsize_t n = files[0].nTrajectories();
+    if(n != 20 || files[1].nTrajectories() != n)
+        fail();
+    for (hsize_t i = 0; i < n; ++i) {
+        vector<MCfloat> points[nRuns];
+        TrajectoryInfo info[nRuns];
+        for (uint j = 0; j < nRuns; ++j) {
+            if(!files[j].loadTrajectory(i, &points[j], &info[j]))
+                fail();
+        }
+        if(points[0].empty() || points[0] != points[1]
+                || info[0].walker != info[1].walker)
+            fail();
+    }
+
+    for (uint i = 0; i < nRuns; ++i) {
+        files[i].close();
+    }
+    pass();
+}
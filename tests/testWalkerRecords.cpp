@@ -0,0 +1,122 @@
+#include "tests.h"
+
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+using namespace MCPP;
+
+const uint nRuns = 2;
+const char *outputFileNames[nRuns] = {"testWalkerRecords-memory.h5",
+                                      "testWalkerRecords-stream.h5"};
+
+void cleanup() {
+    for (uint i = 0; i < nRuns; ++i) {
+        remove(outputFileNames[i]);
+    }
+}
+
+void pass() {
+    cout << "testWalkerRecords PASSED" << endl;
+    cleanup();
+    exit(EXIT_SUCCESS);
+}
+
+void fail() {
+    cout << "FAILED" << endl;
+    cleanup();
+    exit(EXIT_FAILURE);
+}
+
+void runSimulation(uint run, bool streaming, const RawOutputProfile &profile) {
+    Simulation *sim = bilayerSimulation(outputFileNames[run]);
+    sim->setNPhotons(20000);
+    sim->setSeed(0);
+    sim->setRawOutputEnabled(true);
+    sim->setRawOutputProfile(profile);
+    sim->setRawOutputStreamingEnabled(streaming);
+    sim->setRawOutputBufferSize(1000);
+    sim->setWalkerRecordsSaveFlags(FLAG_TRANSMITTED);
+    sim->setWalkTimesSaveFlags(FLAG_TRANSMITTED);
+    sim->setExitPointsSaveFlags(FLAG_TRANSMITTED);
+    sim->setExitKVectorsSaveFlags(FLAG_TRANSMITTED);
+    sim->setExitKVectorsDirsSaveFlags(DIR_X | DIR_Y | DIR_Z);
+    bool ok = sim->run();
+    delete sim;
+    if(!ok)
+        fail();
+}
+
+vector<WalkerRecord> loadRecords(H5OutputFile *file) {
+    vector<WalkerRecord> records(file->nWalkerRecords(TRANSMITTED));
+    if(records.empty() || !file->loadWalkerRecords(TRANSMITTED, records.data()))
+        fail();
+    return records;
+}
+
+int main() {
+    cleanup();
+
+    // records kept in memory with lossless raw output, and streamed with
+    // float32 raw output
+    runSimulation(0, false, RawOutputProfile());
+    runSimulation(1, true, RawOutputProfile::float32());
+
+    H5OutputFile file;
+    if(!file.openFile(outputFileNames[0]))
+        fail();
+    vector<WalkerRecord> records = loadRecords(&file);
+    size_t n = records.size();
+    if(n != file.photonCounters()[TRANSMITTED])
+        fail();
+
+    // fields are named after the members of WalkerRecord
+    {
+        H5File h5(outputFileNames[0], H5F_ACC_RDONLY);
+        DataSet dset = h5.openDataSet("records/transmitted");
+        CompType type = dset.getCompType();
+        const char *names[7] = {"x", "y", "t", "kx", "ky", "kz", "nScatter"};
+        if(type.getNmembers() != 7)
+            fail();
+        for (int i = 0; i < 7; ++i) {
+            if(type.getMemberName(i) != names[i])
+                fail();
+        }
+        dset.close();
+        h5.close();
+    }
+
+    // each record matches the other raw output of the same walker
+    vector<MCfloat> times(n), points(2 * n), k(3 * n);
+    if(!file.loadWalkTimes(TRANSMITTED, times.data())
+            || !file.loadExitPoints(TRANSMITTED, points.data())
+            || !file.loadExitKVectors(TRANSMITTED, k.data()))
+        fail();
+    file.close();
+    for (size_t i = 0; i < n; ++i) {
+        const WalkerRecord *r = &records[i];
+        if(r->x != points[2 * i] || r->y != points[2 * i + 1]
+                || r->t != times[i] || r->kx != k[3 * i]
+                || r->ky != k[3 * i + 1] || r->kz != k[3 * i + 2])
+            fail();
+        if(fabs(r->kx * r->kx + r->ky * r->ky + r->kz * r->kz - 1) > 1e-9)
+            fail();
+        // transmitted walkers cross the whole sample
+        if(r->nScatter == 0)
+            fail();
+    }
+
+    // streamed records are identical, and lossless whatever the profile
+    if(!file.openFile(outputFileNames[1]))
+        fail();
+    vector<WalkerRecord> streamed = loadRecords(&file);
+    file.close();
+    if(streamed.size() != n)
+        fail();
+    for (size_t i = 0; i < n; ++i) {
+        if(memcmp(&streamed[i], &records[i], sizeof(WalkerRecord)) != 0)
+            fail();
+    }
+
+    pass();
+}
@@ -2,9 +2,9 @@
 
 using namespace MCPP;
 
-void testBilayer(const char *outputFileName) {
-    Material mat1, mat2;
-    Air air;
+Simulation *bilayerSimulation(const char *outputFileName) {
+    static Material mat1, mat2;
+    static Air air;
 
     mat1.n=1.5;
     mat1.ls = 1;
@@ -61,6 +61,11 @@ void testBilayer(const char *outputFileName) {
     hist->setName("points_vs_time");
     sim->addHistogram(hist);
 
+    return sim;
+}
+
+void testBilayer(const char *outputFileName) {
+    Simulation *sim = bilayerSimulation(outputFileName);
 
     sim->setNPhotons(1000000);
     sim->setNThreads(4);
@@ -4,6 +4,7 @@
 #include <MCPlusPlus/h5outputfile.h>
 #include <MCPlusPlus/simulation.h>
 
+MCPP::Simulation *bilayerSimulation(const char *outputFileName);
 void testBilayer(const char *outputFileName);
 
 #endif // TESTS_H